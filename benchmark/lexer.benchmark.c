@@ -8,6 +8,25 @@
 #define SAMPLE_SIZE 20
 static double measures[SAMPLE_SIZE];
 
+int lex_all(io_str_t *string)
+{
+    lexer_t l;
+    lexer_init(&l, string->data, string->size);
+    token_t token;
+    while (1)
+    {
+        int err = lexer_next_token(&l, &token);
+        if (err)
+        {
+            fprintf(stderr, "Error lexing: %d\n", err);
+            return err;
+        }
+
+        if (token.type == TOK_EOF)
+            return 0;
+    }
+}
+
 void benchmark_it(char *path)
 {
     io_str_t string;
@@ -18,31 +37,49 @@ void benchmark_it(char *path)
         return;
     }
 
-    lexer_t l;
+    for (size_t i = 0; i < SAMPLE_SIZE; i++)
+    {
+        double start = benchmark_get_time();
+        lex_all(&string);
+        double end = benchmark_get_time();
+        measures[i] = end - start;
+    }
 
+    io_free_string(&string);
+    benchmark_report(path, measures, SAMPLE_SIZE);
+}
+
+/**
+ * Time getting the file in memory and lexing it, once reading it into a
+ * malloc'd copy and once mapping it, so the copy is part of the measure.
+ */
+void benchmark_loader(char *path, char *name, int (*load)(char *, io_str_t *))
+{
     for (size_t i = 0; i < SAMPLE_SIZE; i++)
     {
+        io_str_t string;
         double start = benchmark_get_time();
-        lexer_init(&l, string.data, string.size);
-        token_t token;
-        while (1)
+        int err = load(path, &string);
+        if (err)
         {
-            err = lexer_next_token(&l, &token);
-            if (err)
-            {
-                fprintf(stderr, "Error lexing: %d\n", err);
-                break;
-            }
-
-            if (token.type == TOK_EOF)
-                break;
+            fprintf(stderr, "Error loading fixture: %d\n", err);
+            return;
         }
+        lex_all(&string);
+        io_free_string(&string);
         double end = benchmark_get_time();
         measures[i] = end - start;
     }
 
-    io_free_string(&string);
-    benchmark_report(path, measures, SAMPLE_SIZE);
+    char label[256];
+    snprintf(label, sizeof(label), "%s (%s)", path, name);
+    benchmark_report(label, measures, SAMPLE_SIZE);
+}
+
+void benchmark_loaders(char *path)
+{
+    benchmark_loader(path, "read", io_load_file_into_memory);
+    benchmark_loader(path, "mmap", io_map_file);
 }
 
 int main(void)
@@ -53,6 +90,10 @@ int main(void)
     benchmark_it("./benchmark/fixtures/medium.lisp");
     benchmark_it("./benchmark/fixtures/large.lisp");
 
+    benchmark_loaders("./benchmark/fixtures/small.lisp");
+    benchmark_loaders("./benchmark/fixtures/medium.lisp");
+    benchmark_loaders("./benchmark/fixtures/large.lisp");
+
     printf("Lexer Benchmark Complete\n");
 
     return 0;
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "io.h"
+#include "loader.h"
+#include "parser.h"
+#include "benchmark.h"
+
+#define SAMPLE_SIZE 5
+static double measures[SAMPLE_SIZE];
+
+// A corpus of many small files, where the syscalls per file dominate
+#define CORPUS_FILES 100000
+
+static char dir[] = "/tmp/loader.benchmark.XXXXXX";
+static char **paths;
+
+static long minor_faults(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+// Page faults and buffer allocations per file over the last sample,
+// when the buffer pool is warm both should be close to zero
+static void report_steady_state(long faults, io_pool_stats_t *before)
+{
+    io_pool_stats_t after;
+    io_pool_stats(&after);
+    printf("  last sample: %.3f minor faults, %.4f buffer mallocs per file\n",
+           (double)(minor_faults() - faults) / CORPUS_FILES,
+           (double)(after.misses - before->misses + after.oversized - before->oversized) / CORPUS_FILES);
+}
+
+static int parse_and_free(io_str_t *string)
+{
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, string->data, string->size);
+    err = err || parser_parse(&parser, &program);
+    parser_free_program(&program);
+    io_free_string(string);
+
+    return err;
+}
+
+static int write_corpus(void)
+{
+    if (!mkdtemp(dir))
+        return 1;
+
+    paths = malloc(CORPUS_FILES * sizeof(char *));
+    if (!paths)
+        return 1;
+
+    for (size_t i = 0; i < CORPUS_FILES; ++i)
+    {
+        paths[i] = malloc(sizeof(dir) + 32);
+        if (!paths[i])
+            return 1;
+        snprintf(paths[i], sizeof(dir) + 32, "%s/%zu.lisp", dir, i);
+
+        FILE *file = fopen(paths[i], "w");
+        if (!file)
+            return 1;
+        fprintf(file, "(define (f%zu x) (if (= x %zu) \"small\" (f%zu (- x 1))))\n(f%zu 42)\n", i, i, i, i);
+        fclose(file);
+    }
+
+    return 0;
+}
+
+static void remove_corpus(void)
+{
+    for (size_t i = 0; i < CORPUS_FILES; ++i)
+    {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    free(paths);
+    rmdir(dir);
+}
+
+// One file after the other with stdio, as the drivers used to
+void benchmark_sequential(void)
+{
+    long faults = 0;
+    io_pool_stats_t pool;
+    for (size_t s = 0; s < SAMPLE_SIZE; s++)
+    {
+        faults = minor_faults();
+        io_pool_stats(&pool);
+        double start = benchmark_get_time();
+        for (size_t i = 0; i < CORPUS_FILES; ++i)
+        {
+            io_str_t string;
+            if (io_load_file_into_memory(paths[i], &string) || parse_and_free(&string))
+            {
+                fprintf(stderr, "Error loading %s\n", paths[i]);
+                return;
+            }
+        }
+        measures[s] = benchmark_get_time() - start;
+    }
+
+    benchmark_report("load + parse, sequential stdio", measures, SAMPLE_SIZE);
+    report_steady_state(faults, &pool);
+}
+
+// Parse each file as soon as the loader has it
+void benchmark_loader(int flags, char *name)
+{
+    io_str_t *strings = malloc(CORPUS_FILES * sizeof(io_str_t));
+    if (!strings)
+        return;
+
+    long faults = 0;
+    io_pool_stats_t pool;
+    for (size_t s = 0; s < SAMPLE_SIZE; s++)
+    {
+        faults = minor_faults();
+        io_pool_stats(&pool);
+        double start = benchmark_get_time();
+        loader_t loader;
+        int err = loader_init(&loader, paths, CORPUS_FILES, strings, flags);
+        if (err)
+        {
+            fprintf(stderr, "Error starting loader: %d\n", err);
+            free(strings);
+            return;
+        }
+
+        size_t index;
+        while ((err = loader_next(&loader, &index)) != LOADER_DONE)
+        {
+            if (err || parse_and_free(&strings[index]))
+            {
+                fprintf(stderr, "Error loading %s\n", paths[index]);
+                break;
+            }
+        }
+        loader_destroy(&loader);
+        measures[s] = benchmark_get_time() - start;
+    }
+
+    free(strings);
+    benchmark_report(name, measures, SAMPLE_SIZE);
+    report_steady_state(faults, &pool);
+}
+
+int main(void)
+{
+    printf("Loader Benchmark\n");
+
+    if (write_corpus())
+    {
+        fprintf(stderr, "Error writing the corpus\n");
+        return 1;
+    }
+    printf("%d files in %s\n", CORPUS_FILES, dir);
+
+    benchmark_sequential();
+    benchmark_loader(LOADER_FLAG_POOL, "load + parse, io_uring loader");
+    benchmark_loader(LOADER_FLAG_NO_URING | LOADER_FLAG_POOL, "load + parse, pread loader");
+
+    remove_corpus();
+
+    printf("Loader Benchmark Complete\n");
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 
 #define SAMPLE_SIZE 20
 static double measures[SAMPLE_SIZE];
+static double teardown_measures[SAMPLE_SIZE];
 
 void benchmark_it(char *path)
 {
@@ -18,6 +19,8 @@ void benchmark_it(char *path)
         return;
     }
 
+    parser_stats_t stats = {0};
+
     for (size_t i = 0; i < SAMPLE_SIZE; i++)
     {
         double start = benchmark_get_time();
@@ -33,11 +36,24 @@ void benchmark_it(char *path)
 
         double end = benchmark_get_time();
         measures[i] = end - start;
+
+        if (i == 0)
+            parser_program_stats(&program, &stats);
+
+        start = benchmark_get_time();
         parser_free_program(&program);
+        end = benchmark_get_time();
+        teardown_measures[i] = end - start;
     }
 
     io_free_string(&string);
     benchmark_report(path, measures, SAMPLE_SIZE);
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s (teardown)", path);
+    benchmark_report(name, teardown_measures, SAMPLE_SIZE);
+
+    parser_print_stats(stdout, &stats);
 }
 
 int main(void)
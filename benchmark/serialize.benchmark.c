@@ -0,0 +1,1048 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "io.h"
+#include "parser.h"
+#include "serialize.h"
+#include "frame.h"
+#include "benchmark.h"
+
+#define SAMPLE_SIZE 10
+static double encode_measures[SAMPLE_SIZE];
+static double decode_measures[SAMPLE_SIZE];
+static double zero_copy_measures[SAMPLE_SIZE];
+
+#define MB (1024.0 * 1024.0)
+
+// What a copying decode asks malloc for: every non-empty array, plus
+// the one block holding the copies of every string and symbol
+static size_t count_decode_allocations(form_t *form)
+{
+    if (form->type == FORM_LIST)
+    {
+        size_t count = form->list.size > 0;
+        for (size_t i = 0; i < form->list.size; ++i)
+            count += count_decode_allocations(&form->list.items[i]);
+        return count;
+    }
+
+    return 0;
+}
+
+void benchmark_version(char *path, program_t *program, size_t nodes, int version, int flags)
+{
+    serializer_options_t options = {.version = version, .flags = flags};
+    const char *label = flags & SERIALIZER_FLAG_SYMBOL_TABLE ? "+symbols" : "";
+    size_t size = serializer_encoded_size(program, &options);
+    char *buf = malloc(size);
+    if (!buf)
+    {
+        fprintf(stderr, "Error allocating %zu bytes\n", size);
+        return;
+    }
+
+    size_t written = 0;
+    for (size_t i = 0; i < SAMPLE_SIZE; i++)
+    {
+        double start = benchmark_get_time();
+        int err = serializer_serialize_to_buffer(program, &options, buf, size, &written);
+        double end = benchmark_get_time();
+        if (err)
+        {
+            fprintf(stderr, "Error serializing: %d\n", err);
+            free(buf);
+            return;
+        }
+        encode_measures[i] = end - start;
+    }
+
+    size_t allocations = 0;
+    for (size_t i = 0; i < SAMPLE_SIZE; i++)
+    {
+        program_t decoded = {0};
+        double start = benchmark_get_time();
+        int err = deserializer_deserialize_from_buffer(buf, written, &decoded);
+        double end = benchmark_get_time();
+        if (err)
+        {
+            fprintf(stderr, "Error deserializing: %d\n", err);
+            free(buf);
+            return;
+        }
+        decode_measures[i] = end - start;
+
+        allocations = (decoded.size > 0) + (decoded.chars != NULL);
+        for (size_t j = 0; j < decoded.size; ++j)
+            allocations += count_decode_allocations(&decoded.items[j]);
+        parser_free_program(&decoded);
+    }
+
+    for (size_t i = 0; i < SAMPLE_SIZE; i++)
+    {
+        program_t decoded = {0};
+        double start = benchmark_get_time();
+        int err = deserializer_deserialize_in_place(buf, written, &decoded);
+        double end = benchmark_get_time();
+        if (err)
+        {
+            fprintf(stderr, "Error deserializing in place: %d\n", err);
+            free(buf);
+            return;
+        }
+        zero_copy_measures[i] = end - start;
+        parser_free_program(&decoded);
+    }
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s (v%d%s encode)", path, version, label);
+    benchmark_report(name, encode_measures, SAMPLE_SIZE);
+    snprintf(name, sizeof(name), "%s (v%d%s decode)", path, version, label);
+    benchmark_report(name, decode_measures, SAMPLE_SIZE);
+    snprintf(name, sizeof(name), "%s (v%d%s decode zero-copy)", path, version, label);
+    benchmark_report(name, zero_copy_measures, SAMPLE_SIZE);
+
+    double encode_median = benchmark_median(encode_measures, SAMPLE_SIZE);
+    double decode_median = benchmark_median(decode_measures, SAMPLE_SIZE);
+    double zero_copy_median = benchmark_median(zero_copy_measures, SAMPLE_SIZE);
+    printf("v%d%s: %zu bytes, %.2f bytes/node, %zu decode allocations, encode %.2f MB/s (%.2f Mnodes/s), "
+           "decode %.2f MB/s (%.2f Mnodes/s), zero-copy decode %.2f MB/s (%.2f Mnodes/s)\n",
+           version, label, written, (double)written / nodes, allocations,
+           written / MB / encode_median, nodes / 1e6 / encode_median,
+           written / MB / decode_median, nodes / 1e6 / decode_median,
+           written / MB / zero_copy_median, nodes / 1e6 / zero_copy_median);
+
+    free(buf);
+}
+
+// Every allocator call made by the code under test, see the --wrap
+// flags of the benchmark build
+static _Atomic size_t allocator_calls;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocator_calls++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocator_calls++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocator_calls++;
+    return __real_realloc(ptr, size);
+}
+
+#define TARGET_MESSAGES 3
+
+typedef struct
+{
+    int fd;
+    int err;
+} target_reader_t;
+
+static void *target_read(void *arg)
+{
+    target_reader_t *reader = arg;
+    deserializer_t deserializer;
+    deserializer_init(&deserializer, reader->fd);
+    deserializer_set_flags(&deserializer, DESERIALIZER_FLAG_ZERO_COPY);
+
+    for (size_t i = 0; i < TARGET_MESSAGES && !reader->err; ++i)
+    {
+        program_t program = {0};
+        reader->err = deserializer_deserialize(&deserializer, &program);
+        parser_free_program(&program);
+    }
+
+    return NULL;
+}
+
+static serializer_t target_serializer;
+
+static int target_write(int fd, program_t *program, serializer_options_t *options)
+{
+    serializer_init(&target_serializer, fd);
+    serializer_set_options(&target_serializer, options);
+
+    int err = 0;
+    for (size_t i = 0; i < TARGET_MESSAGES && !err; ++i)
+        err = serializer_serialize(&target_serializer, program);
+
+    return err;
+}
+
+/**
+ * Serialize the program through an fd, and decode it back zero-copy from
+ * the other end where there is one. /dev/null is the encode cost alone,
+ * a pipe and a socketpair add the copy through the kernel with a reader
+ * keeping up, and the tmpfs file writes everything before reading it back.
+ */
+void benchmark_targets(char *path, program_t *program, size_t nodes)
+{
+    serializer_options_t options = {.version = SERIALIZER_VERSION_2};
+    size_t size = serializer_encoded_size(program, &options);
+    const char *targets[] = {"/dev/null", "pipe", "socketpair", "tmpfs"};
+
+    for (size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); ++t)
+    {
+        int fds[2] = {-1, -1};
+        char file[] = "/dev/shm/serialize.benchmark.XXXXXX";
+        int err = 0;
+        if (t == 0)
+            fds[1] = open("/dev/null", O_WRONLY);
+        else if (t == 1)
+            err = pipe(fds);
+        else if (t == 2)
+            err = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        else
+        {
+            fds[1] = mkstemp(file);
+            fds[0] = fds[1] == -1 ? -1 : open(file, O_RDONLY);
+            unlink(file);
+        }
+        if (err || fds[1] == -1 || (t > 0 && fds[0] == -1))
+        {
+            fprintf(stderr, "Error opening %s\n", targets[t]);
+            continue;
+        }
+
+        target_reader_t reader = {.fd = fds[0], .err = 0};
+        pthread_t thread;
+        allocator_calls = 0;
+
+        // Pipes and sockets need the reader going, the file is read after
+        double start = benchmark_get_time();
+        if (t == 1 || t == 2)
+            pthread_create(&thread, NULL, target_read, &reader);
+        err = target_write(fds[1], program, &options);
+        double written = benchmark_get_time();
+        if (t == 1 || t == 2)
+            pthread_join(thread, NULL);
+        else if (t == 3 && !err)
+            target_read(&reader);
+        double end = benchmark_get_time();
+
+        close(fds[1]);
+        if (fds[0] != -1)
+            close(fds[0]);
+        if (err || reader.err)
+        {
+            fprintf(stderr, "Error going through %s: %d %d\n", targets[t], err, reader.err);
+            continue;
+        }
+
+        double bytes = (double)size * TARGET_MESSAGES;
+        double count = (double)nodes * TARGET_MESSAGES;
+        printf("%s v2 %s: %zu bytes/message, %.2f bytes/node, %.2f allocations/message, write %.2f MB/s (%.2f Mnodes/s)",
+               path, targets[t], size, (double)size / nodes, (double)allocator_calls / TARGET_MESSAGES,
+               bytes / MB / (written - start), count / 1e6 / (written - start));
+        if (t == 0)
+            printf("\n");
+        else
+            printf(", end to end %.2f MB/s (%.2f Mnodes/s)\n", bytes / MB / (end - start), count / 1e6 / (end - start));
+    }
+}
+
+void benchmark_source(char *name, char *source, size_t len)
+{
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, source, len);
+    err = err ? err : parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "Error parsing: %d\n", err);
+        return;
+    }
+
+    parser_stats_t stats = {0};
+    parser_program_stats(&program, &stats);
+    size_t nodes = stats.lists + stats.integers + stats.floats + stats.symbols + stats.strings;
+
+    benchmark_version(name, &program, nodes, SERIALIZER_VERSION_1, 0);
+    benchmark_version(name, &program, nodes, SERIALIZER_VERSION_2, 0);
+    benchmark_version(name, &program, nodes, SERIALIZER_VERSION_2, SERIALIZER_FLAG_SYMBOL_TABLE);
+    benchmark_targets(name, &program, nodes);
+
+    parser_free_program(&program);
+}
+
+void benchmark_it(char *path)
+{
+    io_str_t string;
+    int err = io_load_file_into_memory(path, &string);
+    if (err)
+    {
+        fprintf(stderr, "Error loading fixture: %d\n", err);
+        return;
+    }
+
+    benchmark_source(path, string.data, string.size);
+    io_free_string(&string);
+}
+
+// A query reads a handful of forms out of a large cached program
+#define QUERY_FORMS 16
+
+void benchmark_form_index(char *path, char *source, size_t len)
+{
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, source, len);
+    err = err ? err : parser_parse(&parser, &program);
+    if (err || program.size == 0)
+    {
+        fprintf(stderr, "Error parsing %s: %d\n", path, err);
+        return;
+    }
+
+    serializer_options_t plain = {.version = SERIALIZER_VERSION_2};
+    serializer_options_t indexed = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_FORM_INDEX};
+    size_t plain_size = serializer_encoded_size(&program, &plain);
+    size_t cap = serializer_encoded_size(&program, &indexed);
+    char *buf = malloc(cap);
+    size_t written = 0;
+    err = buf ? serializer_serialize_to_buffer(&program, &indexed, buf, cap, &written) : SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    if (err)
+    {
+        fprintf(stderr, "Error serializing: %d\n", err);
+        free(buf);
+        parser_free_program(&program);
+        return;
+    }
+
+    for (size_t i = 0; i < SAMPLE_SIZE; i++)
+    {
+        program_t decoded = {0};
+        double start = benchmark_get_time();
+        err = deserializer_deserialize_in_place(buf, written, &decoded);
+        double end = benchmark_get_time();
+        if (err)
+        {
+            fprintf(stderr, "Error deserializing: %d\n", err);
+            break;
+        }
+        parser_free_program(&decoded);
+        decode_measures[i] = end - start;
+    }
+
+    for (size_t i = 0; i < SAMPLE_SIZE; i++)
+    {
+        double start = benchmark_get_time();
+        for (size_t q = 0; !err && q < QUERY_FORMS; ++q)
+        {
+            program_t decoded = {0};
+            err = deserializer_get_form(buf, written, q * program.size / QUERY_FORMS, &decoded);
+            parser_free_program(&decoded);
+        }
+        double end = benchmark_get_time();
+        if (err)
+        {
+            fprintf(stderr, "Error reading a form: %d\n", err);
+            break;
+        }
+        zero_copy_measures[i] = end - start;
+    }
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s (v2 indexed, whole program in place)", path);
+    benchmark_report(name, decode_measures, SAMPLE_SIZE);
+    snprintf(name, sizeof(name), "%s (v2 indexed, %d forms)", path, QUERY_FORMS);
+    benchmark_report(name, zero_copy_measures, SAMPLE_SIZE);
+    printf("%s: %zu forms, index adds %.2f%% to %zu bytes, %d forms %.1fx faster than the whole program\n", path,
+           program.size, 100.0 * (written - plain_size) / plain_size, plain_size, QUERY_FORMS,
+           benchmark_median(decode_measures, SAMPLE_SIZE) / benchmark_median(zero_copy_measures, SAMPLE_SIZE));
+
+    free(buf);
+    parser_free_program(&program);
+}
+
+/**
+ * Source text to a v2 message, through a program and in a single pass.
+ * MB/s counts source bytes.
+ */
+void benchmark_transcode(char *path)
+{
+    io_str_t string;
+    int err = io_load_file_into_memory(path, &string);
+    if (err)
+    {
+        fprintf(stderr, "Error loading fixture: %d\n", err);
+        return;
+    }
+
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    for (size_t i = 0; i < SAMPLE_SIZE && !err; i++)
+    {
+        double start = benchmark_get_time();
+        parser_t parser;
+        program_t program = {0};
+        err = parser_init(&parser, string.data, string.size);
+        err = err ? err : parser_parse(&parser, &program);
+        size_t cap = serializer_encoded_size(&program, &v2);
+        char *buf = malloc(cap);
+        size_t written = 0;
+        err = err ? err : serializer_serialize_to_buffer(&program, &v2, buf, cap, &written);
+        parser_free_program(&program);
+        free(buf);
+        double end = benchmark_get_time();
+        encode_measures[i] = end - start;
+    }
+
+    for (size_t i = 0; i < SAMPLE_SIZE && !err; i++)
+    {
+        double start = benchmark_get_time();
+        char *buf = NULL;
+        size_t written = 0;
+        err = serializer_transcode(string.data, string.size, &v2, &buf, &written);
+        free(buf);
+        double end = benchmark_get_time();
+        decode_measures[i] = end - start;
+    }
+
+    if (err)
+    {
+        fprintf(stderr, "Error transcoding %s: %d\n", path, err);
+        io_free_string(&string);
+        return;
+    }
+
+    char name[256];
+    snprintf(name, sizeof(name), "%s (parse + serialize v2)", path);
+    benchmark_report(name, encode_measures, SAMPLE_SIZE);
+    snprintf(name, sizeof(name), "%s (transcode v2)", path);
+    benchmark_report(name, decode_measures, SAMPLE_SIZE);
+    printf("%s: parse + serialize %.2f MB/s, transcode %.2f MB/s\n", path,
+           string.size / MB / benchmark_median(encode_measures, SAMPLE_SIZE),
+           string.size / MB / benchmark_median(decode_measures, SAMPLE_SIZE));
+
+    io_free_string(&string);
+}
+
+static double patch_measures[SAMPLE_SIZE];
+
+// Patches are far below the timer resolution, time this many at once
+#define PATCH_ROUNDS 1000
+
+/**
+ * Change two top-level forms of the fixture and compare sending the whole
+ * program again with sending a delta: the bytes on the wire, and the time
+ * to decode the program against the time to patch the old copy.
+ */
+void benchmark_delta(char *path)
+{
+    io_str_t string;
+    int err = io_load_file_into_memory(path, &string);
+    if (err)
+    {
+        fprintf(stderr, "Error loading fixture: %d\n", err);
+        return;
+    }
+
+    parser_t parser;
+    program_t from = {0}, to = {0};
+    err = parser_init(&parser, string.data, string.size);
+    err = err ? err : parser_parse(&parser, &from);
+    err = err ? err : parser_init(&parser, string.data, string.size);
+    err = err ? err : parser_parse(&parser, &to);
+    if (err || to.size < 4)
+    {
+        fprintf(stderr, "Error parsing %s: %d\n", path, err);
+        io_free_string(&string);
+        return;
+    }
+
+    // The edited forms are put back before freeing
+    size_t edits[] = {to.size / 2, to.size * 3 / 4};
+    form_t saved[2];
+    for (size_t e = 0; e < 2; ++e)
+    {
+        saved[e] = to.items[edits[e]];
+        to.items[edits[e]] = (form_t){.type = FORM_ATOM, .atom = {.type = ATOM_NUMBER, .num = {.type = NUMBER_INTEGER, .integer = 424242}}};
+    }
+
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    size_t full_size = serializer_encoded_size(&to, &v2);
+    char *full = malloc(full_size);
+    err = full ? serializer_serialize_to_buffer(&to, &v2, full, full_size, &full_size) : SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    char *delta = NULL, *undo = NULL;
+    size_t delta_size = 0, undo_size = 0;
+    for (size_t i = 0; i < SAMPLE_SIZE && !err; i++)
+    {
+        free(delta);
+        double start = benchmark_get_time();
+        err = serializer_diff(&from, &to, &delta, &delta_size);
+        double end = benchmark_get_time();
+        encode_measures[i] = end - start;
+    }
+    err = err ? err : serializer_diff(&to, &from, &undo, &undo_size);
+
+    for (size_t i = 0; i < SAMPLE_SIZE && !err; i++)
+    {
+        program_t decoded = {0};
+        double start = benchmark_get_time();
+        err = deserializer_deserialize_in_place(full, full_size, &decoded);
+        double end = benchmark_get_time();
+        decode_measures[i] = end - start;
+        parser_free_program(&decoded);
+    }
+
+    // Patch forward, then back to where the delta applies again
+    for (size_t i = 0; i < SAMPLE_SIZE && !err; i++)
+    {
+        double start = benchmark_get_time();
+        for (size_t r = 0; r < PATCH_ROUNDS && !err; ++r)
+        {
+            err = serializer_patch(&from, delta, delta_size);
+            err = err ? err : serializer_patch(&from, undo, undo_size);
+        }
+        double end = benchmark_get_time();
+        patch_measures[i] = (end - start) / (2 * PATCH_ROUNDS);
+    }
+
+    for (size_t e = 0; e < 2; ++e)
+        to.items[edits[e]] = saved[e];
+    parser_free_program(&from);
+    parser_free_program(&to);
+
+    if (!err)
+    {
+        char name[256];
+        snprintf(name, sizeof(name), "%s (diff)", path);
+        benchmark_report(name, encode_measures, SAMPLE_SIZE);
+        snprintf(name, sizeof(name), "%s (patch)", path);
+        benchmark_report(name, patch_measures, SAMPLE_SIZE);
+        printf("%s delta: %zu bytes instead of %zu, diff %.3f ms, patch %.1f us instead of a %.3f ms zero-copy decode\n",
+               path, delta_size, full_size, benchmark_median(encode_measures, SAMPLE_SIZE) * 1e3,
+               benchmark_median(patch_measures, SAMPLE_SIZE) * 1e6, benchmark_median(decode_measures, SAMPLE_SIZE) * 1e3);
+    }
+    else
+    {
+        fprintf(stderr, "Error diffing %s: %d\n", path, err);
+    }
+
+    free(full);
+    free(delta);
+    free(undo);
+    io_free_string(&string);
+}
+
+// The generated fixtures use random names, real programs keep repeating
+// a small vocabulary, which is what the symbol table is for
+#define SYMBOL_HEAVY_COPIES 100000
+
+void benchmark_symbol_heavy(void)
+{
+    const char *form = "(define (fold f acc xs) (if (empty xs) acc (fold f (f acc (car xs)) (cdr xs))))\n"
+                       "(let ((total (fold + 0 items)) (count (length items))) (quotient total count))\n";
+    size_t form_len = strlen(form);
+    size_t len = form_len * SYMBOL_HEAVY_COPIES;
+    char *source = malloc(len);
+    if (!source)
+    {
+        fprintf(stderr, "Error allocating %zu bytes\n", len);
+        return;
+    }
+
+    for (size_t i = 0; i < SYMBOL_HEAVY_COPIES; ++i)
+        memcpy(source + i * form_len, form, form_len);
+
+    benchmark_source("symbol-heavy", source, len);
+    benchmark_form_index("symbol-heavy", source, len);
+    free(source);
+}
+
+// Long string literals, where gathering saves copying nearly every byte
+#define STRING_HEAVY_COPIES 20000
+#define STRING_HEAVY_LENGTH 4096
+#define GATHER_THRESHOLD 256
+
+static serializer_t gather_serializer;
+
+void benchmark_gather(void)
+{
+    size_t form_len = STRING_HEAVY_LENGTH + 8;
+    size_t len = form_len * STRING_HEAVY_COPIES;
+    char *source = malloc(len);
+    if (!source)
+    {
+        fprintf(stderr, "Error allocating %zu bytes\n", len);
+        return;
+    }
+
+    for (size_t i = 0; i < STRING_HEAVY_COPIES; ++i)
+    {
+        char *form = source + i * form_len;
+        memcpy(form, "(log \"", 6);
+        memset(form + 6, 'x', STRING_HEAVY_LENGTH);
+        memcpy(form + 6 + STRING_HEAVY_LENGTH, "\")", 2);
+    }
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, source, len);
+    err = err ? err : parser_parse(&parser, &program);
+    int fd = open("/dev/null", O_WRONLY);
+    if (err || fd == -1)
+    {
+        fprintf(stderr, "Error setting up the gather benchmark: %d\n", err);
+        free(source);
+        return;
+    }
+
+    serializer_options_t options[] = {
+        {.version = SERIALIZER_VERSION_2},
+        {.version = SERIALIZER_VERSION_2, .gather_threshold = GATHER_THRESHOLD},
+    };
+    char *names[] = {"string-heavy (v2 copy to /dev/null)", "string-heavy (v2 gather to /dev/null)"};
+    size_t size = serializer_encoded_size(&program, &options[0]);
+
+    for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); ++o)
+    {
+        serializer_init(&gather_serializer, fd);
+        serializer_set_options(&gather_serializer, &options[o]);
+        for (size_t i = 0; i < SAMPLE_SIZE; i++)
+        {
+            double start = benchmark_get_time();
+            err = serializer_serialize(&gather_serializer, &program);
+            double end = benchmark_get_time();
+            if (err)
+            {
+                fprintf(stderr, "Error serializing: %d\n", err);
+                break;
+            }
+            encode_measures[i] = end - start;
+        }
+
+        benchmark_report(names[o], encode_measures, SAMPLE_SIZE);
+        printf("%s: %.2f MB/s\n", names[o], size / MB / benchmark_median(encode_measures, SAMPLE_SIZE));
+    }
+
+    close(fd);
+    parser_free_program(&program);
+    free(source);
+}
+
+// Messages sent per configuration in the loopback benchmark
+#define LOOPBACK_MESSAGES 5
+
+static serializer_t loopback_serializer;
+
+typedef struct
+{
+    int fd;
+    int err;
+} loopback_reader_t;
+
+static void *loopback_read(void *arg)
+{
+    loopback_reader_t *reader = arg;
+    deserializer_t deserializer;
+    deserializer_init(&deserializer, reader->fd);
+    deserializer_set_flags(&deserializer, DESERIALIZER_FLAG_ZERO_COPY);
+
+    for (size_t i = 0; i < LOOPBACK_MESSAGES && !reader->err; ++i)
+    {
+        program_t program = {0};
+        reader->err = deserializer_deserialize(&deserializer, &program);
+        parser_free_program(&program);
+    }
+
+    return NULL;
+}
+
+// A connected pair of TCP sockets over 127.0.0.1
+static int loopback_connect(int *client, int *server)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == -1)
+        return -1;
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listener, 1) == -1 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addr_len) == -1)
+    {
+        close(listener);
+        return -1;
+    }
+
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (*client == -1 || connect(*client, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(listener);
+        return -1;
+    }
+
+    *server = accept(listener, NULL, NULL);
+    close(listener);
+
+    return *server == -1 ? -1 : 0;
+}
+
+/**
+ * Send the program over loopback TCP with each wire option, decoding on
+ * the other end, to see whether the smaller frames pay for compressing.
+ * MB/s counts the bytes of the v1 encoding, so every row moves the same data.
+ */
+void benchmark_loopback(char *path)
+{
+    io_str_t string;
+    int err = io_load_file_into_memory(path, &string);
+    if (err)
+    {
+        fprintf(stderr, "Error loading fixture: %d\n", err);
+        return;
+    }
+
+    parser_t parser;
+    program_t program = {0};
+    err = parser_init(&parser, string.data, string.size);
+    err = err ? err : parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "Error parsing: %d\n", err);
+        io_free_string(&string);
+        return;
+    }
+
+    serializer_options_t options[] = {
+        {.version = SERIALIZER_VERSION_1},
+        {.version = SERIALIZER_VERSION_2},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED | SERIALIZER_FLAG_SYMBOL_TABLE},
+    };
+    char *labels[] = {"v1", "v2", "v2+lz", "v2+symbols+lz"};
+    size_t raw_size = serializer_encoded_size(&program, &options[0]);
+
+    for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); ++o)
+    {
+        size_t cap = serializer_encoded_size(&program, &options[o]);
+        char *buf = malloc(cap);
+        size_t wire_size = 0;
+        if (!buf || serializer_serialize_to_buffer(&program, &options[o], buf, cap, &wire_size))
+        {
+            fprintf(stderr, "Error sizing %s\n", labels[o]);
+            free(buf);
+            continue;
+        }
+        free(buf);
+
+        int client, server;
+        if (loopback_connect(&client, &server))
+        {
+            fprintf(stderr, "Error connecting over loopback\n");
+            break;
+        }
+
+        loopback_reader_t reader = {.fd = server, .err = 0};
+        pthread_t thread;
+        pthread_create(&thread, NULL, loopback_read, &reader);
+
+        serializer_init(&loopback_serializer, client);
+        serializer_set_options(&loopback_serializer, &options[o]);
+
+        double start = benchmark_get_time();
+        for (size_t i = 0; i < LOOPBACK_MESSAGES && !err; ++i)
+            err = serializer_serialize(&loopback_serializer, &program);
+        pthread_join(thread, NULL);
+        double end = benchmark_get_time();
+
+        close(client);
+        close(server);
+        if (err || reader.err)
+        {
+            fprintf(stderr, "Error sending %s: %d %d\n", labels[o], err, reader.err);
+            break;
+        }
+
+        printf("%s loopback %s: %zu bytes/message, ratio %.2f, %.2f MB/s\n",
+               path, labels[o], wire_size, (double)raw_size / wire_size,
+               raw_size * LOOPBACK_MESSAGES / MB / (end - start));
+    }
+
+    parser_free_program(&program);
+    io_free_string(&string);
+}
+
+// Parse requests per configuration in the pipelining benchmark
+#define PIPELINE_REQUESTS 20000
+
+typedef struct
+{
+    int fd;
+    int err;
+    size_t flushes;
+} parse_server_t;
+
+// Answer parse requests until the client hangs up, flushing the
+// responses only once every buffered request has been handled
+static void *parse_server(void *arg)
+{
+    parse_server_t *server = arg;
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    frame_reader_t reader;
+    frame_writer_t writer;
+    frame_reader_init(&reader, server->fd);
+    frame_writer_init(&writer, server->fd);
+
+    while (!server->err)
+    {
+        if (!frame_reader_has_frame(&reader) && frame_writer_pending(&writer) > 0)
+        {
+            server->err = frame_writer_flush(&writer);
+            server->flushes++;
+        }
+
+        frame_t frame;
+        int err = frame_reader_next(&reader, &frame);
+        if (err == FRAME_ERR_CLOSED)
+            break;
+        if (err)
+        {
+            server->err = err;
+            break;
+        }
+
+        parser_t parser;
+        program_t program = {0};
+        err = parser_init(&parser, (char *)frame.payload, frame.payload_size);
+        err = err ? err : parser_parse(&parser, &program);
+        if (err)
+            server->err = frame_writer_queue_error(&writer, frame.request_id, err);
+        else
+            server->err = frame_writer_queue_program(&writer, frame.request_id, &program, &v2);
+        parser_free_program(&program);
+    }
+
+    frame_reader_free(&reader);
+    frame_writer_free(&writer);
+
+    return NULL;
+}
+
+/**
+ * Send parse requests over loopback TCP with up to window of them in
+ * flight. A window of 1 is the lock-step exchange, larger ones let both
+ * sides batch their frames into fewer syscalls.
+ */
+void benchmark_pipelining(void)
+{
+    const char *request = "(define (fold f acc xs) (if (empty xs) acc (fold f (f acc (car xs)) (cdr xs))))";
+    size_t request_len = strlen(request);
+    size_t windows[] = {1, 16, 128};
+
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); ++w)
+    {
+        int client, server_fd;
+        if (loopback_connect(&client, &server_fd))
+        {
+            fprintf(stderr, "Error connecting over loopback\n");
+            return;
+        }
+
+        parse_server_t server = {.fd = server_fd, .err = 0, .flushes = 0};
+        pthread_t thread;
+        pthread_create(&thread, NULL, parse_server, &server);
+
+        frame_reader_t reader;
+        frame_writer_t writer;
+        frame_reader_init(&reader, client);
+        frame_writer_init(&writer, client);
+
+        int err = 0;
+        size_t sent = 0, received = 0, flushes = 0;
+        double start = benchmark_get_time();
+        while (!err && received < PIPELINE_REQUESTS)
+        {
+            while (!err && sent < PIPELINE_REQUESTS && sent - received < windows[w])
+                err = frame_writer_queue(&writer, FRAME_TYPE_PARSE, (uint32_t)sent++, request, request_len);
+            if (!err && frame_writer_pending(&writer) > 0)
+            {
+                err = frame_writer_flush(&writer);
+                flushes++;
+            }
+
+            // Take every response that arrived before topping the window up
+            do
+            {
+                frame_t frame;
+                err = err ? err : frame_reader_next(&reader, &frame);
+                if (!err && (frame.type != FRAME_TYPE_PROGRAM || frame.request_id != received))
+                    err = FRAME_ERR_MALFORMED_INPUT;
+                received++;
+            } while (!err && received < PIPELINE_REQUESTS && frame_reader_has_frame(&reader));
+        }
+        double end = benchmark_get_time();
+
+        shutdown(client, SHUT_WR);
+        pthread_join(thread, NULL);
+        frame_reader_free(&reader);
+        frame_writer_free(&writer);
+        close(client);
+        close(server_fd);
+        if (err || server.err)
+        {
+            fprintf(stderr, "Error pipelining with a window of %zu: %d %d\n", windows[w], err, server.err);
+            return;
+        }
+
+        printf("pipelining window %zu: %.0f requests/s, %.1f requests per client flush, %.1f responses per server flush\n",
+               windows[w], PIPELINE_REQUESTS / (end - start), (double)PIPELINE_REQUESTS / flushes,
+               (double)PIPELINE_REQUESTS / server.flushes);
+    }
+}
+
+// Messages every worker decodes per configuration in the arena benchmark
+#define ARENA_MESSAGES 20000
+#define ARENA_MESSAGE_COPIES 32
+#define ARENA_MAX_WORKERS 8
+
+typedef enum
+{
+    DECODE_COPY,
+    DECODE_ZERO_COPY,
+    DECODE_ARENA,
+} decode_mode_t;
+
+typedef struct
+{
+    const char *message;
+    size_t len;
+    decode_mode_t mode;
+    int err;
+} arena_worker_t;
+
+// Decode the same message over and over like an RPC worker would, each
+// program released before the next request comes in
+static void *arena_worker(void *arg)
+{
+    arena_worker_t *worker = arg;
+    alloc_arena_t arena;
+    alloc_arena_init(&arena, 0);
+
+    deserializer_t deserializer;
+    deserializer_init(&deserializer, 0);
+    if (worker->mode == DECODE_ZERO_COPY)
+        deserializer_set_flags(&deserializer, DESERIALIZER_FLAG_ZERO_COPY);
+    if (worker->mode == DECODE_ARENA)
+        deserializer_set_arena(&deserializer, &arena);
+
+    for (size_t i = 0; i < ARENA_MESSAGES && !worker->err; ++i)
+    {
+        program_t program = {0};
+        size_t consumed;
+        worker->err = deserializer_feed(&deserializer, worker->message, worker->len, &consumed, &program);
+
+        parser_free_program(&program);
+        alloc_arena_reset(&arena);
+    }
+
+    deserializer_free(&deserializer);
+    alloc_arena_free(&arena);
+
+    return NULL;
+}
+
+/**
+ * Requests of a few KB decoded by 1 to ARENA_MAX_WORKERS threads at
+ * once, copying, zero-copy, and into a per-worker arena that is reset
+ * after every request. The arena takes malloc out of the loop entirely.
+ */
+void benchmark_arena(void)
+{
+    const char *form = "(define (fold f acc xs) (if (empty xs) acc (fold f (f acc (car xs)) (cdr xs)))) \"request\" ";
+    size_t form_len = strlen(form);
+    char source[ARENA_MESSAGE_COPIES * 128];
+    for (size_t i = 0; i < ARENA_MESSAGE_COPIES; ++i)
+        memcpy(source + i * form_len, form, form_len);
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, source, form_len * ARENA_MESSAGE_COPIES);
+    err = err ? err : parser_parse(&parser, &program);
+
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    char message[16 * 1024];
+    size_t len = 0;
+    err = err ? err : serializer_serialize_to_buffer(&program, &v2, message, sizeof(message), &len);
+    parser_free_program(&program);
+    if (err)
+    {
+        fprintf(stderr, "Error preparing the arena benchmark: %d\n", err);
+        return;
+    }
+
+    const char *modes[] = {"copy", "zero-copy", "arena"};
+    size_t workers[] = {1, 4, ARENA_MAX_WORKERS};
+    for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w)
+    {
+        for (decode_mode_t mode = DECODE_COPY; mode <= DECODE_ARENA; ++mode)
+        {
+            arena_worker_t args[ARENA_MAX_WORKERS];
+            pthread_t threads[ARENA_MAX_WORKERS];
+
+            double start = benchmark_get_time();
+            for (size_t t = 0; t < workers[w]; ++t)
+            {
+                args[t] = (arena_worker_t){.message = message, .len = len, .mode = mode, .err = 0};
+                pthread_create(&threads[t], NULL, arena_worker, &args[t]);
+            }
+            for (size_t t = 0; t < workers[w]; ++t)
+            {
+                pthread_join(threads[t], NULL);
+                err = err ? err : args[t].err;
+            }
+            double end = benchmark_get_time();
+
+            if (err)
+            {
+                fprintf(stderr, "Error decoding with %s: %d\n", modes[mode], err);
+                return;
+            }
+
+            printf("arena %zu workers, %s: %.0f messages/s (%zu bytes each)\n", workers[w], modes[mode],
+                   workers[w] * ARENA_MESSAGES / (end - start), len);
+        }
+    }
+}
+
+int main(void)
+{
+    printf("Serializer Benchmark\n");
+
+    benchmark_it("./benchmark/fixtures/small.lisp");
+    benchmark_it("./benchmark/fixtures/medium.lisp");
+    benchmark_it("./benchmark/fixtures/large.lisp");
+    benchmark_transcode("./benchmark/fixtures/medium.lisp");
+    benchmark_transcode("./benchmark/fixtures/large.lisp");
+    benchmark_delta("./benchmark/fixtures/medium.lisp");
+    benchmark_delta("./benchmark/fixtures/large.lisp");
+    benchmark_symbol_heavy();
+    benchmark_gather();
+    benchmark_loopback("./benchmark/fixtures/medium.lisp");
+    benchmark_pipelining();
+    benchmark_arena();
+
+    printf("Serializer Benchmark Complete\n");
+
+    return 0;
+}
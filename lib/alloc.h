@@ -16,6 +16,9 @@ typedef struct
     el_t *els;
     size_t elements;
     size_t cap;
+#else
+    // Without ALLOC_TESTS there is nothing to track
+    char unused;
 #endif
 } alloc_context_t;
 
@@ -29,4 +32,35 @@ void alloc_free(alloc_context_t *ctx, void *ptr);
 int alloc_free_context(alloc_context_t *ctx);
 int alloc_were_all_allocations_freed(alloc_context_t *ctx);
 
+typedef struct alloc_chunk alloc_chunk_t;
+
+/**
+ * A bump allocator over a list of chunks. Nothing is freed on its own:
+ * alloc_arena_reset releases everything at once and keeps the chunks,
+ * so a worker that fills and resets the same arena stops calling malloc
+ * once it has seen its largest request.
+ */
+typedef struct
+{
+    alloc_chunk_t *first;
+    alloc_chunk_t *current;
+    size_t chunk_size;
+} alloc_arena_t;
+
+#define ALLOC_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+int alloc_arena_init(alloc_arena_t *arena, size_t chunk_size);
+
+// size bytes aligned for any type, or NULL when malloc fails or size is
+// too large to round up and fit in a chunk
+void *alloc_arena_alloc(alloc_arena_t *arena, size_t size);
+
+// Forget every allocation, keeping the chunks for the next ones
+int alloc_arena_reset(alloc_arena_t *arena);
+
+// Bytes handed out since the last reset, padding included
+size_t alloc_arena_used(alloc_arena_t *arena);
+
+int alloc_arena_free(alloc_arena_t *arena);
+
 #endif
@@ -1,7 +1,10 @@
 #ifndef BENCHMARK_H
 #define BENCHMARK_H
 
+#include <stddef.h>
+
 double benchmark_get_time(void);
+double benchmark_median(double *measures, size_t size);
 void benchmark_report(char *name, double *measures, size_t size);
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "image.h"
+
+/**
+ * Bumped whenever the same source could give a different entry, so an
+ * old cache directory is simply never hit instead of being misread.
+ * Entries of another IMAGE_VERSION fail to open and are replaced.
+ */
+#define CACHE_VERSION 1
+
+#define CACHE_ENTRY_SUFFIX ".img"
+
+// Files modified this recently get no stamp, they are hashed every time
+#define CACHE_RACY_SECONDS 2
+#define CACHE_STAMPS_DIR "stamps"
+
+/**
+ * A persistent cache of parsed programs. Entries are AST images named
+ * after a hash_bytes of the source, so identical files share one and a
+ * file that changes back is a hit again. For every source path a stamp
+ * remembers its device, inode, size and mtime along with the content
+ * hash; while they match, the source is not even read. Entries are
+ * mapped and walked in place, so a hit costs a stat, a small read and
+ * an mmap whatever the size of the file. Safe to share between threads
+ * and processes: files are written aside and renamed into place.
+ */
+typedef struct
+{
+    char *dir;
+
+    // The stamp matched and the source was never read
+    _Atomic size_t stamp_hits;
+    // The stamp was stale or missing, but the contents were seen before
+    _Atomic size_t content_hits;
+    // The source was parsed and stored
+    _Atomic size_t misses;
+    // Entries or stamps that could not be written
+    _Atomic size_t store_failures;
+} cache_t;
+
+#define CACHE_ERR_INVALID_ARGUMENT -30
+#define CACHE_ERR_FAILED_TO_CREATE_DIR -31
+#define CACHE_ERR_FAILED_TO_LOAD -32
+#define CACHE_ERR_FAILED_TO_PARSE -33
+#define CACHE_ERR_FAILED_TO_STORE -34
+
+// Create dir and its stamps directory unless they exist
+int cache_init(cache_t *cache, char *dir);
+
+/**
+ * Open the image of filepath from the cache if possible, otherwise parse
+ * it and store its image first. Release it with image_close.
+ */
+int cache_open(cache_t *cache, char *filepath, image_t *image);
+
+void cache_print_stats(FILE *out, cache_t *cache);
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+#include "serialize.h"
+
+/**
+ * Framing for many messages on one connection. Every frame starts with
+ * FRAME_MAGIC, a type byte, three reserved bytes, a big-endian u32 request
+ * id and a big-endian u64 payload size. Responses carry the id of their
+ * request, so a client can keep any number of requests in flight and match
+ * the answers as they arrive, in whatever order the server sends them.
+ */
+#define FRAME_MAGIC "CLSF"
+#define FRAME_MAGIC_SIZE 4
+#define FRAME_HEADER_SIZE 20
+
+// The parse service: text goes one way, programs the other.
+// Other type values are free for applications.
+#define FRAME_TYPE_PARSE 1   // program source text
+#define FRAME_TYPE_PROGRAM 2 // a serialized program message, header included
+#define FRAME_TYPE_ERROR 3   // a big-endian i32 error code
+
+// Refuse frames claiming more than this before allocating for them
+#define FRAME_MAX_PAYLOAD_SIZE ((uint64_t)1 << 32)
+
+#define FRAME_READ_SIZE (64 * 1024)
+
+typedef struct
+{
+    uint8_t type;
+    uint32_t request_id;
+    // Points into the reader, valid until its next call
+    const char *payload;
+    size_t payload_size;
+} frame_t;
+
+/**
+ * Queues whole frames in memory until frame_writer_flush writes them
+ * all with as few write calls as the kernel allows, so a server answering
+ * a burst of pipelined requests pays for one syscall instead of one each.
+ */
+typedef struct
+{
+    int fd;
+    char *buffer;
+    size_t used;
+    size_t capacity;
+} frame_writer_t;
+
+/**
+ * Reads in chunks of FRAME_READ_SIZE, so a single read usually brings in
+ * many small frames, and hands them out one at a time.
+ */
+typedef struct
+{
+    int fd;
+    char *buffer;
+    size_t start;
+    size_t end;
+    size_t capacity;
+} frame_reader_t;
+
+#define FRAME_ERR_INVALID_ARGUMENT -1
+#define FRAME_ERR_MEMORY_ALLOCATION_FAILED -2
+#define FRAME_ERR_WRITE_FAILED -3
+#define FRAME_ERR_READ_FAILED -4
+#define FRAME_ERR_MALFORMED_INPUT -5
+#define FRAME_ERR_CLOSED -6
+
+// Returned by frame_reader_next on a non-blocking fd that has no whole frame yet
+#define FRAME_NEED_MORE 1
+
+int frame_writer_init(frame_writer_t *writer, int fd);
+int frame_writer_free(frame_writer_t *writer);
+
+// Queue a frame, the payload is copied
+int frame_writer_queue(frame_writer_t *writer, uint8_t type, uint32_t request_id, const char *payload, size_t len);
+
+/**
+ * Queue a FRAME_TYPE_PROGRAM frame, serializing the program straight into
+ * the queue with serializer_serialize_to_buffer. A NULL options means version 1.
+ */
+int frame_writer_queue_program(frame_writer_t *writer, uint32_t request_id, program_t *program, serializer_options_t *options);
+
+// Queue a FRAME_TYPE_ERROR frame
+int frame_writer_queue_error(frame_writer_t *writer, uint32_t request_id, int32_t code);
+
+// Bytes queued and not written yet
+size_t frame_writer_pending(frame_writer_t *writer);
+
+// Write every queued frame
+int frame_writer_flush(frame_writer_t *writer);
+
+int frame_reader_init(frame_reader_t *reader, int fd);
+int frame_reader_free(frame_reader_t *reader);
+
+/**
+ * 1 when a whole frame is already buffered, so frame_reader_next will not
+ * touch the fd. Servers flush their responses once this drops to 0, which
+ * batches the answers to everything a client pipelined.
+ */
+int frame_reader_has_frame(frame_reader_t *reader);
+
+/**
+ * The next frame, reading as needed. Returns FRAME_ERR_CLOSED when the
+ * connection ends between frames, and FRAME_NEED_MORE when the fd is
+ * non-blocking and would block.
+ */
+int frame_reader_next(frame_reader_t *reader, frame_t *frame);
+
+#endif
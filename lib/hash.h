@@ -0,0 +1,131 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Small, fast non-cryptographic hashing, modelled after xxHash64.
+ * Everything is static inline so callers get it without an extra unit.
+ */
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+#define HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME_5 0x27D4EB2F165667C5ULL
+
+#define HASH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t __hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t __hash_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t __hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * HASH_PRIME_2;
+    acc = HASH_ROTL(acc, 31);
+    return acc * HASH_PRIME_1;
+}
+
+static inline uint64_t __hash_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= __hash_round(0, val);
+    return acc * HASH_PRIME_1 + HASH_PRIME_4;
+}
+
+/**
+ * Scramble the bits of a 64-bit value so every input bit affects every output bit.
+ */
+static inline uint64_t hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= HASH_PRIME_2;
+    h ^= h >> 29;
+    h *= HASH_PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Hash len bytes starting at data.
+ */
+static inline uint64_t hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = seed + HASH_PRIME_1 + HASH_PRIME_2;
+        uint64_t v2 = seed + HASH_PRIME_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH_PRIME_1;
+
+        do
+        {
+            v1 = __hash_round(v1, __hash_read64(p));
+            v2 = __hash_round(v2, __hash_read64(p + 8));
+            v3 = __hash_round(v3, __hash_read64(p + 16));
+            v4 = __hash_round(v4, __hash_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = HASH_ROTL(v1, 1) + HASH_ROTL(v2, 7) + HASH_ROTL(v3, 12) + HASH_ROTL(v4, 18);
+        h = __hash_merge_round(h, v1);
+        h = __hash_merge_round(h, v2);
+        h = __hash_merge_round(h, v3);
+        h = __hash_merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + HASH_PRIME_5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end)
+    {
+        h ^= __hash_round(0, __hash_read64(p));
+        h = HASH_ROTL(h, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)__hash_read32(p) * HASH_PRIME_1;
+        h = HASH_ROTL(h, 23) * HASH_PRIME_2 + HASH_PRIME_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= (*p) * HASH_PRIME_5;
+        h = HASH_ROTL(h, 11) * HASH_PRIME_1;
+        p++;
+    }
+
+    return hash_mix(h);
+}
+
+/**
+ * Fold another hash into an accumulator, order matters.
+ */
+static inline uint64_t hash_combine(uint64_t acc, uint64_t h)
+{
+    return __hash_merge_round(HASH_ROTL(acc, 27), h);
+}
+
+#endif
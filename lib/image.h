@@ -0,0 +1,141 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parser.h"
+
+/**
+ * An AST image is a program laid out so it can be mmap'ed and walked in
+ * place, without decoding it first. Every position in the file is an
+ * offset from its start, so the same bytes work wherever they are mapped.
+ *
+ * The file is a header, then 8-byte aligned node records, then one area
+ * with the chars of every symbol and string (each followed by a NUL).
+ * The items of a list are a contiguous array of records, so a list only
+ * needs the offset of that array and its length. Arrays are placed
+ * depth-first, so a subtree is a mostly contiguous range of the file and
+ * the parts of a huge image nobody looks at are never paged in.
+ *
+ * Images are written in host byte order, opening one with the other
+ * byte order fails with IMAGE_ERR_BYTE_ORDER.
+ */
+#define IMAGE_MAGIC "CLSPAST"
+#define IMAGE_MAGIC_SIZE 8
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304
+
+typedef struct
+{
+    char magic[IMAGE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    // Offset of the list record that holds the top-level forms
+    uint64_t root;
+    uint64_t nodes;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t reserved;
+} image_header_t;
+
+typedef enum
+{
+    IMAGE_NODE_LIST,
+    IMAGE_NODE_INTEGER,
+    IMAGE_NODE_FLOAT,
+    IMAGE_NODE_SYMBOL,
+    IMAGE_NODE_STRING,
+} image_node_type_t;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t reserved;
+    // Lists: number of items. Numbers: their bits. Symbols and strings: length
+    uint64_t value;
+    // Lists: offset of the item array. Symbols and strings: offset of the chars
+    uint64_t offset;
+    // Structural hash, the same parser_form_hash gives for the form
+    uint64_t hash;
+} image_record_t;
+
+/**
+ * A node is the offset of its record in the image.
+ */
+typedef uint64_t image_node_t;
+
+typedef struct
+{
+    const char *base;
+    size_t size;
+    const image_header_t *header;
+
+    // Whether base was mmap'ed by image_open and must be unmapped
+    int mapped;
+} image_t;
+
+#define IMAGE_ERR_INVALID_ARGUMENT -1
+#define IMAGE_ERR_MEMORY_ALLOCATION_FAILED -2
+#define IMAGE_ERR_BUFFER_TOO_SMALL -3
+#define IMAGE_ERR_FAILED_TO_OPEN_FILE -4
+#define IMAGE_ERR_FAILED_TO_WRITE_FILE -5
+#define IMAGE_ERR_FAILED_TO_MAP_FILE -6
+#define IMAGE_ERR_BAD_MAGIC -7
+#define IMAGE_ERR_UNSUPPORTED_VERSION -8
+#define IMAGE_ERR_BYTE_ORDER -9
+#define IMAGE_ERR_MALFORMED_INPUT -10
+#define IMAGE_ERR_WRONG_NODE_TYPE -11
+#define IMAGE_ERR_INDEX_OUT_OF_BOUNDS -12
+
+// Exact number of bytes image_write_to_buffer needs for the program
+size_t image_encoded_size(program_t *program);
+
+int image_write_to_buffer(program_t *program, char *buf, size_t cap, size_t *written);
+
+/**
+ * Write the image of program to path, replacing the file if it exists.
+ * The file is sized up front and filled through a shared mapping, so
+ * no copy of the image is kept in memory.
+ */
+int image_write_file(program_t *program, const char *path);
+
+/**
+ * Map the image at path. Only the header is read and validated, so this
+ * takes the same time for any file size; records are checked against
+ * the bounds of the file as the accessors reach them.
+ */
+int image_open(image_t *image, const char *path);
+
+// Use an image that is already in memory, buf must outlive image
+int image_open_buffer(image_t *image, const char *buf, size_t size);
+
+int image_close(image_t *image);
+
+// The list node holding the top-level forms of the program
+int image_root(image_t *image, image_node_t *root);
+
+int image_node_type(image_t *image, image_node_t node, image_node_type_t *type);
+int image_node_hash(image_t *image, image_node_t node, uint64_t *hash);
+
+int image_list_size(image_t *image, image_node_t node, size_t *size);
+int image_list_item(image_t *image, image_node_t node, size_t index, image_node_t *item);
+
+int image_integer(image_t *image, image_node_t node, int64_t *value);
+int image_float(image_t *image, image_node_t node, double *value);
+
+/**
+ * The chars of a symbol or string node. They point into the image, are
+ * NUL-terminated and must not be written to.
+ */
+int image_chars(image_t *image, image_node_t node, const char **chars, size_t *len);
+
+/**
+ * Add the numbers of the image to stats like parser_program_stats does
+ * for a program. Nothing is allocated to walk an image, so the form
+ * array counters are left alone.
+ */
+int image_program_stats(image_t *image, parser_stats_t *stats);
+
+#endif
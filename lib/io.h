@@ -3,12 +3,49 @@
 
 #include <stdlib.h>
 
+/**
+ * The contents of a file. Strings from io_map_file point into a read-only
+ * mapping and set mapped, io_free_string unmaps them instead of freeing.
+ */
 typedef struct
 {
     char *data;
     size_t size;
+    int mapped;
+    // Bytes behind data when it came from the buffer pool, 0 otherwise
+    size_t capacity;
 } io_str_t;
 
+/**
+ * Buffers for file contents come in power of two size classes from
+ * 2^IO_POOL_MIN_CLASS to 2^IO_POOL_MAX_CLASS bytes. Every thread keeps a
+ * few free buffers of each class, and hands half of them to a shared
+ * depot when it has too many or takes some back when it runs out, so a
+ * thread that only reads files and one that only releases them still
+ * recycle each other's buffers with one lock per batch. Files larger
+ * than the biggest class get a buffer of their own that is freed, and
+ * so returned to the OS, as soon as it is released.
+ */
+#define IO_POOL_MIN_CLASS 12
+#define IO_POOL_MAX_CLASS 20
+#define IO_POOL_CLASSES (IO_POOL_MAX_CLASS - IO_POOL_MIN_CLASS + 1)
+
+// Free buffers a thread keeps per class before sharing half of them
+#define IO_POOL_LOCAL_SLOTS 8
+
+// Free bytes the shared depot holds at most, the rest is freed
+#define IO_POOL_SHARED_BYTES (64 * 1024 * 1024)
+
+typedef struct
+{
+    // Buffers handed out without calling malloc
+    size_t hits;
+    // Pooled buffers that had to be allocated
+    size_t misses;
+    // Buffers too large for any class
+    size_t oversized;
+} io_pool_stats_t;
+
 #define ERR_NO_FILE -1
 #define ERR_NO_STRING -2
 #define ERR_FAILED_TO_OPEN_FILE -3
@@ -16,8 +53,32 @@ typedef struct
 #define ERR_FAILED_TO_FTELL_FILE -5
 #define ERR_OUT_OF_MEMORY -6
 #define ERR_FAILED_TO_READ_FILE -7
+#define ERR_FAILED_TO_STAT_FILE -8
+#define ERR_FAILED_TO_MAP_FILE -9
 
 int io_load_file_into_memory(char *filepath, io_str_t *string);
+
+/**
+ * Map the file read-only instead of copying it, hinting the kernel that it
+ * will be read once from start to end so it reads ahead aggressively.
+ * The data is not NUL-terminated (except for empty files, which get a
+ * static "") and must not be written to.
+ */
+int io_map_file(char *filepath, io_str_t *string);
+
+// Same as io_map_file for the first size bytes of an open file, which
+// the caller can close right after
+int io_map_fd(int fd, size_t size, io_str_t *string);
+
+/**
+ * Make string an empty buffer for size bytes plus a NUL, taken from the
+ * buffer pool of the calling thread when it fits a size class.
+ */
+int io_alloc_string(io_str_t *string, size_t size);
+
 int io_free_string(io_str_t *string);
 
+// Totals over every thread since the start of the process
+int io_pool_stats(io_pool_stats_t *stats);
+
 #endif
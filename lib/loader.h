@@ -0,0 +1,95 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "io.h"
+
+// Files the io_uring backend has open at the same time
+#define LOADER_QUEUE_DEPTH 64
+
+// Threads reading files when io_uring is not available
+#define LOADER_PREAD_THREADS 8
+
+// Never use io_uring, read with the pread thread pool instead
+#define LOADER_FLAG_NO_URING 1
+
+// Take the buffers from the io buffer pool. Only pays off when every
+// string is released soon after it is handed out: kept strings each hold
+// a whole size class, and nothing comes back to be reused
+#define LOADER_FLAG_POOL 2
+
+// Map files of at least LOADER_MAP_MIN_SIZE bytes read-only instead of
+// reading them, for callers that keep the strings around
+#define LOADER_FLAG_MAP 4
+
+// Below this a mapping costs more than the copy it saves: every one takes
+// a whole page and one of the process's limited number of mappings
+#define LOADER_MAP_MIN_SIZE (64 * 1024)
+
+#define LOADER_BACKEND_URING 1
+#define LOADER_BACKEND_PREAD 2
+
+/**
+ * Loads many files in the background and hands them out as soon as each
+ * one is in memory, so they can be parsed while the rest are still read.
+ * With io_uring the open, statx, read and close of a whole batch of files
+ * go through a single ring and a handful of syscalls; on kernels without
+ * it a pool of threads does open, fstat, pread and close per file.
+ */
+typedef struct
+{
+    char **filepaths;
+    size_t count;
+    io_str_t *strings;
+    int *errors;
+
+    int flags;
+    int backend;
+    pthread_t threads[LOADER_PREAD_THREADS];
+    size_t thread_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_ready;
+
+    // pread backend only: the next file a thread should pick up
+    size_t next;
+    // Indices of the loaded files, in completion order
+    size_t *ready;
+    size_t ready_head;
+    size_t ready_tail;
+    int stopping;
+} loader_t;
+
+// Returned by loader_next once every file was handed out
+#define LOADER_DONE 1
+
+#define LOADER_ERR_INVALID_ARGUMENT -20
+#define LOADER_ERR_MEMORY_ALLOCATION_FAILED -21
+#define LOADER_ERR_THREAD_FAILED -22
+
+/**
+ * Start loading count files into strings, which must have room for count
+ * entries and stay alive until loader_destroy. Each string is the
+ * caller's to release with io_free_string once it was handed out, and is
+ * NUL-terminated unless it is mapped.
+ */
+int loader_init(loader_t *loader, char **filepaths, size_t count, io_str_t *strings, int flags);
+
+/**
+ * Block until another file is loaded and store its position in index.
+ * Returns 0 when strings[index] holds the file, the io error (ERR_*) when
+ * it could not be loaded, or LOADER_DONE when there is nothing left.
+ * Can be called from many threads at once.
+ */
+int loader_next(loader_t *loader, size_t *index);
+
+/**
+ * Stop loading new files, wait for the ones in flight and release the
+ * loader. Strings that were loaded but not handed out are still filled
+ * in and must be released by the caller as well.
+ */
+int loader_destroy(loader_t *loader);
+
+#endif
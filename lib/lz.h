@@ -0,0 +1,32 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/**
+ * A small, dependency-free block compressor using the LZ4 block format:
+ * a sequence of (token, literals, 2-byte offset, match length) with
+ * greedy hash-table matching. It trades ratio for speed, which suits
+ * the long runs of zero bytes in encoded programs.
+ */
+
+#define LZ_ERR_INVALID_ARGUMENT -1
+#define LZ_ERR_BUFFER_TOO_SMALL -2
+#define LZ_ERR_MALFORMED_INPUT -3
+
+// The largest output lz_compress can produce for len bytes of input
+size_t lz_compress_bound(size_t len);
+
+/**
+ * Compress len bytes of src into dst, which must have room for
+ * lz_compress_bound(len) bytes so the hot loop needs no bounds checks.
+ */
+int lz_compress(const char *src, size_t len, char *dst, size_t cap, size_t *written);
+
+/**
+ * Decompress a block into dst. Every length and offset is checked, so
+ * arbitrary input can not read or write out of bounds.
+ */
+int lz_decompress(const char *src, size_t len, char *dst, size_t cap, size_t *written);
+
+#endif
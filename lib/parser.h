@@ -6,12 +6,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
-
-typedef struct
-{
-    lexer_t lexer;
-    token_t current_token;
-} parser_t;
+#include <stdio.h>
 
 typedef enum
 {
@@ -61,7 +56,19 @@ typedef struct
 } atom_t;
 
 typedef struct form form_t;
-typedef DYNARRAY(form_t) list_t;
+
+/**
+ * A list is a DYNARRAY of forms that also carries a structural hash of
+ * its contents, so equal subtrees can be told apart without a walk.
+ */
+typedef struct
+{
+    form_t *items;
+    size_t size;
+    size_t capacity;
+
+    uint64_t hash;
+} list_t;
 
 typedef enum
 {
@@ -83,7 +90,57 @@ typedef struct form
     };
 } form_t;
 
-typedef DYNARRAY(form_t) program_t;
+/**
+ * A DYNARRAY of top-level forms. Programs built by the parser own one
+ * allocation per list; a program decoded in zero-copy mode instead keeps
+ * everything in block, which parser_free_program releases in one go.
+ * chars, when set, holds the strings and symbol names of a program
+ * decoded by copy and is released along with it. A program decoded into an
+ * arena (see deserializer_set_arena) sets arena instead and owns nothing:
+ * parser_free_program only forgets it, resetting the arena releases it.
+ */
+typedef struct
+{
+    form_t *items;
+    size_t size;
+    size_t capacity;
+
+    void *block;
+    char *chars;
+    void *arena;
+} program_t;
+
+#define PARSER_LIMIT_NONE SIZE_MAX
+
+/**
+ * Upper bounds for a single parse, PARSER_LIMIT_NONE disables a limit.
+ */
+typedef struct
+{
+    // Maximum nesting of lists, a top-level list is at depth 1
+    size_t max_depth;
+    // Maximum number of forms (atoms and lists) in the whole program
+    size_t max_nodes;
+    // Maximum number of bytes across all strings and symbols
+    size_t max_string_bytes;
+    // Maximum size of the input in bytes
+    size_t max_input_size;
+} parser_limits_t;
+
+typedef struct
+{
+    lexer_t lexer;
+    token_t current_token;
+
+    parser_limits_t limits;
+    size_t nodes;
+    size_t string_bytes;
+
+    // Lists that were opened but not closed yet, innermost last.
+    // Living on the parser (instead of the C stack) is what allows
+    // parser_step to stop anywhere and pick up where it left off.
+    DYNARRAY(list_t) open_lists;
+} parser_t;
 
 #define PARSER_ERR_PARSER_NOT_DEFINED -1
 #define PARSER_ERR_INPUT_NOT_DEFINED -2
@@ -98,13 +155,98 @@ typedef DYNARRAY(form_t) program_t;
 #define PARSER_ERR_SYMBOL_NOT_DEFINED -11
 #define PARSER_ERR_EXPECTED_LPAREN -12
 #define PARSER_ERR_UNEXPECTED_EOF -13
+#define PARSER_ERR_MAX_DEPTH_EXCEEDED -14
+#define PARSER_ERR_MAX_NODES_EXCEEDED -15
+#define PARSER_ERR_MAX_STRING_BYTES_EXCEEDED -16
+#define PARSER_ERR_MAX_INPUT_SIZE_EXCEEDED -17
+#define PARSER_ERR_LIMITS_NOT_DEFINED -18
+#define PARSER_ERR_STATS_NOT_DEFINED -19
+
+// Returned by parser_step when the token budget ran out before the input did
+#define PARSER_AGAIN 1
+
+#define PARSER_BUDGET_UNLIMITED SIZE_MAX
 
 int parser_init(parser_t *parser, char *input, size_t input_len);
 int parser_parse(parser_t *parser, program_t *program);
 
+/**
+ * Bound the resources the next parse may use. Must be called after
+ * parser_init, which resets every limit to PARSER_LIMIT_NONE.
+ */
+int parser_set_limits(parser_t *parser, parser_limits_t *limits);
+
+/**
+ * Parse at most budget_tokens tokens into program.
+ *
+ * Returns PARSER_AGAIN if there is still input left, in which case it
+ * must be called again with the same parser and program to continue.
+ * Returns 0 once the whole input was parsed, or a negative error code.
+ */
+int parser_step(parser_t *parser, program_t *program, size_t budget_tokens);
+
+/**
+ * Give up on a parse that parser_step left unfinished, freeing the lists
+ * that were still open. The forms already added to the program stay
+ * there for parser_free_program; the parser needs a parser_init again.
+ */
+int parser_abort(parser_t *parser);
+
+/**
+ * Convert the parser's current token into an atom, for callers that drive
+ * the lexer themselves. Strings and symbols point into the input.
+ */
+int parser_parse_atom(parser_t *parser, atom_t *atom);
+
 int parser_free_form(form_t *form);
 int parser_free_program(program_t *program);
 
+/**
+ * Structural hash of a form: equal forms always hash the same.
+ * Lists return the hash stored by the parser (or deserializer), atoms
+ * are hashed on the spot.
+ */
+uint64_t parser_form_hash(form_t *form);
+
+/**
+ * Recompute the hash of a list from its items, which must already be hashed.
+ */
+uint64_t parser_list_hash(list_t *list);
+
+/**
+ * Recompute every list hash of a program that was built by hand.
+ */
+int parser_hash_program(program_t *program);
+
+// Bucket 0 counts empty lists, bucket i counts lists of size [2^(i-1), 2^i),
+// and the last bucket everything larger
+#define PARSER_STATS_FANOUT_BUCKETS 12
+
+typedef struct
+{
+    size_t lists;
+    size_t integers;
+    size_t floats;
+    size_t symbols;
+    size_t strings;
+    size_t max_depth;
+    size_t fanout[PARSER_STATS_FANOUT_BUCKETS];
+
+    // Bytes held by the program and list arrays, counting their capacity
+    size_t form_array_bytes;
+    // Of form_array_bytes, the ones past size that DYNARRAY_PUSH over-allocated
+    size_t wasted_capacity_bytes;
+    // Bytes of string and symbol data referenced by the atoms
+    size_t string_bytes;
+} parser_stats_t;
+
+/**
+ * Walk the program once and add its numbers to stats, so a zeroed
+ * stats can be passed for many programs to get totals.
+ */
+int parser_program_stats(program_t *program, parser_stats_t *stats);
+void parser_print_stats(FILE *out, parser_stats_t *stats);
+
 #ifdef PARSER_TESTS
 int __program_equals(program_t *p1, program_t *p2);
 int __form_equals(form_t *f1, form_t *f2);
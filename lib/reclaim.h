@@ -0,0 +1,66 @@
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "parser.h"
+#include "dynarray.h"
+
+#define RECLAIM_MAX_THREADS 16
+
+// Programs with at least this many top-level forms are split across workers
+#define RECLAIM_SPLIT_THRESHOLD 1024
+
+typedef struct
+{
+    form_t *items;
+    size_t pending;
+} reclaim_owner_t;
+
+typedef struct
+{
+    reclaim_owner_t *owner;
+    size_t from;
+    size_t to;
+} reclaim_job_t;
+
+/**
+ * A pool of threads that tear programs down in the background,
+ * so the caller gets control back as soon as the program is queued.
+ */
+typedef struct
+{
+    pthread_t threads[RECLAIM_MAX_THREADS];
+    size_t thread_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t is_idle;
+
+    DYNARRAY(reclaim_job_t) jobs;
+    size_t in_flight;
+    // Jobs queued since reclaimer_init, one per chunk of a program
+    size_t jobs_queued;
+    int stopping;
+} reclaimer_t;
+
+#define RECLAIM_ERR_INVALID_ARGUMENT -1
+#define RECLAIM_ERR_MEMORY_ALLOCATION_FAILED -2
+#define RECLAIM_ERR_THREAD_FAILED -3
+
+int reclaimer_init(reclaimer_t *reclaimer, size_t thread_count);
+
+/**
+ * Take ownership of the program and free it on a worker thread.
+ * The program is left empty, as if parser_free_program was called.
+ */
+int reclaimer_free_program(reclaimer_t *reclaimer, program_t *program);
+
+// Block until every queued program has been freed
+int reclaimer_drain(reclaimer_t *reclaimer);
+
+// Drain the queue and join the worker threads
+int reclaimer_destroy(reclaimer_t *reclaimer);
+
+#endif
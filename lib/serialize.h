@@ -3,18 +3,122 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "parser.h"
+#include "alloc.h"
+
+/**
+ * Version 1 is the original format: a big-endian size_t with the payload
+ * size, then 4-byte enums and 8-byte sizes for every node.
+ *
+ * Version 2 starts with SERIALIZER_MAGIC, a version and a flags byte,
+ * and encodes every node with a one-byte tag, LEB128 lengths and
+ * zigzag varint integers. Both are always readable.
+ */
+#define SERIALIZER_VERSION_1 1
+#define SERIALIZER_VERSION_2 2
+
+#define SERIALIZER_MAGIC "CLSP"
+#define SERIALIZER_MAGIC_SIZE 4
+
+// magic, version, flags, two reserved bytes and a big-endian u64 payload size
+#define SERIALIZER_V2_HEADER_SIZE 16
+
+// Refuse messages claiming a larger payload before allocating for them
+#define SERIALIZER_MAX_PAYLOAD_SIZE ((uint64_t)1 << 32)
+
+// Deepest nesting of lists a decoder accepts, counted like the parser's
+// max_depth (a top-level list is at depth 1). Decoding recurses once per
+// level and a v2 list costs only 2 bytes, so without it a small message
+// could exhaust the stack
+#define SERIALIZER_MAX_DEPTH 4096
+
+/**
+ * Version 2 only: write every distinct symbol once in a table at the start
+ * of the payload and refer to it by index. The decoder shares one copy of
+ * each name between all its atoms, kept in program->chars.
+ */
+#define SERIALIZER_FLAG_SYMBOL_TABLE 0x01
+
+/**
+ * Version 2 only: the payload is a varint with its original size followed
+ * by an LZ4-style block (see lz.h). The whole payload is encoded in memory
+ * before it is compressed, so gather_threshold has no effect.
+ */
+#define SERIALIZER_FLAG_COMPRESSED 0x02
+
+/**
+ * Version 2 only: end the payload with a trailer of big-endian u64 offsets,
+ * one per top-level form plus one per item of every list with at least
+ * index_min_list_size items, so deserializer_get_form can jump straight to
+ * a subtree. Can not be combined with SERIALIZER_FLAG_COMPRESSED.
+ */
+#define SERIALIZER_FLAG_FORM_INDEX 0x04
+
+/**
+ * Marks the messages written by serializer_diff. They hold edits instead
+ * of a program, so only serializer_patch reads them.
+ */
+#define SERIALIZER_FLAG_DELTA 0x08
 
+typedef struct
+{
+    int version;
+    int flags;
+
+    // serializer_serialize only: string and symbol bodies of at least this
+    // many bytes are not copied but handed to writev from where they sit,
+    // so they must not change until it returns. 0 copies everything.
+    size_t gather_threshold;
+
+    // SERIALIZER_FLAG_FORM_INDEX only: lists with at least this many items
+    // get an offset for each of them. 0 indexes the top-level forms only.
+    size_t index_min_list_size;
+} serializer_options_t;
+
+#define SERIALIZER_BUFFER_SIZE (64 * 1024)
+
+#ifdef IOV_MAX
+#define SERIALIZER_IOV_MAX IOV_MAX
+#else
+#define SERIALIZER_IOV_MAX 1024
+#endif
+
+/**
+ * Encodes programs into a fixed-size buffer that is flushed to fd
+ * whenever it fills up, so memory use does not grow with the program.
+ * With a gather_threshold the buffer only holds the small parts, and
+ * iov lists them in order with the large bodies for a single writev.
+ */
 typedef struct
 {
     int fd;
-    // TODO: buffered writing
+    serializer_options_t options;
+
+    char buffer[SERIALIZER_BUFFER_SIZE];
+    struct iovec iov[SERIALIZER_IOV_MAX];
 } serializer_t;
 
+// Decode into a single block that owns the payload and every form array,
+// with strings and symbols pointing into the payload instead of copied
+#define DESERIALIZER_FLAG_ZERO_COPY 1
+
 typedef struct
 {
     int fd;
+    int flags;
+    // When set, messages and programs are carved out of it instead of malloc
+    alloc_arena_t *arena;
+
+    // A message in progress for deserializer_feed, kept between calls
+    char header[SERIALIZER_V2_HEADER_SIZE];
+    size_t header_have;
+    size_t header_need;
+    char *message;
+    size_t message_size;
+    size_t message_have;
 } deserializer_t;
 
 #define SERIALIZER_ERR_INVALID_ARGUMENT -1
@@ -24,10 +128,136 @@ typedef struct
 int serializer_init(serializer_t *serializer, int fd);
 int serializer_serialize(serializer_t *serializer, program_t *program);
 
+#define SERIALIZER_ERR_BUFFER_TOO_SMALL -5
+#define SERIALIZER_ERR_UNSUPPORTED_VERSION -6
+
+/**
+ * Pick the format of the following messages, serializer_init selects version 1.
+ */
+int serializer_set_options(serializer_t *serializer, serializer_options_t *options);
+
+/**
+ * Number of bytes serializer_serialize would write for the program,
+ * so callers can size their buffers exactly once. For compressed
+ * messages this is an upper bound, the exact size is only known
+ * after compressing. A NULL options means version 1.
+ */
+size_t serializer_encoded_size(program_t *program, serializer_options_t *options);
+
+/**
+ * Encode the program into buf without any syscall, and without any
+ * allocation unless the symbol table has to be built or the payload
+ * compressed. On success written holds the number of bytes used, which
+ * is serializer_encoded_size(program, options) for uncompressed messages.
+ */
+int serializer_serialize_to_buffer(program_t *program, serializer_options_t *options, char *buf, size_t cap, size_t *written);
+
+#define SERIALIZER_ERR_PARSE_FAILED -10
+
+/**
+ * Parse the source and encode it in the same pass, without building a
+ * program: the only memory besides the output is a stack with one entry
+ * per open list, whose size is backpatched at its ')'. The bytes are the
+ * same serializer_serialize_to_buffer writes for the parsed program.
+ * Only plain version 1 and 2 messages, options->flags must be 0.
+ */
+int serializer_transcode_to_buffer(char *input, size_t input_len, serializer_options_t *options, char *buf, size_t cap, size_t *written);
+
+// Like serializer_transcode_to_buffer into a buffer it allocates, which the caller frees
+int serializer_transcode(char *input, size_t input_len, serializer_options_t *options, char **out, size_t *written);
+
 int deserializer_init(deserializer_t *deserializer, int fd);
 
+// Release a message that was only partially fed
+int deserializer_free(deserializer_t *deserializer);
+
 #define SERIALIZER_ERR_READ_FAILED -4
+#define SERIALIZER_ERR_MALFORMED_INPUT -7
+
+int deserializer_set_flags(deserializer_t *deserializer, int flags);
+
+/**
+ * Decode the following messages into arena, NULL goes back to malloc.
+ * The message is read straight into the arena and decoded in zero-copy
+ * mode whatever the flags, so a program costs a few bump allocations
+ * and no call to malloc once the arena has grown to fit. Programs stay
+ * valid until the arena is reset; parser_free_program on them only
+ * clears the struct. Reset the arena between messages, never while
+ * deserializer_feed holds a partial one.
+ */
+int deserializer_set_arena(deserializer_t *deserializer, alloc_arena_t *arena);
 
 int deserializer_deserialize(deserializer_t *deserializer, program_t *program);
 
+/**
+ * Decode a whole message, header included, that is already in memory.
+ * Every list and string is copied into its own allocation.
+ */
+int deserializer_deserialize_from_buffer(char *buf, size_t len, program_t *program);
+
+/**
+ * Like deserializer_deserialize_from_buffer, but strings and symbols point
+ * into buf, which must outlive the program, and all form arrays share a
+ * single allocation released by parser_free_program.
+ */
+int deserializer_deserialize_in_place(char *buf, size_t len, program_t *program);
+
+#define SERIALIZER_ERR_NO_INDEX -8
+#define SERIALIZER_ERR_INDEX_OUT_OF_BOUNDS -9
+
+/**
+ * Decode only the form at path from a message written with
+ * SERIALIZER_FLAG_FORM_INDEX, without looking at the rest of the payload.
+ * path[0] picks a top-level form, path[1] an item of it and so on; indexed
+ * lists are jumped into, smaller ones are skipped through. As with
+ * deserializer_deserialize_in_place, strings and symbols point into buf and
+ * program gets a single item, released by parser_free_program.
+ */
+int deserializer_get_form_at(char *buf, size_t len, const size_t *path, size_t depth, program_t *program);
+
+// deserializer_get_form_at for the n-th top-level form
+int deserializer_get_form(char *buf, size_t len, size_t n, program_t *program);
+
+#define SERIALIZER_ERR_DELTA_MISMATCH -11
+
+/**
+ * Encode what changed between two programs as a delta message, into a
+ * buffer the caller frees. Lists are compared by their hashes, so both
+ * programs must have them (the parser and the deserializer set them,
+ * parser_hash_program does it for programs built by hand). Top-level
+ * forms and list items are replaced, inserted or removed in runs, and
+ * lists that only changed inside are patched recursively, so the delta
+ * grows with the edit and not with the program.
+ */
+int serializer_diff(program_t *from, program_t *to, char **out, size_t *written);
+
+/**
+ * Apply a delta from serializer_diff to the program it was computed from,
+ * in place. The whole delta is checked against the program first and
+ * SERIALIZER_ERR_DELTA_MISMATCH leaves it untouched; the program must own
+ * its lists, so zero-copy and arena programs are refused. Inserted strings
+ * and symbols point into delta, which must outlive the program.
+ */
+int serializer_patch(program_t *program, char *delta, size_t len);
+
+// Returned by the incremental API when a message is not complete yet
+#define DESERIALIZER_NEED_MORE 1
+
+/**
+ * Hand the deserializer the next n bytes of the stream, in pieces of any size.
+ * Returns DESERIALIZER_NEED_MORE once every byte was taken and the message is
+ * still incomplete, or 0 when program holds a whole message. In both cases
+ * consumed tells how many bytes were used, anything after them belongs to
+ * the next message.
+ */
+int deserializer_feed(deserializer_t *deserializer, const char *buf, size_t n, size_t *consumed, program_t *program);
+
+/**
+ * Read whatever the (non-blocking) fd has without waiting and decode a
+ * message once it is complete. Returns DESERIALIZER_NEED_MORE when the fd
+ * would block, so it fits an epoll loop with one deserializer per connection.
+ * Never reads past the end of the current message.
+ */
+int deserializer_try_deserialize(deserializer_t *deserializer, program_t *program);
+
 #endif
@@ -0,0 +1,69 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stddef.h>
+
+#include "dynarray.h"
+
+typedef struct
+{
+    // Offset of the path in the list's names until walk_sort sets path
+    size_t name;
+    size_t size;
+    char *path;
+} walk_entry_t;
+
+typedef DYNARRAY(char) walk_chars_t;
+
+/**
+ * The files to process, gathered from paths, directories and manifests.
+ * Every path lives in one names buffer instead of an allocation each;
+ * walk_sort orders the entries by size, largest first, so a scheduler
+ * starts the long files early, and fills paths for the loader.
+ */
+typedef struct
+{
+    DYNARRAY(walk_entry_t) entries;
+    walk_chars_t names;
+
+    // Set by walk_sort, count entries pointing into names
+    char **paths;
+    size_t count;
+} walk_list_t;
+
+// Bytes asked from getdents64 at a time
+#define WALK_DENTS_BUFFER_SIZE (32 * 1024)
+
+#define WALK_ERR_INVALID_ARGUMENT -1
+#define WALK_ERR_MEMORY_ALLOCATION_FAILED -2
+#define WALK_ERR_FAILED_TO_OPEN -3
+#define WALK_ERR_FAILED_TO_STAT -4
+#define WALK_ERR_FAILED_TO_READ_DIRECTORY -5
+#define WALK_ERR_FAILED_TO_READ_MANIFEST -6
+
+int walk_init(walk_list_t *list);
+
+/**
+ * Add a file, or every regular file below a directory whose name ends in
+ * suffix (NULL takes them all). Directories are read with getdents64 and
+ * their files are stat'ed relative to the directory, so a walk costs a
+ * few syscalls per directory plus one per file. Symbolic links to files
+ * are followed, symbolic links to directories are not.
+ */
+int walk_add_path(walk_list_t *list, char *path, char *suffix);
+
+/**
+ * Add every path listed in a manifest, one per line. Empty lines and
+ * lines starting with '#' are skipped; listed directories are walked.
+ */
+int walk_add_manifest(walk_list_t *list, char *manifest, char *suffix);
+
+// walk_add_manifest for arguments starting with '@', walk_add_path otherwise
+int walk_add_argument(walk_list_t *list, char *arg, char *suffix);
+
+// Order the entries by size, largest first, and fill paths and count
+int walk_sort(walk_list_t *list);
+
+int walk_free(walk_list_t *list);
+
+#endif
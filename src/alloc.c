@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "alloc.h"
 
@@ -13,6 +14,9 @@ int alloc_init(alloc_context_t *ctx, size_t size)
     ctx->els = (el_t *)calloc(size, sizeof(el_t));
     if (!ctx->els)
         return ALLOC_ERR_MALLOC_FAILED;
+#else
+    (void)ctx;
+    (void)size;
 #endif
 
     return 0;
@@ -45,6 +49,7 @@ void *alloc_alloc(alloc_context_t *ctx, size_t size)
     ctx->elements++;
     return ptr;
 #else
+    (void)ctx;
     return malloc(size);
 #endif
 }
@@ -67,6 +72,7 @@ void alloc_free(alloc_context_t *ctx, void *ptr)
         }
     }
 #else
+    (void)ctx;
     free(ptr);
 #endif
 }
@@ -86,6 +92,8 @@ int alloc_free_context(alloc_context_t *ctx)
     ctx->els = NULL;
     ctx->elements = 0;
     ctx->cap = 0;
+#else
+    (void)ctx;
 #endif
     return 0;
 }
@@ -101,6 +109,8 @@ int alloc_were_all_allocations_freed(alloc_context_t *ctx)
         if (ctx->els[i].is_free == 0)
             return 0;
     }
+#else
+    (void)ctx;
 #endif
 
     return 1;
@@ -125,8 +135,124 @@ void *alloc_realloc(alloc_context_t *ctx, void *ptr, size_t size)
         }
     }
 #else
+    (void)ctx;
     return realloc(ptr, size);
 #endif
 
     return NULL;
 }
+
+struct alloc_chunk
+{
+    alloc_chunk_t *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+#define ALLOC_ARENA_ALIGN _Alignof(max_align_t)
+
+int alloc_arena_init(alloc_arena_t *arena, size_t chunk_size)
+{
+    if (!arena)
+        return ALLOC_ERR_INVALID_ARG;
+
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ALLOC_ARENA_DEFAULT_CHUNK_SIZE;
+
+    return 0;
+}
+
+void *alloc_arena_alloc(alloc_arena_t *arena, size_t size)
+{
+    if (!arena)
+        return NULL;
+    // Rounding up and adding the chunk header must not wrap around
+    if (size > SIZE_MAX - ALLOC_ARENA_ALIGN - sizeof(alloc_chunk_t))
+        return NULL;
+
+    size = (size + ALLOC_ARENA_ALIGN - 1) & ~(ALLOC_ARENA_ALIGN - 1);
+    if (size == 0)
+        size = ALLOC_ARENA_ALIGN;
+
+    // Move on through the chunks kept by a reset before making a new one
+    alloc_chunk_t *chunk = arena->current;
+    while (chunk && chunk->size - chunk->used < size)
+    {
+        chunk = chunk->next;
+        if (chunk)
+            chunk->used = 0;
+    }
+
+    if (!chunk)
+    {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        chunk = malloc(sizeof(alloc_chunk_t) + chunk_size);
+        if (!chunk)
+            return NULL;
+
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = NULL;
+        if (arena->current)
+        {
+            // Chunks skipped for being too small stay after the new one
+            chunk->next = arena->current->next;
+            arena->current->next = chunk;
+        }
+        else
+        {
+            arena->first = chunk;
+        }
+    }
+
+    arena->current = chunk;
+    void *ptr = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+int alloc_arena_reset(alloc_arena_t *arena)
+{
+    if (!arena)
+        return ALLOC_ERR_INVALID_ARG;
+
+    arena->current = arena->first;
+    if (arena->current)
+        arena->current->used = 0;
+
+    return 0;
+}
+
+size_t alloc_arena_used(alloc_arena_t *arena)
+{
+    if (!arena || !arena->current)
+        return 0;
+
+    size_t used = 0;
+    for (alloc_chunk_t *chunk = arena->first; chunk != arena->current; chunk = chunk->next)
+        used += chunk->used;
+
+    return used + arena->current->used;
+}
+
+int alloc_arena_free(alloc_arena_t *arena)
+{
+    if (!arena)
+        return ALLOC_ERR_INVALID_ARG;
+
+    alloc_chunk_t *chunk = arena->first;
+    while (chunk)
+    {
+        alloc_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->first = NULL;
+    arena->current = NULL;
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "hash.h"
+#include "io.h"
+
+#define CACHE_STAMP_MAGIC "CLSC"
+
+/**
+ * What a stamp file holds, in native byte order since a cache
+ * directory never leaves the machine that wrote it.
+ */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash;
+} cache_stamp_t;
+
+static void __cache_entry_path(cache_t *cache, uint64_t hash, char *out)
+{
+    snprintf(out, PATH_MAX, "%s/%016llx" CACHE_ENTRY_SUFFIX, cache->dir, (unsigned long long)hash);
+}
+
+static void __cache_stamp_path(cache_t *cache, char *filepath, char *out)
+{
+    uint64_t key = hash_bytes(filepath, strlen(filepath), CACHE_VERSION);
+    snprintf(out, PATH_MAX, "%s/" CACHE_STAMPS_DIR "/%016llx", cache->dir, (unsigned long long)key);
+}
+
+static void __cache_stamp_fill(cache_stamp_t *stamp, struct stat *st, uint64_t hash)
+{
+    memset(stamp, 0, sizeof(*stamp));
+    memcpy(stamp->magic, CACHE_STAMP_MAGIC, sizeof(stamp->magic));
+    stamp->version = CACHE_VERSION;
+    stamp->dev = st->st_dev;
+    stamp->ino = st->st_ino;
+    stamp->size = st->st_size;
+    stamp->mtime_sec = st->st_mtim.tv_sec;
+    stamp->mtime_nsec = st->st_mtim.tv_nsec;
+    stamp->hash = hash;
+}
+
+// Write the file next to its final name and rename it in, so readers
+// never see half of it
+static int __cache_write_file(char *path, char *data, size_t len)
+{
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return -1;
+
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    if (close(fd) != 0 || done != len || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Whether the stamp of filepath matches st, and if so the content hash
+static int __cache_read_stamp(cache_t *cache, char *filepath, struct stat *st, uint64_t *hash)
+{
+    char path[PATH_MAX];
+    __cache_stamp_path(cache, filepath, path);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    cache_stamp_t stamp;
+    ssize_t n = read(fd, &stamp, sizeof(stamp));
+    close(fd);
+    if (n != (ssize_t)sizeof(stamp))
+        return 0;
+
+    cache_stamp_t expected;
+    __cache_stamp_fill(&expected, st, stamp.hash);
+    if (memcmp(&stamp, &expected, sizeof(stamp)) != 0)
+        return 0;
+
+    *hash = stamp.hash;
+    return 1;
+}
+
+static void __cache_write_stamp(cache_t *cache, char *filepath, struct stat *st, uint64_t hash)
+{
+    // mtime ticks with a coarse clock, so a file written just now could
+    // still change without its stamp noticing; it is hashed next time
+    if (st->st_mtim.tv_sec >= time(NULL) - CACHE_RACY_SECONDS)
+        return;
+
+    char path[PATH_MAX];
+    __cache_stamp_path(cache, filepath, path);
+
+    cache_stamp_t stamp;
+    __cache_stamp_fill(&stamp, st, hash);
+    if (__cache_write_file(path, (char *)&stamp, sizeof(stamp)) != 0)
+        cache->store_failures++;
+}
+
+static int __cache_read_entry(cache_t *cache, uint64_t hash, image_t *image)
+{
+    char path[PATH_MAX];
+    __cache_entry_path(cache, hash, path);
+
+    // A missing or damaged entry is only a miss, parsing again replaces it
+    return image_open(image, path) == 0;
+}
+
+// Write the image aside and map it before renaming it in, so the program
+// is usable even when the entry cannot be stored
+static int __cache_write_entry(cache_t *cache, uint64_t hash, program_t *program, image_t *image)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 8];
+    __cache_entry_path(cache, hash, path);
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return CACHE_ERR_FAILED_TO_STORE;
+    close(fd);
+
+    if (image_write_file(program, tmp) != 0 || image_open(image, tmp) != 0)
+    {
+        unlink(tmp);
+        return CACHE_ERR_FAILED_TO_STORE;
+    }
+
+    if (rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        cache->store_failures++;
+    }
+
+    return 0;
+}
+
+static int __cache_mkdir(char *path)
+{
+    if (mkdir(path, 0755) == 0 || errno == EEXIST)
+        return 0;
+
+    return CACHE_ERR_FAILED_TO_CREATE_DIR;
+}
+
+int cache_init(cache_t *cache, char *dir)
+{
+    if (!cache)
+        return CACHE_ERR_INVALID_ARGUMENT;
+    if (!dir)
+        return CACHE_ERR_INVALID_ARGUMENT;
+
+    cache->dir = dir;
+    cache->stamp_hits = 0;
+    cache->content_hits = 0;
+    cache->misses = 0;
+    cache->store_failures = 0;
+
+    char stamps[PATH_MAX];
+    snprintf(stamps, sizeof(stamps), "%s/" CACHE_STAMPS_DIR, dir);
+
+    int err = __cache_mkdir(dir);
+    return err ? err : __cache_mkdir(stamps);
+}
+
+int cache_open(cache_t *cache, char *filepath, image_t *image)
+{
+    if (!cache)
+        return CACHE_ERR_INVALID_ARGUMENT;
+    if (!filepath)
+        return CACHE_ERR_INVALID_ARGUMENT;
+    if (!image)
+        return CACHE_ERR_INVALID_ARGUMENT;
+
+    struct stat st;
+    if (stat(filepath, &st) != 0)
+        return CACHE_ERR_FAILED_TO_LOAD;
+
+    uint64_t hash;
+    if (__cache_read_stamp(cache, filepath, &st, &hash) && __cache_read_entry(cache, hash, image))
+    {
+        cache->stamp_hits++;
+        return 0;
+    }
+
+    io_str_t source = {0};
+    if (io_map_file(filepath, &source) != 0)
+        return CACHE_ERR_FAILED_TO_LOAD;
+
+    hash = hash_bytes(source.data, source.size, CACHE_VERSION);
+    if (__cache_read_entry(cache, hash, image))
+    {
+        io_free_string(&source);
+        __cache_write_stamp(cache, filepath, &st, hash);
+        cache->content_hits++;
+        return 0;
+    }
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, source.data, source.size);
+    err = err || parser_parse(&parser, &program);
+    if (err)
+    {
+        parser_free_program(&program);
+        io_free_string(&source);
+        return CACHE_ERR_FAILED_TO_PARSE;
+    }
+
+    err = __cache_write_entry(cache, hash, &program, image);
+    parser_free_program(&program);
+    io_free_string(&source);
+    if (err)
+    {
+        cache->store_failures++;
+        return err;
+    }
+
+    __cache_write_stamp(cache, filepath, &st, hash);
+    cache->misses++;
+    return 0;
+}
+
+void cache_print_stats(FILE *out, cache_t *cache)
+{
+    if (!out || !cache)
+        return;
+
+    size_t hits = cache->stamp_hits + cache->content_hits;
+    size_t total = hits + cache->misses;
+    fprintf(out, "Cache: %zu hits (%zu by stamp, %zu by content), %zu misses, %.1f%% hit rate\n",
+            hits, (size_t)cache->stamp_hits, (size_t)cache->content_hits, (size_t)cache->misses,
+            total ? 100.0 * hits / total : 0.0);
+    if (cache->store_failures)
+        fprintf(out, "Cache: %zu entries or stamps could not be written\n", (size_t)cache->store_failures);
+}
@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "frame.h"
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TO_BIG_ENDIAN_32(v) __builtin_bswap32(v)
+#define TO_BIG_ENDIAN_64(v) __builtin_bswap64(v)
+#else
+#define TO_BIG_ENDIAN_32(v) (v)
+#define TO_BIG_ENDIAN_64(v) (v)
+#endif
+
+int frame_writer_init(frame_writer_t *writer, int fd)
+{
+    if (!writer)
+        return FRAME_ERR_INVALID_ARGUMENT;
+    if (fd < 0)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    writer->fd = fd;
+    writer->buffer = NULL;
+    writer->used = 0;
+    writer->capacity = 0;
+
+    return 0;
+}
+
+int frame_writer_free(frame_writer_t *writer)
+{
+    if (!writer)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->used = 0;
+    writer->capacity = 0;
+
+    return 0;
+}
+
+static int __writer_reserve(frame_writer_t *writer, size_t len)
+{
+    if (len <= writer->capacity - writer->used)
+        return 0;
+
+    size_t capacity = writer->capacity ? writer->capacity : FRAME_READ_SIZE;
+    while (capacity - writer->used < len)
+        capacity *= 2;
+
+    char *buffer = realloc(writer->buffer, capacity);
+    if (!buffer)
+        return FRAME_ERR_MEMORY_ALLOCATION_FAILED;
+
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+
+    return 0;
+}
+
+static void __write_header(char *out, uint8_t type, uint32_t request_id, uint64_t payload_size)
+{
+    memcpy(out, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+    out[FRAME_MAGIC_SIZE] = (char)type;
+    memset(out + FRAME_MAGIC_SIZE + 1, 0, 3);
+
+    uint32_t id = TO_BIG_ENDIAN_32(request_id);
+    memcpy(out + 8, &id, sizeof(id));
+    uint64_t size = TO_BIG_ENDIAN_64(payload_size);
+    memcpy(out + 12, &size, sizeof(size));
+}
+
+int frame_writer_queue(frame_writer_t *writer, uint8_t type, uint32_t request_id, const char *payload, size_t len)
+{
+    if (!writer)
+        return FRAME_ERR_INVALID_ARGUMENT;
+    if (!payload && len > 0)
+        return FRAME_ERR_INVALID_ARGUMENT;
+    if (len > FRAME_MAX_PAYLOAD_SIZE)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    int err = __writer_reserve(writer, FRAME_HEADER_SIZE + len);
+    if (err)
+        return err;
+
+    char *out = writer->buffer + writer->used;
+    __write_header(out, type, request_id, len);
+    if (len > 0)
+        memcpy(out + FRAME_HEADER_SIZE, payload, len);
+    writer->used += FRAME_HEADER_SIZE + len;
+
+    return 0;
+}
+
+int frame_writer_queue_program(frame_writer_t *writer, uint32_t request_id, program_t *program, serializer_options_t *options)
+{
+    if (!writer)
+        return FRAME_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    // An upper bound for compressed messages, the header gets the real size
+    size_t bound = serializer_encoded_size(program, options);
+    if (bound == 0 || bound > FRAME_MAX_PAYLOAD_SIZE)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    int err = __writer_reserve(writer, FRAME_HEADER_SIZE + bound);
+    if (err)
+        return err;
+
+    char *out = writer->buffer + writer->used;
+    size_t written = 0;
+    err = serializer_serialize_to_buffer(program, options, out + FRAME_HEADER_SIZE, bound, &written);
+    if (err)
+        return err == SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED ? FRAME_ERR_MEMORY_ALLOCATION_FAILED : FRAME_ERR_INVALID_ARGUMENT;
+
+    __write_header(out, FRAME_TYPE_PROGRAM, request_id, written);
+    writer->used += FRAME_HEADER_SIZE + written;
+
+    return 0;
+}
+
+int frame_writer_queue_error(frame_writer_t *writer, uint32_t request_id, int32_t code)
+{
+    uint32_t be = TO_BIG_ENDIAN_32((uint32_t)code);
+    return frame_writer_queue(writer, FRAME_TYPE_ERROR, request_id, (const char *)&be, sizeof(be));
+}
+
+size_t frame_writer_pending(frame_writer_t *writer)
+{
+    return writer ? writer->used : 0;
+}
+
+int frame_writer_flush(frame_writer_t *writer)
+{
+    if (!writer)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    size_t written = 0;
+    while (written < writer->used)
+    {
+        ssize_t n = write(writer->fd, writer->buffer + written, writer->used - written);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            // Keep what was not written for the next flush
+            memmove(writer->buffer, writer->buffer + written, writer->used - written);
+            writer->used -= written;
+            return FRAME_ERR_WRITE_FAILED;
+        }
+        written += (size_t)n;
+    }
+
+    writer->used = 0;
+
+    return 0;
+}
+
+int frame_reader_init(frame_reader_t *reader, int fd)
+{
+    if (!reader)
+        return FRAME_ERR_INVALID_ARGUMENT;
+    if (fd < 0)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    reader->fd = fd;
+    reader->buffer = malloc(FRAME_READ_SIZE);
+    if (!reader->buffer)
+        return FRAME_ERR_MEMORY_ALLOCATION_FAILED;
+    reader->start = 0;
+    reader->end = 0;
+    reader->capacity = FRAME_READ_SIZE;
+
+    return 0;
+}
+
+int frame_reader_free(frame_reader_t *reader)
+{
+    if (!reader)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    free(reader->buffer);
+    reader->buffer = NULL;
+    reader->start = 0;
+    reader->end = 0;
+    reader->capacity = 0;
+
+    return 0;
+}
+
+/**
+ * Parse the header at the start of the buffered bytes. Returns
+ * FRAME_NEED_MORE until the header is complete, and sets size to the
+ * whole frame once it is.
+ */
+static int __reader_peek(frame_reader_t *reader, size_t *size)
+{
+    size_t have = reader->end - reader->start;
+    if (have < FRAME_HEADER_SIZE)
+        return FRAME_NEED_MORE;
+
+    const char *header = reader->buffer + reader->start;
+    if (memcmp(header, FRAME_MAGIC, FRAME_MAGIC_SIZE) != 0)
+        return FRAME_ERR_MALFORMED_INPUT;
+
+    uint64_t payload_size;
+    memcpy(&payload_size, header + 12, sizeof(payload_size));
+    payload_size = TO_BIG_ENDIAN_64(payload_size);
+    if (payload_size > FRAME_MAX_PAYLOAD_SIZE)
+        return FRAME_ERR_MALFORMED_INPUT;
+
+    *size = FRAME_HEADER_SIZE + payload_size;
+    return 0;
+}
+
+int frame_reader_has_frame(frame_reader_t *reader)
+{
+    if (!reader)
+        return 0;
+
+    size_t size;
+    return __reader_peek(reader, &size) == 0 && reader->end - reader->start >= size;
+}
+
+// Make room for at least need bytes from start, moving the frame in
+// progress to the front first and growing only for frames that do not fit
+static int __reader_make_room(frame_reader_t *reader, size_t need)
+{
+    if (reader->start > 0)
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    if (need <= reader->capacity)
+        return 0;
+
+    char *buffer = realloc(reader->buffer, need);
+    if (!buffer)
+        return FRAME_ERR_MEMORY_ALLOCATION_FAILED;
+
+    reader->buffer = buffer;
+    reader->capacity = need;
+
+    return 0;
+}
+
+int frame_reader_next(frame_reader_t *reader, frame_t *frame)
+{
+    if (!reader)
+        return FRAME_ERR_INVALID_ARGUMENT;
+    if (!frame)
+        return FRAME_ERR_INVALID_ARGUMENT;
+
+    while (1)
+    {
+        size_t size = FRAME_HEADER_SIZE;
+        int err = __reader_peek(reader, &size);
+        if (err < 0)
+            return err;
+
+        if (err == 0 && reader->end - reader->start >= size)
+        {
+            const char *header = reader->buffer + reader->start;
+            uint32_t request_id;
+            memcpy(&request_id, header + 8, sizeof(request_id));
+
+            frame->type = (uint8_t)header[FRAME_MAGIC_SIZE];
+            frame->request_id = TO_BIG_ENDIAN_32(request_id);
+            frame->payload = header + FRAME_HEADER_SIZE;
+            frame->payload_size = size - FRAME_HEADER_SIZE;
+            reader->start += size;
+            return 0;
+        }
+
+        // Only move bytes around when the frame does not fit where it is
+        if (reader->start + size > reader->capacity || reader->end == reader->capacity)
+        {
+            err = __reader_make_room(reader, size);
+            if (err)
+                return err;
+        }
+
+        ssize_t n = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end);
+        if (n == 0)
+            return reader->end == reader->start ? FRAME_ERR_CLOSED : FRAME_ERR_MALFORMED_INPUT;
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return FRAME_NEED_MORE;
+            return FRAME_ERR_READ_FAILED;
+        }
+        reader->end += (size_t)n;
+    }
+}
@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+/**
+ * Where the next item array and the next chars go while an image is built.
+ */
+typedef struct
+{
+    char *base;
+    size_t records;
+    size_t strings;
+} image_builder_t;
+
+static void __image_count_form(form_t *form, size_t *nodes, size_t *string_bytes)
+{
+    *nodes += 1;
+    if (form->type == FORM_LIST)
+    {
+        for (size_t i = 0; i < form->list.size; ++i)
+            __image_count_form(&form->list.items[i], nodes, string_bytes);
+        return;
+    }
+
+    if (form->atom.type == ATOM_SYMBOL)
+        *string_bytes += form->atom.sym.len + 1;
+    else if (form->atom.type == ATOM_STRING)
+        *string_bytes += form->atom.str.len + 1;
+}
+
+static void __image_count_program(program_t *program, size_t *nodes, size_t *string_bytes)
+{
+    *nodes = 0;
+    *string_bytes = 0;
+    for (size_t i = 0; i < program->size; ++i)
+        __image_count_form(&program->items[i], nodes, string_bytes);
+}
+
+size_t image_encoded_size(program_t *program)
+{
+    if (!program)
+        return 0;
+
+    size_t nodes, string_bytes;
+    __image_count_program(program, &nodes, &string_bytes);
+
+    // One more record for the root list
+    return sizeof(image_header_t) + (nodes + 1) * sizeof(image_record_t) + string_bytes;
+}
+
+static uint64_t __image_emit_chars(image_builder_t *builder, const char *chars, size_t len)
+{
+    uint64_t offset = builder->strings;
+    memcpy(builder->base + offset, chars, len);
+    builder->base[offset + len] = '\0';
+    builder->strings += len + 1;
+    return offset;
+}
+
+static void __image_emit_list(image_builder_t *builder, image_record_t *record, form_t *items, size_t size, uint64_t hash);
+
+static void __image_emit_form(image_builder_t *builder, image_record_t *record, form_t *form)
+{
+    if (form->type == FORM_LIST)
+    {
+        __image_emit_list(builder, record, form->list.items, form->list.size, form->list.hash);
+        return;
+    }
+
+    atom_t *atom = &form->atom;
+    record->reserved = 0;
+    record->hash = parser_form_hash(form);
+    switch (atom->type)
+    {
+    case ATOM_NUMBER:
+        if (atom->num.type == NUMBER_INTEGER)
+        {
+            record->type = IMAGE_NODE_INTEGER;
+            memcpy(&record->value, &atom->num.integer, sizeof(record->value));
+        }
+        else
+        {
+            record->type = IMAGE_NODE_FLOAT;
+            memcpy(&record->value, &atom->num.float_num, sizeof(record->value));
+        }
+        record->offset = 0;
+        break;
+    case ATOM_SYMBOL:
+        record->type = IMAGE_NODE_SYMBOL;
+        record->value = atom->sym.len;
+        record->offset = __image_emit_chars(builder, atom->sym.chars, atom->sym.len);
+        break;
+    case ATOM_STRING:
+        record->type = IMAGE_NODE_STRING;
+        record->value = atom->str.len;
+        record->offset = __image_emit_chars(builder, atom->str.chars, atom->str.len);
+        break;
+    }
+}
+
+static void __image_emit_list(image_builder_t *builder, image_record_t *record, form_t *items, size_t size, uint64_t hash)
+{
+    uint64_t array = builder->records;
+    builder->records += size * sizeof(image_record_t);
+
+    record->type = IMAGE_NODE_LIST;
+    record->reserved = 0;
+    record->value = size;
+    record->offset = array;
+    record->hash = hash;
+
+    // Item i is placed before the subtree of item i + 1 is laid out,
+    // so every subtree ends up in one contiguous range
+    for (size_t i = 0; i < size; ++i)
+    {
+        image_record_t *item = (image_record_t *)(builder->base + array + i * sizeof(image_record_t));
+        __image_emit_form(builder, item, &items[i]);
+    }
+}
+
+static void __image_build(program_t *program, char *buf, size_t nodes, size_t string_bytes)
+{
+    size_t strings_offset = sizeof(image_header_t) + (nodes + 1) * sizeof(image_record_t);
+
+    image_header_t *header = (image_header_t *)buf;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE);
+    header->version = IMAGE_VERSION;
+    header->byte_order = IMAGE_BYTE_ORDER;
+    header->file_size = strings_offset + string_bytes;
+    header->root = sizeof(image_header_t);
+    header->nodes = nodes;
+    header->strings_offset = strings_offset;
+    header->strings_size = string_bytes;
+
+    image_builder_t builder = {
+        .base = buf,
+        .records = header->root + sizeof(image_record_t),
+        .strings = strings_offset,
+    };
+
+    list_t root = {.items = program->items, .size = program->size};
+    image_record_t *record = (image_record_t *)(buf + header->root);
+    __image_emit_list(&builder, record, program->items, program->size, parser_list_hash(&root));
+}
+
+int image_write_to_buffer(program_t *program, char *buf, size_t cap, size_t *written)
+{
+    if (!program)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!buf)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    // Records are read in place, so they need their natural alignment
+    if ((uintptr_t)buf % sizeof(uint64_t) != 0)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    size_t nodes, string_bytes;
+    __image_count_program(program, &nodes, &string_bytes);
+    size_t size = sizeof(image_header_t) + (nodes + 1) * sizeof(image_record_t) + string_bytes;
+    if (size > cap)
+        return IMAGE_ERR_BUFFER_TOO_SMALL;
+
+    __image_build(program, buf, nodes, string_bytes);
+    if (written)
+        *written = size;
+
+    return 0;
+}
+
+int image_write_file(program_t *program, const char *path)
+{
+    if (!program)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!path)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    size_t nodes, string_bytes;
+    __image_count_program(program, &nodes, &string_bytes);
+    size_t size = sizeof(image_header_t) + (nodes + 1) * sizeof(image_record_t) + string_bytes;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return IMAGE_ERR_FAILED_TO_OPEN_FILE;
+
+    if (ftruncate(fd, size) == -1)
+    {
+        close(fd);
+        return IMAGE_ERR_FAILED_TO_WRITE_FILE;
+    }
+
+    char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buf == MAP_FAILED)
+    {
+        close(fd);
+        return IMAGE_ERR_FAILED_TO_MAP_FILE;
+    }
+
+    __image_build(program, buf, nodes, string_bytes);
+
+    int err = munmap(buf, size);
+    err = close(fd) || err;
+    if (err)
+        return IMAGE_ERR_FAILED_TO_WRITE_FILE;
+
+    return 0;
+}
+
+int image_open_buffer(image_t *image, const char *buf, size_t size)
+{
+    if (!image)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!buf)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if ((uintptr_t)buf % sizeof(uint64_t) != 0)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (size < sizeof(image_header_t))
+        return IMAGE_ERR_MALFORMED_INPUT;
+
+    const image_header_t *header = (const image_header_t *)buf;
+    if (memcmp(header->magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) != 0)
+        return IMAGE_ERR_BAD_MAGIC;
+    if (header->byte_order != IMAGE_BYTE_ORDER)
+        return IMAGE_ERR_BYTE_ORDER;
+    if (header->version != IMAGE_VERSION)
+        return IMAGE_ERR_UNSUPPORTED_VERSION;
+
+    if (header->file_size != size)
+        return IMAGE_ERR_MALFORMED_INPUT;
+    if (header->strings_offset > size || header->strings_size != size - header->strings_offset)
+        return IMAGE_ERR_MALFORMED_INPUT;
+    if (header->root != sizeof(image_header_t) ||
+        header->root + sizeof(image_record_t) > header->strings_offset)
+        return IMAGE_ERR_MALFORMED_INPUT;
+
+    image->base = buf;
+    image->size = size;
+    image->header = header;
+    image->mapped = 0;
+
+    return 0;
+}
+
+int image_open(image_t *image, const char *path)
+{
+    if (!image)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!path)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return IMAGE_ERR_FAILED_TO_OPEN_FILE;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return IMAGE_ERR_FAILED_TO_OPEN_FILE;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(image_header_t))
+    {
+        close(fd);
+        return IMAGE_ERR_MALFORMED_INPUT;
+    }
+
+    char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (buf == MAP_FAILED)
+        return IMAGE_ERR_FAILED_TO_MAP_FILE;
+
+    // Walks jump around the file, readahead would mostly page in
+    // records that are never visited
+    madvise(buf, size, MADV_RANDOM);
+
+    int err = image_open_buffer(image, buf, size);
+    if (err)
+    {
+        munmap(buf, size);
+        return err;
+    }
+    image->mapped = 1;
+
+    return 0;
+}
+
+int image_close(image_t *image)
+{
+    if (!image)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    if (image->mapped && image->base)
+        munmap((void *)image->base, image->size);
+
+    image->base = NULL;
+    image->size = 0;
+    image->header = NULL;
+    image->mapped = 0;
+
+    return 0;
+}
+
+static int __image_record(image_t *image, image_node_t node, const image_record_t **record)
+{
+    if (!image || !image->header)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (node % sizeof(uint64_t) != 0 || node < image->header->root ||
+        node > image->header->strings_offset - sizeof(image_record_t))
+        return IMAGE_ERR_MALFORMED_INPUT;
+
+    *record = (const image_record_t *)(image->base + node);
+    return 0;
+}
+
+int image_root(image_t *image, image_node_t *root)
+{
+    if (!image || !image->header)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!root)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    *root = image->header->root;
+    return 0;
+}
+
+int image_node_type(image_t *image, image_node_t node, image_node_type_t *type)
+{
+    if (!type)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+    if (record->type > IMAGE_NODE_STRING)
+        return IMAGE_ERR_MALFORMED_INPUT;
+
+    *type = (image_node_type_t)record->type;
+    return 0;
+}
+
+int image_node_hash(image_t *image, image_node_t node, uint64_t *hash)
+{
+    if (!hash)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+
+    *hash = record->hash;
+    return 0;
+}
+
+int image_list_size(image_t *image, image_node_t node, size_t *size)
+{
+    if (!size)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+    if (record->type != IMAGE_NODE_LIST)
+        return IMAGE_ERR_WRONG_NODE_TYPE;
+
+    *size = record->value;
+    return 0;
+}
+
+int image_list_item(image_t *image, image_node_t node, size_t index, image_node_t *item)
+{
+    if (!item)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+    if (record->type != IMAGE_NODE_LIST)
+        return IMAGE_ERR_WRONG_NODE_TYPE;
+    if (index >= record->value)
+        return IMAGE_ERR_INDEX_OUT_OF_BOUNDS;
+
+    // The item's own record is bounds checked whenever it is accessed
+    *item = record->offset + index * sizeof(image_record_t);
+    return 0;
+}
+
+int image_integer(image_t *image, image_node_t node, int64_t *value)
+{
+    if (!value)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+    if (record->type != IMAGE_NODE_INTEGER)
+        return IMAGE_ERR_WRONG_NODE_TYPE;
+
+    memcpy(value, &record->value, sizeof(*value));
+    return 0;
+}
+
+int image_float(image_t *image, image_node_t node, double *value)
+{
+    if (!value)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+    if (record->type != IMAGE_NODE_FLOAT)
+        return IMAGE_ERR_WRONG_NODE_TYPE;
+
+    memcpy(value, &record->value, sizeof(*value));
+    return 0;
+}
+
+int image_chars(image_t *image, image_node_t node, const char **chars, size_t *len)
+{
+    if (!chars)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!len)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+    if (record->type != IMAGE_NODE_SYMBOL && record->type != IMAGE_NODE_STRING)
+        return IMAGE_ERR_WRONG_NODE_TYPE;
+
+    const image_header_t *header = image->header;
+    if (record->offset < header->strings_offset || record->offset >= image->size ||
+        record->value >= image->size - record->offset)
+        return IMAGE_ERR_MALFORMED_INPUT;
+
+    *chars = image->base + record->offset;
+    *len = record->value;
+    return 0;
+}
+
+static int __image_node_stats(image_t *image, image_node_t node, parser_stats_t *stats, size_t depth)
+{
+    const image_record_t *record;
+    int err = __image_record(image, node, &record);
+    if (err)
+        return err;
+
+    switch (record->type)
+    {
+    case IMAGE_NODE_INTEGER:
+        stats->integers++;
+        return 0;
+    case IMAGE_NODE_FLOAT:
+        stats->floats++;
+        return 0;
+    case IMAGE_NODE_SYMBOL:
+        stats->symbols++;
+        stats->string_bytes += record->value;
+        return 0;
+    case IMAGE_NODE_STRING:
+        stats->strings++;
+        stats->string_bytes += record->value;
+        return 0;
+    case IMAGE_NODE_LIST:
+        break;
+    default:
+        return IMAGE_ERR_MALFORMED_INPUT;
+    }
+
+    // Item arrays are always placed after the record of their list, a
+    // malformed image pointing backwards could otherwise loop forever
+    if (record->value && record->offset <= node)
+        return IMAGE_ERR_MALFORMED_INPUT;
+
+    if (depth > 0)
+    {
+        stats->lists++;
+        if (depth > stats->max_depth)
+            stats->max_depth = depth;
+
+        size_t bucket = 0;
+        while (bucket < PARSER_STATS_FANOUT_BUCKETS - 1 && ((size_t)1 << bucket) <= record->value)
+            bucket++;
+        stats->fanout[bucket]++;
+    }
+
+    for (size_t i = 0; i < record->value; ++i)
+    {
+        err = __image_node_stats(image, record->offset + i * sizeof(image_record_t), stats, depth + 1);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
+int image_program_stats(image_t *image, parser_stats_t *stats)
+{
+    if (!image || !image->header)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+    if (!stats)
+        return IMAGE_ERR_INVALID_ARGUMENT;
+
+    // The root list is the program itself, it is not counted as a form
+    return __image_node_stats(image, image->header->root, stats, 0);
+}
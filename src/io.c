@@ -1,8 +1,180 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "io.h"
 
+/**
+ * The free buffers of one thread, per size class.
+ */
+typedef struct
+{
+    char *buffers[IO_POOL_CLASSES][IO_POOL_LOCAL_SLOTS];
+    size_t counts[IO_POOL_CLASSES];
+} io_pool_cache_t;
+
+/**
+ * Free buffers any thread can take, chained through their first bytes.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    char *heads[IO_POOL_CLASSES];
+    size_t bytes;
+} io_pool_depot_t;
+
+static io_pool_depot_t io_pool_depot = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static _Atomic size_t io_pool_hits, io_pool_misses, io_pool_oversized;
+
+static pthread_once_t io_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t io_pool_key;
+static _Thread_local io_pool_cache_t io_pool_cache;
+static _Thread_local int io_pool_registered;
+
+// The smallest class holding size bytes, -1 when none does
+static int __io_pool_class(size_t size)
+{
+    int bits = IO_POOL_MIN_CLASS;
+    while (bits <= IO_POOL_MAX_CLASS && ((size_t)1 << bits) < size)
+        bits++;
+
+    return bits <= IO_POOL_MAX_CLASS ? bits - IO_POOL_MIN_CLASS : -1;
+}
+
+// Move count buffers of a class from the cache to the depot, freeing
+// the ones that would take it over its budget
+static void __io_pool_give(io_pool_cache_t *cache, int class, size_t count)
+{
+    size_t size = (size_t)1 << (class + IO_POOL_MIN_CLASS);
+
+    pthread_mutex_lock(&io_pool_depot.lock);
+    for (; count > 0; --count)
+    {
+        char *buffer = cache->buffers[class][--cache->counts[class]];
+        if (io_pool_depot.bytes + size > IO_POOL_SHARED_BYTES)
+        {
+            free(buffer);
+            continue;
+        }
+        *(char **)buffer = io_pool_depot.heads[class];
+        io_pool_depot.heads[class] = buffer;
+        io_pool_depot.bytes += size;
+    }
+    pthread_mutex_unlock(&io_pool_depot.lock);
+}
+
+// Refill half of the cache's slots of a class from the depot
+static void __io_pool_take(io_pool_cache_t *cache, int class)
+{
+    size_t size = (size_t)1 << (class + IO_POOL_MIN_CLASS);
+
+    pthread_mutex_lock(&io_pool_depot.lock);
+    while (cache->counts[class] < IO_POOL_LOCAL_SLOTS / 2 && io_pool_depot.heads[class])
+    {
+        char *buffer = io_pool_depot.heads[class];
+        io_pool_depot.heads[class] = *(char **)buffer;
+        io_pool_depot.bytes -= size;
+        cache->buffers[class][cache->counts[class]++] = buffer;
+    }
+    pthread_mutex_unlock(&io_pool_depot.lock);
+}
+
+// Runs when a thread that used the pool exits, its buffers go to the depot
+static void __io_pool_flush(void *arg)
+{
+    io_pool_cache_t *cache = (io_pool_cache_t *)arg;
+    for (int class = 0; class < IO_POOL_CLASSES; ++class)
+    {
+        if (cache->counts[class])
+            __io_pool_give(cache, class, cache->counts[class]);
+    }
+}
+
+static void __io_pool_init(void)
+{
+    pthread_key_create(&io_pool_key, __io_pool_flush);
+}
+
+static io_pool_cache_t *__io_pool_cache(void)
+{
+    if (!io_pool_registered)
+    {
+        pthread_once(&io_pool_once, __io_pool_init);
+        pthread_setspecific(io_pool_key, &io_pool_cache);
+        io_pool_registered = 1;
+    }
+
+    return &io_pool_cache;
+}
+
+int io_alloc_string(io_str_t *string, size_t size)
+{
+    if (!string)
+        return ERR_NO_STRING;
+
+    string->data = NULL;
+    string->size = 0;
+    string->mapped = 0;
+    string->capacity = 0;
+
+    int class = __io_pool_class(size + 1);
+    if (class < 0)
+    {
+        string->data = (char *)malloc(size + 1);
+        if (!string->data)
+            return ERR_OUT_OF_MEMORY;
+        io_pool_oversized++;
+        return 0;
+    }
+
+    io_pool_cache_t *cache = __io_pool_cache();
+    if (cache->counts[class] == 0)
+        __io_pool_take(cache, class);
+
+    size_t capacity = (size_t)1 << (class + IO_POOL_MIN_CLASS);
+    if (cache->counts[class] > 0)
+    {
+        string->data = cache->buffers[class][--cache->counts[class]];
+        io_pool_hits++;
+    }
+    else
+    {
+        string->data = (char *)malloc(capacity);
+        if (!string->data)
+            return ERR_OUT_OF_MEMORY;
+        io_pool_misses++;
+    }
+    string->capacity = capacity;
+
+    return 0;
+}
+
+static void __io_pool_release(char *data, size_t capacity)
+{
+    int class = __io_pool_class(capacity);
+    io_pool_cache_t *cache = __io_pool_cache();
+    if (cache->counts[class] == IO_POOL_LOCAL_SLOTS)
+        __io_pool_give(cache, class, IO_POOL_LOCAL_SLOTS / 2);
+
+    cache->buffers[class][cache->counts[class]++] = data;
+}
+
+int io_pool_stats(io_pool_stats_t *stats)
+{
+    if (!stats)
+        return ERR_NO_STRING;
+
+    stats->hits = io_pool_hits;
+    stats->misses = io_pool_misses;
+    stats->oversized = io_pool_oversized;
+
+    return 0;
+}
+
 int io_load_file_into_memory(char *filepath, io_str_t *string)
 {
     if (!filepath)
@@ -33,8 +205,7 @@ int io_load_file_into_memory(char *filepath, io_str_t *string)
         return ERR_FAILED_TO_SEEK_FILE;
     }
 
-    string->data = (char *)malloc(size + 1);
-    if (!string->data)
+    if (io_alloc_string(string, size) != 0)
     {
         fclose(file);
         return ERR_OUT_OF_MEMORY;
@@ -43,7 +214,7 @@ int io_load_file_into_memory(char *filepath, io_str_t *string)
     ssize_t read = fread(string->data, 1, size, file);
     if (read != size)
     {
-        free(string->data);
+        io_free_string(string);
         fclose(file);
         return ERR_FAILED_TO_READ_FILE;
     }
@@ -55,15 +226,83 @@ int io_load_file_into_memory(char *filepath, io_str_t *string)
     return 0;
 }
 
+int io_map_file(char *filepath, io_str_t *string)
+{
+    if (!filepath)
+        return ERR_NO_FILE;
+    if (!string)
+        return ERR_NO_STRING;
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return ERR_FAILED_TO_OPEN_FILE;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return ERR_FAILED_TO_STAT_FILE;
+    }
+
+    int err = io_map_fd(fd, st.st_size, string);
+    // The mapping keeps its own reference to the file
+    close(fd);
+
+    return err;
+}
+
+int io_map_fd(int fd, size_t size, io_str_t *string)
+{
+    if (fd < 0)
+        return ERR_NO_FILE;
+    if (!string)
+        return ERR_NO_STRING;
+
+    // mmap refuses empty lengths, so empty files share a static empty
+    // string, marked as mapped so it is never freed
+    if (size == 0)
+    {
+        string->data = "";
+        string->size = 0;
+        string->mapped = 1;
+        string->capacity = 0;
+        return 0;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return ERR_FAILED_TO_MAP_FILE;
+
+    // Only hints, a kernel that ignores them still gives the right bytes
+    madvise(data, size, MADV_SEQUENTIAL);
+    madvise(data, size, MADV_WILLNEED);
+
+    string->data = (char *)data;
+    string->size = size;
+    string->mapped = 1;
+    string->capacity = 0;
+
+    return 0;
+}
+
 int io_free_string(io_str_t *string)
 {
     if (!string)
         return ERR_NO_STRING;
 
-    if (string->data)
+    if (string->data && string->mapped)
+    {
+        if (string->size)
+            munmap(string->data, string->size);
+    }
+    else if (string->data && string->capacity)
+        __io_pool_release(string->data, string->capacity);
+    else if (string->data)
         free(string->data);
     string->data = NULL;
     string->size = 0;
+    string->mapped = 0;
+    string->capacity = 0;
 
     return 0;
 }
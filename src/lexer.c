@@ -40,6 +40,13 @@ int lexer_init(lexer_t *lexer, char *input, size_t input_len)
     return 0;
 }
 
+// The character at pos, or '\0' past the end: mapped input has no
+// terminator, so nothing may be read beyond input_len
+static inline char __lexer_peek(lexer_t *lexer)
+{
+    return lexer->pos < lexer->input_len ? lexer->input[lexer->pos] : '\0';
+}
+
 static void __lexer_skip_whitespace(lexer_t *lexer)
 {
     while (lexer->pos < lexer->input_len &&
@@ -71,7 +78,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
 
     lexer_state_t state = LEXER_STATE_START;
     size_t start;
-    char c = lexer->input[lexer->pos];
+    char c = __lexer_peek(lexer);
     int err = 0;
 
     while (1)
@@ -130,7 +137,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
                 start = lexer->pos;
                 state = LEXER_STATE_SIGNED_NUMBER_PLUS;
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             case '-':
@@ -138,7 +145,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
                 start = lexer->pos;
                 state = LEXER_STATE_SIGNED_NUMBER_MINUS;
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             case '=':
@@ -154,7 +161,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
                 start = lexer->pos;
                 state = LEXER_STATE_STRING_LITERAL;
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             default:
@@ -173,7 +180,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
             {
                 state = LEXER_STATE_INTEGER;
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
 
@@ -189,7 +196,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
             {
                 state = LEXER_STATE_INTEGER;
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
 
@@ -214,7 +221,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
             default:
             {
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             };
             }
@@ -226,14 +233,14 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
             if (IS_DIGIT(c))
             {
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             if (c == '.')
             {
                 state = LEXER_STATE_FLOAT;
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             else
@@ -251,7 +258,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
             if (IS_DIGIT(c))
             {
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             else
@@ -268,7 +275,7 @@ int lexer_next_token(lexer_t *lexer, token_t *token)
             if (IS_ALPHANUMERICAL(c))
             {
                 lexer->pos++;
-                c = lexer->input[lexer->pos];
+                c = __lexer_peek(lexer);
                 goto lexer_loop;
             }
             else
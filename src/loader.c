@@ -0,0 +1,680 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+#include "loader.h"
+
+// The loader has produced index, wake up one consumer
+static void __loader_publish(loader_t *loader, size_t index, int err)
+{
+    pthread_mutex_lock(&loader->lock);
+    loader->errors[index] = err;
+    loader->ready[loader->ready_tail++] = index;
+    pthread_cond_signal(&loader->has_ready);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static int __loader_stopping(loader_t *loader)
+{
+    pthread_mutex_lock(&loader->lock);
+    int stopping = loader->stopping;
+    pthread_mutex_unlock(&loader->lock);
+
+    return stopping;
+}
+
+// Files that were never started count as failed, so loader_next still ends
+static void __loader_abandon(loader_t *loader, size_t from)
+{
+    for (size_t i = from; i < loader->count; ++i)
+        __loader_publish(loader, i, ERR_FAILED_TO_OPEN_FILE);
+}
+
+// An empty buffer for size bytes plus a NUL, of exactly that size
+// unless the caller asked for pooled buffers
+static int __loader_alloc(loader_t *loader, io_str_t *string, size_t size)
+{
+    if (loader->flags & LOADER_FLAG_POOL)
+        return io_alloc_string(string, size);
+
+    *string = (io_str_t){0};
+    string->data = (char *)malloc(size + 1);
+
+    return string->data ? 0 : ERR_OUT_OF_MEMORY;
+}
+
+/* pread backend */
+
+static int __load_with_pread(loader_t *loader, char *filepath, io_str_t *string)
+{
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return ERR_FAILED_TO_OPEN_FILE;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return ERR_FAILED_TO_STAT_FILE;
+    }
+
+    if ((loader->flags & LOADER_FLAG_MAP) && st.st_size >= LOADER_MAP_MIN_SIZE)
+    {
+        int err = io_map_fd(fd, st.st_size, string);
+        close(fd);
+        return err;
+    }
+
+    if (__loader_alloc(loader, string, st.st_size) != 0)
+    {
+        close(fd);
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)st.st_size)
+    {
+        ssize_t n = pread(fd, string->data + done, st.st_size - done, done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            io_free_string(string);
+            close(fd);
+            return ERR_FAILED_TO_READ_FILE;
+        }
+        done += n;
+    }
+    close(fd);
+
+    string->data[done] = '\0';
+    string->size = done;
+
+    return 0;
+}
+
+static void *__pread_worker(void *arg)
+{
+    loader_t *loader = (loader_t *)arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&loader->lock);
+        if (loader->next == loader->count || loader->stopping)
+        {
+            pthread_mutex_unlock(&loader->lock);
+            break;
+        }
+        size_t index = loader->next++;
+        pthread_mutex_unlock(&loader->lock);
+
+        int err = __load_with_pread(loader, loader->filepaths[index], &loader->strings[index]);
+        __loader_publish(loader, index, err);
+    }
+
+    return NULL;
+}
+
+/* io_uring backend, talking to the kernel directly */
+
+typedef struct
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned sq_entries;
+
+    // SQEs filled but not handed to the kernel yet
+    unsigned queued;
+    // Closes submitted and not completed yet
+    unsigned closing;
+} uring_t;
+
+static int __uring_setup(uring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        return -1;
+
+    ring->fd = fd;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = 0;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    ring->cq_ring = ring->sq_ring;
+    if (ring->cq_ring_size)
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        if (ring->cq_ring_size)
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(fd);
+        return -1;
+    }
+
+    char *sq = (char *)ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void __uring_teardown(uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_size)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Whether the kernel knows every operation the loader needs
+static int __uring_supported(uring_t *ring)
+{
+    static const int ops[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    if (!probe)
+        return 0;
+
+    int supported = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); ++i)
+    {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+            supported = 0;
+    }
+
+    free(probe);
+    return supported;
+}
+
+static int __uring_enter(uring_t *ring, unsigned min_complete)
+{
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    while (1)
+    {
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->queued, min_complete, flags, NULL, 0);
+        if (ret >= 0)
+        {
+            ring->queued -= ret;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+    }
+}
+
+// Next free SQE, submitting what is queued when the ring is full
+static struct io_uring_sqe *__uring_get_sqe(uring_t *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        if (__uring_enter(ring, 0) != 0)
+            return NULL;
+    }
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    return sqe;
+}
+
+// What a completion was for, kept in the low bits of user_data
+#define URING_OP_OPEN 0
+#define URING_OP_STAT 1
+#define URING_OP_READ 2
+#define URING_OP_CLOSE 3
+#define URING_OP_BITS 2
+
+// A single read is capped, larger files take several
+#define URING_MAX_READ (1u << 30)
+
+/**
+ * A file in flight. openat and statx both go by path, so they are
+ * submitted together; the read is submitted once both are back and the
+ * buffer can be sized, and the close is fire-and-forget.
+ */
+typedef struct
+{
+    size_t index;
+    int fd;
+    int err;
+    int pending;
+    size_t done;
+    struct statx stx;
+} uring_slot_t;
+
+static int __uring_submit_read(uring_t *ring, loader_t *loader, uring_slot_t *slot, size_t id)
+{
+    struct io_uring_sqe *sqe = __uring_get_sqe(ring);
+    if (!sqe)
+        return -1;
+
+    size_t left = slot->stx.stx_size - slot->done;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (unsigned long)(loader->strings[slot->index].data + slot->done);
+    sqe->len = left > URING_MAX_READ ? URING_MAX_READ : (unsigned)left;
+    sqe->off = slot->done;
+    sqe->user_data = (id << URING_OP_BITS) | URING_OP_READ;
+    slot->pending = 1;
+
+    return 0;
+}
+
+static int __uring_start(uring_t *ring, loader_t *loader, uring_slot_t *slot, size_t id, size_t index)
+{
+    slot->index = index;
+    slot->fd = -1;
+    slot->err = 0;
+    slot->done = 0;
+    slot->pending = 2;
+
+    struct io_uring_sqe *open_sqe = __uring_get_sqe(ring);
+    if (!open_sqe)
+        return -1;
+    open_sqe->opcode = IORING_OP_OPENAT;
+    open_sqe->fd = AT_FDCWD;
+    open_sqe->addr = (unsigned long)loader->filepaths[index];
+    open_sqe->open_flags = O_RDONLY;
+    open_sqe->user_data = (id << URING_OP_BITS) | URING_OP_OPEN;
+
+    struct io_uring_sqe *stat_sqe = __uring_get_sqe(ring);
+    if (!stat_sqe)
+        return -1;
+    stat_sqe->opcode = IORING_OP_STATX;
+    stat_sqe->fd = AT_FDCWD;
+    stat_sqe->addr = (unsigned long)loader->filepaths[index];
+    stat_sqe->len = STATX_SIZE;
+    stat_sqe->off = (unsigned long)&slot->stx;
+    stat_sqe->user_data = (id << URING_OP_BITS) | URING_OP_STAT;
+
+    return 0;
+}
+
+// The file of the slot is done either way: close it and hand it out
+static int __uring_finish(uring_t *ring, loader_t *loader, uring_slot_t *slot)
+{
+    io_str_t *string = &loader->strings[slot->index];
+    if (slot->err && string->data)
+        io_free_string(string);
+    else if (!slot->err && !string->mapped)
+    {
+        string->data[slot->done] = '\0';
+        string->size = slot->done;
+    }
+
+    if (slot->fd >= 0)
+    {
+        struct io_uring_sqe *sqe = __uring_get_sqe(ring);
+        if (!sqe)
+            return -1;
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot->fd;
+        sqe->user_data = URING_OP_CLOSE;
+        ring->closing++;
+    }
+
+    __loader_publish(loader, slot->index, slot->err);
+    slot->pending = 0;
+
+    return 0;
+}
+
+// openat and statx are back, map the file or size the buffer and start reading
+static int __uring_opened(uring_t *ring, loader_t *loader, uring_slot_t *slot, size_t id)
+{
+    if (slot->err)
+        return __uring_finish(ring, loader, slot);
+
+    io_str_t *string = &loader->strings[slot->index];
+    if ((loader->flags & LOADER_FLAG_MAP) && slot->stx.stx_size >= LOADER_MAP_MIN_SIZE)
+    {
+        slot->err = io_map_fd(slot->fd, slot->stx.stx_size, string);
+        return __uring_finish(ring, loader, slot);
+    }
+
+    if (__loader_alloc(loader, string, slot->stx.stx_size) != 0)
+    {
+        slot->err = ERR_OUT_OF_MEMORY;
+        return __uring_finish(ring, loader, slot);
+    }
+
+    if (slot->stx.stx_size == 0)
+        return __uring_finish(ring, loader, slot);
+
+    return __uring_submit_read(ring, loader, slot, id);
+}
+
+static int __uring_complete(uring_t *ring, loader_t *loader, uring_slot_t *slots, struct io_uring_cqe *cqe)
+{
+    int op = cqe->user_data & ((1 << URING_OP_BITS) - 1);
+    if (op == URING_OP_CLOSE)
+    {
+        ring->closing--;
+        return 0;
+    }
+
+    size_t id = cqe->user_data >> URING_OP_BITS;
+    uring_slot_t *slot = &slots[id];
+
+    switch (op)
+    {
+    case URING_OP_OPEN:
+        if (cqe->res < 0 && !slot->err)
+            slot->err = ERR_FAILED_TO_OPEN_FILE;
+        else if (cqe->res >= 0)
+            slot->fd = cqe->res;
+        break;
+    case URING_OP_STAT:
+        if (cqe->res < 0 && !slot->err)
+            slot->err = ERR_FAILED_TO_STAT_FILE;
+        break;
+    case URING_OP_READ:
+        // A file that shrank under us reads short, like fread would
+        if (cqe->res <= 0)
+        {
+            slot->err = ERR_FAILED_TO_READ_FILE;
+            return __uring_finish(ring, loader, slot);
+        }
+        slot->done += cqe->res;
+        if (slot->done < slot->stx.stx_size)
+            return __uring_submit_read(ring, loader, slot, id);
+        return __uring_finish(ring, loader, slot);
+    }
+
+    if (--slot->pending == 0)
+        return __uring_opened(ring, loader, slot, id);
+
+    return 0;
+}
+
+typedef struct
+{
+    loader_t *loader;
+    uring_t ring;
+} uring_job_t;
+
+static void *__uring_worker(void *arg)
+{
+    uring_job_t *job = (uring_job_t *)arg;
+    loader_t *loader = job->loader;
+    uring_t *ring = &job->ring;
+
+    uring_slot_t *slots = (uring_slot_t *)calloc(LOADER_QUEUE_DEPTH, sizeof(uring_slot_t));
+    size_t *free_slots = (size_t *)malloc(LOADER_QUEUE_DEPTH * sizeof(size_t));
+    size_t free_count = 0;
+    size_t started = 0;
+    if (!slots || !free_slots)
+        goto done;
+
+    for (size_t i = 0; i < LOADER_QUEUE_DEPTH; ++i)
+        free_slots[free_count++] = LOADER_QUEUE_DEPTH - 1 - i;
+
+    // Every pass tops the ring up with new files, then waits for at least
+    // one completion and handles all that are there
+    while (1)
+    {
+        int stopping = __loader_stopping(loader);
+        while (!stopping && free_count && started < loader->count)
+        {
+            size_t id = free_slots[--free_count];
+            if (__uring_start(ring, loader, &slots[id], id, started++) != 0)
+                goto done;
+        }
+
+        size_t busy = LOADER_QUEUE_DEPTH - free_count;
+        if (busy == 0 && ring->closing == 0 && (started == loader->count || stopping))
+            break;
+
+        if (__uring_enter(ring, 1) != 0)
+            goto done;
+
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+
+            if (__uring_complete(ring, loader, slots, &cqe) != 0)
+                goto done;
+
+            size_t id = cqe.user_data >> URING_OP_BITS;
+            int op = cqe.user_data & ((1 << URING_OP_BITS) - 1);
+            if (op != URING_OP_CLOSE && slots[id].pending == 0)
+                free_slots[free_count++] = id;
+        }
+    }
+
+done:
+    // Only reached early when the ring itself broke: report what is left
+    for (size_t i = 0; slots && i < LOADER_QUEUE_DEPTH; ++i)
+    {
+        if (slots[i].pending)
+        {
+            slots[i].err = ERR_FAILED_TO_READ_FILE;
+            if (slots[i].fd >= 0)
+                close(slots[i].fd);
+            slots[i].fd = -1;
+            __uring_finish(ring, loader, &slots[i]);
+        }
+    }
+    __loader_abandon(loader, started);
+
+    free(slots);
+    free(free_slots);
+    __uring_teardown(ring);
+    free(job);
+
+    return NULL;
+}
+
+static int __loader_start_uring(loader_t *loader)
+{
+    uring_job_t *job = (uring_job_t *)malloc(sizeof(uring_job_t));
+    if (!job)
+        return LOADER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    job->loader = loader;
+    if (__uring_setup(&job->ring, 2 * LOADER_QUEUE_DEPTH) != 0)
+    {
+        free(job);
+        return -1;
+    }
+
+    if (!__uring_supported(&job->ring))
+    {
+        __uring_teardown(&job->ring);
+        free(job);
+        return -1;
+    }
+
+    if (pthread_create(&loader->threads[0], NULL, __uring_worker, job) != 0)
+    {
+        __uring_teardown(&job->ring);
+        free(job);
+        return LOADER_ERR_THREAD_FAILED;
+    }
+    loader->thread_count = 1;
+    loader->backend = LOADER_BACKEND_URING;
+
+    return 0;
+}
+
+int loader_init(loader_t *loader, char **filepaths, size_t count, io_str_t *strings, int flags)
+{
+    if (!loader)
+        return LOADER_ERR_INVALID_ARGUMENT;
+    if (!filepaths && count)
+        return LOADER_ERR_INVALID_ARGUMENT;
+    if (!strings && count)
+        return LOADER_ERR_INVALID_ARGUMENT;
+
+    loader->filepaths = filepaths;
+    loader->count = count;
+    loader->strings = strings;
+    loader->flags = flags;
+    loader->thread_count = 0;
+    loader->next = 0;
+    loader->ready_head = 0;
+    loader->ready_tail = 0;
+    loader->stopping = 0;
+
+    for (size_t i = 0; i < count; ++i)
+        strings[i] = (io_str_t){0};
+
+    loader->errors = (int *)malloc((count ? count : 1) * sizeof(int));
+    loader->ready = (size_t *)malloc((count ? count : 1) * sizeof(size_t));
+    if (!loader->errors || !loader->ready)
+    {
+        free(loader->errors);
+        free(loader->ready);
+        return LOADER_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->has_ready, NULL);
+
+    if (count == 0)
+        return 0;
+
+    if (!(flags & LOADER_FLAG_NO_URING))
+    {
+        int err = __loader_start_uring(loader);
+        if (err == 0)
+            return 0;
+        if (err != -1)
+        {
+            loader_destroy(loader);
+            return err;
+        }
+    }
+
+    // No io_uring here, fall back to the thread pool
+    loader->backend = LOADER_BACKEND_PREAD;
+    size_t thread_count = count < LOADER_PREAD_THREADS ? count : LOADER_PREAD_THREADS;
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        if (pthread_create(&loader->threads[i], NULL, __pread_worker, loader) != 0)
+        {
+            loader_destroy(loader);
+            return LOADER_ERR_THREAD_FAILED;
+        }
+        loader->thread_count++;
+    }
+
+    return 0;
+}
+
+int loader_next(loader_t *loader, size_t *index)
+{
+    if (!loader)
+        return LOADER_ERR_INVALID_ARGUMENT;
+    if (!index)
+        return LOADER_ERR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&loader->lock);
+    while (loader->ready_head == loader->ready_tail && loader->ready_head < loader->count)
+        pthread_cond_wait(&loader->has_ready, &loader->lock);
+
+    if (loader->ready_head == loader->count)
+    {
+        // Wake up the other consumers so they see it too
+        pthread_cond_broadcast(&loader->has_ready);
+        pthread_mutex_unlock(&loader->lock);
+        return LOADER_DONE;
+    }
+
+    *index = loader->ready[loader->ready_head++];
+    int err = loader->errors[*index];
+    pthread_mutex_unlock(&loader->lock);
+
+    return err;
+}
+
+int loader_destroy(loader_t *loader)
+{
+    if (!loader)
+        return LOADER_ERR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&loader->lock);
+    loader->stopping = 1;
+    pthread_mutex_unlock(&loader->lock);
+
+    for (size_t i = 0; i < loader->thread_count; ++i)
+        pthread_join(loader->threads[i], NULL);
+    loader->thread_count = 0;
+
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->has_ready);
+
+    free(loader->errors);
+    free(loader->ready);
+    loader->errors = NULL;
+    loader->ready = NULL;
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_LOG 14
+
+// As in LZ4, the last match starts at least 12 bytes before the end
+// and the last 5 bytes are always literals
+#define LZ_MATCH_FIND_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+// Misses in a row before the search starts skipping ahead faster,
+// so incompressible input does not cost a hash lookup per byte
+#define LZ_SKIP_TRIGGER 6
+
+static inline uint32_t __lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t __lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+static inline uint8_t *__lz_write_length(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+
+    return op;
+}
+
+static uint8_t *__lz_write_sequence(uint8_t *op, const uint8_t *literals, size_t literal_len)
+{
+    uint8_t *token = op++;
+    *token = (uint8_t)((literal_len < 15 ? literal_len : 15) << 4);
+    if (literal_len >= 15)
+        op = __lz_write_length(op, literal_len - 15);
+
+    memcpy(op, literals, literal_len);
+
+    return op + literal_len;
+}
+
+size_t lz_compress_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+int lz_compress(const char *src, size_t len, char *dst, size_t cap, size_t *written)
+{
+    if (!src && len > 0)
+        return LZ_ERR_INVALID_ARGUMENT;
+    if (!dst)
+        return LZ_ERR_INVALID_ARGUMENT;
+    if (!written)
+        return LZ_ERR_INVALID_ARGUMENT;
+    if (cap < lz_compress_bound(len))
+        return LZ_ERR_BUFFER_TOO_SMALL;
+
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *end = base + len;
+    const uint8_t *anchor = base;
+    uint8_t *op = (uint8_t *)dst;
+
+    if (len > LZ_MATCH_FIND_LIMIT)
+    {
+        // Positions relative to base, a stale or empty slot is caught by
+        // comparing the bytes it points at
+        uint32_t table[1 << LZ_HASH_LOG] = {0};
+        const uint8_t *find_limit = end - LZ_MATCH_FIND_LIMIT;
+        const uint8_t *match_limit = end - LZ_LAST_LITERALS;
+        const uint8_t *ip = base + 1;
+        size_t misses = 0;
+
+        while (ip < find_limit)
+        {
+            uint32_t sequence = __lz_read32(ip);
+            uint32_t h = __lz_hash(sequence);
+            const uint8_t *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || __lz_read32(ref) != sequence)
+            {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            // Grow the match backwards over literals that also match
+            while (ip > anchor && ref > base && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            size_t match_len = LZ_MIN_MATCH;
+            while (ip + match_len < match_limit && ip[match_len] == ref[match_len])
+                match_len++;
+
+            uint8_t *token = op;
+            op = __lz_write_sequence(op, anchor, (size_t)(ip - anchor));
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+
+            size_t extra = match_len - LZ_MIN_MATCH;
+            *token |= (uint8_t)(extra < 15 ? extra : 15);
+            if (extra >= 15)
+                op = __lz_write_length(op, extra - 15);
+
+            ip += match_len;
+            anchor = ip;
+        }
+    }
+
+    op = __lz_write_sequence(op, anchor, (size_t)(end - anchor));
+    *written = (size_t)(op - (uint8_t *)dst);
+
+    return 0;
+}
+
+static inline int __lz_read_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t byte;
+    do
+    {
+        if (*ip >= end)
+            return LZ_ERR_MALFORMED_INPUT;
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t len, char *dst, size_t cap, size_t *written)
+{
+    if (!src)
+        return LZ_ERR_INVALID_ARGUMENT;
+    if (!dst && cap > 0)
+        return LZ_ERR_INVALID_ARGUMENT;
+    if (!written)
+        return LZ_ERR_INVALID_ARGUMENT;
+
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + len;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + cap;
+
+    // Every block ends with a sequence of literals only
+    if (len == 0)
+        return LZ_ERR_MALFORMED_INPUT;
+
+    while (1)
+    {
+        if (ip >= iend)
+            return LZ_ERR_MALFORMED_INPUT;
+
+        uint8_t token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && __lz_read_length(&ip, iend, &literal_len))
+            return LZ_ERR_MALFORMED_INPUT;
+
+        if (literal_len > (size_t)(iend - ip))
+            return LZ_ERR_MALFORMED_INPUT;
+        if (literal_len > (size_t)(oend - op))
+            return LZ_ERR_BUFFER_TOO_SMALL;
+
+        memcpy(op, ip, literal_len);
+        op += literal_len;
+        ip += literal_len;
+
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return LZ_ERR_MALFORMED_INPUT;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst))
+            return LZ_ERR_MALFORMED_INPUT;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && __lz_read_length(&ip, iend, &match_len))
+            return LZ_ERR_MALFORMED_INPUT;
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op))
+            return LZ_ERR_BUFFER_TOO_SMALL;
+
+        // A match may overlap the bytes it produces, which repeats them
+        const uint8_t *ref = op - offset;
+        if (offset >= match_len)
+        {
+            memcpy(op, ref, match_len);
+        }
+        else
+        {
+            for (size_t i = 0; i < match_len; ++i)
+                op[i] = ref[i];
+        }
+        op += match_len;
+    }
+
+    *written = (size_t)(op - (uint8_t *)dst);
+
+    return 0;
+}
@@ -4,6 +4,13 @@
 #include <assert.h>
 
 #include "parser.h"
+#include "hash.h"
+
+#define PARSER_HASH_SEED_INTEGER 0x1ULL
+#define PARSER_HASH_SEED_FLOAT 0x2ULL
+#define PARSER_HASH_SEED_SYMBOL 0x3ULL
+#define PARSER_HASH_SEED_STRING 0x4ULL
+#define PARSER_HASH_SEED_LIST 0x5ULL
 
 int parser_init(parser_t *parser, char *input, size_t input_len)
 {
@@ -16,6 +23,17 @@ int parser_init(parser_t *parser, char *input, size_t input_len)
     if (err)
         return err;
 
+    parser->open_lists.items = NULL;
+    parser->open_lists.size = 0;
+    parser->open_lists.capacity = 0;
+
+    parser->limits.max_depth = PARSER_LIMIT_NONE;
+    parser->limits.max_nodes = PARSER_LIMIT_NONE;
+    parser->limits.max_string_bytes = PARSER_LIMIT_NONE;
+    parser->limits.max_input_size = PARSER_LIMIT_NONE;
+    parser->nodes = 0;
+    parser->string_bytes = 0;
+
     err = lexer_next_token(&parser->lexer, &parser->current_token);
     if (err)
         return err;
@@ -23,8 +41,18 @@ int parser_init(parser_t *parser, char *input, size_t input_len)
     return 0;
 }
 
-int parser_parse_form(parser_t *parser, form_t *form);
-int parser_parse_list(parser_t *parser, list_t *list);
+int parser_set_limits(parser_t *parser, parser_limits_t *limits)
+{
+    if (!parser)
+        return PARSER_ERR_PARSER_NOT_DEFINED;
+    if (!limits)
+        return PARSER_ERR_LIMITS_NOT_DEFINED;
+
+    parser->limits = *limits;
+
+    return 0;
+}
+
 int parser_parse_atom(parser_t *parser, atom_t *atom);
 
 int parser_parse_number(parser_t *parser, number_t *number);
@@ -34,98 +62,139 @@ int parser_parse_float(parser_t *parser, double *val);
 int parser_parse_string(parser_t *parser, string_t *string);
 int parser_parse_symbol(parser_t *parser, symbol_t *symbol);
 
-int parser_parse(parser_t *parser, program_t *program)
+static void __parser_free_open_lists(parser_t *parser)
 {
-    if (!parser)
-        return PARSER_ERR_PARSER_NOT_DEFINED;
-    if (!program)
-        return PARSER_ERR_PROGRAM_NOT_DEFINED;
-
-    int err;
-    while (parser->current_token.type != TOK_EOF)
+    for (size_t i = 0; i < parser->open_lists.size; ++i)
     {
-        form_t form;
-        err = parser_parse_form(parser, &form);
-        if (err)
-            return err;
-
-        DYNARRAY_PUSH(*program, form, form_t);
-
-        err = lexer_next_token(&parser->lexer, &parser->current_token);
-        if (err)
-            return err;
+        form_t form = {.type = FORM_LIST, .list = parser->open_lists.items[i]};
+        parser_free_form(&form);
     }
 
-    return 0;
+    DYNARRAY_FREE(parser->open_lists);
 }
 
-int parser_parse_form(parser_t *parser, form_t *form)
+int parser_abort(parser_t *parser)
 {
     if (!parser)
         return PARSER_ERR_PARSER_NOT_DEFINED;
-    if (!form)
-        return PARSER_ERR_FORM_NOT_DEFINED;
-
-    int err;
-    if (parser->current_token.type == TOK_LPAREN)
-    {
-        list_t list;
-        form->type = FORM_LIST;
-        list.items = NULL;
-        list.size = 0;
-        list.capacity = 0;
-        err = parser_parse_list(parser, &list);
-        if (err)
-            return err;
-
-        form->list = list;
-    }
-    else
-    {
-        atom_t atom;
-        form->type = FORM_ATOM;
-        err = parser_parse_atom(parser, &atom);
-        if (err)
-            return err;
-
-        form->atom = atom;
-    }
 
+    __parser_free_open_lists(parser);
     return 0;
 }
 
-int parser_parse_list(parser_t *parser, list_t *list)
+int parser_parse(parser_t *parser, program_t *program)
+{
+    return parser_step(parser, program, PARSER_BUDGET_UNLIMITED);
+}
+
+int parser_step(parser_t *parser, program_t *program, size_t budget_tokens)
 {
     if (!parser)
         return PARSER_ERR_PARSER_NOT_DEFINED;
-    if (!list)
-        return PARSER_ERR_LIST_NOT_DEFINED;
-    if (parser->current_token.type != TOK_LPAREN)
-        return PARSER_ERR_EXPECTED_LPAREN;
-
-    int err = lexer_next_token(&parser->lexer, &parser->current_token);
-    if (err)
-        return err;
+    if (!program)
+        return PARSER_ERR_PROGRAM_NOT_DEFINED;
+    if (parser->lexer.input_len > parser->limits.max_input_size)
+        return PARSER_ERR_MAX_INPUT_SIZE_EXCEEDED;
 
-    while (parser->current_token.type != TOK_RPAREN)
+    int err;
+    while (parser->current_token.type != TOK_EOF || parser->open_lists.size > 0)
     {
-        if (parser->current_token.type == TOK_EOF)
+        if (budget_tokens == 0)
+            return PARSER_AGAIN;
+        if (budget_tokens != PARSER_BUDGET_UNLIMITED)
+            budget_tokens--;
+
+        form_t form;
+        int completed = 1;
+
+        switch (parser->current_token.type)
+        {
+        case TOK_LPAREN:
         {
+            if (parser->open_lists.size >= parser->limits.max_depth)
+            {
+                __parser_free_open_lists(parser);
+                return PARSER_ERR_MAX_DEPTH_EXCEEDED;
+            }
+            if (++parser->nodes > parser->limits.max_nodes)
+            {
+                __parser_free_open_lists(parser);
+                return PARSER_ERR_MAX_NODES_EXCEEDED;
+            }
+
+            list_t list = {0};
+            DYNARRAY_PUSH(parser->open_lists, list, list_t);
+            completed = 0;
+            break;
+        }
+        case TOK_EOF:
+        {
+            __parser_free_open_lists(parser);
             return PARSER_ERR_UNEXPECTED_EOF;
         }
+        default:
+        {
+            if (parser->current_token.type == TOK_RPAREN && parser->open_lists.size > 0)
+            {
+                form.type = FORM_LIST;
+                form.list = parser->open_lists.items[--parser->open_lists.size];
+                // The items were folded in as they were pushed, only the size is left
+                form.list.hash = hash_combine(form.list.hash, PARSER_HASH_SEED_LIST + form.list.size);
+                break;
+            }
+
+            if (++parser->nodes > parser->limits.max_nodes)
+            {
+                __parser_free_open_lists(parser);
+                return PARSER_ERR_MAX_NODES_EXCEEDED;
+            }
+
+            form.type = FORM_ATOM;
+            err = parser_parse_atom(parser, &form.atom);
+            if (err)
+            {
+                __parser_free_open_lists(parser);
+                return err;
+            }
+
+            if (form.atom.type == ATOM_STRING || form.atom.type == ATOM_SYMBOL)
+            {
+                // Symbols and strings share the layout, so either len works
+                parser->string_bytes += form.atom.str.len;
+                if (parser->string_bytes > parser->limits.max_string_bytes)
+                {
+                    __parser_free_open_lists(parser);
+                    return PARSER_ERR_MAX_STRING_BYTES_EXCEEDED;
+                }
+            }
+            break;
+        }
+        }
 
-        form_t form;
-        err = parser_parse_form(parser, &form);
-        if (err)
-            return err;
-
-        DYNARRAY_PUSH(*list, form, form_t);
+        if (completed)
+        {
+            if (parser->open_lists.size > 0)
+            {
+                list_t *parent = &parser->open_lists.items[parser->open_lists.size - 1];
+                parent->hash = hash_combine(parent->hash, parser_form_hash(&form));
+                DYNARRAY_PUSH(*parent, form, form_t);
+            }
+            else
+            {
+                DYNARRAY_PUSH(*program, form, form_t);
+            }
+        }
 
         err = lexer_next_token(&parser->lexer, &parser->current_token);
         if (err)
+        {
+            __parser_free_open_lists(parser);
             return err;
+        }
     }
 
+    DYNARRAY_FREE(parser->open_lists);
+
     return 0;
 }
 
@@ -289,6 +358,30 @@ int parser_free_program(program_t *program)
     if (!program)
         return PARSER_ERR_PROGRAM_NOT_DEFINED;
 
+    if (program->arena)
+    {
+        program->arena = NULL;
+        program->chars = NULL;
+        program->block = NULL;
+        program->items = NULL;
+        program->size = 0;
+        program->capacity = 0;
+        return 0;
+    }
+
+    free(program->chars);
+    program->chars = NULL;
+
+    if (program->block)
+    {
+        free(program->block);
+        program->block = NULL;
+        program->items = NULL;
+        program->size = 0;
+        program->capacity = 0;
+        return 0;
+    }
+
     for (size_t i = 0; i < program->size; ++i)
     {
         form_t *form = &program->items[i];
@@ -328,6 +421,155 @@ int parser_free_form(form_t *form)
     return 0;
 }
 
+uint64_t parser_form_hash(form_t *form)
+{
+    if (form->type == FORM_LIST)
+        return form->list.hash;
+
+    atom_t *atom = &form->atom;
+    switch (atom->type)
+    {
+    case ATOM_NUMBER:
+    {
+        if (atom->num.type == NUMBER_INTEGER)
+            return hash_mix((uint64_t)atom->num.integer ^ hash_mix(PARSER_HASH_SEED_INTEGER));
+
+        // 0.0 and -0.0 compare equal, so they must hash the same
+        double value = atom->num.float_num == 0.0 ? 0.0 : atom->num.float_num;
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return hash_mix(bits ^ hash_mix(PARSER_HASH_SEED_FLOAT));
+    }
+    case ATOM_SYMBOL:
+        return hash_bytes(atom->sym.chars, atom->sym.len, PARSER_HASH_SEED_SYMBOL);
+    case ATOM_STRING:
+        return hash_bytes(atom->str.chars, atom->str.len, PARSER_HASH_SEED_STRING);
+    }
+
+    return 0;
+}
+
+uint64_t parser_list_hash(list_t *list)
+{
+    uint64_t hash = 0;
+    for (size_t i = 0; i < list->size; ++i)
+        hash = hash_combine(hash, parser_form_hash(&list->items[i]));
+
+    return hash_combine(hash, PARSER_HASH_SEED_LIST + list->size);
+}
+
+static void __parser_hash_form(form_t *form)
+{
+    if (form->type != FORM_LIST)
+        return;
+
+    for (size_t i = 0; i < form->list.size; ++i)
+        __parser_hash_form(&form->list.items[i]);
+
+    form->list.hash = parser_list_hash(&form->list);
+}
+
+int parser_hash_program(program_t *program)
+{
+    if (!program)
+        return PARSER_ERR_PROGRAM_NOT_DEFINED;
+
+    for (size_t i = 0; i < program->size; ++i)
+        __parser_hash_form(&program->items[i]);
+
+    return 0;
+}
+
+static void __parser_form_stats(form_t *form, parser_stats_t *stats, size_t depth)
+{
+    if (form->type == FORM_ATOM)
+    {
+        switch (form->atom.type)
+        {
+        case ATOM_NUMBER:
+        {
+            if (form->atom.num.type == NUMBER_INTEGER)
+                stats->integers++;
+            else
+                stats->floats++;
+            break;
+        }
+        case ATOM_SYMBOL:
+        {
+            stats->symbols++;
+            stats->string_bytes += form->atom.sym.len;
+            break;
+        }
+        case ATOM_STRING:
+        {
+            stats->strings++;
+            stats->string_bytes += form->atom.str.len;
+            break;
+        }
+        }
+        return;
+    }
+
+    list_t *list = &form->list;
+
+    stats->lists++;
+    if (depth > stats->max_depth)
+        stats->max_depth = depth;
+
+    size_t bucket = 0;
+    while (bucket < PARSER_STATS_FANOUT_BUCKETS - 1 && ((size_t)1 << bucket) <= list->size)
+        bucket++;
+    stats->fanout[bucket]++;
+
+    stats->form_array_bytes += list->capacity * sizeof(form_t);
+    stats->wasted_capacity_bytes += (list->capacity - list->size) * sizeof(form_t);
+
+    for (size_t i = 0; i < list->size; ++i)
+        __parser_form_stats(&list->items[i], stats, depth + 1);
+}
+
+int parser_program_stats(program_t *program, parser_stats_t *stats)
+{
+    if (!program)
+        return PARSER_ERR_PROGRAM_NOT_DEFINED;
+    if (!stats)
+        return PARSER_ERR_STATS_NOT_DEFINED;
+
+    stats->form_array_bytes += program->capacity * sizeof(form_t);
+    stats->wasted_capacity_bytes += (program->capacity - program->size) * sizeof(form_t);
+
+    for (size_t i = 0; i < program->size; ++i)
+        __parser_form_stats(&program->items[i], stats, 1);
+
+    return 0;
+}
+
+void parser_print_stats(FILE *out, parser_stats_t *stats)
+{
+    if (!out || !stats)
+        return;
+
+    size_t atoms = stats->integers + stats->floats + stats->symbols + stats->strings;
+
+    fprintf(out, "Forms: %zu (lists: %zu, atoms: %zu)\n", stats->lists + atoms, stats->lists, atoms);
+    fprintf(out, "Atoms: integers: %zu, floats: %zu, symbols: %zu, strings: %zu\n",
+            stats->integers, stats->floats, stats->symbols, stats->strings);
+    fprintf(out, "Max depth: %zu\n", stats->max_depth);
+    fprintf(out, "List fan-out:");
+    for (size_t i = 0; i < PARSER_STATS_FANOUT_BUCKETS; ++i)
+    {
+        if (i == 0)
+            fprintf(out, " [0]: %zu", stats->fanout[i]);
+        else if (i == PARSER_STATS_FANOUT_BUCKETS - 1)
+            fprintf(out, " [%zu+]: %zu", (size_t)1 << (i - 1), stats->fanout[i]);
+        else
+            fprintf(out, " [%zu-%zu]: %zu", (size_t)1 << (i - 1), ((size_t)1 << i) - 1, stats->fanout[i]);
+    }
+    fprintf(out, "\n");
+    fprintf(out, "Form array bytes: %zu (wasted capacity: %zu)\n", stats->form_array_bytes, stats->wasted_capacity_bytes);
+    fprintf(out, "String bytes: %zu\n", stats->string_bytes);
+}
+
 #ifdef PARSER_TESTS
 
 int __program_equals(program_t *p1, program_t *p2)
@@ -446,6 +688,10 @@ int __list_equals(list_t *l1, list_t *l2)
     if (l1->size != l2->size)
         return 0;
 
+    // Equal lists always share a hash, so a mismatch settles it without a walk
+    if (l1->hash != l2->hash)
+        return 0;
+
     for (size_t i = 0; i < l1->size; ++i)
     {
         form_t *f1 = &l1->items[i];
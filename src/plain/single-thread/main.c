@@ -1,92 +1,236 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "parser.h"
 #include "dynarray.h"
 #include "io.h"
 #include "benchmark.h"
+#include "reclaim.h"
+#include "loader.h"
+#include "walk.h"
+#include "cache.h"
+
+#define RECLAIM_THREADS 4
 
 typedef struct
 {
     char *filename;
     program_t program;
+    // The file contents, the program points into them
+    io_str_t source;
+    // Set instead of program and source when loaded through a cache
+    image_t image;
 } m_unit_t;
 
 typedef DYNARRAY(m_unit_t) module_t;
 
 int module_parse_files(module_t *mod, char **filenames, size_t count);
+int module_load_cached_files(module_t *mod, char **filenames, size_t count, cache_t *cache);
 
 int main(int argc, char **argv)
 {
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: %s <file1> <file2> ...\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--stats] [--cache <dir>] <file|directory|@manifest> ...\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     printf("[INFO]: Running Single-threaded parser\n");
-    printf("[INFO]: Number of files: %d\n", argc);
-
-    double start_time = benchmark_get_time();
 
     argv++;
     argc--;
 
+    int print_stats = 0;
+    char *cache_dir = NULL;
+    while (argc > 0 && strncmp(argv[0], "--", 2) == 0)
+    {
+        if (strcmp(argv[0], "--stats") == 0)
+        {
+            print_stats = 1;
+        }
+        else if (strcmp(argv[0], "--cache") == 0 && argc > 1)
+        {
+            cache_dir = argv[1];
+            argv++;
+            argc--;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        argv++;
+        argc--;
+    }
+
+    // Unchanged files are loaded from the cache instead of parsed
+    cache_t cache;
+    if (cache_dir && cache_init(&cache, cache_dir) != 0)
+    {
+        fprintf(stderr, "Error creating cache directory %s\n", cache_dir);
+        return EXIT_FAILURE;
+    }
+
+    // Arguments can be files, directories to walk or @manifests; the
+    // files come out largest first so the big ones are started early
+    double walk_start = benchmark_get_time();
+    walk_list_t files;
+    walk_init(&files);
+    for (int i = 0; i < argc; i++)
+    {
+        int err = walk_add_argument(&files, argv[i], ".lisp");
+        if (err != 0)
+        {
+            fprintf(stderr, "Error reading %s: %d\n", argv[i], err);
+            walk_free(&files);
+            return EXIT_FAILURE;
+        }
+    }
+    walk_sort(&files);
+    argv = files.paths;
+    argc = (int)files.count;
+    printf("[INFO]: Walk time: %f seconds\n", benchmark_get_time() - walk_start);
+
+    printf("[INFO]: Number of files: %d\n", argc);
+
+    double start_time = benchmark_get_time();
+
     module_t module = {0};
-    int err = module_parse_files(&module, argv, argc);
+    int err = cache_dir ? module_load_cached_files(&module, argv, argc, &cache)
+                        : module_parse_files(&module, argv, argc);
     if (err != 0)
     {
         fprintf(stderr, "Error parsing files: %d\n", err);
         return err;
     }
 
-    for (size_t i = 0; i < module.size; ++i)
-    {
-        parser_free_program(&module.items[i].program);
-    }
-
     double end_time = benchmark_get_time();
     double duration = end_time - start_time;
 
     fprintf(stderr, "[INFO]: Parsed %zu files successfully.\n", module.size);
     printf("[INFO]: Parsing time: %f seconds\n", duration);
+    if (cache_dir)
+        cache_print_stats(stdout, &cache);
+
+    if (print_stats)
+    {
+        parser_stats_t stats = {0};
+        for (size_t i = 0; i < module.size; ++i)
+        {
+            if (cache_dir)
+                image_program_stats(&module.items[i].image, &stats);
+            else
+                parser_program_stats(&module.items[i].program, &stats);
+        }
+        parser_print_stats(stdout, &stats);
+    }
+
+    // Teardown is handed off to the reclaimer, so it is timed on its own:
+    // the hand-off is what the caller waits for, the drain is the full cost
+    reclaimer_t reclaimer;
+    err = reclaimer_init(&reclaimer, RECLAIM_THREADS);
+    if (err != 0)
+    {
+        fprintf(stderr, "Error starting reclaimer: %d\n", err);
+        return err;
+    }
+
+    double teardown_start = benchmark_get_time();
+    for (size_t i = 0; i < module.size; ++i)
+    {
+        reclaimer_free_program(&reclaimer, &module.items[i].program);
+    }
+    double handoff_end = benchmark_get_time();
+    reclaimer_destroy(&reclaimer);
+    double teardown_end = benchmark_get_time();
+
+    printf("[INFO]: Teardown hand-off time: %f seconds\n", handoff_end - teardown_start);
+    printf("[INFO]: Teardown time: %f seconds\n", teardown_end - teardown_start);
 
+    for (size_t i = 0; i < module.size; ++i)
+    {
+        io_free_string(&module.items[i].source);
+        if (cache_dir)
+            image_close(&module.items[i].image);
+    }
     DYNARRAY_FREE(module);
+    walk_free(&files);
 
     return EXIT_SUCCESS;
 }
 
 int module_parse_files(module_t *mod, char **filenames, size_t count)
 {
+    // Files are read in the background and parsed in the order they come
+    // in; the sources stay until teardown, so large ones are mapped
+    io_str_t *strings = malloc((count ? count : 1) * sizeof(io_str_t));
+    if (!strings)
+        return ERR_OUT_OF_MEMORY;
+
+    loader_t loader;
+    int err = loader_init(&loader, filenames, count, strings, LOADER_FLAG_MAP);
+    if (err != 0)
+    {
+        free(strings);
+        return err;
+    }
+
     parser_t parser = {0};
-    int err = 0;
-    for (size_t i = 0; i < count; ++i)
+    size_t index;
+    while ((err = loader_next(&loader, &index)) != LOADER_DONE)
     {
         m_unit_t unit = {0};
         // Note: the string with the file content must outlive the program
         // since the program contains pointers to the string data.
-        io_str_t string = {0};
-        unit.filename = filenames[i];
-        err = io_load_file_into_memory(filenames[i], &string);
+        io_str_t string = strings[index];
+        strings[index] = (io_str_t){0};
+        unit.filename = filenames[index];
         if (err != 0)
         {
-            fprintf(stderr, "Error loading file %s: %d\n", filenames[i], err);
-            return err;
+            fprintf(stderr, "Error loading file %s: %d\n", filenames[index], err);
+            break;
         }
 
         err = parser_init(&parser, string.data, string.size);
         if (err != 0)
         {
-            fprintf(stderr, "Error initializing parser for file %s: %d\n", filenames[i], err);
+            fprintf(stderr, "Error initializing parser for file %s: %d\n", filenames[index], err);
             io_free_string(&string);
-            return err;
+            break;
         }
         err = parser_parse(&parser, &unit.program);
         if (err != 0)
         {
-            fprintf(stderr, "Error parsing file %s: %d\n", filenames[i], err);
+            fprintf(stderr, "Error parsing file %s: %d\n", filenames[index], err);
             parser_free_program(&unit.program);
             io_free_string(&string);
+            break;
+        }
+
+        unit.source = string;
+        DYNARRAY_PUSH(*mod, unit, m_unit_t);
+    }
+
+    // After an error, release the files that were loaded but not parsed
+    loader_destroy(&loader);
+    for (size_t i = 0; i < count; ++i)
+        io_free_string(&strings[i]);
+    free(strings);
+
+    return err == LOADER_DONE ? 0 : err;
+}
+
+int module_load_cached_files(module_t *mod, char **filenames, size_t count, cache_t *cache)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_unit_t unit = {0};
+        unit.filename = filenames[i];
+        int err = cache_open(cache, filenames[i], &unit.image);
+        if (err != 0)
+        {
+            fprintf(stderr, "Error loading file %s: %d\n", filenames[i], err);
             return err;
         }
 
@@ -1,10 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 
 #include "parser.h"
 #include "io.h"
 #include "benchmark.h"
+#include "reclaim.h"
+#include "loader.h"
+#include "walk.h"
+#include "cache.h"
 
 #define MAX_THREADS 10
 
@@ -12,18 +17,27 @@ typedef struct
 {
     char *filename;
     program_t program;
+    // The file contents, the program points into them
+    io_str_t source;
+    // Set instead of program and source when loaded through a cache
+    image_t image;
 } m_unit_t;
 
 typedef struct
 {
     char **filenames;
     m_unit_t *output;
-    size_t from;
-    size_t to;
+    io_str_t *strings;
+    loader_t *loader;
+
+    // With a cache, threads take files in turn and load them through it
+    cache_t *cache;
+    size_t count;
 } thread_data_t;
 
 pthread_t threads[MAX_THREADS] = {0};
 thread_data_t thread_data[MAX_THREADS] = {0};
+_Atomic size_t next_file = 0;
 
 void *module_parse_files(void *arg);
 
@@ -31,68 +45,121 @@ int main(int argc, char **argv)
 {
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: %s <file1> <file2> ...\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--stats] [--cache <dir>] <file|directory|@manifest> ...\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     argv++;
     argc--;
 
-    double start_time = benchmark_get_time();
+    int print_stats = 0;
+    char *cache_dir = NULL;
+    while (argc > 0 && strncmp(argv[0], "--", 2) == 0)
+    {
+        if (strcmp(argv[0], "--stats") == 0)
+        {
+            print_stats = 1;
+        }
+        else if (strcmp(argv[0], "--cache") == 0 && argc > 1)
+        {
+            cache_dir = argv[1];
+            argv++;
+            argc--;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        argv++;
+        argc--;
+    }
+
+    // Unchanged files are loaded from the cache instead of parsed
+    cache_t cache;
+    if (cache_dir && cache_init(&cache, cache_dir) != 0)
+    {
+        fprintf(stderr, "Error creating cache directory %s\n", cache_dir);
+        return EXIT_FAILURE;
+    }
 
-    size_t modules_per_thread = argc / MAX_THREADS;
-    if (modules_per_thread == 0)
+    // Arguments can be files, directories to walk or @manifests; the
+    // files come out largest first so the big ones are started early
+    double walk_start = benchmark_get_time();
+    walk_list_t files;
+    walk_init(&files);
+    for (int i = 0; i < argc; i++)
     {
-        modules_per_thread = 1;
+        int err = walk_add_argument(&files, argv[i], ".lisp");
+        if (err != 0)
+        {
+            fprintf(stderr, "Error reading %s: %d\n", argv[i], err);
+            walk_free(&files);
+            return EXIT_FAILURE;
+        }
     }
+    walk_sort(&files);
+    argv = files.paths;
+    argc = (int)files.count;
+    printf("[INFO]: Walk time: %f seconds\n", benchmark_get_time() - walk_start);
+
+    double start_time = benchmark_get_time();
 
     printf("[INFO]: Running Multi-threaded parser\n");
     printf("[INFO]: Number of files: %d\n", argc);
     printf("[INFO]: Number of threads: %d\n", MAX_THREADS);
-    printf("[INFO]: Number of modules per thread: %zu\n", modules_per_thread);
 
     m_unit_t *output = malloc(argc * sizeof(m_unit_t));
-    if (output == NULL)
+    io_str_t *strings = malloc(argc * sizeof(io_str_t));
+    if (output == NULL || strings == NULL)
     {
         fprintf(stderr, "Error allocating memory for output\n");
+        free(output);
+        free(strings);
         return EXIT_FAILURE;
     }
 
     // Initialize all programs to zero
     for (int i = 0; i < argc; i++)
     {
+        output[i].filename = argv[i];
         output[i].program = (program_t){0};
+        output[i].source = (io_str_t){0};
+        output[i].image = (image_t){0};
     }
 
-    size_t thread_count = 0;
-    for (int i = 0; i < argc; i += modules_per_thread)
+    // Files are read in the background, and every thread takes the next
+    // one that is in memory, so parsing overlaps with the reads. The
+    // sources stay until teardown, so large ones are mapped, not copied
+    loader_t loader;
+    int err = cache_dir ? 0 : loader_init(&loader, argv, argc, strings, LOADER_FLAG_MAP);
+    if (err != 0)
     {
-        size_t from = i;
-        size_t to = i + modules_per_thread;
-        if (to > (size_t)argc)
-        {
-            to = argc;
-        }
+        fprintf(stderr, "Error starting loader: %d\n", err);
+        free(output);
+        free(strings);
+        return EXIT_FAILURE;
+    }
+    if (!cache_dir)
+        printf("[INFO]: Loader: %s\n", loader.backend == LOADER_BACKEND_URING ? "io_uring" : "pread");
 
+    size_t thread_count = 0;
+    for (; thread_count < MAX_THREADS; thread_count++)
+    {
         thread_data[thread_count] = (thread_data_t){
             .filenames = argv,
-            .from = from,
-            .to = to,
-            .output = output};
+            .output = output,
+            .strings = strings,
+            .loader = cache_dir ? NULL : &loader,
+            .cache = cache_dir ? &cache : NULL,
+            .count = argc};
 
-        int err = pthread_create(&threads[thread_count], NULL, module_parse_files, &thread_data[thread_count]);
+        err = pthread_create(&threads[thread_count], NULL, module_parse_files, &thread_data[thread_count]);
         if (err != 0)
         {
             fprintf(stderr, "Error creating thread: %d\n", err);
-            // Clean up already created threads
-            for (size_t j = 0; j < thread_count; j++)
-            {
-                pthread_join(threads[j], NULL);
-            }
-            free(output);
-            return EXIT_FAILURE;
+            break;
         }
-        thread_count++;
     }
 
     // Wait for all threads to complete
@@ -100,20 +167,66 @@ int main(int argc, char **argv)
     {
         pthread_join(threads[i], NULL);
     }
+    if (!cache_dir)
+        loader_destroy(&loader);
+    free(strings);
+    if (thread_count == 0)
+    {
+        free(output);
+        return EXIT_FAILURE;
+    }
 
     double end_time = benchmark_get_time();
     double duration = end_time - start_time;
 
     fprintf(stderr, "[INFO]: Parsed %d files successfully.\n", argc);
     printf("[INFO]: Parsing time: %f seconds\n", duration);
+    if (cache_dir)
+        cache_print_stats(stdout, &cache);
+
+    if (print_stats)
+    {
+        parser_stats_t stats = {0};
+        for (int i = 0; i < argc; i++)
+        {
+            if (cache_dir)
+                image_program_stats(&output[i].image, &stats);
+            else
+                parser_program_stats(&output[i].program, &stats);
+        }
+        parser_print_stats(stdout, &stats);
+    }
+
+    // Clean up all programs, split across the reclaimer's threads
+    reclaimer_t reclaimer;
+    err = reclaimer_init(&reclaimer, MAX_THREADS);
+    if (err != 0)
+    {
+        fprintf(stderr, "Error starting reclaimer: %d\n", err);
+        free(output);
+        return EXIT_FAILURE;
+    }
 
-    // Clean up all programs
+    double teardown_start = benchmark_get_time();
     for (int i = 0; i < argc; i++)
     {
-        parser_free_program(&output[i].program);
+        reclaimer_free_program(&reclaimer, &output[i].program);
     }
+    double handoff_end = benchmark_get_time();
+    reclaimer_destroy(&reclaimer);
+    double teardown_end = benchmark_get_time();
+
+    printf("[INFO]: Teardown hand-off time: %f seconds\n", handoff_end - teardown_start);
+    printf("[INFO]: Teardown time: %f seconds\n", teardown_end - teardown_start);
 
+    for (int i = 0; i < argc; i++)
+    {
+        io_free_string(&output[i].source);
+        if (cache_dir)
+            image_close(&output[i].image);
+    }
     free(output);
+    walk_free(&files);
     return EXIT_SUCCESS;
 }
 
@@ -121,37 +234,51 @@ void *module_parse_files(void *arg)
 {
     thread_data_t *data = (thread_data_t *)arg;
 
-    for (size_t i = data->from; i < data->to; i++)
+    if (data->cache)
+    {
+        size_t i;
+        while ((i = next_file++) < data->count)
+        {
+            m_unit_t *unit = &data->output[i];
+            if (cache_open(data->cache, unit->filename, &unit->image) != 0)
+                fprintf(stderr, "[ERROR]: Failed to load file %s\n", unit->filename);
+        }
+        return NULL;
+    }
+
+    size_t i;
+    int err;
+    while ((err = loader_next(data->loader, &i)) != LOADER_DONE)
     {
         char *filename = data->filenames[i];
         program_t *program = &data->output[i].program;
-        io_str_t str = {0};
+        io_str_t *str = &data->output[i].source;
 
-        int err = io_load_file_into_memory(filename, &str);
         if (err != 0)
         {
             fprintf(stderr, "[ERROR]: Failed to load file %s\n", filename);
             continue;
         }
+        *str = data->strings[i];
 
         parser_t parser = {0};
-        err = parser_init(&parser, str.data, str.size);
+        err = parser_init(&parser, str->data, str->size);
         if (err != 0)
         {
             fprintf(stderr, "[ERROR]: Failed to initialize parser\n");
-            free(str.data);
+            io_free_string(str);
             continue;
         }
 
+        // The contents stay until teardown, the program points into them
         err = parser_parse(&parser, program);
         if (err != 0)
         {
             fprintf(stderr, "[ERROR]: Failed to parse file %s\n", filename);
-            free(str.data);
+            parser_free_program(program);
+            io_free_string(str);
             continue;
         }
-
-        free(str.data);
     }
 
     return NULL;
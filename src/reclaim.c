@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "reclaim.h"
+
+static void *__reclaimer_worker(void *arg)
+{
+    reclaimer_t *reclaimer = (reclaimer_t *)arg;
+
+    pthread_mutex_lock(&reclaimer->lock);
+    while (1)
+    {
+        while (reclaimer->jobs.size == 0 && !reclaimer->stopping)
+            pthread_cond_wait(&reclaimer->has_work, &reclaimer->lock);
+
+        if (reclaimer->jobs.size == 0)
+            break;
+
+        reclaim_job_t job = reclaimer->jobs.items[--reclaimer->jobs.size];
+        reclaimer->in_flight++;
+        pthread_mutex_unlock(&reclaimer->lock);
+
+        for (size_t i = job.from; i < job.to; ++i)
+            parser_free_form(&job.owner->items[i]);
+
+        pthread_mutex_lock(&reclaimer->lock);
+
+        // The last job of a program also releases its top-level array
+        if (--job.owner->pending == 0)
+        {
+            free(job.owner->items);
+            free(job.owner);
+        }
+
+        reclaimer->in_flight--;
+        if (reclaimer->jobs.size == 0 && reclaimer->in_flight == 0)
+            pthread_cond_broadcast(&reclaimer->is_idle);
+    }
+    pthread_mutex_unlock(&reclaimer->lock);
+
+    return NULL;
+}
+
+int reclaimer_init(reclaimer_t *reclaimer, size_t thread_count)
+{
+    if (!reclaimer)
+        return RECLAIM_ERR_INVALID_ARGUMENT;
+    if (thread_count == 0 || thread_count > RECLAIM_MAX_THREADS)
+        return RECLAIM_ERR_INVALID_ARGUMENT;
+
+    reclaimer->thread_count = 0;
+    reclaimer->in_flight = 0;
+    reclaimer->stopping = 0;
+    reclaimer->jobs.items = NULL;
+    reclaimer->jobs.size = 0;
+    reclaimer->jobs.capacity = 0;
+    reclaimer->jobs_queued = 0;
+
+    pthread_mutex_init(&reclaimer->lock, NULL);
+    pthread_cond_init(&reclaimer->has_work, NULL);
+    pthread_cond_init(&reclaimer->is_idle, NULL);
+
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        if (pthread_create(&reclaimer->threads[i], NULL, __reclaimer_worker, reclaimer) != 0)
+        {
+            reclaimer_destroy(reclaimer);
+            return RECLAIM_ERR_THREAD_FAILED;
+        }
+        reclaimer->thread_count++;
+    }
+
+    return 0;
+}
+
+int reclaimer_free_program(reclaimer_t *reclaimer, program_t *program)
+{
+    if (!reclaimer)
+        return RECLAIM_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return RECLAIM_ERR_INVALID_ARGUMENT;
+
+    // Nothing to walk when there are no forms or they all share one block
+    if (program->size == 0 || program->block || program->arena)
+        return parser_free_program(program);
+
+    // Shared chars are one allocation, not worth a trip to a worker
+    free(program->chars);
+    program->chars = NULL;
+
+    reclaim_owner_t *owner = malloc(sizeof(reclaim_owner_t));
+    if (!owner)
+        return RECLAIM_ERR_MEMORY_ALLOCATION_FAILED;
+
+    size_t chunks = 1;
+    if (program->size >= RECLAIM_SPLIT_THRESHOLD)
+        chunks = reclaimer->thread_count;
+
+    size_t per_chunk = (program->size + chunks - 1) / chunks;
+
+    owner->items = program->items;
+    owner->pending = 0;
+
+    pthread_mutex_lock(&reclaimer->lock);
+    for (size_t from = 0; from < program->size; from += per_chunk)
+    {
+        size_t to = from + per_chunk;
+        if (to > program->size)
+            to = program->size;
+
+        reclaim_job_t job = {.owner = owner, .from = from, .to = to};
+        size_t before = reclaimer->jobs.size;
+        DYNARRAY_PUSH(reclaimer->jobs, job, reclaim_job_t);
+        if (reclaimer->jobs.size == before)
+        {
+            // Whatever was queued will still run, the rest is freed here
+            owner->pending++;
+            pthread_mutex_unlock(&reclaimer->lock);
+
+            for (size_t i = from; i < program->size; ++i)
+                parser_free_form(&program->items[i]);
+
+            pthread_mutex_lock(&reclaimer->lock);
+            if (--owner->pending == 0)
+            {
+                free(owner->items);
+                free(owner);
+            }
+            break;
+        }
+        owner->pending++;
+        reclaimer->jobs_queued++;
+    }
+    pthread_cond_broadcast(&reclaimer->has_work);
+    pthread_mutex_unlock(&reclaimer->lock);
+
+    program->items = NULL;
+    program->size = 0;
+    program->capacity = 0;
+
+    return 0;
+}
+
+int reclaimer_drain(reclaimer_t *reclaimer)
+{
+    if (!reclaimer)
+        return RECLAIM_ERR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&reclaimer->lock);
+    while (reclaimer->jobs.size > 0 || reclaimer->in_flight > 0)
+        pthread_cond_wait(&reclaimer->is_idle, &reclaimer->lock);
+    pthread_mutex_unlock(&reclaimer->lock);
+
+    return 0;
+}
+
+int reclaimer_destroy(reclaimer_t *reclaimer)
+{
+    if (!reclaimer)
+        return RECLAIM_ERR_INVALID_ARGUMENT;
+
+    pthread_mutex_lock(&reclaimer->lock);
+    reclaimer->stopping = 1;
+    pthread_cond_broadcast(&reclaimer->has_work);
+    pthread_mutex_unlock(&reclaimer->lock);
+
+    // Workers only exit once the queue is empty, so nothing is leaked
+    for (size_t i = 0; i < reclaimer->thread_count; ++i)
+        pthread_join(reclaimer->threads[i], NULL);
+    reclaimer->thread_count = 0;
+
+    DYNARRAY_FREE(reclaimer->jobs);
+    pthread_cond_destroy(&reclaimer->is_idle);
+    pthread_cond_destroy(&reclaimer->has_work);
+    pthread_mutex_destroy(&reclaimer->lock);
+
+    return 0;
+}
@@ -5,34 +5,16 @@
 #include <errno.h>
 
 #include "serialize.h"
+#include "hash.h"
+#include "lz.h"
 
-#define BIG_ENDIAN_WRITE(buffer, value, type)                       \
-    do                                                              \
-    {                                                               \
-        union                                                       \
-        {                                                           \
-            type v;                                                 \
-            char c[sizeof(type)];                                   \
-        } u = {.v = value};                                         \
-        for (size_t i = 0; i < sizeof(type); ++i)                   \
-        {                                                           \
-            DYNARRAY_PUSH(buffer, u.c[sizeof(type) - i - 1], char); \
-        }                                                           \
-    } while (0)
-
-#define BIG_ENDIAN_WRITE_AT(buffer, value, type, offset)    \
-    do                                                      \
-    {                                                       \
-        union                                               \
-        {                                                   \
-            type v;                                         \
-            char c[sizeof(type)];                           \
-        } u = {.v = value};                                 \
-        for (size_t i = 0; i < sizeof(type); ++i)           \
-        {                                                   \
-            buffer[offset + i] = u.c[sizeof(type) - i - 1]; \
-        }                                                   \
-    } while (0)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define TO_BIG_ENDIAN_32(v) __builtin_bswap32(v)
+#define TO_BIG_ENDIAN_64(v) __builtin_bswap64(v)
+#else
+#define TO_BIG_ENDIAN_32(v) (v)
+#define TO_BIG_ENDIAN_64(v) (v)
+#endif
 
 #define BIG_ENDIAN_READ(buffer, value, type)       \
     do                                             \
@@ -51,6 +33,8 @@
 
 // TODO: Validate program when deserializing
 
+static serializer_options_t __default_options = {.version = SERIALIZER_VERSION_1, .flags = 0};
+
 int serializer_init(serializer_t *serializer, int fd)
 {
     if (!serializer)
@@ -59,421 +43,3033 @@ int serializer_init(serializer_t *serializer, int fd)
         return SERIALIZER_ERR_INVALID_ARGUMENT;
 
     serializer->fd = fd;
+    serializer->options = __default_options;
 
     return 0;
 }
 
-typedef DYNARRAY(char) dyn_buffer_t;
+static int __check_options(serializer_options_t *options)
+{
+    if (options->version != SERIALIZER_VERSION_1 && options->version != SERIALIZER_VERSION_2)
+        return SERIALIZER_ERR_UNSUPPORTED_VERSION;
+    // Offsets into a compressed payload would still need it all inflated
+    if ((options->flags & SERIALIZER_FLAG_FORM_INDEX) && (options->flags & SERIALIZER_FLAG_COMPRESSED))
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    // Only serializer_diff writes deltas
+    if (options->flags & SERIALIZER_FLAG_DELTA)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
 
-size_t __encode_form(form_t *form, dyn_buffer_t *buffer);
-size_t __encode_atom(atom_t *atom, dyn_buffer_t *buffer);
-size_t __encode_list(list_t *list, dyn_buffer_t *buffer);
-size_t __encode_number(number_t *number, dyn_buffer_t *buffer);
-size_t __encode_string(string_t *string, dyn_buffer_t *buffer);
-size_t __encode_symbol(symbol_t *symbol, dyn_buffer_t *buffer);
+    return 0;
+}
 
-int serializer_serialize(serializer_t *serializer, program_t *program)
+int serializer_set_options(serializer_t *serializer, serializer_options_t *options)
 {
     if (!serializer)
         return SERIALIZER_ERR_INVALID_ARGUMENT;
-    if (!program)
+    if (!options)
         return SERIALIZER_ERR_INVALID_ARGUMENT;
+    int err = __check_options(options);
+    if (err)
+        return err;
 
-    dyn_buffer_t dbuffer = {0};
-    for (size_t i = 0; i < sizeof(size_t); ++i)
-        DYNARRAY_PUSH(dbuffer, 0, char);
-
-    // First thing we are going to encode is the size
-    size_t numbytes = sizeof(program->size);
+    serializer->options = *options;
 
-    // Write the program size
-    BIG_ENDIAN_WRITE(dbuffer, program->size, size_t);
+    return 0;
+}
 
-    // Write all the forms
-    for (size_t i = 0; i < program->size; ++i)
+/**
+ * Where encoded bytes go: a buffer that is either flushed to fd when it
+ * fills up, or, with no fd, is all the room there is.
+ *
+ * With an iov array the writer gathers instead: bodies of at least
+ * gather_threshold bytes are queued by reference, and buffer[pending..used)
+ * is the run of copied bytes that has no iov entry yet.
+ */
+typedef struct
+{
+    int fd;
+    char *buffer;
+    size_t capacity;
+    size_t used;
+
+    struct iovec *iov;
+    size_t iov_count;
+    size_t iov_capacity;
+    size_t pending;
+    size_t gather_threshold;
+
+    // With no fd, realloc the buffer when it fills up instead of failing
+    int growable;
+} writer_t;
+
+static int __write_all(int fd, const char *data, size_t len)
+{
+    size_t written = 0;
+    while (written < len)
     {
-        form_t *form = &program->items[i];
-        size_t form_bytes = __encode_form(form, &dbuffer);
-        numbytes += form_bytes;
+        ssize_t n = write(fd, data + written, len - written);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return SERIALIZER_ERR_WRITE_FAILED;
+        }
+        written += (size_t)n;
     }
 
-    // Now we need to backpatch the size
-    BIG_ENDIAN_WRITE_AT(dbuffer.items, numbytes, size_t, 0);
+    return 0;
+}
 
-    // then write the data
-    ssize_t bytes_written = write(serializer->fd, dbuffer.items, dbuffer.size);
-    if (bytes_written == -1)
+static int __writev_all(int fd, struct iovec *iov, size_t count)
+{
+    while (count > 0)
     {
-        DYNARRAY_FREE(dbuffer);
-        return SERIALIZER_ERR_WRITE_FAILED;
+        ssize_t n = writev(fd, iov, (int)count);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return SERIALIZER_ERR_WRITE_FAILED;
+        }
+
+        // Skip what was written, a partial write can stop mid-entry
+        size_t left = (size_t)n;
+        while (count > 0 && left >= iov->iov_len)
+        {
+            left -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
     }
 
-    if ((size_t)bytes_written != dbuffer.size)
+    return 0;
+}
+
+static void __writer_close_pending(writer_t *writer)
+{
+    if (writer->used == writer->pending)
+        return;
+
+    writer->iov[writer->iov_count].iov_base = writer->buffer + writer->pending;
+    writer->iov[writer->iov_count].iov_len = writer->used - writer->pending;
+    writer->iov_count++;
+    writer->pending = writer->used;
+}
+
+static int __writer_flush(writer_t *writer)
+{
+    if (writer->fd < 0)
+        return SERIALIZER_ERR_BUFFER_TOO_SMALL;
+
+    if (!writer->iov)
     {
-        DYNARRAY_FREE(dbuffer);
-        return SERIALIZER_ERR_WRITE_FAILED;
+        int err = __write_all(writer->fd, writer->buffer, writer->used);
+        if (err)
+            return err;
+
+        writer->used = 0;
+        return 0;
     }
 
-    DYNARRAY_FREE(dbuffer);
+    // Room for this entry is always kept free by __writer_write_body
+    __writer_close_pending(writer);
+    int err = __writev_all(writer->fd, writer->iov, writer->iov_count);
+    if (err)
+        return err;
+
+    writer->used = 0;
+    writer->pending = 0;
+    writer->iov_count = 0;
 
     return 0;
 }
 
-size_t __encode_form(form_t *form, dyn_buffer_t *buffer)
+static int __writer_grow(writer_t *writer, size_t len)
 {
-    size_t numbytes = 0;
+    size_t capacity = writer->capacity ? writer->capacity * 2 : SERIALIZER_BUFFER_SIZE;
+    if (capacity < writer->used + len)
+        capacity = writer->used + len;
 
-    numbytes += sizeof(form->type);
-    BIG_ENDIAN_WRITE(*buffer, form->type, form_type_t);
+    char *buffer = realloc(writer->buffer, capacity);
+    if (!buffer)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
 
-    switch (form->type)
-    {
-    case FORM_ATOM:
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+
+    return 0;
+}
+
+static int __writer_write(writer_t *writer, const void *data, size_t len)
+{
+    if (writer->used + len > writer->capacity && writer->growable)
     {
-        atom_t *atom = &form->atom;
-        numbytes += __encode_atom(atom, buffer);
-        break;
+        int err = __writer_grow(writer, len);
+        if (err)
+            return err;
     }
-    case FORM_LIST:
+
+    if (writer->used + len > writer->capacity)
     {
-        list_t *list = &form->list;
-        numbytes += __encode_list(list, buffer);
-        break;
+        int err = __writer_flush(writer);
+        if (err)
+            return err;
+
+        // Too big to ever fit, hand it to the kernel straight from the source
+        if (len > writer->capacity)
+            return __write_all(writer->fd, data, len);
     }
+
+    memcpy(writer->buffer + writer->used, data, len);
+    writer->used += len;
+
+    return 0;
+}
+
+/**
+ * Write the body of a string or symbol, which in gather mode is queued
+ * by reference when it is large enough instead of being copied.
+ */
+static int __writer_write_body(writer_t *writer, const char *data, size_t len)
+{
+    if (!writer->iov || len < writer->gather_threshold)
+        return __writer_write(writer, data, len);
+
+    // One entry for the copied bytes before the body, one for the body,
+    // and one more so __writer_flush can always close the pending run
+    if (writer->iov_count + 3 > writer->iov_capacity)
+    {
+        int err = __writer_flush(writer);
+        if (err)
+            return err;
     }
 
-    return numbytes;
+    __writer_close_pending(writer);
+    writer->iov[writer->iov_count].iov_base = (void *)data;
+    writer->iov[writer->iov_count].iov_len = len;
+    writer->iov_count++;
+
+    return 0;
 }
 
-size_t __encode_atom(atom_t *atom, dyn_buffer_t *buffer)
+static inline int __writer_write_u32(writer_t *writer, uint32_t value)
 {
-    size_t numbytes = 0;
+    uint32_t be = TO_BIG_ENDIAN_32(value);
+    return __writer_write(writer, &be, sizeof(be));
+}
 
-    numbytes += sizeof(atom->type);
-    BIG_ENDIAN_WRITE(*buffer, atom->type, atom_type_t);
+static inline int __writer_write_u64(writer_t *writer, uint64_t value)
+{
+    uint64_t be = TO_BIG_ENDIAN_64(value);
+    return __writer_write(writer, &be, sizeof(be));
+}
 
-    switch (atom->type)
-    {
-    case ATOM_NUMBER:
+static inline int __writer_write_u8(writer_t *writer, uint8_t value)
+{
+    if (writer->used < writer->capacity)
     {
-        numbytes += __encode_number(&atom->num, buffer);
-        break;
+        writer->buffer[writer->used++] = (char)value;
+        return 0;
     }
-    case ATOM_STRING:
+
+    return __writer_write(writer, &value, sizeof(value));
+}
+
+#define VARINT_MAX_BYTES 10
+
+static inline size_t __varint_encode(uint64_t value, uint8_t *out)
+{
+    size_t n = 0;
+    while (value >= 0x80)
     {
-        numbytes += __encode_string(&atom->str, buffer);
-        break;
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
     }
-    case ATOM_SYMBOL:
+    out[n++] = (uint8_t)value;
+
+    return n;
+}
+
+static inline size_t __varint_size(uint64_t value)
+{
+    size_t n = 1;
+    while (value >= 0x80)
     {
-        numbytes += __encode_symbol(&atom->sym, buffer);
-        break;
-    }
+        value >>= 7;
+        n++;
     }
 
-    return numbytes;
+    return n;
 }
 
-size_t __encode_list(list_t *list, dyn_buffer_t *buffer)
+static inline int __writer_write_varint(writer_t *writer, uint64_t value)
 {
-    size_t numbytes = 0;
+    if (writer->used + VARINT_MAX_BYTES <= writer->capacity)
+    {
+        writer->used += __varint_encode(value, (uint8_t *)writer->buffer + writer->used);
+        return 0;
+    }
 
-    numbytes += sizeof(list->size);
-    BIG_ENDIAN_WRITE(*buffer, list->size, size_t);
+    uint8_t bytes[VARINT_MAX_BYTES];
+    size_t n = __varint_encode(value, bytes);
+    return __writer_write(writer, bytes, n);
+}
 
-    for (size_t i = 0; i < list->size; ++i)
+#define ZIGZAG_ENCODE(v) (((uint64_t)(v) << 1) ^ (uint64_t)((v) >> 63))
+#define ZIGZAG_DECODE(v) ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+// Version 2 folds the form, atom and number types into a single tag byte
+typedef enum
+{
+    V2_TAG_LIST = 0,
+    V2_TAG_INTEGER = 1,
+    V2_TAG_FLOAT = 2,
+    V2_TAG_SYMBOL = 3,
+    V2_TAG_STRING = 4,
+    // Index into the symbol table, with SERIALIZER_FLAG_SYMBOL_TABLE
+    V2_TAG_SYMBOL_REF = 5,
+} v2_tag_t;
+
+typedef struct
+{
+    symbol_t *symbol;
+    uint64_t hash;
+} symbol_entry_t;
+
+/**
+ * Distinct symbols of a program in order of first appearance, with an
+ * open-addressing index on top so every occurrence finds its number.
+ */
+typedef struct
+{
+    DYNARRAY(symbol_entry_t) entries;
+    // Entry index + 1 for every slot, 0 marks a free slot
+    size_t *slots;
+    size_t slot_count;
+} symbol_table_t;
+
+static size_t __symbol_table_slot(symbol_table_t *table, symbol_t *symbol, uint64_t hash)
+{
+    size_t mask = table->slot_count - 1;
+    size_t slot = hash & mask;
+    while (table->slots[slot])
     {
-        form_t *form = &list->items[i];
-        size_t form_bytes = __encode_form(form, buffer);
-        numbytes += form_bytes;
+        symbol_entry_t *entry = &table->entries.items[table->slots[slot] - 1];
+        if (entry->hash == hash && entry->symbol->len == symbol->len &&
+            memcmp(entry->symbol->chars, symbol->chars, symbol->len) == 0)
+            break;
+        slot = (slot + 1) & mask;
     }
 
-    return numbytes;
+    return slot;
 }
 
-size_t __encode_number(number_t *number, dyn_buffer_t *buffer)
+static int __symbol_table_grow(symbol_table_t *table)
 {
-    size_t numbytes = 0;
+    size_t slot_count = table->slot_count ? table->slot_count * 2 : 64;
+    size_t *slots = calloc(slot_count, sizeof(size_t));
+    if (!slots)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
 
-    numbytes += sizeof(number->type);
-    BIG_ENDIAN_WRITE(*buffer, number->type, number_type_t);
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
 
-    switch (number->type)
-    {
-    case NUMBER_INTEGER:
+    // Entries are distinct, so each one just takes the first free slot
+    for (size_t i = 0; i < table->entries.size; ++i)
     {
-        numbytes += sizeof(number->integer);
-        BIG_ENDIAN_WRITE(*buffer, number->integer, int64_t);
-        break;
+        size_t slot = table->entries.items[i].hash & (slot_count - 1);
+        while (slots[slot])
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = i + 1;
     }
-    case NUMBER_FLOAT:
+
+    return 0;
+}
+
+static int __symbol_table_add(symbol_table_t *table, symbol_t *symbol)
+{
+    // Keep the load factor under a half so probe runs stay short
+    if ((table->entries.size + 1) * 2 > table->slot_count)
     {
-        numbytes += sizeof(number->float_num);
-        BIG_ENDIAN_WRITE(*buffer, number->float_num, double);
-        break;
-    }
+        int err = __symbol_table_grow(table);
+        if (err)
+            return err;
     }
 
-    return numbytes;
+    uint64_t hash = hash_bytes(symbol->chars, symbol->len, 0);
+    size_t slot = __symbol_table_slot(table, symbol, hash);
+    if (table->slots[slot])
+        return 0;
+
+    symbol_entry_t entry = {.symbol = symbol, .hash = hash};
+    size_t before = table->entries.size;
+    DYNARRAY_PUSH(table->entries, entry, symbol_entry_t);
+    if (table->entries.size == before)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    table->slots[slot] = table->entries.size;
+
+    return 0;
 }
 
-size_t __encode_string(string_t *string, dyn_buffer_t *buffer)
+static size_t __symbol_table_index(symbol_table_t *table, symbol_t *symbol)
 {
-    size_t numbytes = 0;
-
-    numbytes += sizeof(string->len);
-    BIG_ENDIAN_WRITE(*buffer, string->len, size_t);
+    uint64_t hash = hash_bytes(symbol->chars, symbol->len, 0);
+    return table->slots[__symbol_table_slot(table, symbol, hash)] - 1;
+}
 
-    for (size_t i = 0; i < string->len; ++i)
+static int __symbol_table_add_form(symbol_table_t *table, form_t *form)
+{
+    if (form->type == FORM_LIST)
     {
-        DYNARRAY_PUSH(*buffer, string->chars[i], char);
+        for (size_t i = 0; i < form->list.size; ++i)
+        {
+            int err = __symbol_table_add_form(table, &form->list.items[i]);
+            if (err)
+                return err;
+        }
+        return 0;
     }
 
-    numbytes += string->len;
+    if (form->atom.type == ATOM_SYMBOL)
+        return __symbol_table_add(table, &form->atom.sym);
 
-    return numbytes;
+    return 0;
 }
 
-size_t __encode_symbol(symbol_t *symbol, dyn_buffer_t *buffer)
+static void __symbol_table_free(symbol_table_t *table)
 {
-    size_t numbytes = 0;
-
-    numbytes += sizeof(symbol->len);
-    BIG_ENDIAN_WRITE(*buffer, symbol->len, size_t);
+    DYNARRAY_FREE(table->entries);
+    free(table->slots);
+    table->slots = NULL;
+    table->slot_count = 0;
+}
 
-    for (size_t i = 0; i < symbol->len; ++i)
+/**
+ * Build the symbol table when the options ask for one. symbols is left
+ * NULL otherwise, which is how the encoders tell the two layouts apart.
+ */
+static int __symbol_table_build(symbol_table_t *table, program_t *program, serializer_options_t *options, symbol_table_t **symbols)
+{
+    memset(table, 0, sizeof(*table));
+    *symbols = NULL;
+    if (options->version != SERIALIZER_VERSION_2 || !(options->flags & SERIALIZER_FLAG_SYMBOL_TABLE))
+        return 0;
+
+    int err = __symbol_table_grow(table);
+    for (size_t i = 0; !err && i < program->size; ++i)
+        err = __symbol_table_add_form(table, &program->items[i]);
+    if (err)
     {
-        DYNARRAY_PUSH(*buffer, symbol->chars[i], char);
+        __symbol_table_free(table);
+        return err;
     }
 
-    numbytes += symbol->len;
+    *symbols = table;
+    return 0;
+}
+
+static size_t __symbol_table_encoded_size(symbol_table_t *table)
+{
+    size_t numbytes = __varint_size(table->entries.size);
+    for (size_t i = 0; i < table->entries.size; ++i)
+    {
+        symbol_t *symbol = table->entries.items[i].symbol;
+        numbytes += __varint_size(symbol->len) + symbol->len;
+    }
 
     return numbytes;
 }
 
-// Deserializer
-size_t __deserialize_atom(atom_t *atom, char *buffer);
-size_t __deserialize_form(form_t *form, char *buffer);
-size_t __deserialize_list(list_t *list, char *buffer);
-size_t __deserialize_number(number_t *number, char *buffer);
-size_t __deserialize_string(string_t *string, char *buffer);
-size_t __deserialize_symbol(symbol_t *symbol, char *buffer);
-
-int deserializer_init(deserializer_t *deserializer, int fd)
+static int __encode_symbol_table(symbol_table_t *table, writer_t *writer)
 {
-    if (!deserializer)
-        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    int err = __writer_write_varint(writer, table->entries.size);
+    for (size_t i = 0; !err && i < table->entries.size; ++i)
+    {
+        symbol_t *symbol = table->entries.items[i].symbol;
+        err = __writer_write_varint(writer, symbol->len);
+        err = err ? err : __writer_write_body(writer, symbol->chars, symbol->len);
+    }
 
-    if (fd < 0)
-        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    return err;
+}
 
-    deserializer->fd = fd;
+size_t __encoded_size_form(form_t *form);
+size_t __encoded_size_form_v2(form_t *form, symbol_table_t *symbols);
+int __encode_form_v2(form_t *form, symbol_table_t *symbols, writer_t *writer);
 
-    return 0;
-}
+int __encode_form(form_t *form, writer_t *writer);
+int __encode_atom(atom_t *atom, writer_t *writer);
+int __encode_list(list_t *list, writer_t *writer);
+int __encode_number(number_t *number, writer_t *writer);
+int __encode_string(string_t *string, writer_t *writer);
+int __encode_symbol(symbol_t *symbol, writer_t *writer);
 
-int deserializer_deserialize(deserializer_t *deserializer, program_t *program)
+typedef struct
 {
-    if (!deserializer)
-        return SERIALIZER_ERR_INVALID_ARGUMENT;
-    if (!program)
-        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    // Offset of the list's tag in the payload
+    uint64_t offset;
+    // Where its item offsets start in form_index_t.children
+    size_t first;
+} indexed_list_t;
+
+/**
+ * Payload offsets of the top-level forms and of the items of large lists,
+ * worked out by sizing the program once before it is encoded. Lists are
+ * in the order they appear, so their offsets are sorted.
+ */
+typedef struct
+{
+    DYNARRAY(uint64_t) forms;
+    DYNARRAY(uint64_t) children;
+    DYNARRAY(indexed_list_t) lists;
+    size_t min_list_size;
+    // Everything before the trailer, which is where it starts
+    uint64_t trailer_offset;
+} form_index_t;
+
+// The trailer ends with the list count, the form count and trailer_offset
+#define FORM_INDEX_FOOTER_SIZE (3 * sizeof(uint64_t))
+
+static int __form_index_add_form(form_index_t *index, form_t *form, symbol_table_t *symbols, uint64_t *offset)
+{
+    if (form->type != FORM_LIST)
+    {
+        *offset += __encoded_size_form_v2(form, symbols);
+        return 0;
+    }
 
-    char sizebuf[sizeof(size_t)] = {0};
-    ssize_t bytes_read = read(deserializer->fd, sizebuf, sizeof(size_t));
-    if (bytes_read == -1)
+    size_t first = index->children.size;
+    int indexed = index->min_list_size > 0 && form->list.size >= index->min_list_size;
+    if (indexed)
     {
-        return SERIALIZER_ERR_READ_FAILED;
+        size_t lists = index->lists.size;
+        indexed_list_t list = {.offset = *offset, .first = first};
+        DYNARRAY_PUSH(index->lists, list, indexed_list_t);
+
+        // Reserve the item offsets now, nested lists add theirs after
+        for (size_t i = 0; i < form->list.size; ++i)
+            DYNARRAY_PUSH(index->children, 0, uint64_t);
+        if (index->lists.size == lists || index->children.size != first + form->list.size)
+            return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
     }
 
-    size_t total_size = 0;
-    BIG_ENDIAN_READ(sizebuf, total_size, size_t);
+    *offset += 1 + __varint_size(form->list.size);
+    for (size_t i = 0; i < form->list.size; ++i)
+    {
+        if (indexed)
+            index->children.items[first + i] = *offset;
+        int err = __form_index_add_form(index, &form->list.items[i], symbols, offset);
+        if (err)
+            return err;
+    }
 
-    char *buffer = malloc(total_size);
-    if (!buffer)
-        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    return 0;
+}
+
+static void __form_index_free(form_index_t *index)
+{
+    DYNARRAY_FREE(index->forms);
+    DYNARRAY_FREE(index->children);
+    DYNARRAY_FREE(index->lists);
+}
 
-    bytes_read = read(deserializer->fd, buffer, total_size);
-    if (bytes_read == -1)
+/**
+ * Build the form index when the options ask for one, like
+ * __symbol_table_build, which has to run first since symbol
+ * references change the size of the forms.
+ */
+static int __form_index_build(form_index_t *index, program_t *program, serializer_options_t *options,
+                              symbol_table_t *symbols, form_index_t **out)
+{
+    memset(index, 0, sizeof(*index));
+    *out = NULL;
+    if (options->version != SERIALIZER_VERSION_2 || !(options->flags & SERIALIZER_FLAG_FORM_INDEX))
+        return 0;
+
+    index->min_list_size = options->index_min_list_size;
+    uint64_t offset = __varint_size(program->size);
+    if (symbols)
+        offset += __symbol_table_encoded_size(symbols);
+
+    int err = 0;
+    for (size_t i = 0; !err && i < program->size; ++i)
+    {
+        size_t before = index->forms.size;
+        DYNARRAY_PUSH(index->forms, offset, uint64_t);
+        if (index->forms.size == before)
+            err = SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+        err = err ? err : __form_index_add_form(index, &program->items[i], symbols, &offset);
+    }
+    if (err)
     {
-        return SERIALIZER_ERR_READ_FAILED;
+        __form_index_free(index);
+        return err;
     }
 
-    if ((size_t)bytes_read != total_size)
+    index->trailer_offset = offset;
+    *out = index;
+    return 0;
+}
+
+static size_t __form_index_encoded_size(form_index_t *index)
+{
+    return sizeof(uint64_t) * (index->forms.size + index->children.size + 2 * index->lists.size) + FORM_INDEX_FOOTER_SIZE;
+}
+
+/**
+ * The trailer: every top-level form offset, the item offsets of the indexed
+ * lists back to back, then a directory of (list offset, payload offset of its
+ * items) pairs to binary search, and the footer.
+ */
+static int __encode_form_index(form_index_t *index, writer_t *writer)
+{
+    int err = 0;
+    for (size_t i = 0; !err && i < index->forms.size; ++i)
+        err = __writer_write_u64(writer, index->forms.items[i]);
+    for (size_t i = 0; !err && i < index->children.size; ++i)
+        err = __writer_write_u64(writer, index->children.items[i]);
+
+    uint64_t children_offset = index->trailer_offset + sizeof(uint64_t) * index->forms.size;
+    for (size_t i = 0; !err && i < index->lists.size; ++i)
     {
-        return SERIALIZER_ERR_READ_FAILED;
+        indexed_list_t *list = &index->lists.items[i];
+        err = __writer_write_u64(writer, list->offset);
+        err = err ? err : __writer_write_u64(writer, children_offset + sizeof(uint64_t) * list->first);
     }
 
-    char *current = buffer;
+    err = err ? err : __writer_write_u64(writer, index->lists.size);
+    err = err ? err : __writer_write_u64(writer, index->forms.size);
+    return err ? err : __writer_write_u64(writer, index->trailer_offset);
+}
 
-    // Read the program size
-    BIG_ENDIAN_READ(current, program->size, size_t);
-    current += sizeof(program->size);
+static int __encode_program(program_t *program, writer_t *writer, size_t numbytes)
+{
+    int err = __writer_write_u64(writer, numbytes);
+    if (err)
+        return err;
 
-    program->items = malloc(program->size * sizeof(form_t));
-    program->capacity = program->size;
-    if (!program->items)
-        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    // Write the program size
+    err = __writer_write_u64(writer, program->size);
+    if (err)
+        return err;
 
+    // Write all the forms
     for (size_t i = 0; i < program->size; ++i)
     {
-        form_t *form = &program->items[i];
-        size_t form_bytes = __deserialize_form(form, current);
-        current += form_bytes;
+        err = __encode_form(&program->items[i], writer);
+        if (err)
+            return err;
     }
 
-    free(buffer);
-
     return 0;
 }
 
-size_t __deserialize_form(form_t *form, char *buffer)
+static int __encode_header_v2(serializer_options_t *options, writer_t *writer, size_t numbytes)
 {
-    size_t numbytes = 0;
+    int err = __writer_write(writer, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE);
+    if (err)
+        return err;
 
-    numbytes += sizeof(form->type);
-    BIG_ENDIAN_READ(buffer, form->type, form_type_t);
-    buffer += sizeof(form->type);
+    uint8_t header[4] = {SERIALIZER_VERSION_2, (uint8_t)options->flags, 0, 0};
+    err = __writer_write(writer, header, sizeof(header));
+    if (err)
+        return err;
 
-    switch (form->type)
-    {
-    case FORM_ATOM:
+    return __writer_write_u64(writer, numbytes);
+}
+
+static int __encode_payload_v2(program_t *program, symbol_table_t *symbols, form_index_t *index, writer_t *writer)
+{
+    int err;
+    if (symbols)
     {
-        atom_t *atom = &form->atom;
-        numbytes += __deserialize_atom(atom, buffer);
-        break;
+        err = __encode_symbol_table(symbols, writer);
+        if (err)
+            return err;
     }
-    case FORM_LIST:
+
+    err = __writer_write_varint(writer, program->size);
+    if (err)
+        return err;
+
+    for (size_t i = 0; i < program->size; ++i)
     {
-        list_t *list = &form->list;
-        numbytes += __deserialize_list(list, buffer);
-        break;
-    }
+        err = __encode_form_v2(&program->items[i], symbols, writer);
+        if (err)
+            return err;
     }
 
-    return numbytes;
+    return index ? __encode_form_index(index, writer) : 0;
 }
 
-size_t __deserialize_atom(atom_t *atom, char *buffer)
+static int __encode_program_v2(program_t *program, serializer_options_t *options, symbol_table_t *symbols,
+                               form_index_t *index, writer_t *writer, size_t numbytes)
 {
-    size_t numbytes = 0;
+    int err = __encode_header_v2(options, writer, numbytes);
+    return err ? err : __encode_payload_v2(program, symbols, index, writer);
+}
 
-    numbytes += sizeof(atom->type);
-    BIG_ENDIAN_READ(buffer, atom->type, atom_type_t);
-    buffer += sizeof(atom->type);
+static size_t __encoded_payload_size(program_t *program, serializer_options_t *options, symbol_table_t *symbols,
+                                     form_index_t *index)
+{
+    // Building the index already sized every form
+    if (index)
+        return index->trailer_offset + __form_index_encoded_size(index);
 
-    switch (atom->type)
-    {
-    case ATOM_NUMBER:
-    {
-        numbytes += __deserialize_number(&atom->num, buffer);
-        break;
-    }
-    case ATOM_STRING:
+    size_t numbytes;
+    if (options->version == SERIALIZER_VERSION_2)
     {
-        numbytes += __deserialize_string(&atom->str, buffer);
-        break;
+        numbytes = __varint_size(program->size);
+        if (symbols)
+            numbytes += __symbol_table_encoded_size(symbols);
+        for (size_t i = 0; i < program->size; ++i)
+            numbytes += __encoded_size_form_v2(&program->items[i], symbols);
     }
-    case ATOM_SYMBOL:
+    else
     {
-        numbytes += __deserialize_symbol(&atom->sym, buffer);
-        break;
-    }
+        numbytes = sizeof(program->size);
+        for (size_t i = 0; i < program->size; ++i)
+            numbytes += __encoded_size_form(&program->items[i]);
     }
+
     return numbytes;
 }
 
-size_t __deserialize_list(list_t *list, char *buffer)
+static size_t __header_size(serializer_options_t *options)
 {
-    size_t numbytes = 0;
+    return options->version == SERIALIZER_VERSION_2 ? SERIALIZER_V2_HEADER_SIZE : sizeof(size_t);
+}
+
+static int __is_compressed(serializer_options_t *options)
+{
+    return options->version == SERIALIZER_VERSION_2 && (options->flags & SERIALIZER_FLAG_COMPRESSED);
+}
 
-    numbytes += sizeof(list->size);
-    BIG_ENDIAN_READ(buffer, list->size, size_t);
-    buffer += sizeof(list->size);
+static size_t __compressed_size_bound(size_t raw_size)
+{
+    return SERIALIZER_V2_HEADER_SIZE + __varint_size(raw_size) + lz_compress_bound(raw_size);
+}
 
-    list->items = malloc(list->size * sizeof(form_t));
-    list->capacity = list->size;
-    if (!list->items)
+/**
+ * Encode the payload in memory, then write the header, its size and the
+ * compressed block to buf, which needs room for __compressed_size_bound.
+ */
+static int __encode_compressed(program_t *program, serializer_options_t *options, symbol_table_t *symbols,
+                               char *buf, size_t cap, size_t *written)
+{
+    size_t raw_size = __encoded_payload_size(program, options, symbols, NULL);
+    char *raw = malloc(raw_size ? raw_size : 1);
+    if (!raw)
         return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
 
-    for (size_t i = 0; i < list->size; ++i)
+    writer_t raw_writer = {.fd = -1, .buffer = raw, .capacity = raw_size, .used = 0};
+    int err = __encode_payload_v2(program, symbols, NULL, &raw_writer);
+    if (err)
     {
-        form_t *form = &list->items[i];
-        size_t form_bytes = __deserialize_form(form, buffer);
-        numbytes += form_bytes;
-        buffer += form_bytes;
+        free(raw);
+        return err;
     }
 
-    return numbytes;
+    writer_t writer = {.fd = -1, .buffer = buf, .capacity = cap, .used = 0};
+    err = __encode_header_v2(options, &writer, 0);
+    err = err ? err : __writer_write_varint(&writer, raw_size);
+
+    size_t compressed = 0;
+    if (!err && lz_compress(raw, raw_size, buf + writer.used, cap - writer.used, &compressed) != 0)
+        err = SERIALIZER_ERR_BUFFER_TOO_SMALL;
+    free(raw);
+    if (err)
+        return err;
+
+    size_t payload_size = writer.used - SERIALIZER_V2_HEADER_SIZE + compressed;
+    uint64_t be = TO_BIG_ENDIAN_64(payload_size);
+    memcpy(buf + SERIALIZER_V2_HEADER_SIZE - sizeof(be), &be, sizeof(be));
+    *written = SERIALIZER_V2_HEADER_SIZE + payload_size;
+
+    return 0;
 }
 
-size_t __deserialize_number(number_t *number, char *buffer)
+static int __serialize_compressed(serializer_t *serializer, program_t *program, symbol_table_t *symbols)
 {
-    size_t numbytes = 0;
+    size_t cap = __compressed_size_bound(__encoded_payload_size(program, &serializer->options, symbols, NULL));
+    char *message = malloc(cap);
+    if (!message)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
 
-    numbytes += sizeof(number->type);
-    BIG_ENDIAN_READ(buffer, number->type, number_type_t);
-    buffer += sizeof(number->type);
+    size_t written = 0;
+    int err = __encode_compressed(program, &serializer->options, symbols, message, cap, &written);
+    err = err ? err : __write_all(serializer->fd, message, written);
+    free(message);
 
-    switch (number->type)
-    {
-    case NUMBER_INTEGER:
+    return err;
+}
+
+int serializer_serialize(serializer_t *serializer, program_t *program)
+{
+    if (!serializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    symbol_table_t table, *symbols;
+    int err = __symbol_table_build(&table, program, &serializer->options, &symbols);
+    if (err)
+        return err;
+
+    if (__is_compressed(&serializer->options))
     {
-        numbytes += sizeof(number->integer);
-        BIG_ENDIAN_READ(buffer, number->integer, int64_t);
-        break;
+        err = __serialize_compressed(serializer, program, symbols);
+        __symbol_table_free(&table);
+        return err;
     }
-    case NUMBER_FLOAT:
+
+    form_index_t form_index, *index;
+    err = __form_index_build(&form_index, program, &serializer->options, symbols, &index);
+    if (err)
     {
-        numbytes += sizeof(number->float_num);
-        BIG_ENDIAN_READ(buffer, number->float_num, double);
-        break;
+        __symbol_table_free(&table);
+        return err;
     }
+
+    // The total size goes first, and since the buffer may be flushed long
+    // before the end, it has to be known up front instead of backpatched
+    size_t numbytes = __encoded_payload_size(program, &serializer->options, symbols, index);
+
+    writer_t writer = {
+        .fd = serializer->fd,
+        .buffer = serializer->buffer,
+        .capacity = SERIALIZER_BUFFER_SIZE,
+        .used = 0,
+    };
+    if (serializer->options.gather_threshold > 0)
+    {
+        writer.iov = serializer->iov;
+        writer.iov_capacity = SERIALIZER_IOV_MAX;
+        writer.gather_threshold = serializer->options.gather_threshold;
     }
 
-    return numbytes;
+    if (serializer->options.version == SERIALIZER_VERSION_2)
+        err = __encode_program_v2(program, &serializer->options, symbols, index, &writer, numbytes);
+    else
+        err = __encode_program(program, &writer, numbytes);
+    __form_index_free(&form_index);
+    __symbol_table_free(&table);
+    if (err)
+        return err;
+
+    return __writer_flush(&writer);
 }
 
-size_t __deserialize_string(string_t *string, char *buffer)
+size_t serializer_encoded_size(program_t *program, serializer_options_t *options)
 {
-    size_t numbytes = 0;
-
-    numbytes += sizeof(string->len);
-    BIG_ENDIAN_READ(buffer, string->len, size_t);
-    buffer += sizeof(string->len);
+    if (!program)
+        return 0;
+    if (!options)
+        options = &__default_options;
 
-    string->chars = malloc(string->len);
-    if (!string->chars)
-        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    symbol_table_t table, *symbols;
+    if (__symbol_table_build(&table, program, options, &symbols))
+        return 0;
 
-    for (size_t i = 0; i < string->len; ++i)
+    form_index_t form_index, *index;
+    if (__form_index_build(&form_index, program, options, symbols, &index))
     {
-        string->chars[i] = buffer[i];
+        __symbol_table_free(&table);
+        return 0;
     }
 
-    numbytes += string->len;
+    size_t numbytes = __encoded_payload_size(program, options, symbols, index);
+    if (__is_compressed(options))
+        numbytes = __compressed_size_bound(numbytes);
+    else
+        numbytes += __header_size(options);
+    __form_index_free(&form_index);
+    __symbol_table_free(&table);
 
     return numbytes;
 }
 
-size_t __deserialize_symbol(symbol_t *symbol, char *buffer)
+int serializer_serialize_to_buffer(program_t *program, serializer_options_t *options, char *buf, size_t cap, size_t *written)
 {
-    size_t numbytes = 0;
-
-    numbytes += sizeof(symbol->len);
-    BIG_ENDIAN_READ(buffer, symbol->len, size_t);
-    buffer += sizeof(symbol->len);
-
-    symbol->chars = malloc(symbol->len);
-    if (!symbol->chars)
-        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!buf)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!written)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!options)
+        options = &__default_options;
+    int err = __check_options(options);
+    if (err)
+        return err;
+
+    writer_t writer = {
+        .fd = -1,
+        .buffer = buf,
+        .capacity = cap,
+        .used = 0,
+    };
+
+    symbol_table_t table, *symbols;
+    err = __symbol_table_build(&table, program, options, &symbols);
+    if (err)
+        return err;
+
+    if (__is_compressed(options))
+    {
+        err = __encode_compressed(program, options, symbols, buf, cap, written);
+        __symbol_table_free(&table);
+        return err;
+    }
 
-    for (size_t i = 0; i < symbol->len; ++i)
+    form_index_t form_index, *index;
+    err = __form_index_build(&form_index, program, options, symbols, &index);
+    if (err)
     {
-        symbol->chars[i] = buffer[i];
+        __symbol_table_free(&table);
+        return err;
     }
 
-    numbytes += symbol->len;
+    // The whole message stays in memory, so the size can be backpatched
+    // and the tree only has to be walked once, unless it is indexed
+    if (options->version == SERIALIZER_VERSION_2)
+        err = __encode_program_v2(program, options, symbols, index, &writer, 0);
+    else
+        err = __encode_program(program, &writer, 0);
+    __form_index_free(&form_index);
+    __symbol_table_free(&table);
+    if (err)
+        return err;
 
-    return numbytes;
+    size_t header_size = __header_size(options);
+    uint64_t be = TO_BIG_ENDIAN_64(writer.used - header_size);
+    memcpy(buf + header_size - sizeof(be), &be, sizeof(be));
+
+    *written = writer.used;
+
+    return 0;
+}
+
+/**
+ * A list whose size is only known at its ')': where the size goes in the
+ * output and how many items were written so far. The top-level forms are
+ * counted the same way, as the bottom entry of the stack.
+ */
+typedef struct
+{
+    size_t size_at;
+    uint64_t items;
+} pending_list_t;
+
+typedef struct
+{
+    parser_t parser;
+    serializer_options_t *options;
+    writer_t *writer;
+    DYNARRAY(pending_list_t) open_lists;
+} transcoder_t;
+
+// Version 1 sizes are fixed, version 2 ones start as a single byte
+static int __transcoder_open(transcoder_t *transcoder)
+{
+    writer_t *writer = transcoder->writer;
+    pending_list_t list = {.size_at = writer->used, .items = 0};
+    size_t depth = transcoder->open_lists.size;
+    DYNARRAY_PUSH(transcoder->open_lists, list, pending_list_t);
+    if (transcoder->open_lists.size == depth)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    if (transcoder->options->version == SERIALIZER_VERSION_2)
+        return __writer_write_u8(writer, 0);
+    return __writer_write_u64(writer, 0);
+}
+
+/**
+ * Backpatch the size of the innermost open list. A version 2 size that
+ * needs more than its byte moves the list's items up to make room; only
+ * lists of 128 items or more pay for this, and only once.
+ */
+static int __transcoder_close(transcoder_t *transcoder)
+{
+    writer_t *writer = transcoder->writer;
+    pending_list_t list = transcoder->open_lists.items[--transcoder->open_lists.size];
+
+    if (transcoder->options->version != SERIALIZER_VERSION_2)
+    {
+        uint64_t be = TO_BIG_ENDIAN_64(list.items);
+        memcpy(writer->buffer + list.size_at, &be, sizeof(be));
+        return 0;
+    }
+
+    size_t extra = __varint_size(list.items) - 1;
+    if (extra > 0)
+    {
+        size_t items_at = list.size_at + 1;
+        size_t items_len = writer->used - items_at;
+        if (writer->used + extra > writer->capacity)
+        {
+            int err = writer->growable ? __writer_grow(writer, extra) : SERIALIZER_ERR_BUFFER_TOO_SMALL;
+            if (err)
+                return err;
+        }
+        memmove(writer->buffer + items_at + extra, writer->buffer + items_at, items_len);
+        writer->used += extra;
+    }
+
+    __varint_encode(list.items, (uint8_t *)writer->buffer + list.size_at);
+    return 0;
+}
+
+static int __transcoder_atom(transcoder_t *transcoder)
+{
+    // Tokens parser_parse_atom does not know, like '=', are symbols
+    token_t *token = &transcoder->parser.current_token;
+    form_t form = {.type = FORM_ATOM};
+    form.atom.type = ATOM_SYMBOL;
+    form.atom.sym.chars = token->start;
+    form.atom.sym.len = token->len;
+    if (parser_parse_atom(&transcoder->parser, &form.atom))
+        return SERIALIZER_ERR_PARSE_FAILED;
+
+    if (transcoder->options->version == SERIALIZER_VERSION_2)
+        return __encode_form_v2(&form, NULL, transcoder->writer);
+    return __encode_form(&form, transcoder->writer);
+}
+
+static int __transcode(transcoder_t *transcoder)
+{
+    writer_t *writer = transcoder->writer;
+    int v2 = transcoder->options->version == SERIALIZER_VERSION_2;
+    int err = v2 ? __encode_header_v2(transcoder->options, writer, 0) : __writer_write_u64(writer, 0);
+    err = err ? err : __transcoder_open(transcoder);
+
+    token_t *token = &transcoder->parser.current_token;
+    while (!err && token->type != TOK_EOF)
+    {
+        pending_list_t *top = &transcoder->open_lists.items[transcoder->open_lists.size - 1];
+        if (token->type == TOK_RPAREN)
+        {
+            if (transcoder->open_lists.size == 1)
+                return SERIALIZER_ERR_PARSE_FAILED;
+            err = __transcoder_close(transcoder);
+        }
+        else if (token->type == TOK_LPAREN)
+        {
+            top->items++;
+            err = v2 ? __writer_write_u8(writer, V2_TAG_LIST) : __writer_write_u32(writer, FORM_LIST);
+            err = err ? err : __transcoder_open(transcoder);
+        }
+        else
+        {
+            top->items++;
+            err = __transcoder_atom(transcoder);
+        }
+
+        if (!err && lexer_next_token(&transcoder->parser.lexer, token))
+            err = SERIALIZER_ERR_PARSE_FAILED;
+    }
+    if (err)
+        return err;
+
+    // Everything but the top level has to be closed by now
+    if (transcoder->open_lists.size != 1)
+        return SERIALIZER_ERR_PARSE_FAILED;
+    err = __transcoder_close(transcoder);
+    if (err)
+        return err;
+
+    size_t header_size = __header_size(transcoder->options);
+    uint64_t be = TO_BIG_ENDIAN_64(writer->used - header_size);
+    memcpy(writer->buffer + header_size - sizeof(be), &be, sizeof(be));
+
+    return 0;
+}
+
+static int __transcode_into(char *input, size_t input_len, serializer_options_t *options, writer_t *writer)
+{
+    if (!options)
+        options = &__default_options;
+    int err = __check_options(options);
+    if (err)
+        return err;
+    // The symbol table, the index and compression all need the whole program first
+    if (options->flags)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    transcoder_t transcoder = {.options = options, .writer = writer};
+    if (parser_init(&transcoder.parser, input, input_len))
+        return SERIALIZER_ERR_PARSE_FAILED;
+
+    err = __transcode(&transcoder);
+    DYNARRAY_FREE(transcoder.open_lists);
+
+    return err;
+}
+
+int serializer_transcode_to_buffer(char *input, size_t input_len, serializer_options_t *options, char *buf, size_t cap, size_t *written)
+{
+    if (!input)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!buf)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!written)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    writer_t writer = {.fd = -1, .buffer = buf, .capacity = cap, .used = 0};
+    int err = __transcode_into(input, input_len, options, &writer);
+    if (err)
+        return err;
+
+    *written = writer.used;
+    return 0;
+}
+
+int serializer_transcode(char *input, size_t input_len, serializer_options_t *options, char **out, size_t *written)
+{
+    if (!input)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!out)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!written)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    // Encoded messages are about as large as their source, start there
+    writer_t writer = {.fd = -1, .growable = 1};
+    int err = __writer_grow(&writer, input_len + SERIALIZER_V2_HEADER_SIZE + VARINT_MAX_BYTES);
+    err = err ? err : __transcode_into(input, input_len, options, &writer);
+    if (err)
+    {
+        free(writer.buffer);
+        return err;
+    }
+
+    *out = writer.buffer;
+    *written = writer.used;
+    return 0;
+}
+
+size_t __encoded_size_form(form_t *form)
+{
+    size_t numbytes = sizeof(form_type_t);
+
+    if (form->type == FORM_LIST)
+    {
+        numbytes += sizeof(form->list.size);
+        for (size_t i = 0; i < form->list.size; ++i)
+            numbytes += __encoded_size_form(&form->list.items[i]);
+        return numbytes;
+    }
+
+    numbytes += sizeof(atom_type_t);
+    switch (form->atom.type)
+    {
+    case ATOM_NUMBER:
+    {
+        numbytes += sizeof(number_type_t);
+        numbytes += form->atom.num.type == NUMBER_INTEGER ? sizeof(int64_t) : sizeof(double);
+        break;
+    }
+    case ATOM_STRING:
+    {
+        numbytes += sizeof(form->atom.str.len) + form->atom.str.len;
+        break;
+    }
+    case ATOM_SYMBOL:
+    {
+        numbytes += sizeof(form->atom.sym.len) + form->atom.sym.len;
+        break;
+    }
+    }
+
+    return numbytes;
+}
+
+int __encode_form(form_t *form, writer_t *writer)
+{
+    int err = __writer_write_u32(writer, form->type);
+    if (err)
+        return err;
+
+    switch (form->type)
+    {
+    case FORM_ATOM:
+    {
+        return __encode_atom(&form->atom, writer);
+    }
+    case FORM_LIST:
+    {
+        return __encode_list(&form->list, writer);
+    }
+    }
+
+    return 0;
+}
+
+int __encode_atom(atom_t *atom, writer_t *writer)
+{
+    int err = __writer_write_u32(writer, atom->type);
+    if (err)
+        return err;
+
+    switch (atom->type)
+    {
+    case ATOM_NUMBER:
+    {
+        return __encode_number(&atom->num, writer);
+    }
+    case ATOM_STRING:
+    {
+        return __encode_string(&atom->str, writer);
+    }
+    case ATOM_SYMBOL:
+    {
+        return __encode_symbol(&atom->sym, writer);
+    }
+    }
+
+    return 0;
+}
+
+int __encode_list(list_t *list, writer_t *writer)
+{
+    int err = __writer_write_u64(writer, list->size);
+    if (err)
+        return err;
+
+    for (size_t i = 0; i < list->size; ++i)
+    {
+        err = __encode_form(&list->items[i], writer);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
+int __encode_number(number_t *number, writer_t *writer)
+{
+    int err = __writer_write_u32(writer, number->type);
+    if (err)
+        return err;
+
+    switch (number->type)
+    {
+    case NUMBER_INTEGER:
+    {
+        return __writer_write_u64(writer, (uint64_t)number->integer);
+    }
+    case NUMBER_FLOAT:
+    {
+        uint64_t bits;
+        memcpy(&bits, &number->float_num, sizeof(bits));
+        return __writer_write_u64(writer, bits);
+    }
+    }
+
+    return 0;
+}
+
+int __encode_string(string_t *string, writer_t *writer)
+{
+    int err = __writer_write_u64(writer, string->len);
+    if (err)
+        return err;
+
+    return __writer_write_body(writer, string->chars, string->len);
+}
+
+int __encode_symbol(symbol_t *symbol, writer_t *writer)
+{
+    int err = __writer_write_u64(writer, symbol->len);
+    if (err)
+        return err;
+
+    return __writer_write_body(writer, symbol->chars, symbol->len);
+}
+
+size_t __encoded_size_form_v2(form_t *form, symbol_table_t *symbols)
+{
+    if (form->type == FORM_LIST)
+    {
+        size_t numbytes = 1 + __varint_size(form->list.size);
+        for (size_t i = 0; i < form->list.size; ++i)
+            numbytes += __encoded_size_form_v2(&form->list.items[i], symbols);
+        return numbytes;
+    }
+
+    atom_t *atom = &form->atom;
+    switch (atom->type)
+    {
+    case ATOM_NUMBER:
+    {
+        if (atom->num.type == NUMBER_INTEGER)
+            return 1 + __varint_size(ZIGZAG_ENCODE(atom->num.integer));
+        return 1 + sizeof(double);
+    }
+    case ATOM_STRING:
+        return 1 + __varint_size(atom->str.len) + atom->str.len;
+    case ATOM_SYMBOL:
+        if (symbols)
+            return 1 + __varint_size(__symbol_table_index(symbols, &atom->sym));
+        return 1 + __varint_size(atom->sym.len) + atom->sym.len;
+    }
+
+    return 1;
+}
+
+int __encode_form_v2(form_t *form, symbol_table_t *symbols, writer_t *writer)
+{
+    int err;
+    if (form->type == FORM_LIST)
+    {
+        err = __writer_write_u8(writer, V2_TAG_LIST);
+        err = err ? err : __writer_write_varint(writer, form->list.size);
+        for (size_t i = 0; !err && i < form->list.size; ++i)
+            err = __encode_form_v2(&form->list.items[i], symbols, writer);
+        return err;
+    }
+
+    atom_t *atom = &form->atom;
+    switch (atom->type)
+    {
+    case ATOM_NUMBER:
+    {
+        if (atom->num.type == NUMBER_INTEGER)
+        {
+            err = __writer_write_u8(writer, V2_TAG_INTEGER);
+            return err ? err : __writer_write_varint(writer, ZIGZAG_ENCODE(atom->num.integer));
+        }
+
+        uint64_t bits;
+        memcpy(&bits, &atom->num.float_num, sizeof(bits));
+        err = __writer_write_u8(writer, V2_TAG_FLOAT);
+        return err ? err : __writer_write_u64(writer, bits);
+    }
+    case ATOM_STRING:
+    {
+        err = __writer_write_u8(writer, V2_TAG_STRING);
+        err = err ? err : __writer_write_varint(writer, atom->str.len);
+        return err ? err : __writer_write_body(writer, atom->str.chars, atom->str.len);
+    }
+    case ATOM_SYMBOL:
+    {
+        if (symbols)
+        {
+            err = __writer_write_u8(writer, V2_TAG_SYMBOL_REF);
+            return err ? err : __writer_write_varint(writer, __symbol_table_index(symbols, &atom->sym));
+        }
+
+        err = __writer_write_u8(writer, V2_TAG_SYMBOL);
+        err = err ? err : __writer_write_varint(writer, atom->sym.len);
+        return err ? err : __writer_write_body(writer, atom->sym.chars, atom->sym.len);
+    }
+    }
+
+    return 0;
+}
+
+// Deserializer
+int deserializer_init(deserializer_t *deserializer, int fd)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    if (fd < 0)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    deserializer->fd = fd;
+    deserializer->flags = 0;
+    deserializer->arena = NULL;
+    deserializer->header_have = 0;
+    deserializer->header_need = sizeof(size_t);
+    deserializer->message = NULL;
+    deserializer->message_size = 0;
+    deserializer->message_have = 0;
+
+    return 0;
+}
+
+int deserializer_free(deserializer_t *deserializer)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    // A message in an arena goes away with the next reset
+    if (!deserializer->arena)
+        free(deserializer->message);
+    deserializer->message = NULL;
+    deserializer->message_size = 0;
+    deserializer->message_have = 0;
+    deserializer->header_have = 0;
+    deserializer->header_need = sizeof(size_t);
+
+    return 0;
+}
+
+int deserializer_set_flags(deserializer_t *deserializer, int flags)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    deserializer->flags = flags;
+
+    return 0;
+}
+
+int deserializer_set_arena(deserializer_t *deserializer, alloc_arena_t *arena)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    // The message in progress must be released the way it was allocated
+    if (deserializer->message)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    deserializer->arena = arena;
+
+    return 0;
+}
+
+static int __read_all(int fd, char *buffer, size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        ssize_t n = read(fd, buffer + total, len - total);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return SERIALIZER_ERR_READ_FAILED;
+        }
+        if (n == 0)
+            return SERIALIZER_ERR_READ_FAILED;
+        total += (size_t)n;
+    }
+
+    return 0;
+}
+
+typedef struct
+{
+    const char *cur;
+    const char *end;
+} reader_t;
+
+/**
+ * State shared by the decoders. In zero-copy mode every form array is
+ * carved out of forms, which the counting pass sized exactly, and every
+ * string points into the payload instead of being copied. With an arena
+ * the symbol table comes from it too, so decoding never calls malloc.
+ * Otherwise strings and symbol names are copied one after the other
+ * into chars, which becomes program->chars.
+ */
+typedef struct
+{
+    reader_t reader;
+    int zero_copy;
+    form_t *forms;
+    alloc_arena_t *arena;
+
+    // Copy mode only: where the next string goes
+    char *chars;
+
+    // The message's symbol table, shared by every V2_TAG_SYMBOL_REF
+    symbol_t *symbols;
+    size_t symbol_count;
+} decoder_t;
+
+typedef struct
+{
+    int version;
+    int flags;
+    size_t header_size;
+    size_t payload_size;
+} message_header_t;
+
+static int __read_header(const char *buf, size_t len, message_header_t *header)
+{
+    if (len < sizeof(size_t))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    header->version = SERIALIZER_VERSION_1;
+    header->flags = 0;
+    header->header_size = sizeof(size_t);
+    if (memcmp(buf, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE) == 0)
+    {
+        if (len < SERIALIZER_V2_HEADER_SIZE)
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+        header->version = (uint8_t)buf[SERIALIZER_MAGIC_SIZE];
+        header->flags = (uint8_t)buf[SERIALIZER_MAGIC_SIZE + 1];
+        header->header_size = SERIALIZER_V2_HEADER_SIZE;
+    }
+
+    if (header->version != SERIALIZER_VERSION_1 && header->version != SERIALIZER_VERSION_2)
+        return SERIALIZER_ERR_UNSUPPORTED_VERSION;
+    // A flag we do not know changes the layout in ways we cannot guess
+    if (header->flags & ~(SERIALIZER_FLAG_SYMBOL_TABLE | SERIALIZER_FLAG_COMPRESSED | SERIALIZER_FLAG_FORM_INDEX))
+        return SERIALIZER_ERR_UNSUPPORTED_VERSION;
+
+    BIG_ENDIAN_READ((buf + header->header_size - sizeof(size_t)), header->payload_size, size_t);
+    // The size comes from the wire, header_size + payload_size must not wrap
+    if (header->payload_size > SIZE_MAX - header->header_size ||
+        header->payload_size > SERIALIZER_MAX_PAYLOAD_SIZE)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    return 0;
+}
+
+static inline int __reader_varint(reader_t *reader, uint64_t *value);
+static int __count_forms(message_header_t *header, reader_t reader, size_t *count);
+static int __decode_program(message_header_t *header, decoder_t *decoder, program_t *program);
+
+// Form arrays go after the payload in the same block, aligned for form_t
+#define FORMS_OFFSET(payload_end) \
+    (((payload_end) + _Alignof(form_t) - 1) & ~(size_t)(_Alignof(form_t) - 1))
+
+// An LZ block never expands its input more than this, anything claiming
+// more is rejected before the allocation
+#define LZ_MAX_RATIO 256
+
+/**
+ * Decompress the message in buf into a new allocation that holds the same
+ * message uncompressed, header included, and update header to match.
+ * The allocation comes from arena when there is one.
+ */
+static int __inflate_message(const char *buf, message_header_t *header, alloc_arena_t *arena, char **out)
+{
+    reader_t reader = {.cur = buf + header->header_size, .end = buf + header->header_size + header->payload_size};
+    uint64_t raw_size;
+    int err = __reader_varint(&reader, &raw_size);
+    if (err)
+        return err;
+
+    size_t compressed = (size_t)(reader.end - reader.cur);
+    if (raw_size / LZ_MAX_RATIO > compressed || raw_size > SERIALIZER_MAX_PAYLOAD_SIZE)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    char *message = arena ? alloc_arena_alloc(arena, header->header_size + raw_size)
+                          : malloc(header->header_size + raw_size);
+    if (!message)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    size_t written = 0;
+    err = lz_decompress(reader.cur, compressed, message + header->header_size, raw_size, &written);
+    if (err || written != raw_size)
+    {
+        if (!arena)
+            free(message);
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    }
+
+    header->flags &= ~SERIALIZER_FLAG_COMPRESSED;
+    header->payload_size = raw_size;
+
+    // Rewrite the header too, so the result reads like any other message
+    memcpy(message, buf, header->header_size);
+    message[SERIALIZER_MAGIC_SIZE + 1] = (char)header->flags;
+    uint64_t be = TO_BIG_ENDIAN_64(raw_size);
+    memcpy(message + header->header_size - sizeof(be), &be, sizeof(be));
+
+    *out = message;
+    return 0;
+}
+
+/**
+ * Decode a complete message read into buffer, which is taken over: it is
+ * either freed or, in zero-copy mode, becomes the block of the program.
+ */
+static int __decode_message(char *buffer, message_header_t *header, int flags, program_t *program)
+{
+    if (header->flags & SERIALIZER_FLAG_COMPRESSED)
+    {
+        char *inflated;
+        int err = __inflate_message(buffer, header, NULL, &inflated);
+        free(buffer);
+        if (err)
+            return err;
+        buffer = inflated;
+    }
+
+    size_t message_size = header->header_size + header->payload_size;
+
+    if (!(flags & DESERIALIZER_FLAG_ZERO_COPY))
+    {
+        int err = deserializer_deserialize_from_buffer(buffer, message_size, program);
+        free(buffer);
+        return err;
+    }
+
+    reader_t reader = {.cur = buffer + header->header_size, .end = buffer + message_size};
+    size_t count = 0;
+    int err = __count_forms(header, reader, &count);
+    if (err)
+    {
+        free(buffer);
+        return err;
+    }
+
+    // Grow the receive buffer to hold every form array after the payload,
+    // so the whole program is a single block
+    size_t forms_offset = FORMS_OFFSET(message_size);
+    char *block = realloc(buffer, forms_offset + count * sizeof(form_t));
+    if (!block)
+    {
+        free(buffer);
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    decoder_t decoder = {
+        .reader = {.cur = block + header->header_size, .end = block + message_size},
+        .zero_copy = 1,
+        .forms = (form_t *)(block + forms_offset),
+    };
+
+    err = __decode_program(header, &decoder, program);
+    program->block = block;
+    if (err)
+        parser_free_program(program);
+
+    return err;
+}
+
+/**
+ * Decode a complete message that lives in arena, zero-copy, with every
+ * form array and the symbol table carved out of the arena as well.
+ */
+static int __decode_message_in_arena(char *buffer, message_header_t *header, alloc_arena_t *arena, program_t *program)
+{
+    if (header->flags & SERIALIZER_FLAG_COMPRESSED)
+    {
+        int err = __inflate_message(buffer, header, arena, &buffer);
+        if (err)
+            return err;
+    }
+
+    size_t message_size = header->header_size + header->payload_size;
+    reader_t reader = {.cur = buffer + header->header_size, .end = buffer + message_size};
+    size_t count = 0;
+    int err = __count_forms(header, reader, &count);
+    if (err)
+        return err;
+
+    form_t *forms = alloc_arena_alloc(arena, count * sizeof(form_t));
+    if (!forms)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    decoder_t decoder = {.reader = reader, .zero_copy = 1, .forms = forms, .arena = arena};
+
+    err = __decode_program(header, &decoder, program);
+    program->arena = arena;
+    if (err)
+        parser_free_program(program);
+
+    return err;
+}
+
+int deserializer_deserialize(deserializer_t *deserializer, program_t *program)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    // Both headers start with 8 bytes, enough to tell the versions apart
+    char header_bytes[SERIALIZER_V2_HEADER_SIZE] = {0};
+    size_t header_size = sizeof(size_t);
+    int err = __read_all(deserializer->fd, header_bytes, header_size);
+    if (err)
+        return err;
+
+    if (memcmp(header_bytes, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE) == 0)
+    {
+        err = __read_all(deserializer->fd, header_bytes + header_size, SERIALIZER_V2_HEADER_SIZE - header_size);
+        if (err)
+            return err;
+        header_size = SERIALIZER_V2_HEADER_SIZE;
+    }
+
+    message_header_t header;
+    err = __read_header(header_bytes, header_size, &header);
+    if (err)
+        return err;
+
+    size_t message_size = header.header_size + header.payload_size;
+    alloc_arena_t *arena = deserializer->arena;
+    char *buffer = arena ? alloc_arena_alloc(arena, message_size) : malloc(message_size);
+    if (!buffer)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    memcpy(buffer, header_bytes, header.header_size);
+    err = __read_all(deserializer->fd, buffer + header.header_size, header.payload_size);
+    if (err)
+    {
+        if (!arena)
+            free(buffer);
+        return err;
+    }
+
+    if (arena)
+        return __decode_message_in_arena(buffer, &header, arena, program);
+
+    return __decode_message(buffer, &header, deserializer->flags, program);
+}
+
+int deserializer_deserialize_from_buffer(char *buf, size_t len, program_t *program)
+{
+    if (!buf)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    message_header_t header;
+    int err = __read_header(buf, len, &header);
+    if (err)
+        return err;
+    if (header.payload_size > len - header.header_size)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    if (header.flags & SERIALIZER_FLAG_COMPRESSED)
+    {
+        char *inflated;
+        err = __inflate_message(buf, &header, NULL, &inflated);
+        if (err)
+            return err;
+        err = deserializer_deserialize_from_buffer(inflated, header.header_size + header.payload_size, program);
+        free(inflated);
+        return err;
+    }
+
+    decoder_t decoder = {
+        .reader = {.cur = buf + header.header_size, .end = buf + header.header_size + header.payload_size},
+        .zero_copy = 0,
+        .forms = NULL,
+    };
+
+    return __decode_program(&header, &decoder, program);
+}
+
+int deserializer_deserialize_in_place(char *buf, size_t len, program_t *program)
+{
+    if (!buf)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    message_header_t header;
+    int err = __read_header(buf, len, &header);
+    if (err)
+        return err;
+    if (header.payload_size > len - header.header_size)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    // Nothing in buf can be pointed at, the inflated copy becomes the block
+    if (header.flags & SERIALIZER_FLAG_COMPRESSED)
+    {
+        char *inflated;
+        err = __inflate_message(buf, &header, NULL, &inflated);
+        return err ? err : __decode_message(inflated, &header, DESERIALIZER_FLAG_ZERO_COPY, program);
+    }
+
+    reader_t reader = {.cur = buf + header.header_size, .end = buf + header.header_size + header.payload_size};
+    size_t count = 0;
+    err = __count_forms(&header, reader, &count);
+    if (err)
+        return err;
+
+    form_t *block = malloc(count ? count * sizeof(form_t) : 1);
+    if (!block)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    decoder_t decoder = {.reader = reader, .zero_copy = 1, .forms = block};
+
+    err = __decode_program(&header, &decoder, program);
+    program->block = block;
+    if (err)
+        parser_free_program(program);
+
+    return err;
+}
+
+/**
+ * Take up to n bytes into the message in progress. Returns 0 with the
+ * message handed over to decoding once it is complete.
+ */
+static int __feed(deserializer_t *deserializer, const char *buf, size_t n, size_t *consumed, program_t *program)
+{
+    *consumed = 0;
+
+    if (!deserializer->message)
+    {
+        // The first 8 bytes tell the version, which tells the header size
+        while (1)
+        {
+            if (deserializer->header_have == sizeof(size_t) &&
+                deserializer->header_need == sizeof(size_t) &&
+                memcmp(deserializer->header, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE) == 0)
+                deserializer->header_need = SERIALIZER_V2_HEADER_SIZE;
+
+            if (deserializer->header_have == deserializer->header_need)
+                break;
+            if (*consumed == n)
+                return DESERIALIZER_NEED_MORE;
+
+            size_t take = deserializer->header_need - deserializer->header_have;
+            if (take > n - *consumed)
+                take = n - *consumed;
+
+            memcpy(deserializer->header + deserializer->header_have, buf + *consumed, take);
+            deserializer->header_have += take;
+            *consumed += take;
+        }
+
+        message_header_t header;
+        int err = __read_header(deserializer->header, deserializer->header_have, &header);
+        if (err)
+        {
+            deserializer_free(deserializer);
+            return err;
+        }
+
+        deserializer->message_size = header.header_size + header.payload_size;
+        if (deserializer->arena)
+            deserializer->message = alloc_arena_alloc(deserializer->arena, deserializer->message_size);
+        else
+            deserializer->message = malloc(deserializer->message_size);
+        if (!deserializer->message)
+        {
+            deserializer_free(deserializer);
+            return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+        }
+
+        memcpy(deserializer->message, deserializer->header, header.header_size);
+        deserializer->message_have = header.header_size;
+    }
+
+    size_t take = deserializer->message_size - deserializer->message_have;
+    if (take > n - *consumed)
+        take = n - *consumed;
+
+    if (take > 0)
+    {
+        memcpy(deserializer->message + deserializer->message_have, buf + *consumed, take);
+        deserializer->message_have += take;
+        *consumed += take;
+    }
+
+    if (deserializer->message_have < deserializer->message_size)
+        return DESERIALIZER_NEED_MORE;
+
+    message_header_t header;
+    __read_header(deserializer->message, deserializer->message_size, &header);
+
+    // The message is handed over, the deserializer is ready for the next one
+    char *message = deserializer->message;
+    deserializer->message = NULL;
+    deserializer_free(deserializer);
+
+    if (deserializer->arena)
+        return __decode_message_in_arena(message, &header, deserializer->arena, program);
+
+    return __decode_message(message, &header, deserializer->flags, program);
+}
+
+int deserializer_feed(deserializer_t *deserializer, const char *buf, size_t n, size_t *consumed, program_t *program)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!buf && n > 0)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!consumed)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    return __feed(deserializer, buf, n, consumed, program);
+}
+
+int deserializer_try_deserialize(deserializer_t *deserializer, program_t *program)
+{
+    if (!deserializer)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    while (1)
+    {
+        // Ask for exactly what the current message still misses, so bytes
+        // of the next message stay in the socket for the next call
+        char *dst;
+        size_t want;
+        if (!deserializer->message)
+        {
+            dst = deserializer->header + deserializer->header_have;
+            want = deserializer->header_need - deserializer->header_have;
+        }
+        else
+        {
+            dst = deserializer->message + deserializer->message_have;
+            want = deserializer->message_size - deserializer->message_have;
+        }
+
+        ssize_t n = want ? read(deserializer->fd, dst, want) : 0;
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return DESERIALIZER_NEED_MORE;
+            return SERIALIZER_ERR_READ_FAILED;
+        }
+        if (n == 0 && want > 0)
+            return SERIALIZER_ERR_READ_FAILED;
+
+        // The bytes are already in place, feed only does the bookkeeping
+        if (!deserializer->message)
+            deserializer->header_have += (size_t)n;
+        else
+            deserializer->message_have += (size_t)n;
+
+        size_t consumed;
+        int err = __feed(deserializer, NULL, 0, &consumed, program);
+        if (err != DESERIALIZER_NEED_MORE)
+            return err;
+    }
+}
+
+static inline int __reader_varint(reader_t *reader, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (reader->cur >= reader->end)
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+
+        uint8_t byte = (uint8_t)*reader->cur++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return 0;
+        }
+    }
+
+    return SERIALIZER_ERR_MALFORMED_INPUT;
+}
+
+static inline int __reader_u32(reader_t *reader, uint32_t *value)
+{
+    if (reader->end - reader->cur < (ptrdiff_t)sizeof(uint32_t))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    uint32_t be;
+    memcpy(&be, reader->cur, sizeof(be));
+    *value = TO_BIG_ENDIAN_32(be);
+    reader->cur += sizeof(be);
+
+    return 0;
+}
+
+static inline int __reader_u64(reader_t *reader, uint64_t *value)
+{
+    if (reader->end - reader->cur < (ptrdiff_t)sizeof(uint64_t))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    uint64_t be;
+    memcpy(&be, reader->cur, sizeof(be));
+    *value = TO_BIG_ENDIAN_64(be);
+    reader->cur += sizeof(be);
+
+    return 0;
+}
+
+static inline int __reader_skip(reader_t *reader, uint64_t len)
+{
+    if (len > (uint64_t)(reader->end - reader->cur))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    reader->cur += len;
+
+    return 0;
+}
+
+// Every encoded form takes at least min_bytes, so a count above what is
+// left in the payload can be rejected before anything is allocated
+static inline int __reader_check_count(reader_t *reader, uint64_t count, size_t min_bytes)
+{
+    if (count > (uint64_t)(reader->end - reader->cur) / min_bytes)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    return 0;
+}
+
+static int __decoder_alloc_forms(decoder_t *decoder, size_t count, form_t **items)
+{
+    *items = NULL;
+    if (count == 0)
+        return 0;
+
+    if (decoder->forms)
+    {
+        *items = decoder->forms;
+        decoder->forms += count;
+        return 0;
+    }
+
+    *items = malloc(count * sizeof(form_t));
+    if (!*items)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    return 0;
+}
+
+static int __decoder_chars(decoder_t *decoder, uint64_t len, size_t *out_len, char **chars)
+{
+    reader_t *reader = &decoder->reader;
+    if (len > (uint64_t)(reader->end - reader->cur))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    if (decoder->zero_copy)
+    {
+        *chars = (char *)reader->cur;
+    }
+    else
+    {
+        *chars = decoder->chars;
+        memcpy(decoder->chars, reader->cur, len);
+        decoder->chars += len;
+    }
+
+    reader->cur += len;
+    *out_len = len;
+
+    return 0;
+}
+
+// Version 1: 4-byte enums, 8-byte sizes. The smallest form is an empty
+// list, its type and its count
+#define V1_MIN_FORM_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+static int __count_forms_v1(reader_t *reader, size_t *count, size_t depth)
+{
+    uint32_t form_type, atom_type, number_type;
+    uint64_t n;
+
+    int err = __reader_u32(reader, &form_type);
+    if (err)
+        return err;
+
+    switch (form_type)
+    {
+    case FORM_LIST:
+    {
+        err = depth > SERIALIZER_MAX_DEPTH ? SERIALIZER_ERR_MALFORMED_INPUT : 0;
+        err = err ? err : __reader_u64(reader, &n);
+        err = err ? err : __reader_check_count(reader, n, V1_MIN_FORM_SIZE);
+        if (err)
+            return err;
+
+        *count += n;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            err = __count_forms_v1(reader, count, depth + 1);
+            if (err)
+                return err;
+        }
+        return 0;
+    }
+    case FORM_ATOM:
+    {
+        err = __reader_u32(reader, &atom_type);
+        if (err)
+            return err;
+
+        switch (atom_type)
+        {
+        case ATOM_NUMBER:
+        {
+            err = __reader_u32(reader, &number_type);
+            return err ? err : __reader_skip(reader, sizeof(uint64_t));
+        }
+        case ATOM_STRING:
+        case ATOM_SYMBOL:
+        {
+            err = __reader_u64(reader, &n);
+            return err ? err : __reader_skip(reader, n);
+        }
+        }
+    }
+    }
+
+    return SERIALIZER_ERR_MALFORMED_INPUT;
+}
+
+static int __decode_form_v1(decoder_t *decoder, form_t *form, size_t depth)
+{
+    reader_t *reader = &decoder->reader;
+    uint32_t form_type, atom_type, number_type;
+    uint64_t n;
+
+    // Until proven to be a list there is nothing for parser_free_form to release
+    form->type = FORM_ATOM;
+
+    int err = __reader_u32(reader, &form_type);
+    if (err)
+        return err;
+
+    switch (form_type)
+    {
+    case FORM_LIST:
+    {
+        err = depth > SERIALIZER_MAX_DEPTH ? SERIALIZER_ERR_MALFORMED_INPUT : 0;
+        err = err ? err : __reader_u64(reader, &n);
+        err = err ? err : __reader_check_count(reader, n, V1_MIN_FORM_SIZE);
+        if (err)
+            return err;
+
+        form->type = FORM_LIST;
+        form->list.size = 0;
+        form->list.capacity = n;
+        err = __decoder_alloc_forms(decoder, n, &form->list.items);
+        if (err)
+            return err;
+
+        // Children are counted before decoding, so on failure the caller
+        // can release everything with parser_free_program
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            form->list.size++;
+            err = __decode_form_v1(decoder, &form->list.items[i], depth + 1);
+            if (err)
+                return err;
+        }
+
+        // Hashes are not part of the wire format, rebuild them bottom-up
+        form->list.hash = parser_list_hash(&form->list);
+        return 0;
+    }
+    case FORM_ATOM:
+    {
+        err = __reader_u32(reader, &atom_type);
+        if (err)
+            return err;
+
+        switch (atom_type)
+        {
+        case ATOM_NUMBER:
+        {
+            err = __reader_u32(reader, &number_type);
+            err = err ? err : __reader_u64(reader, &n);
+            if (err)
+                return err;
+
+            form->atom.type = ATOM_NUMBER;
+            if (number_type == NUMBER_INTEGER)
+            {
+                form->atom.num.type = NUMBER_INTEGER;
+                form->atom.num.integer = (int64_t)n;
+                return 0;
+            }
+            if (number_type == NUMBER_FLOAT)
+            {
+                form->atom.num.type = NUMBER_FLOAT;
+                memcpy(&form->atom.num.float_num, &n, sizeof(n));
+                return 0;
+            }
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+        }
+        case ATOM_STRING:
+        {
+            form->atom.type = ATOM_STRING;
+            err = __reader_u64(reader, &n);
+            return err ? err : __decoder_chars(decoder, n, &form->atom.str.len, &form->atom.str.chars);
+        }
+        case ATOM_SYMBOL:
+        {
+            form->atom.type = ATOM_SYMBOL;
+            err = __reader_u64(reader, &n);
+            return err ? err : __decoder_chars(decoder, n, &form->atom.sym.len, &form->atom.sym.chars);
+        }
+        }
+    }
+    }
+
+    return SERIALIZER_ERR_MALFORMED_INPUT;
+}
+
+static int __count_forms_v2(reader_t *reader, size_t *count, size_t depth)
+{
+    if (reader->cur >= reader->end)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    uint64_t n;
+    int err;
+    uint8_t tag = (uint8_t)*reader->cur++;
+    switch (tag)
+    {
+    case V2_TAG_LIST:
+    {
+        err = depth > SERIALIZER_MAX_DEPTH ? SERIALIZER_ERR_MALFORMED_INPUT : 0;
+        err = err ? err : __reader_varint(reader, &n);
+        err = err ? err : __reader_check_count(reader, n, 1);
+        if (err)
+            return err;
+
+        *count += n;
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            err = __count_forms_v2(reader, count, depth + 1);
+            if (err)
+                return err;
+        }
+        return 0;
+    }
+    case V2_TAG_INTEGER:
+    case V2_TAG_SYMBOL_REF:
+        return __reader_varint(reader, &n);
+    case V2_TAG_FLOAT:
+        return __reader_skip(reader, sizeof(double));
+    case V2_TAG_SYMBOL:
+    case V2_TAG_STRING:
+    {
+        err = __reader_varint(reader, &n);
+        return err ? err : __reader_skip(reader, n);
+    }
+    }
+
+    return SERIALIZER_ERR_MALFORMED_INPUT;
+}
+
+static int __decode_form_v2(decoder_t *decoder, form_t *form, size_t depth)
+{
+    reader_t *reader = &decoder->reader;
+    if (reader->cur >= reader->end)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    // Until proven to be a list there is nothing for parser_free_form to release
+    form->type = FORM_ATOM;
+
+    uint64_t n;
+    int err;
+    uint8_t tag = (uint8_t)*reader->cur++;
+    switch (tag)
+    {
+    case V2_TAG_LIST:
+    {
+        err = depth > SERIALIZER_MAX_DEPTH ? SERIALIZER_ERR_MALFORMED_INPUT : 0;
+        err = err ? err : __reader_varint(reader, &n);
+        err = err ? err : __reader_check_count(reader, n, 1);
+        if (err)
+            return err;
+
+        form->type = FORM_LIST;
+        form->list.size = 0;
+        form->list.capacity = n;
+        err = __decoder_alloc_forms(decoder, n, &form->list.items);
+        if (err)
+            return err;
+
+        // Children are counted before decoding, so on failure the caller
+        // can release everything with parser_free_program
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            form->list.size++;
+            err = __decode_form_v2(decoder, &form->list.items[i], depth + 1);
+            if (err)
+                return err;
+        }
+
+        form->list.hash = parser_list_hash(&form->list);
+        return 0;
+    }
+    case V2_TAG_INTEGER:
+    {
+        err = __reader_varint(reader, &n);
+        if (err)
+            return err;
+
+        form->atom.type = ATOM_NUMBER;
+        form->atom.num.type = NUMBER_INTEGER;
+        form->atom.num.integer = ZIGZAG_DECODE(n);
+        return 0;
+    }
+    case V2_TAG_FLOAT:
+    {
+        err = __reader_u64(reader, &n);
+        if (err)
+            return err;
+
+        form->atom.type = ATOM_NUMBER;
+        form->atom.num.type = NUMBER_FLOAT;
+        memcpy(&form->atom.num.float_num, &n, sizeof(n));
+        return 0;
+    }
+    case V2_TAG_SYMBOL:
+    {
+        form->atom.type = ATOM_SYMBOL;
+        err = __reader_varint(reader, &n);
+        return err ? err : __decoder_chars(decoder, n, &form->atom.sym.len, &form->atom.sym.chars);
+    }
+    case V2_TAG_STRING:
+    {
+        form->atom.type = ATOM_STRING;
+        err = __reader_varint(reader, &n);
+        return err ? err : __decoder_chars(decoder, n, &form->atom.str.len, &form->atom.str.chars);
+    }
+    case V2_TAG_SYMBOL_REF:
+    {
+        err = __reader_varint(reader, &n);
+        if (err)
+            return err;
+        if (n >= decoder->symbol_count)
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+
+        form->atom.type = ATOM_SYMBOL;
+        form->atom.sym = decoder->symbols[n];
+        return 0;
+    }
+    }
+
+    return SERIALIZER_ERR_MALFORMED_INPUT;
+}
+
+static int __read_program_size(message_header_t *header, reader_t *reader, uint64_t *size)
+{
+    if (header->version == SERIALIZER_VERSION_2)
+    {
+        int err = __reader_varint(reader, size);
+        return err ? err : __reader_check_count(reader, *size, 1);
+    }
+
+    int err = __reader_u64(reader, size);
+    return err ? err : __reader_check_count(reader, *size, V1_MIN_FORM_SIZE);
+}
+
+static int __skip_symbol_table(reader_t *reader)
+{
+    uint64_t count, len;
+    int err = __reader_varint(reader, &count);
+    err = err ? err : __reader_check_count(reader, count, 1);
+    for (uint64_t i = 0; !err && i < count; ++i)
+    {
+        err = __reader_varint(reader, &len);
+        err = err ? err : __reader_skip(reader, len);
+    }
+
+    return err;
+}
+
+/**
+ * Read the symbol table into decoder->symbols. Zero-copy decoding points
+ * the names into the payload; otherwise they are copied into the
+ * decoder's chars like any other string.
+ */
+static int __decoder_read_symbols(decoder_t *decoder)
+{
+    reader_t *reader = &decoder->reader;
+    reader_t table = *reader;
+    uint64_t count, len = 0;
+    int err = __reader_varint(reader, &count);
+    err = err ? err : __reader_check_count(reader, count, 1);
+    if (err)
+        return err;
+
+    // One pass to validate the table, one to fill it
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        err = __reader_varint(reader, &len);
+        err = err ? err : __reader_skip(reader, len);
+        if (err)
+            return err;
+    }
+
+    size_t symbols_size = count ? count * sizeof(symbol_t) : 1;
+    decoder->symbols = decoder->arena ? alloc_arena_alloc(decoder->arena, symbols_size) : malloc(symbols_size);
+    if (!decoder->symbols)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+    decoder->symbol_count = count;
+
+    __reader_varint(&table, &count);
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        __reader_varint(&table, &len);
+        decoder->symbols[i].len = len;
+        if (!decoder->zero_copy)
+        {
+            memcpy(decoder->chars, table.cur, len);
+            decoder->symbols[i].chars = decoder->chars;
+            decoder->chars += len;
+        }
+        else
+        {
+            decoder->symbols[i].chars = (char *)table.cur;
+        }
+        table.cur += len;
+    }
+
+    return 0;
+}
+
+static int __count_forms(message_header_t *header, reader_t reader, size_t *count)
+{
+    if (header->flags & SERIALIZER_FLAG_SYMBOL_TABLE)
+    {
+        int err = __skip_symbol_table(&reader);
+        if (err)
+            return err;
+    }
+
+    uint64_t size;
+    int err = __read_program_size(header, &reader, &size);
+    if (err)
+        return err;
+
+    *count = size;
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        if (header->version == SERIALIZER_VERSION_2)
+            err = __count_forms_v2(&reader, count, 1);
+        else
+            err = __count_forms_v1(&reader, count, 1);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
+static int __decode_forms(message_header_t *header, decoder_t *decoder, program_t *program)
+{
+    uint64_t size;
+    int err = __read_program_size(header, &decoder->reader, &size);
+    if (err)
+        return err;
+
+    err = __decoder_alloc_forms(decoder, size, &program->items);
+    if (err)
+        return err;
+    program->capacity = size;
+
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        program->size++;
+        if (header->version == SERIALIZER_VERSION_2)
+            err = __decode_form_v2(decoder, &program->items[i], 1);
+        else
+            err = __decode_form_v1(decoder, &program->items[i], 1);
+        if (err)
+            return err;
+    }
+
+    return 0;
+}
+
+static int __decode_program(message_header_t *header, decoder_t *decoder, program_t *program)
+{
+    program->items = NULL;
+    program->size = 0;
+    program->capacity = 0;
+    program->block = NULL;
+    program->chars = NULL;
+    program->arena = NULL;
+
+    decoder->symbols = NULL;
+    decoder->symbol_count = 0;
+
+    // Every string lies somewhere in the payload, so a block the size of
+    // what is left of it holds all of their copies
+    if (!decoder->zero_copy)
+    {
+        size_t remaining = (size_t)(decoder->reader.end - decoder->reader.cur);
+        program->chars = malloc(remaining ? remaining : 1);
+        if (!program->chars)
+            return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+        decoder->chars = program->chars;
+    }
+
+    int err = 0;
+    if (header->flags & SERIALIZER_FLAG_SYMBOL_TABLE)
+        err = __decoder_read_symbols(decoder);
+    err = err ? err : __decode_forms(header, decoder, program);
+
+    // Atoms hold copies of the entries, only the names are shared
+    if (!decoder->arena)
+        free(decoder->symbols);
+    decoder->symbols = NULL;
+
+    return err;
+}
+
+/**
+ * The trailer of an indexed message, checked against the payload so
+ * that following an offset from it never leaves the payload.
+ */
+typedef struct
+{
+    const char *payload;
+    uint64_t trailer_offset;
+    uint64_t form_count;
+    uint64_t list_count;
+    // Item offsets lie between the form offsets and the directory
+    uint64_t children_offset;
+    uint64_t directory_offset;
+} form_index_reader_t;
+
+static inline uint64_t __index_u64(form_index_reader_t *index, uint64_t offset)
+{
+    uint64_t be;
+    memcpy(&be, index->payload + offset, sizeof(be));
+    return TO_BIG_ENDIAN_64(be);
+}
+
+static int __read_form_index(const char *payload, size_t payload_size, form_index_reader_t *index)
+{
+    if (payload_size < FORM_INDEX_FOOTER_SIZE)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    index->payload = payload;
+    uint64_t footer = payload_size - FORM_INDEX_FOOTER_SIZE;
+    index->list_count = __index_u64(index, footer);
+    index->form_count = __index_u64(index, footer + sizeof(uint64_t));
+    index->trailer_offset = __index_u64(index, footer + 2 * sizeof(uint64_t));
+
+    // Both tables have to fit between the forms and the footer
+    if (index->trailer_offset > footer)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    uint64_t room = footer - index->trailer_offset;
+    if (index->form_count > room / sizeof(uint64_t))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    room -= index->form_count * sizeof(uint64_t);
+    if (index->list_count > room / (2 * sizeof(uint64_t)))
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    index->children_offset = index->trailer_offset + index->form_count * sizeof(uint64_t);
+    index->directory_offset = footer - index->list_count * 2 * sizeof(uint64_t);
+
+    return 0;
+}
+
+/**
+ * Find the offset of item n of the list at offset and depth, through the
+ * list's own offsets when it has them and by skipping the items before
+ * it otherwise.
+ */
+static int __form_index_item(form_index_reader_t *index, uint64_t offset, size_t depth, size_t n, uint64_t *item)
+{
+    reader_t reader = {.cur = index->payload + offset, .end = index->payload + index->trailer_offset};
+    if (reader.cur >= reader.end)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    if ((uint8_t)*reader.cur++ != V2_TAG_LIST)
+        return SERIALIZER_ERR_INDEX_OUT_OF_BOUNDS;
+
+    uint64_t size;
+    int err = __reader_varint(&reader, &size);
+    if (err)
+        return err;
+    if (n >= size)
+        return SERIALIZER_ERR_INDEX_OUT_OF_BOUNDS;
+
+    // The directory is sorted by list offset
+    size_t lo = 0, hi = index->list_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (__index_u64(index, index->directory_offset + mid * 2 * sizeof(uint64_t)) < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint64_t entry = index->directory_offset + lo * 2 * sizeof(uint64_t);
+    if (lo < index->list_count && __index_u64(index, entry) == offset)
+    {
+        uint64_t children = __index_u64(index, entry + sizeof(uint64_t));
+        if (children < index->children_offset || children > index->directory_offset ||
+            (index->directory_offset - children) / sizeof(uint64_t) < size)
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+
+        *item = __index_u64(index, children + n * sizeof(uint64_t));
+        return *item < index->trailer_offset ? 0 : SERIALIZER_ERR_MALFORMED_INPUT;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t ignored = 0;
+        err = __count_forms_v2(&reader, &ignored, depth + 1);
+        if (err)
+            return err;
+    }
+
+    *item = (uint64_t)(reader.cur - index->payload);
+    return 0;
+}
+
+int deserializer_get_form_at(char *buf, size_t len, const size_t *path, size_t depth, program_t *program)
+{
+    if (!buf)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!path || depth == 0)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    message_header_t header;
+    int err = __read_header(buf, len, &header);
+    if (err)
+        return err;
+    if (header.payload_size > len - header.header_size)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    if (!(header.flags & SERIALIZER_FLAG_FORM_INDEX) || (header.flags & SERIALIZER_FLAG_COMPRESSED))
+        return SERIALIZER_ERR_NO_INDEX;
+
+    form_index_reader_t index;
+    err = __read_form_index(buf + header.header_size, header.payload_size, &index);
+    if (err)
+        return err;
+    if (path[0] >= index.form_count)
+        return SERIALIZER_ERR_INDEX_OUT_OF_BOUNDS;
+
+    uint64_t offset = __index_u64(&index, index.trailer_offset + path[0] * sizeof(uint64_t));
+    if (offset >= index.trailer_offset)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    for (size_t i = 1; i < depth; ++i)
+    {
+        err = __form_index_item(&index, offset, i, path[i], &offset);
+        if (err)
+            return err;
+    }
+
+    // Size the block for this subtree alone
+    reader_t reader = {.cur = index.payload + offset, .end = index.payload + index.trailer_offset};
+    size_t count = 1;
+    err = __count_forms_v2(&reader, &count, depth);
+    if (err)
+        return err;
+
+    form_t *block = malloc(count * sizeof(form_t));
+    if (!block)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    program->items = NULL;
+    program->size = 0;
+    program->capacity = 0;
+    program->block = block;
+    program->chars = NULL;
+    program->arena = NULL;
+
+    decoder_t decoder = {
+        .reader = {.cur = index.payload, .end = index.payload + index.trailer_offset},
+        .zero_copy = 1,
+        .forms = block,
+    };
+
+    if (header.flags & SERIALIZER_FLAG_SYMBOL_TABLE)
+        err = __decoder_read_symbols(&decoder);
+    decoder.reader.cur = index.payload + offset;
+
+    err = err ? err : __decoder_alloc_forms(&decoder, 1, &program->items);
+    if (!err)
+    {
+        program->size = 1;
+        program->capacity = 1;
+        err = __decode_form_v2(&decoder, &program->items[0], depth);
+    }
+
+    free(decoder.symbols);
+    if (err)
+        parser_free_program(program);
+
+    return err;
+}
+
+int deserializer_get_form(char *buf, size_t len, size_t n, program_t *program)
+{
+    return deserializer_get_form_at(buf, len, &n, 1, program);
+}
+
+// Delta
+#define DELTA_OP_SPLICE 0
+#define DELTA_OP_PATCH 1
+
+// How many items ahead the diff looks for a form that was only moved by
+// an insertion or a removal, before calling it a replacement
+#define DELTA_LOOKAHEAD 32
+
+/**
+ * One edit of a list: replace remove old items from index with insert
+ * new items from insert_at, or patch the list at index in place with
+ * the edits between it and the new list at insert_at.
+ */
+typedef struct
+{
+    uint8_t kind;
+    size_t index;
+    size_t remove;
+    size_t insert_at;
+    size_t insert;
+} delta_op_t;
+
+typedef DYNARRAY(delta_op_t) delta_ops_t;
+
+static int __delta_push(delta_ops_t *ops, delta_op_t op)
+{
+    // Neighbouring splices are a single one
+    delta_op_t *last = ops->size > 0 ? &ops->items[ops->size - 1] : NULL;
+    if (op.kind == DELTA_OP_SPLICE && last && last->kind == DELTA_OP_SPLICE &&
+        last->index + last->remove == op.index && last->insert_at + last->insert == op.insert_at)
+    {
+        last->remove += op.remove;
+        last->insert += op.insert;
+        return 0;
+    }
+
+    size_t before = ops->size;
+    DYNARRAY_PUSH(*ops, op, delta_op_t);
+    return ops->size == before ? SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED : 0;
+}
+
+// Where hash shows up in hashes[from, from + DELTA_LOOKAHEAD), or SIZE_MAX
+static size_t __delta_find(const uint64_t *hashes, size_t size, size_t from, uint64_t hash)
+{
+    for (size_t i = from; i < size && i < from + DELTA_LOOKAHEAD; ++i)
+    {
+        if (hashes[i] == hash)
+            return i;
+    }
+
+    return SIZE_MAX;
+}
+
+/**
+ * What a splice must find in the list it edits: the items it removes and
+ * the one after them, so a delta applied twice or to another version of
+ * the list is refused even when the sizes happen to match.
+ */
+static uint64_t __delta_context(form_t *items, size_t size, size_t index, size_t remove)
+{
+    uint64_t hash = 0;
+    size_t end = index + remove < size ? index + remove + 1 : size;
+    for (size_t k = index; k < end; ++k)
+        hash = hash_combine(hash, parser_form_hash(&items[k]));
+
+    return hash_combine(hash, remove);
+}
+
+/**
+ * Line up the old and new items by hash, walking both at once: equal
+ * items are kept, an item found a little further on the other side means
+ * the ones in between were inserted or removed, and an item that changed
+ * in place (its neighbours line up) is patched if both are lists and
+ * replaced otherwise.
+ */
+static int __delta_align(form_t *old, size_t old_size, form_t *new, size_t new_size, delta_ops_t *ops)
+{
+    uint64_t *hashes = malloc((old_size + new_size + 1) * sizeof(uint64_t));
+    if (!hashes)
+        return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+
+    uint64_t *old_hashes = hashes, *new_hashes = hashes + old_size;
+    for (size_t i = 0; i < old_size; ++i)
+        old_hashes[i] = parser_form_hash(&old[i]);
+    for (size_t j = 0; j < new_size; ++j)
+        new_hashes[j] = parser_form_hash(&new[j]);
+
+    int err = 0;
+    size_t i = 0, j = 0;
+    while (!err && i < old_size && j < new_size)
+    {
+        if (old_hashes[i] == new_hashes[j])
+        {
+            i++;
+            j++;
+            continue;
+        }
+
+        // In repetitive code the old item also shows up a little further,
+        // matching neighbours tell a change in place from an insertion
+        int next_matches = i + 1 == old_size || j + 1 == new_size || old_hashes[i + 1] == new_hashes[j + 1];
+        size_t in_old = next_matches ? SIZE_MAX : __delta_find(old_hashes, old_size, i + 1, new_hashes[j]);
+        size_t in_new = next_matches ? SIZE_MAX : __delta_find(new_hashes, new_size, j + 1, old_hashes[i]);
+        if (in_old == SIZE_MAX && in_new == SIZE_MAX)
+        {
+            uint8_t kind = old[i].type == FORM_LIST && new[j].type == FORM_LIST ? DELTA_OP_PATCH : DELTA_OP_SPLICE;
+            err = __delta_push(ops, (delta_op_t){.kind = kind, .index = i, .remove = 1, .insert_at = j, .insert = 1});
+            i++;
+            j++;
+        }
+        else if (in_new != SIZE_MAX && (in_old == SIZE_MAX || in_new - j <= in_old - i))
+        {
+            err = __delta_push(ops, (delta_op_t){.kind = DELTA_OP_SPLICE, .index = i, .insert_at = j, .insert = in_new - j});
+            j = in_new;
+        }
+        else
+        {
+            err = __delta_push(ops, (delta_op_t){.kind = DELTA_OP_SPLICE, .index = i, .remove = in_old - i, .insert_at = j});
+            i = in_old;
+        }
+    }
+
+    if (!err && (i < old_size || j < new_size))
+        err = __delta_push(ops, (delta_op_t){.kind = DELTA_OP_SPLICE, .index = i, .remove = old_size - i, .insert_at = j, .insert = new_size - j});
+
+    free(hashes);
+    return err;
+}
+
+static int __encode_delta(form_t *old, size_t old_size, form_t *new, size_t new_size, writer_t *writer)
+{
+    delta_ops_t ops = {0};
+    int err = __delta_align(old, old_size, new, new_size, &ops);
+    err = err ? err : __writer_write_varint(writer, ops.size);
+
+    for (size_t k = 0; !err && k < ops.size; ++k)
+    {
+        delta_op_t *op = &ops.items[k];
+        err = __writer_write_u8(writer, op->kind);
+        err = err ? err : __writer_write_varint(writer, op->index);
+        if (err)
+            break;
+
+        if (op->kind == DELTA_OP_PATCH)
+        {
+            list_t *from = &old[op->index].list, *to = &new[op->insert_at].list;
+            err = __writer_write_u64(writer, from->hash);
+            err = err ? err : __writer_write_u64(writer, to->hash);
+            err = err ? err : __encode_delta(from->items, from->size, to->items, to->size, writer);
+            continue;
+        }
+
+        err = __writer_write_varint(writer, op->remove);
+        err = err ? err : __writer_write_varint(writer, op->insert);
+        err = err ? err : __writer_write_u64(writer, __delta_context(old, old_size, op->index, op->remove));
+        for (size_t n = 0; !err && n < op->insert; ++n)
+            err = __encode_form_v2(&new[op->insert_at + n], NULL, writer);
+    }
+
+    DYNARRAY_FREE(ops);
+    return err;
+}
+
+int serializer_diff(program_t *from, program_t *to, char **out, size_t *written)
+{
+    if (!from)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!to)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!out)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!written)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    serializer_options_t options = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_DELTA};
+    writer_t writer = {.fd = -1, .growable = 1};
+    int err = __encode_header_v2(&options, &writer, 0);
+    err = err ? err : __writer_write_varint(&writer, from->size);
+    err = err ? err : __encode_delta(from->items, from->size, to->items, to->size, &writer);
+    if (err)
+    {
+        free(writer.buffer);
+        return err;
+    }
+
+    uint64_t be = TO_BIG_ENDIAN_64(writer.used - SERIALIZER_V2_HEADER_SIZE);
+    memcpy(writer.buffer + SERIALIZER_V2_HEADER_SIZE - sizeof(be), &be, sizeof(be));
+
+    *out = writer.buffer;
+    *written = writer.used;
+    return 0;
+}
+
+/**
+ * Walk the edits of one list without touching it, so a delta that does
+ * not fit the program is refused before anything changed. depth is the
+ * one of the items, 1 for the top-level forms.
+ */
+static int __check_delta(reader_t *reader, form_t *items, size_t size, size_t depth)
+{
+    uint64_t count;
+    int err = __reader_varint(reader, &count);
+    err = err ? err : __reader_check_count(reader, count, 2);
+    if (err)
+        return err;
+
+    // Edits come in order and never overlap
+    uint64_t next = 0;
+    for (uint64_t k = 0; k < count; ++k)
+    {
+        if (reader->cur >= reader->end)
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+        uint8_t kind = (uint8_t)*reader->cur++;
+
+        uint64_t index;
+        err = __reader_varint(reader, &index);
+        if (err)
+            return err;
+        if (index < next || index > size)
+            return SERIALIZER_ERR_DELTA_MISMATCH;
+
+        if (kind == DELTA_OP_PATCH)
+        {
+            uint64_t old_hash, new_hash;
+            err = __reader_u64(reader, &old_hash);
+            err = err ? err : __reader_u64(reader, &new_hash);
+            if (err)
+                return err;
+            if (index == size || items[index].type != FORM_LIST || items[index].list.hash != old_hash)
+                return SERIALIZER_ERR_DELTA_MISMATCH;
+
+            err = __check_delta(reader, items[index].list.items, items[index].list.size, depth + 1);
+            if (err)
+                return err;
+            next = index + 1;
+            continue;
+        }
+        if (kind != DELTA_OP_SPLICE)
+            return SERIALIZER_ERR_MALFORMED_INPUT;
+
+        uint64_t remove, insert, context;
+        err = __reader_varint(reader, &remove);
+        err = err ? err : __reader_varint(reader, &insert);
+        err = err ? err : __reader_u64(reader, &context);
+        err = err ? err : __reader_check_count(reader, insert, 1);
+        if (err)
+            return err;
+        if (remove > size - index || __delta_context(items, size, index, remove) != context)
+            return SERIALIZER_ERR_DELTA_MISMATCH;
+
+        size_t forms = 0;
+        for (uint64_t n = 0; n < insert; ++n)
+        {
+            err = __count_forms_v2(reader, &forms, depth);
+            if (err)
+                return err;
+        }
+        next = index + remove;
+    }
+
+    return 0;
+}
+
+/**
+ * Apply the edits of one list, which __check_delta already accepted, to
+ * the items array of a list or of the program. Only running out of
+ * memory can fail here, and the items stay releasable when it does.
+ */
+static int __apply_delta(decoder_t *decoder, form_t **items, size_t *size, size_t *capacity, size_t depth)
+{
+    reader_t *reader = &decoder->reader;
+    uint64_t count = 0;
+    __reader_varint(reader, &count);
+
+    // Positions in the delta are in the old list, earlier splices move them
+    size_t shift_up = 0, shift_down = 0;
+    for (uint64_t k = 0; k < count; ++k)
+    {
+        uint8_t kind = (uint8_t)*reader->cur++;
+        uint64_t index = 0;
+        __reader_varint(reader, &index);
+        size_t at = (size_t)index + shift_up - shift_down;
+
+        if (kind == DELTA_OP_PATCH)
+        {
+            uint64_t old_hash = 0, new_hash = 0;
+            __reader_u64(reader, &old_hash);
+            __reader_u64(reader, &new_hash);
+
+            list_t *list = &(*items)[at].list;
+            int err = __apply_delta(decoder, &list->items, &list->size, &list->capacity, depth + 1);
+            if (err)
+                return err;
+            list->hash = new_hash;
+            continue;
+        }
+
+        uint64_t remove = 0, insert = 0, context;
+        __reader_varint(reader, &remove);
+        __reader_varint(reader, &insert);
+        __reader_u64(reader, &context);
+
+        size_t new_size = *size - remove + insert;
+        if (new_size > *capacity)
+        {
+            form_t *grown = realloc(*items, new_size * sizeof(form_t));
+            if (!grown)
+                return SERIALIZER_ERR_MEMORY_ALLOCATION_FAILED;
+            *items = grown;
+            *capacity = new_size;
+        }
+
+        for (uint64_t n = 0; n < remove; ++n)
+            parser_free_form(&(*items)[at + n]);
+        size_t tail = *size - at - remove;
+        if (tail > 0 && insert != remove)
+            memmove(&(*items)[at + insert], &(*items)[at + remove], tail * sizeof(form_t));
+        *size = new_size;
+
+        // Placeholders first, so a failed decode leaves nothing dangling
+        for (uint64_t n = 0; n < insert; ++n)
+        {
+            (*items)[at + n].type = FORM_ATOM;
+            (*items)[at + n].atom.type = ATOM_NUMBER;
+            (*items)[at + n].atom.num.type = NUMBER_INTEGER;
+            (*items)[at + n].atom.num.integer = 0;
+        }
+        for (uint64_t n = 0; n < insert; ++n)
+        {
+            int err = __decode_form_v2(decoder, &(*items)[at + n], depth);
+            if (err)
+                return err;
+        }
+
+        shift_up += insert;
+        shift_down += remove;
+    }
+
+    return 0;
+}
+
+int serializer_patch(program_t *program, char *delta, size_t len)
+{
+    if (!program)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    if (!delta)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+    // Forms in a shared block can not be released or grown one by one
+    if (program->block || program->arena)
+        return SERIALIZER_ERR_INVALID_ARGUMENT;
+
+    if (len < SERIALIZER_V2_HEADER_SIZE || memcmp(delta, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE) != 0)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+    if ((uint8_t)delta[SERIALIZER_MAGIC_SIZE] != SERIALIZER_VERSION_2 ||
+        (uint8_t)delta[SERIALIZER_MAGIC_SIZE + 1] != SERIALIZER_FLAG_DELTA)
+        return SERIALIZER_ERR_UNSUPPORTED_VERSION;
+
+    uint64_t payload_size;
+    BIG_ENDIAN_READ((delta + SERIALIZER_V2_HEADER_SIZE - sizeof(uint64_t)), payload_size, uint64_t);
+    if (payload_size > len - SERIALIZER_V2_HEADER_SIZE)
+        return SERIALIZER_ERR_MALFORMED_INPUT;
+
+    reader_t reader = {.cur = delta + SERIALIZER_V2_HEADER_SIZE, .end = delta + SERIALIZER_V2_HEADER_SIZE + payload_size};
+    uint64_t base_size;
+    int err = __reader_varint(&reader, &base_size);
+    if (err)
+        return err;
+    if (base_size != program->size)
+        return SERIALIZER_ERR_DELTA_MISMATCH;
+
+    reader_t check = reader;
+    err = __check_delta(&check, program->items, program->size, 1);
+    if (err)
+        return err;
+
+    // Inserted lists get their own arrays, like everything else in the
+    // program, and their strings point into the delta
+    decoder_t decoder = {.reader = reader, .zero_copy = 1, .forms = NULL};
+
+    return __apply_delta(&decoder, &program->items, &program->size, &program->capacity, 1);
 }
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "walk.h"
+#include "io.h"
+
+// What getdents64 fills the buffer with, glibc does not declare it
+typedef struct
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} walk_dirent_t;
+
+#define WALK_DT_UNKNOWN 0
+#define WALK_DT_DIR 4
+#define WALK_DT_REG 8
+#define WALK_DT_LNK 10
+
+// Append "dir/name" (or only dir when name is NULL) with its NUL
+static int __walk_push_path(walk_chars_t *chars, char *dir, size_t dir_len, char *name, size_t name_len, size_t *offset)
+{
+    size_t needed = dir_len + (name ? 1 + name_len : 0) + 1;
+    if (chars->size + needed > chars->capacity)
+    {
+        size_t new_capacity = chars->capacity ? chars->capacity : 4096;
+        while (chars->size + needed > new_capacity)
+            new_capacity *= 2;
+
+        char *new_items = realloc(chars->items, new_capacity);
+        if (!new_items)
+            return WALK_ERR_MEMORY_ALLOCATION_FAILED;
+        chars->items = new_items;
+        chars->capacity = new_capacity;
+    }
+
+    *offset = chars->size;
+    char *out = chars->items + chars->size;
+    memcpy(out, dir, dir_len);
+    if (name)
+    {
+        out[dir_len] = '/';
+        memcpy(out + dir_len + 1, name, name_len);
+    }
+    out[needed - 1] = '\0';
+    chars->size += needed;
+
+    return 0;
+}
+
+static int __walk_push_entry(walk_list_t *list, char *dir, size_t dir_len, char *name, size_t name_len, size_t size)
+{
+    walk_entry_t entry = {0};
+    int err = __walk_push_path(&list->names, dir, dir_len, name, name_len, &entry.name);
+    if (err)
+        return err;
+
+    size_t before = list->entries.size;
+    entry.size = size;
+    DYNARRAY_PUSH(list->entries, entry, walk_entry_t);
+    if (list->entries.size == before)
+        return WALK_ERR_MEMORY_ALLOCATION_FAILED;
+
+    return 0;
+}
+
+static int __walk_has_suffix(char *name, size_t len, char *suffix)
+{
+    if (!suffix)
+        return 1;
+
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && memcmp(name + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+// Add the files of one open directory, queueing its subdirectories in dirs
+static int __walk_read_directory(walk_list_t *list, int fd, char *dir, walk_chars_t *dirs, char *buf, char *suffix)
+{
+    size_t dir_len = strlen(dir);
+    // Keep "/" from becoming "//name"
+    if (dir_len > 0 && dir[dir_len - 1] == '/')
+        dir_len--;
+
+    while (1)
+    {
+        long n = syscall(SYS_getdents64, fd, buf, WALK_DENTS_BUFFER_SIZE);
+        if (n < 0)
+            return WALK_ERR_FAILED_TO_READ_DIRECTORY;
+        if (n == 0)
+            return 0;
+
+        for (long pos = 0; pos < n;)
+        {
+            walk_dirent_t *dent = (walk_dirent_t *)(buf + pos);
+            pos += dent->d_reclen;
+
+            char *name = dent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            size_t name_len = strlen(name);
+
+            // Links and file systems without d_type need a stat to tell
+            struct stat st;
+            int type = dent->d_type;
+            int have_stat = 0;
+            if (type == WALK_DT_UNKNOWN || type == WALK_DT_LNK)
+            {
+                if (fstatat(fd, name, &st, 0) != 0)
+                    continue;
+                have_stat = 1;
+
+                if (S_ISREG(st.st_mode))
+                    type = WALK_DT_REG;
+                else if (S_ISDIR(st.st_mode) && dent->d_type == WALK_DT_UNKNOWN)
+                    type = WALK_DT_DIR;
+                else
+                    continue;
+            }
+
+            int err = 0;
+            if (type == WALK_DT_DIR)
+            {
+                size_t offset;
+                err = __walk_push_path(dirs, dir, dir_len, name, name_len, &offset);
+            }
+            else if (type == WALK_DT_REG && __walk_has_suffix(name, name_len, suffix))
+            {
+                if (!have_stat && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                    return WALK_ERR_FAILED_TO_STAT;
+                err = __walk_push_entry(list, dir, dir_len, name, name_len, st.st_size);
+            }
+            if (err)
+                return err;
+        }
+    }
+}
+
+static int __walk_directory(walk_list_t *list, char *root, char *suffix)
+{
+    // Directories still to read, as NUL-terminated paths one after the
+    // other; the last one is taken first, which is a depth-first walk
+    walk_chars_t dirs = {0};
+    size_t offset;
+    int err = __walk_push_path(&dirs, root, strlen(root), NULL, 0, &offset);
+    if (err)
+        return err;
+
+    char *buf = malloc(WALK_DENTS_BUFFER_SIZE);
+    if (!buf)
+    {
+        DYNARRAY_FREE(dirs);
+        return WALK_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    while (dirs.size && !err)
+    {
+        // Find the start of the last path and take it off the stack
+        size_t start = dirs.size - 1;
+        while (start > 0 && dirs.items[start - 1] != '\0')
+            start--;
+
+        char *dir = strdup(dirs.items + start);
+        dirs.size = start;
+        if (!dir)
+        {
+            err = WALK_ERR_MEMORY_ALLOCATION_FAILED;
+            break;
+        }
+
+        int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            err = WALK_ERR_FAILED_TO_OPEN;
+        else
+        {
+            err = __walk_read_directory(list, fd, dir, &dirs, buf, suffix);
+            close(fd);
+        }
+        free(dir);
+    }
+
+    free(buf);
+    DYNARRAY_FREE(dirs);
+
+    return err;
+}
+
+int walk_init(walk_list_t *list)
+{
+    if (!list)
+        return WALK_ERR_INVALID_ARGUMENT;
+
+    *list = (walk_list_t){0};
+
+    return 0;
+}
+
+int walk_add_path(walk_list_t *list, char *path, char *suffix)
+{
+    if (!list)
+        return WALK_ERR_INVALID_ARGUMENT;
+    if (!path)
+        return WALK_ERR_INVALID_ARGUMENT;
+
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return WALK_ERR_FAILED_TO_STAT;
+
+    if (S_ISDIR(st.st_mode))
+        return __walk_directory(list, path, suffix);
+
+    // Files named explicitly are taken whatever their suffix
+    return __walk_push_entry(list, path, strlen(path), NULL, 0, st.st_size);
+}
+
+int walk_add_manifest(walk_list_t *list, char *manifest, char *suffix)
+{
+    if (!list)
+        return WALK_ERR_INVALID_ARGUMENT;
+    if (!manifest)
+        return WALK_ERR_INVALID_ARGUMENT;
+
+    io_str_t content = {0};
+    if (io_load_file_into_memory(manifest, &content) != 0)
+        return WALK_ERR_FAILED_TO_READ_MANIFEST;
+
+    int err = 0;
+    char *line = content.data;
+    char *end = content.data + content.size;
+    while (line < end && !err)
+    {
+        char *eol = memchr(line, '\n', end - line);
+        if (!eol)
+            eol = end;
+
+        // The buffer is ours, so the line can be terminated in place
+        char *last = eol;
+        while (last > line && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t'))
+            last--;
+        *last = '\0';
+
+        if (last > line && line[0] != '#')
+            err = walk_add_path(list, line, suffix);
+
+        line = eol + 1;
+    }
+
+    io_free_string(&content);
+
+    return err;
+}
+
+int walk_add_argument(walk_list_t *list, char *arg, char *suffix)
+{
+    if (!arg)
+        return WALK_ERR_INVALID_ARGUMENT;
+
+    if (arg[0] == '@')
+        return walk_add_manifest(list, arg + 1, suffix);
+
+    return walk_add_path(list, arg, suffix);
+}
+
+static int __walk_compare(const void *a, const void *b)
+{
+    const walk_entry_t *e1 = (const walk_entry_t *)a;
+    const walk_entry_t *e2 = (const walk_entry_t *)b;
+
+    if (e1->size != e2->size)
+        return e1->size > e2->size ? -1 : 1;
+
+    return strcmp(e1->path, e2->path);
+}
+
+int walk_sort(walk_list_t *list)
+{
+    if (!list)
+        return WALK_ERR_INVALID_ARGUMENT;
+
+    size_t count = list->entries.size;
+    char **paths = malloc((count ? count : 1) * sizeof(char *));
+    if (!paths)
+        return WALK_ERR_MEMORY_ALLOCATION_FAILED;
+
+    // The names buffer is final now, so the offsets can become pointers
+    for (size_t i = 0; i < count; ++i)
+        list->entries.items[i].path = list->names.items + list->entries.items[i].name;
+
+    if (count)
+        qsort(list->entries.items, count, sizeof(walk_entry_t), __walk_compare);
+
+    for (size_t i = 0; i < count; ++i)
+        paths[i] = list->entries.items[i].path;
+
+    free(list->paths);
+    list->paths = paths;
+    list->count = count;
+
+    return 0;
+}
+
+int walk_free(walk_list_t *list)
+{
+    if (!list)
+        return WALK_ERR_INVALID_ARGUMENT;
+
+    DYNARRAY_FREE(list->entries);
+    DYNARRAY_FREE(list->names);
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+
+    return 0;
+}
@@ -8,6 +8,7 @@ int should_be_able_to_init_a_context(void);
 int should_be_able_to_alloc_and_free(void);
 int should_be_able_to_realloc(void);
 int should_be_able_to_alloc_a_shitload_of_memory(void);
+int should_reuse_arena_chunks_after_a_reset(void);
 
 int main(void)
 {
@@ -16,6 +17,7 @@ int main(void)
     err = err || should_be_able_to_alloc_and_free();
     err = err || should_be_able_to_realloc();
     err = err || should_be_able_to_alloc_a_shitload_of_memory();
+    err = err || should_reuse_arena_chunks_after_a_reset();
 
     if (err == 0)
     {
@@ -256,3 +258,87 @@ int should_be_able_to_alloc_a_shitload_of_memory(void)
     fprintf(stdout, "[OK] should_be_able_to_alloc_a_shitload_of_memory\n");
     return 0;
 }
+
+int should_reuse_arena_chunks_after_a_reset(void)
+{
+    fprintf(stdout, "[TEST] should_reuse_arena_chunks_after_a_reset\n");
+
+    alloc_arena_t arena;
+    int err = alloc_arena_init(&arena, 256);
+    if (err)
+        return 1;
+
+    // Small pieces that spill over a few chunks, then one larger than a chunk
+    char *first = NULL;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        char *ptr = alloc_arena_alloc(&arena, 1 + i % 24);
+        if (!ptr || (uintptr_t)ptr % _Alignof(max_align_t) != 0)
+        {
+            fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: allocation %zu is misaligned\n", i);
+            return 1;
+        }
+        memset(ptr, 0xaa, 1 + i % 24);
+        if (i == 0)
+            first = ptr;
+    }
+
+    char *large = alloc_arena_alloc(&arena, 1000);
+    if (!large)
+        return 1;
+    memset(large, 0xbb, 1000);
+
+    size_t used = alloc_arena_used(&arena);
+    if (used < 1000 + 100)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: %zu bytes used\n", used);
+        return 1;
+    }
+
+    // The same requests after a reset land in the same memory
+    alloc_arena_reset(&arena);
+    if (alloc_arena_used(&arena) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: reset left bytes in use\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < 100; ++i)
+    {
+        char *ptr = alloc_arena_alloc(&arena, 1 + i % 24);
+        if (i == 0 && ptr != first)
+        {
+            fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: first chunk was not reused\n");
+            return 1;
+        }
+    }
+
+    if (alloc_arena_alloc(&arena, 1000) != large || alloc_arena_used(&arena) != used)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: large chunk was not reused\n");
+        return 1;
+    }
+
+    // Sizes that would wrap to a tiny allocation once rounded up, or once
+    // the chunk header is added to them
+    size_t huge_sizes[] = {SIZE_MAX, SIZE_MAX - 14, SIZE_MAX - 20};
+    for (size_t i = 0; i < sizeof(huge_sizes) / sizeof(huge_sizes[0]); ++i)
+    {
+        if (alloc_arena_alloc(&arena, huge_sizes[i]) != NULL)
+        {
+            fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: allocated %zu bytes\n", huge_sizes[i]);
+            return 1;
+        }
+    }
+
+    if (alloc_arena_alloc(NULL, 1) != NULL || alloc_arena_reset(NULL) != ALLOC_ERR_INVALID_ARG)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_arena_chunks_after_a_reset: NULL arena was accepted\n");
+        return 1;
+    }
+
+    alloc_arena_free(&arena);
+
+    fprintf(stdout, "[OK] should_reuse_arena_chunks_after_a_reset\n");
+    return 0;
+}
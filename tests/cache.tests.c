@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "cache.h"
+#include "parser.h"
+
+int should_hit_by_stamp_then_by_content(void);
+int should_miss_when_the_contents_change(void);
+int should_report_files_that_do_not_parse(void);
+int should_load_files_ending_in_a_token(void);
+
+static char root[] = "/tmp/cache.tests.XXXXXX";
+static char cache_dir[64];
+static char source[64];
+
+static int write_source(char *contents)
+{
+    FILE *file = fopen(source, "w");
+    if (!file)
+        return 1;
+    fputs(contents, file);
+    fclose(file);
+
+    return 0;
+}
+
+// Files modified in the last seconds get no stamp, so pretend it is old
+static int age_source(void)
+{
+    struct timeval times[2];
+    gettimeofday(&times[0], NULL);
+    times[0].tv_sec -= 3600;
+    times[1] = times[0];
+    return utimes(source, times);
+}
+
+// Open through the cache and compare the structural hashes of the
+// top-level forms with a fresh parse of contents
+static int expect_load(char *name, cache_t *cache, char *contents)
+{
+    image_t image;
+    int err = cache_open(cache, source, &image);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] %s: cache_open failed: %d\n", name, err);
+        return 1;
+    }
+
+    parser_t parser;
+    program_t expected = {0};
+    image_node_t root;
+    size_t size;
+    err = parser_init(&parser, contents, strlen(contents));
+    err = err || parser_parse(&parser, &expected);
+    err = err || image_root(&image, &root) || image_list_size(&image, root, &size);
+    err = err || size != expected.size;
+    for (size_t i = 0; !err && i < size; ++i)
+    {
+        image_node_t item;
+        uint64_t hash;
+        err = image_list_item(&image, root, i, &item) || image_node_hash(&image, item, &hash);
+        err = err || hash != parser_form_hash(&expected.items[i]);
+    }
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] %s: loaded image differs from %s\n", name, contents);
+        return 1;
+    }
+
+    parser_free_program(&expected);
+    image_close(&image);
+
+    return 0;
+}
+
+static int expect_stats(char *name, cache_t *cache, size_t stamp_hits, size_t content_hits, size_t misses)
+{
+    if (cache->stamp_hits != stamp_hits || cache->content_hits != content_hits || cache->misses != misses)
+    {
+        fprintf(stderr, "[FAIL] %s: expected %zu/%zu/%zu hits by stamp/hits by content/misses, got %zu/%zu/%zu\n",
+                name, stamp_hits, content_hits, misses,
+                (size_t)cache->stamp_hits, (size_t)cache->content_hits, (size_t)cache->misses);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    if (!mkdtemp(root))
+    {
+        fprintf(stdout, "[FAIL] Could not create a directory for the cache tests\n");
+        return 1;
+    }
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", root);
+    snprintf(source, sizeof(source), "%s/source.lisp", root);
+
+    int err = 0;
+    err = err || should_hit_by_stamp_then_by_content();
+    err = err || should_miss_when_the_contents_change();
+    err = err || should_report_files_that_do_not_parse();
+    err = err || should_load_files_ending_in_a_token();
+
+    char command[128];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    if (system(command) != 0)
+        fprintf(stderr, "Could not remove %s\n", root);
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All cache tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some cache tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int should_hit_by_stamp_then_by_content(void)
+{
+    fprintf(stdout, "[TEST] should_hit_by_stamp_then_by_content\n");
+
+    char *contents = "(define (f x) (g \"str\" 1.5 -3)) (f 1) ()";
+    cache_t cache;
+    int err = cache_init(&cache, cache_dir);
+    err = err || write_source(contents) || age_source();
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_hit_by_stamp_then_by_content: setup failed: %d\n", err);
+        return 1;
+    }
+
+    if (expect_load("should_hit_by_stamp_then_by_content", &cache, contents) ||
+        expect_stats("should_hit_by_stamp_then_by_content", &cache, 0, 0, 1))
+        return 1;
+
+    if (expect_load("should_hit_by_stamp_then_by_content", &cache, contents) ||
+        expect_stats("should_hit_by_stamp_then_by_content", &cache, 1, 0, 1))
+        return 1;
+
+    // Same contents with a new inode and mtime, only the stamp is stale
+    unlink(source);
+    if (write_source(contents) || age_source() ||
+        expect_load("should_hit_by_stamp_then_by_content", &cache, contents) ||
+        expect_stats("should_hit_by_stamp_then_by_content", &cache, 1, 1, 1))
+        return 1;
+
+    // A new cache over the same directory sees what the first one stored
+    cache_t again;
+    cache_init(&again, cache_dir);
+    if (expect_load("should_hit_by_stamp_then_by_content", &again, contents) ||
+        expect_stats("should_hit_by_stamp_then_by_content", &again, 1, 0, 0))
+        return 1;
+
+    fprintf(stdout, "[OK] should_hit_by_stamp_then_by_content\n");
+    return 0;
+}
+
+int should_miss_when_the_contents_change(void)
+{
+    fprintf(stdout, "[TEST] should_miss_when_the_contents_change\n");
+
+    cache_t cache;
+    cache_init(&cache, cache_dir);
+
+    // Fresh files never get a stamp, every load hashes them
+    char *before = "(a b c)";
+    char *after = "(a b c d)";
+    if (write_source(before) || expect_load("should_miss_when_the_contents_change", &cache, before))
+        return 1;
+
+    if (write_source(after) || expect_load("should_miss_when_the_contents_change", &cache, after))
+        return 1;
+
+    // Going back to the first contents finds their entry again
+    if (write_source(before) || expect_load("should_miss_when_the_contents_change", &cache, before) ||
+        expect_stats("should_miss_when_the_contents_change", &cache, 0, 1, 2))
+        return 1;
+
+    fprintf(stdout, "[OK] should_miss_when_the_contents_change\n");
+    return 0;
+}
+
+int should_report_files_that_do_not_parse(void)
+{
+    fprintf(stdout, "[TEST] should_report_files_that_do_not_parse\n");
+
+    cache_t cache;
+    cache_init(&cache, cache_dir);
+
+    image_t image;
+    int missing = cache_open(&cache, "/tmp/cache.tests.does-not-exist", &image);
+    int unparsable = write_source("(a (b") ? 0 : cache_open(&cache, source, &image);
+    if (missing != CACHE_ERR_FAILED_TO_LOAD || unparsable != CACHE_ERR_FAILED_TO_PARSE)
+    {
+        fprintf(stderr, "[FAIL] should_report_files_that_do_not_parse: got %d and %d\n", missing, unparsable);
+        return 1;
+    }
+
+    if (expect_stats("should_report_files_that_do_not_parse", &cache, 0, 0, 0))
+        return 1;
+
+    fprintf(stdout, "[OK] should_report_files_that_do_not_parse\n");
+    return 0;
+}
+
+int should_load_files_ending_in_a_token(void)
+{
+    fprintf(stdout, "[TEST] should_load_files_ending_in_a_token\n");
+
+    cache_t cache;
+    cache_init(&cache, cache_dir);
+
+    // Sources are mapped, so nothing follows the last token: no newline
+    // and no NUL to stop the lexer
+    char *sources[] = {"(a b) sym", "(a b) 123", "(a b) 1.5", "(a b) -"};
+    size_t count = sizeof(sources) / sizeof(sources[0]);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (write_source(sources[i]) || expect_load("should_load_files_ending_in_a_token", &cache, sources[i]))
+            return 1;
+    }
+
+    if (expect_stats("should_load_files_ending_in_a_token", &cache, 0, 0, count))
+        return 1;
+
+    fprintf(stdout, "[OK] should_load_files_ending_in_a_token\n");
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "frame.h"
+#include "parser.h"
+#include "serialize.h"
+
+int should_answer_pipelined_requests(void);
+int should_read_frames_split_across_reads(void);
+int should_reject_malformed_frames(void);
+
+int main(void)
+{
+    int err = 0;
+    err = err || should_answer_pipelined_requests();
+    err = err || should_read_frames_split_across_reads();
+    err = err || should_reject_malformed_frames();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All frame tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some frame tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+#define PIPELINED_REQUESTS 100
+
+static char *sources[] = {"(+ 1 (* 2 3))", "(define (f x) (g x 2.5))", "\"just a string\"", "(f", "()"};
+#define SOURCE_COUNT (sizeof(sources) / sizeof(sources[0]))
+
+int should_answer_pipelined_requests(void)
+{
+    fprintf(stdout, "[TEST] should_answer_pipelined_requests\n");
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        return 1;
+
+    frame_writer_t client_writer, server_writer;
+    frame_reader_t client_reader, server_reader;
+    int err = frame_writer_init(&client_writer, fds[0]);
+    err = err || frame_reader_init(&client_reader, fds[0]);
+    err = err || frame_writer_init(&server_writer, fds[1]);
+    err = err || frame_reader_init(&server_reader, fds[1]);
+    if (err)
+        return 1;
+
+    // Every request goes out in a single flush
+    for (uint32_t id = 0; id < PIPELINED_REQUESTS; ++id)
+    {
+        char *source = sources[id % SOURCE_COUNT];
+        err = frame_writer_queue(&client_writer, FRAME_TYPE_PARSE, id, source, strlen(source));
+        if (err)
+            return 1;
+    }
+    err = frame_writer_flush(&client_writer);
+    if (err || frame_writer_pending(&client_writer) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_answer_pipelined_requests: failed to send the requests: %d\n", err);
+        return 1;
+    }
+
+    // The server answers everything it has, then flushes once
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    size_t answered = 0;
+    do
+    {
+        frame_t frame;
+        err = frame_reader_next(&server_reader, &frame);
+        if (err || frame.type != FRAME_TYPE_PARSE)
+        {
+            fprintf(stderr, "[FAIL] should_answer_pipelined_requests: server failed to read a request: %d\n", err);
+            return 1;
+        }
+
+        parser_t parser;
+        program_t program = {0};
+        err = parser_init(&parser, (char *)frame.payload, frame.payload_size);
+        err = err ? err : parser_parse(&parser, &program);
+        if (err)
+            err = frame_writer_queue_error(&server_writer, frame.request_id, err);
+        else
+            err = frame_writer_queue_program(&server_writer, frame.request_id, &program, &v2);
+        parser_free_program(&program);
+        if (err)
+            return 1;
+        answered++;
+    } while (frame_reader_has_frame(&server_reader));
+
+    if (answered != PIPELINED_REQUESTS)
+    {
+        fprintf(stderr, "[FAIL] should_answer_pipelined_requests: %zu requests arrived together, expected %d\n",
+                answered, PIPELINED_REQUESTS);
+        return 1;
+    }
+    if (frame_writer_flush(&server_writer))
+        return 1;
+
+    for (uint32_t i = 0; i < PIPELINED_REQUESTS; ++i)
+    {
+        frame_t frame;
+        err = frame_reader_next(&client_reader, &frame);
+        if (err || frame.request_id != i)
+        {
+            fprintf(stderr, "[FAIL] should_answer_pipelined_requests: no answer to request %u: %d\n", i, err);
+            return 1;
+        }
+
+        char *source = sources[i % SOURCE_COUNT];
+        parser_t parser;
+        program_t expected = {0};
+        int parse_err = parser_init(&parser, source, strlen(source));
+        parse_err = parse_err ? parse_err : parser_parse(&parser, &expected);
+
+        if (parse_err)
+        {
+            int32_t code;
+            memcpy(&code, frame.payload, sizeof(code));
+            code = (int32_t)__builtin_bswap32((uint32_t)code);
+            if (frame.type != FRAME_TYPE_ERROR || frame.payload_size != sizeof(code) || code != parse_err)
+            {
+                fprintf(stderr, "[FAIL] should_answer_pipelined_requests: request %u should have failed with %d\n", i, parse_err);
+                return 1;
+            }
+            parser_free_program(&expected);
+            continue;
+        }
+
+        // In place decoding keeps every string in the copy
+        char *message = malloc(frame.payload_size);
+        memcpy(message, frame.payload, frame.payload_size);
+        program_t decoded = {0};
+        err = frame.type == FRAME_TYPE_PROGRAM ? deserializer_deserialize_in_place(message, frame.payload_size, &decoded) : 1;
+        if (err || !__program_equals(&expected, &decoded))
+        {
+            fprintf(stderr, "[FAIL] should_answer_pipelined_requests: wrong answer to request %u: %d\n", i, err);
+            return 1;
+        }
+
+        parser_free_program(&decoded);
+        parser_free_program(&expected);
+        free(message);
+    }
+
+    frame_writer_free(&client_writer);
+    frame_writer_free(&server_writer);
+    frame_reader_free(&client_reader);
+    frame_reader_free(&server_reader);
+    close(fds[0]);
+    close(fds[1]);
+
+    fprintf(stdout, "[OK] should_answer_pipelined_requests\n");
+    return 0;
+}
+
+int should_read_frames_split_across_reads(void)
+{
+    fprintf(stdout, "[TEST] should_read_frames_split_across_reads\n");
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        return 1;
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    // A small frame, then one that does not fit the read buffer
+    size_t large_len = 3 * FRAME_READ_SIZE + 5;
+    char *large = malloc(large_len);
+    if (!large)
+        return 1;
+    for (size_t i = 0; i < large_len; ++i)
+        large[i] = (char)(i * 7);
+
+    frame_writer_t writer;
+    frame_reader_t reader;
+    int err = frame_writer_init(&writer, fds[0]);
+    err = err || frame_reader_init(&reader, fds[1]);
+    err = err || frame_writer_queue(&writer, 42, 7, "hello", 5);
+    err = err || frame_writer_queue(&writer, 43, 8, large, large_len);
+    if (err)
+        return 1;
+
+    // Hand the bytes over one at a time at first, then in large pieces
+    frame_t frame;
+    size_t sent = 0;
+    size_t frames = 0;
+    while (frames < 2)
+    {
+        err = frame_reader_next(&reader, &frame);
+        if (err == FRAME_NEED_MORE)
+        {
+            size_t piece = sent < 64 ? 1 : 4096;
+            if (piece > writer.used - sent)
+                piece = writer.used - sent;
+            if (piece == 0 || write(fds[0], writer.buffer + sent, piece) != (ssize_t)piece)
+            {
+                fprintf(stderr, "[FAIL] should_read_frames_split_across_reads: ran out of bytes at %zu\n", sent);
+                return 1;
+            }
+            sent += piece;
+            continue;
+        }
+
+        int ok = err == 0;
+        if (frames == 0)
+            ok = ok && frame.type == 42 && frame.request_id == 7 && frame.payload_size == 5 && memcmp(frame.payload, "hello", 5) == 0;
+        else
+            ok = ok && frame.type == 43 && frame.request_id == 8 && frame.payload_size == large_len &&
+                 memcmp(frame.payload, large, large_len) == 0;
+        if (!ok)
+        {
+            fprintf(stderr, "[FAIL] should_read_frames_split_across_reads: frame %zu is wrong: %d\n", frames, err);
+            return 1;
+        }
+        frames++;
+    }
+
+    if (sent != writer.used || frame_reader_next(&reader, &frame) != FRAME_NEED_MORE)
+    {
+        fprintf(stderr, "[FAIL] should_read_frames_split_across_reads: read a frame that was never sent\n");
+        return 1;
+    }
+
+    free(large);
+    frame_writer_free(&writer);
+    frame_reader_free(&reader);
+    close(fds[0]);
+    close(fds[1]);
+
+    fprintf(stdout, "[OK] should_read_frames_split_across_reads\n");
+    return 0;
+}
+
+int expect_read_error(const char *bytes, size_t len, int expected)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        return 1;
+    if (len > 0 && write(fds[0], bytes, len) != (ssize_t)len)
+        return 1;
+    close(fds[0]);
+
+    frame_reader_t reader;
+    frame_t frame;
+    int err = frame_reader_init(&reader, fds[1]);
+    err = err ? err : frame_reader_next(&reader, &frame);
+    frame_reader_free(&reader);
+    close(fds[1]);
+
+    if (err != expected)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_frames: expected %d, got %d\n", expected, err);
+        return 1;
+    }
+
+    return 0;
+}
+
+int should_reject_malformed_frames(void)
+{
+    fprintf(stdout, "[TEST] should_reject_malformed_frames\n");
+
+    frame_writer_t writer;
+    int err = frame_writer_init(&writer, 0);
+    err = err || frame_writer_queue(&writer, FRAME_TYPE_PARSE, 1, "(+ 1 2)", 7);
+    if (err)
+        return 1;
+
+    char bad[FRAME_HEADER_SIZE + 7];
+    memcpy(bad, writer.buffer, sizeof(bad));
+    bad[0] = 'X';
+
+    char huge[FRAME_HEADER_SIZE + 7];
+    memcpy(huge, writer.buffer, sizeof(huge));
+    memset(huge + 12, 0xff, 8);
+
+    err = expect_read_error(NULL, 0, FRAME_ERR_CLOSED);
+    err = err || expect_read_error(writer.buffer, writer.used - 1, FRAME_ERR_MALFORMED_INPUT);
+    err = err || expect_read_error(writer.buffer, FRAME_HEADER_SIZE - 1, FRAME_ERR_MALFORMED_INPUT);
+    err = err || expect_read_error(bad, sizeof(bad), FRAME_ERR_MALFORMED_INPUT);
+    err = err || expect_read_error(huge, sizeof(huge), FRAME_ERR_MALFORMED_INPUT);
+    frame_writer_free(&writer);
+    if (err)
+        return 1;
+
+    fprintf(stdout, "[OK] should_reject_malformed_frames\n");
+    return 0;
+}
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image.h"
+#include "parser.h"
+
+int should_walk_an_image_in_place(void);
+int should_map_an_image_file(void);
+int should_reject_malformed_images(void);
+int should_count_stats_like_the_parser(void);
+
+int main(void)
+{
+    int err = 0;
+    err = err || should_walk_an_image_in_place();
+    err = err || should_map_an_image_file();
+    err = err || should_reject_malformed_images();
+    err = err || should_count_stats_like_the_parser();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All image tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some image tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static char *program_str = "(define (f x) (* x 2.5)) \"a string\" (f -42) () (((nested)))";
+
+int image_equals_form(image_t *image, image_node_t node, form_t *form)
+{
+    image_node_type_t type;
+    uint64_t hash;
+    if (image_node_type(image, node, &type) || image_node_hash(image, node, &hash))
+        return 0;
+    if (hash != parser_form_hash(form))
+        return 0;
+
+    if (form->type == FORM_LIST)
+    {
+        size_t size;
+        if (type != IMAGE_NODE_LIST || image_list_size(image, node, &size) || size != form->list.size)
+            return 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            image_node_t item;
+            if (image_list_item(image, node, i, &item) || !image_equals_form(image, item, &form->list.items[i]))
+                return 0;
+        }
+        return 1;
+    }
+
+    atom_t *atom = &form->atom;
+    const char *chars;
+    size_t len;
+    switch (atom->type)
+    {
+    case ATOM_NUMBER:
+        if (atom->num.type == NUMBER_INTEGER)
+        {
+            int64_t value;
+            return type == IMAGE_NODE_INTEGER && !image_integer(image, node, &value) && value == atom->num.integer;
+        }
+        else
+        {
+            double value;
+            return type == IMAGE_NODE_FLOAT && !image_float(image, node, &value) && value == atom->num.float_num;
+        }
+    case ATOM_SYMBOL:
+        return type == IMAGE_NODE_SYMBOL && !image_chars(image, node, &chars, &len) &&
+               len == atom->sym.len && memcmp(chars, atom->sym.chars, len) == 0 && chars[len] == '\0';
+    case ATOM_STRING:
+        return type == IMAGE_NODE_STRING && !image_chars(image, node, &chars, &len) &&
+               len == atom->str.len && memcmp(chars, atom->str.chars, len) == 0 && chars[len] == '\0';
+    }
+
+    return 0;
+}
+
+int image_equals_program(image_t *image, program_t *program)
+{
+    image_node_t root;
+    size_t size;
+    if (image_root(image, &root) || image_list_size(image, root, &size) || size != program->size)
+        return 0;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        image_node_t item;
+        if (image_list_item(image, root, i, &item) || !image_equals_form(image, item, &program->items[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+int should_walk_an_image_in_place(void)
+{
+    fprintf(stdout, "[TEST] should_walk_an_image_in_place\n");
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_walk_an_image_in_place: parsing failed: %d\n", err);
+        return 1;
+    }
+
+    size_t size = image_encoded_size(&program);
+    char *buf = malloc(size);
+    size_t written = 0;
+
+    err = image_write_to_buffer(&program, buf, size - 1, &written);
+    if (err != IMAGE_ERR_BUFFER_TOO_SMALL)
+    {
+        fprintf(stderr, "[FAIL] should_walk_an_image_in_place: expected IMAGE_ERR_BUFFER_TOO_SMALL, got %d\n", err);
+        return 1;
+    }
+
+    err = image_write_to_buffer(&program, buf, size, &written);
+    if (err || written != size)
+    {
+        fprintf(stderr, "[FAIL] should_walk_an_image_in_place: image_write_to_buffer failed: %d\n", err);
+        return 1;
+    }
+
+    image_t image;
+    err = image_open_buffer(&image, buf, written);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_walk_an_image_in_place: image_open_buffer failed: %d\n", err);
+        return 1;
+    }
+
+    if (!image_equals_program(&image, &program))
+    {
+        fprintf(stderr, "[FAIL] should_walk_an_image_in_place: image does not match the program\n");
+        return 1;
+    }
+
+    image_close(&image);
+    free(buf);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_walk_an_image_in_place\n");
+    return 0;
+}
+
+int should_map_an_image_file(void)
+{
+    fprintf(stdout, "[TEST] should_map_an_image_file\n");
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_map_an_image_file: parsing failed: %d\n", err);
+        return 1;
+    }
+
+    char path[] = "/tmp/clisp-image-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        fprintf(stderr, "[FAIL] should_map_an_image_file: mkstemp failed\n");
+        return 1;
+    }
+    close(fd);
+
+    err = image_write_file(&program, path);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_map_an_image_file: image_write_file failed: %d\n", err);
+        return 1;
+    }
+
+    image_t image;
+    err = image_open(&image, path);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_map_an_image_file: image_open failed: %d\n", err);
+        return 1;
+    }
+
+    if (!image_equals_program(&image, &program))
+    {
+        fprintf(stderr, "[FAIL] should_map_an_image_file: image does not match the program\n");
+        return 1;
+    }
+
+    image_close(&image);
+    unlink(path);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_map_an_image_file\n");
+    return 0;
+}
+
+int should_reject_malformed_images(void)
+{
+    fprintf(stdout, "[TEST] should_reject_malformed_images\n");
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: parsing failed: %d\n", err);
+        return 1;
+    }
+
+    size_t size = image_encoded_size(&program);
+    char *buf = malloc(size);
+    err = image_write_to_buffer(&program, buf, size, NULL);
+    if (err)
+        return 1;
+
+    image_t image;
+    if (image_open_buffer(&image, buf, size - 1) != IMAGE_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: accepted a truncated image\n");
+        return 1;
+    }
+
+    buf[0] = 'X';
+    if (image_open_buffer(&image, buf, size) != IMAGE_ERR_BAD_MAGIC)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: accepted a bad magic\n");
+        return 1;
+    }
+    buf[0] = IMAGE_MAGIC[0];
+
+    err = image_open_buffer(&image, buf, size);
+    if (err)
+        return 1;
+
+    // (define (f x) (* x 2.5)) is the first item of the root
+    image_node_t root, define, name;
+    image_node_type_t type;
+    int64_t integer;
+    err = image_root(&image, &root);
+    err = err || image_list_item(&image, root, 0, &define);
+    err = err || image_list_item(&image, define, 0, &name);
+    if (err)
+        return 1;
+
+    if (image_integer(&image, name, &integer) != IMAGE_ERR_WRONG_NODE_TYPE)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: read a symbol as an integer\n");
+        return 1;
+    }
+
+    if (image_list_item(&image, define, 3, &name) != IMAGE_ERR_INDEX_OUT_OF_BOUNDS)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: read past the end of a list\n");
+        return 1;
+    }
+
+    // Point the symbol's chars past the end of the image
+    image_record_t *record = (image_record_t *)(buf + name);
+    record->offset = size - 2;
+    const char *chars;
+    size_t len;
+    if (image_chars(&image, name, &chars, &len) != IMAGE_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: followed chars out of the image\n");
+        return 1;
+    }
+
+    // And the list's items into the header
+    record = (image_record_t *)(buf + define);
+    record->offset = 8;
+    if (image_list_item(&image, define, 0, &name) == 0 && image_node_type(&image, name, &type) != IMAGE_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_images: followed items out of the record area\n");
+        return 1;
+    }
+
+    image_close(&image);
+    free(buf);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_reject_malformed_images\n");
+    return 0;
+}
+
+int should_count_stats_like_the_parser(void)
+{
+    fprintf(stdout, "[TEST] should_count_stats_like_the_parser\n");
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_count_stats_like_the_parser: parsing failed: %d\n", err);
+        return 1;
+    }
+
+    size_t size = image_encoded_size(&program);
+    char *buf = malloc(size);
+    image_t image;
+    err = image_write_to_buffer(&program, buf, size, NULL);
+    err = err || image_open_buffer(&image, buf, size);
+    if (err)
+        return 1;
+
+    parser_stats_t expected = {0}, stats = {0};
+    parser_program_stats(&program, &expected);
+    err = image_program_stats(&image, &stats);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_count_stats_like_the_parser: image_program_stats failed: %d\n", err);
+        return 1;
+    }
+
+    // Only the form arrays of the parsed program have no counterpart
+    expected.form_array_bytes = 0;
+    expected.wasted_capacity_bytes = 0;
+    if (memcmp(&stats, &expected, sizeof(stats)) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_count_stats_like_the_parser: got %zu lists, %zu symbols, depth %zu, "
+                        "expected %zu lists, %zu symbols, depth %zu\n",
+                stats.lists, stats.symbols, stats.max_depth, expected.lists, expected.symbols, expected.max_depth);
+        return 1;
+    }
+
+    // An item array pointing back at its own list is a cycle, not a deeper tree
+    image_node_t root;
+    image_root(&image, &root);
+    image_record_t *record = (image_record_t *)(buf + root);
+    record->offset = root;
+    if (image_program_stats(&image, &stats) != IMAGE_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_count_stats_like_the_parser: walked into a cycle\n");
+        return 1;
+    }
+
+    image_close(&image);
+    free(buf);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_count_stats_like_the_parser\n");
+    return 0;
+}
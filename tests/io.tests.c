@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "io.h"
+#include "parser.h"
+
+int should_map_a_file_read_only(void);
+int should_map_empty_files(void);
+int should_parse_a_mapped_file_ending_in_a_token(void);
+int should_reuse_buffers_of_a_class(void);
+int should_not_pool_oversized_buffers(void);
+int should_share_buffers_between_threads(void);
+
+int main(void)
+{
+    int err = 0;
+    err = err || should_map_a_file_read_only();
+    err = err || should_map_empty_files();
+    err = err || should_parse_a_mapped_file_ending_in_a_token();
+    err = err || should_reuse_buffers_of_a_class();
+    err = err || should_not_pool_oversized_buffers();
+    err = err || should_share_buffers_between_threads();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All io tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some io tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static char path[] = "/tmp/io.tests.XXXXXX";
+
+static int write_temp_file(char *contents, size_t len)
+{
+    strcpy(path, "/tmp/io.tests.XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+
+    int err = write(fd, contents, len) != (ssize_t)len;
+    close(fd);
+    return err;
+}
+
+int should_map_a_file_read_only(void)
+{
+    fprintf(stdout, "[TEST] should_map_a_file_read_only\n");
+
+    char *contents = "(define (f x) x)\n";
+    io_str_t string;
+    if (write_temp_file(contents, strlen(contents)) || io_map_file(path, &string) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_map_a_file_read_only: could not map %s\n", path);
+        return 1;
+    }
+
+    if (!string.mapped || string.capacity != 0 || string.size != strlen(contents) ||
+        memcmp(string.data, contents, string.size) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_map_a_file_read_only: got %zu bytes, mapped %d\n", string.size, string.mapped);
+        return 1;
+    }
+
+    // Released by unmapping, and the string is reset like any other
+    if (io_free_string(&string) != 0 || string.data || string.size || string.mapped)
+    {
+        fprintf(stderr, "[FAIL] should_map_a_file_read_only: io_free_string left the string set\n");
+        return 1;
+    }
+
+    if (io_map_file("/tmp/io.tests.does-not-exist", &string) != ERR_FAILED_TO_OPEN_FILE)
+    {
+        fprintf(stderr, "[FAIL] should_map_a_file_read_only: mapped a missing file\n");
+        return 1;
+    }
+
+    unlink(path);
+
+    fprintf(stdout, "[OK] should_map_a_file_read_only\n");
+    return 0;
+}
+
+int should_map_empty_files(void)
+{
+    fprintf(stdout, "[TEST] should_map_empty_files\n");
+
+    io_str_t string;
+    if (write_temp_file("", 0) || io_map_file(path, &string) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_map_empty_files: could not map %s\n", path);
+        return 1;
+    }
+
+    // mmap refuses empty lengths, so the string is a static "" that is
+    // marked mapped and must survive io_free_string
+    if (!string.mapped || string.size != 0 || !string.data || string.data[0] != '\0')
+    {
+        fprintf(stderr, "[FAIL] should_map_empty_files: expected an empty mapped string\n");
+        return 1;
+    }
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, string.data, string.size);
+    err = err || parser_parse(&parser, &program);
+    if (err || program.size != 0)
+    {
+        fprintf(stderr, "[FAIL] should_map_empty_files: parsing the empty file failed: %d\n", err);
+        return 1;
+    }
+
+    io_free_string(&string);
+    unlink(path);
+
+    fprintf(stdout, "[OK] should_map_empty_files\n");
+    return 0;
+}
+
+int should_parse_a_mapped_file_ending_in_a_token(void)
+{
+    fprintf(stdout, "[TEST] should_parse_a_mapped_file_ending_in_a_token\n");
+
+    // A whole page of forms, the last byte being the end of a symbol
+    size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    char *contents = malloc(size);
+    if (!contents)
+        return 1;
+    memset(contents, ' ', size);
+    memcpy(contents, "(f 1)", 5);
+    memcpy(contents + size - 3, "sym", 3);
+
+    io_str_t string;
+    if (write_temp_file(contents, size) || io_map_file(path, &string) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_parse_a_mapped_file_ending_in_a_token: could not map %s\n", path);
+        return 1;
+    }
+
+    // Put an inaccessible page right after the mapping, so reading one
+    // byte past the file faults instead of going unnoticed
+    void *guard = mmap(string.data + size, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, string.data, string.size);
+    err = err || parser_parse(&parser, &program);
+    if (err || program.size != 2 || program.items[1].atom.sym.len != 3)
+    {
+        fprintf(stderr, "[FAIL] should_parse_a_mapped_file_ending_in_a_token: parsing failed: %d\n", err);
+        return 1;
+    }
+
+    parser_free_program(&program);
+    if (guard != MAP_FAILED)
+        munmap(guard, size);
+    io_free_string(&string);
+    unlink(path);
+    free(contents);
+
+    fprintf(stdout, "[OK] should_parse_a_mapped_file_ending_in_a_token\n");
+    return 0;
+}
+
+int should_reuse_buffers_of_a_class(void)
+{
+    fprintf(stdout, "[TEST] should_reuse_buffers_of_a_class\n");
+
+    io_pool_stats_t before, after;
+    io_pool_stats(&before);
+
+    // 5000 and 8000 bytes, with their NULs, both fit the 8 KiB class
+    io_str_t string;
+    if (io_alloc_string(&string, 5000) != 0 || string.capacity != 8192)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_buffers_of_a_class: expected an 8 KiB buffer, got %zu\n", string.capacity);
+        return 1;
+    }
+    char *first = string.data;
+    memset(string.data, 'x', 5001);
+    io_free_string(&string);
+
+    if (io_alloc_string(&string, 8000) != 0 || string.data != first)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_buffers_of_a_class: the released buffer was not reused\n");
+        return 1;
+    }
+    io_free_string(&string);
+
+    io_pool_stats(&after);
+    if (after.misses - before.misses != 1 || after.hits - before.hits != 1)
+    {
+        fprintf(stderr, "[FAIL] should_reuse_buffers_of_a_class: expected 1 miss and 1 hit, got %zu and %zu\n",
+                after.misses - before.misses, after.hits - before.hits);
+        return 1;
+    }
+
+    fprintf(stdout, "[OK] should_reuse_buffers_of_a_class\n");
+    return 0;
+}
+
+int should_not_pool_oversized_buffers(void)
+{
+    fprintf(stdout, "[TEST] should_not_pool_oversized_buffers\n");
+
+    io_pool_stats_t before, after;
+    io_pool_stats(&before);
+
+    size_t size = (size_t)1 << IO_POOL_MAX_CLASS;
+    io_str_t string;
+    if (io_alloc_string(&string, size) != 0 || string.capacity != 0)
+    {
+        fprintf(stderr, "[FAIL] should_not_pool_oversized_buffers: got a pooled buffer of %zu\n", string.capacity);
+        return 1;
+    }
+    string.data[size] = '\0';
+    io_free_string(&string);
+
+    io_pool_stats(&after);
+    if (after.oversized - before.oversized != 1 || after.hits != before.hits || after.misses != before.misses)
+    {
+        fprintf(stderr, "[FAIL] should_not_pool_oversized_buffers: the buffer went through the pool\n");
+        return 1;
+    }
+
+    fprintf(stdout, "[OK] should_not_pool_oversized_buffers\n");
+    return 0;
+}
+
+#define IO_TEST_BUFFERS 64
+
+static io_str_t handed[IO_TEST_BUFFERS];
+
+static void *allocate_buffers(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < IO_TEST_BUFFERS; ++i)
+    {
+        if (io_alloc_string(&handed[i], 100000) != 0)
+            return (void *)1;
+    }
+
+    return NULL;
+}
+
+static void *release_buffers(void *arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < IO_TEST_BUFFERS; ++i)
+        io_free_string(&handed[i]);
+
+    return NULL;
+}
+
+static int run(void *(*fn)(void *))
+{
+    pthread_t thread;
+    void *result;
+    if (pthread_create(&thread, NULL, fn, NULL) != 0 || pthread_join(thread, &result) != 0)
+        return 1;
+
+    return result != NULL;
+}
+
+int should_share_buffers_between_threads(void)
+{
+    fprintf(stdout, "[TEST] should_share_buffers_between_threads\n");
+
+    // Like a loader thread reading files that another thread parses and
+    // releases: the second round must be served from the released buffers
+    io_pool_stats_t before, after;
+    if (run(allocate_buffers) || run(release_buffers))
+    {
+        fprintf(stderr, "[FAIL] should_share_buffers_between_threads: first round failed\n");
+        return 1;
+    }
+
+    io_pool_stats(&before);
+    if (run(allocate_buffers) || run(release_buffers))
+    {
+        fprintf(stderr, "[FAIL] should_share_buffers_between_threads: second round failed\n");
+        return 1;
+    }
+    io_pool_stats(&after);
+
+    if (after.misses != before.misses || after.hits - before.hits != IO_TEST_BUFFERS)
+    {
+        fprintf(stderr, "[FAIL] should_share_buffers_between_threads: expected %d hits, got %zu hits and %zu misses\n",
+                IO_TEST_BUFFERS, after.hits - before.hits, after.misses - before.misses);
+        return 1;
+    }
+
+    fprintf(stdout, "[OK] should_share_buffers_between_threads\n");
+    return 0;
+}
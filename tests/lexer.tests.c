@@ -36,6 +36,7 @@ int should_be_able_to_report_an_unterminated_string_literal(void);
 int should_be_able_to_lex_a_signed_integer(void);
 int should_be_able_to_lex_floating_point_numbers(void);
 int should_be_able_to_lex_a_math_expression(void);
+int should_stop_at_the_end_of_unterminated_input(void);
 
 int main(void)
 {
@@ -51,6 +52,7 @@ int main(void)
     err = err || should_be_able_to_lex_a_signed_integer();
     err = err || should_be_able_to_lex_floating_point_numbers();
     err = err || should_be_able_to_lex_a_math_expression();
+    err = err || should_stop_at_the_end_of_unterminated_input();
 
     if (err == 0)
     {
@@ -1305,3 +1307,59 @@ int should_be_able_to_lex_a_math_expression(void)
 
     return 0;
 }
+
+int should_stop_at_the_end_of_unterminated_input(void)
+{
+    // Mapped files have no NUL after their last byte, so every token
+    // that can end the input must stop at input_len on its own
+    char *inputs[] = {"(f sym", "(f 123", "(f 1.5", "(f 1.", "(f -12", "(f +7", "(f -", "(f +", "(f \"str"};
+    token_type_t last_types[] = {TOK_STRING, TOK_INTEGER, TOK_FLOAT, TOK_FLOAT, TOK_INTEGER, TOK_INTEGER,
+                                 TOK_MINUS, TOK_PLUS, TOK_EOF};
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+    {
+        // Exactly the bytes of the input, reading one more is out of bounds
+        size_t len = strlen(inputs[i]);
+        char *input = malloc(len);
+        if (!input)
+            return 1;
+        memcpy(input, inputs[i], len);
+
+        lexer_t l;
+        token_t token;
+        lexer_init(&l, input, len);
+        int err = 0;
+        for (size_t t = 0; t < 3 && err == 0; ++t)
+            err = lexer_next_token(&l, &token);
+
+        int expected_err = last_types[i] == TOK_EOF ? LEXER_ERR_UNTERMINATED_STRING_LITERAL : 0;
+        if (err != expected_err || (!err && token.type != last_types[i]) ||
+            (!err && token.start + token.len != input + len))
+        {
+            fprintf(
+                stderr,
+                "[FAIL] should_stop_at_the_end_of_unterminated_input: %s: got %d and token type %d\n",
+                inputs[i],
+                err,
+                token.type);
+            return 1;
+        }
+
+        if (!err && (lexer_next_token(&l, &token) != 0 || token.type != TOK_EOF))
+        {
+            fprintf(
+                stderr,
+                "[FAIL] should_stop_at_the_end_of_unterminated_input: %s: expected the end of input\n",
+                inputs[i]);
+            return 1;
+        }
+
+        free(input);
+    }
+
+    fprintf(
+        stdout,
+        "[PASS] should_stop_at_the_end_of_unterminated_input\n");
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "loader.h"
+#include "io.h"
+
+#define LOADER_TEST_FILES 200
+
+int should_load_every_file_once(int flags, char *name);
+int should_report_files_that_fail(int flags, char *name);
+
+static char dir[] = "/tmp/loader.tests.XXXXXX";
+static char *paths[LOADER_TEST_FILES];
+
+static size_t file_size(size_t i)
+{
+    // Empty files, small ones and a few that take more than one page
+    return (i * 7919) % (i % 10 == 0 ? 100000 : 600);
+}
+
+static char file_byte(size_t i, size_t pos)
+{
+    return (char)('a' + (i + pos) % 26);
+}
+
+static int write_fixtures(void)
+{
+    if (!mkdtemp(dir))
+        return 1;
+
+    for (size_t i = 0; i < LOADER_TEST_FILES; ++i)
+    {
+        paths[i] = malloc(sizeof(dir) + 32);
+        if (!paths[i])
+            return 1;
+        snprintf(paths[i], sizeof(dir) + 32, "%s/%zu.lisp", dir, i);
+
+        FILE *file = fopen(paths[i], "w");
+        if (!file)
+            return 1;
+        for (size_t pos = 0; pos < file_size(i); ++pos)
+            fputc(file_byte(i, pos), file);
+        fclose(file);
+    }
+
+    return 0;
+}
+
+static void remove_fixtures(void)
+{
+    for (size_t i = 0; i < LOADER_TEST_FILES; ++i)
+    {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    rmdir(dir);
+}
+
+int main(void)
+{
+    if (write_fixtures())
+    {
+        fprintf(stdout, "[FAIL] Could not write the loader fixtures\n");
+        return 1;
+    }
+
+    int err = 0;
+    err = err || should_load_every_file_once(0, "should_load_every_file_once");
+    err = err || should_load_every_file_once(LOADER_FLAG_NO_URING, "should_load_every_file_once_with_pread");
+    err = err || should_load_every_file_once(LOADER_FLAG_POOL, "should_load_every_file_once_pooled");
+    err = err || should_load_every_file_once(LOADER_FLAG_NO_URING | LOADER_FLAG_POOL,
+                                             "should_load_every_file_once_pooled_with_pread");
+    err = err || should_load_every_file_once(LOADER_FLAG_MAP, "should_load_every_file_once_mapped");
+    err = err || should_load_every_file_once(LOADER_FLAG_NO_URING | LOADER_FLAG_MAP,
+                                             "should_load_every_file_once_mapped_with_pread");
+    err = err || should_report_files_that_fail(0, "should_report_files_that_fail");
+    err = err || should_report_files_that_fail(LOADER_FLAG_NO_URING, "should_report_files_that_fail_with_pread");
+
+    remove_fixtures();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All loader tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some loader tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int should_load_every_file_once(int flags, char *name)
+{
+    fprintf(stdout, "[TEST] %s\n", name);
+
+    io_str_t strings[LOADER_TEST_FILES];
+    char seen[LOADER_TEST_FILES] = {0};
+    loader_t loader;
+    int err = loader_init(&loader, paths, LOADER_TEST_FILES, strings, flags);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] %s: loader_init failed: %d\n", name, err);
+        return 1;
+    }
+
+    size_t index;
+    size_t loaded = 0;
+    while ((err = loader_next(&loader, &index)) != LOADER_DONE)
+    {
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] %s: loading %s failed: %d\n", name, paths[index], err);
+            return 1;
+        }
+        if (seen[index]++)
+        {
+            fprintf(stderr, "[FAIL] %s: file %zu was handed out twice\n", name, index);
+            return 1;
+        }
+
+        io_str_t *string = &strings[index];
+        // Only large files are mapped, and mapped ones have no NUL
+        int mapped = (flags & LOADER_FLAG_MAP) && string->size >= LOADER_MAP_MIN_SIZE;
+        int same = string->data && string->size == file_size(index) && string->mapped == mapped &&
+                   (mapped || string->data[string->size] == '\0');
+        if (!same || (!(flags & LOADER_FLAG_POOL) && string->capacity != 0))
+        {
+            fprintf(stderr, "[FAIL] %s: file %zu has the wrong size or buffer\n", name, index);
+            return 1;
+        }
+        for (size_t pos = 0; same && pos < string->size; ++pos)
+            same = string->data[pos] == file_byte(index, pos);
+        if (!same)
+        {
+            fprintf(stderr, "[FAIL] %s: file %zu has the wrong contents\n", name, index);
+            return 1;
+        }
+
+        io_free_string(string);
+        loaded++;
+    }
+
+    // Once done, every further call says so too
+    if (loader_next(&loader, &index) != LOADER_DONE || loaded != LOADER_TEST_FILES)
+    {
+        fprintf(stderr, "[FAIL] %s: loaded %zu of %d files\n", name, loaded, LOADER_TEST_FILES);
+        return 1;
+    }
+
+    loader_destroy(&loader);
+
+    fprintf(stdout, "[OK] %s\n", name);
+    return 0;
+}
+
+int should_report_files_that_fail(int flags, char *name)
+{
+    fprintf(stdout, "[TEST] %s\n", name);
+
+    char *mixed[] = {paths[1], "/tmp/loader.tests.does-not-exist", paths[2], dir};
+    size_t count = sizeof(mixed) / sizeof(mixed[0]);
+    io_str_t strings[4];
+    int errors[4] = {0};
+    loader_t loader;
+    int err = loader_init(&loader, mixed, count, strings, flags);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] %s: loader_init failed: %d\n", name, err);
+        return 1;
+    }
+
+    size_t index;
+    while ((err = loader_next(&loader, &index)) != LOADER_DONE)
+        errors[index] = err;
+
+    loader_destroy(&loader);
+
+    // A directory opens and stats fine but can not be read
+    if (errors[0] != 0 || errors[1] != ERR_FAILED_TO_OPEN_FILE || errors[2] != 0 || errors[3] != ERR_FAILED_TO_READ_FILE)
+    {
+        fprintf(stderr, "[FAIL] %s: got errors %d %d %d %d\n", name, errors[0], errors[1], errors[2], errors[3]);
+        return 1;
+    }
+
+    if (strings[1].data || strings[3].data)
+    {
+        fprintf(stderr, "[FAIL] %s: failed files kept a buffer\n", name);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        io_free_string(&strings[i]);
+
+    fprintf(stdout, "[OK] %s\n", name);
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lz.h"
+
+int should_round_trip_blocks(void);
+int should_compress_redundant_input(void);
+int should_reject_malformed_blocks(void);
+
+int main(void)
+{
+    int err = 0;
+    err = err || should_round_trip_blocks();
+    err = err || should_compress_redundant_input();
+    err = err || should_reject_malformed_blocks();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All lz tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some lz tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int round_trip(const char *name, const char *input, size_t len, size_t *compressed_len)
+{
+    size_t cap = lz_compress_bound(len);
+    char *compressed = malloc(cap);
+    char *output = malloc(len ? len : 1);
+    if (!compressed || !output)
+        return 1;
+
+    int err = lz_compress(input, len, compressed, cap, compressed_len);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] %s: lz_compress failed: %d\n", name, err);
+        return 1;
+    }
+
+    size_t written = 0;
+    err = lz_decompress(compressed, *compressed_len, output, len, &written);
+    if (err || written != len || memcmp(input, output, len) != 0)
+    {
+        fprintf(stderr, "[FAIL] %s: %zu bytes did not survive the round trip: %d\n", name, len, err);
+        return 1;
+    }
+
+    free(compressed);
+    free(output);
+    return 0;
+}
+
+int should_round_trip_blocks(void)
+{
+    fprintf(stdout, "[TEST] should_round_trip_blocks\n");
+
+    size_t len = 300000;
+    char *input = malloc(len);
+    if (!input)
+        return 1;
+
+    // Random bytes, with a run of zeros and a repeated phrase mixed in
+    unsigned int seed = 42;
+    for (size_t i = 0; i < len; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        input[i] = (char)(seed >> 16);
+    }
+    memset(input + 1000, 0, 5000);
+    for (size_t i = 20000; i + 13 < 40000; i += 13)
+        memcpy(input + i, "(define x 1) ", 13);
+
+    // Every length around the limits where the last literals kick in
+    size_t compressed_len;
+    for (size_t n = 0; n < 64; ++n)
+    {
+        if (round_trip("should_round_trip_blocks", input + 1000, n, &compressed_len))
+            return 1;
+    }
+
+    if (round_trip("should_round_trip_blocks", input, len, &compressed_len))
+        return 1;
+
+    free(input);
+
+    fprintf(stdout, "[OK] should_round_trip_blocks\n");
+    return 0;
+}
+
+int should_compress_redundant_input(void)
+{
+    fprintf(stdout, "[TEST] should_compress_redundant_input\n");
+
+    size_t len = 1 << 20;
+    char *input = calloc(len, 1);
+    if (!input)
+        return 1;
+
+    size_t compressed_len = 0;
+    if (round_trip("should_compress_redundant_input", input, len, &compressed_len))
+        return 1;
+
+    if (compressed_len > len / 200)
+    {
+        fprintf(stderr, "[FAIL] should_compress_redundant_input: 1MB of zeros took %zu bytes\n", compressed_len);
+        return 1;
+    }
+
+    free(input);
+
+    fprintf(stdout, "[OK] should_compress_redundant_input (%zu bytes)\n", compressed_len);
+    return 0;
+}
+
+int should_reject_malformed_blocks(void)
+{
+    fprintf(stdout, "[TEST] should_reject_malformed_blocks\n");
+
+    const char *input = "abcdabcdabcdabcdabcdabcdabcdabcdabcdabcd, then some literals";
+    size_t len = strlen(input);
+    char compressed[128];
+    size_t compressed_len = 0;
+    if (lz_compress(input, len, compressed, sizeof(compressed), &compressed_len))
+        return 1;
+
+    char output[128];
+    size_t written;
+    for (size_t cut = 0; cut < compressed_len; ++cut)
+    {
+        int err = lz_decompress(compressed, cut, output, sizeof(output), &written);
+        if (err == 0 && written == len)
+        {
+            fprintf(stderr, "[FAIL] should_reject_malformed_blocks: accepted a block cut at %zu\n", cut);
+            return 1;
+        }
+    }
+
+    if (lz_decompress(compressed, compressed_len, output, len - 1, &written) != LZ_ERR_BUFFER_TOO_SMALL)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_blocks: wrote past the output\n");
+        return 1;
+    }
+
+    // The first match points back at offset 4, make it reach before the start
+    char bad[128];
+    memcpy(bad, compressed, compressed_len);
+    size_t literals = (uint8_t)bad[0] >> 4;
+    bad[1 + literals] = (char)0xff;
+    if (lz_decompress(bad, compressed_len, output, sizeof(output), &written) != LZ_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_reject_malformed_blocks: followed an offset out of the output\n");
+        return 1;
+    }
+
+    fprintf(stdout, "[OK] should_reject_malformed_blocks\n");
+    return 0;
+}
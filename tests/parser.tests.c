@@ -19,6 +19,11 @@ int should_parse_nested_function_calls(void);
 int should_parse_empty_list(void);
 int should_fail_to_parse_unfinished_lists(void);
 int should_parse_a_mathematical_expression(void);
+int should_parse_in_token_budgeted_steps(void);
+int should_abort_a_parse_halfway(void);
+int should_enforce_parser_limits(void);
+int should_collect_program_stats(void);
+int should_compute_structural_hashes(void);
 
 int main(void)
 {
@@ -39,6 +44,11 @@ int main(void)
     err = err || should_parse_empty_list();
     err = err || should_fail_to_parse_unfinished_lists();
     err = err || should_parse_a_mathematical_expression();
+    err = err || should_parse_in_token_budgeted_steps();
+    err = err || should_abort_a_parse_halfway();
+    err = err || should_enforce_parser_limits();
+    err = err || should_collect_program_stats();
+    err = err || should_compute_structural_hashes();
 
     if (err == 0)
     {
@@ -609,3 +619,261 @@ int should_parse_a_mathematical_expression(void)
     fprintf(stdout, "[PASS] should_parse_a_mathematical_expression\n");
     return 0;
 }
+
+int should_parse_in_token_budgeted_steps(void)
+{
+    fprintf(stdout, "[TEST] should_parse_in_token_budgeted_steps\n");
+
+    char *input = "(define (f x) (* x 2.5)) \"str\" (f (g (h 1)) ()) sym";
+
+    parser_t parser;
+    program_t expected = {0};
+    int err = parser_init(&parser, input, strlen(input));
+    if (err)
+        return 1;
+    err = parser_parse(&parser, &expected);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_parse_in_token_budgeted_steps: parser_parse failed: %d\n", err);
+        return 1;
+    }
+
+    for (size_t budget = 1; budget <= 4; ++budget)
+    {
+        program_t program = {0};
+        err = parser_init(&parser, input, strlen(input));
+        if (err)
+            return 1;
+
+        size_t steps = 0;
+        while ((err = parser_step(&parser, &program, budget)) == PARSER_AGAIN)
+            steps++;
+
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_parse_in_token_budgeted_steps: parser_step failed: %d\n", err);
+            return 1;
+        }
+
+        if (budget == 1 && steps < 10)
+        {
+            fprintf(stderr, "[FAIL] should_parse_in_token_budgeted_steps: expected the parse to be split, got %zu steps\n", steps);
+            return 1;
+        }
+
+        if (!__program_equals(&expected, &program))
+        {
+            fprintf(stderr, "[FAIL] should_parse_in_token_budgeted_steps: budget %zu produced a different program\n", budget);
+            return 1;
+        }
+
+        parser_free_program(&program);
+    }
+
+    parser_free_program(&expected);
+    fprintf(stdout, "[PASS] should_parse_in_token_budgeted_steps\n");
+    return 0;
+}
+
+int should_abort_a_parse_halfway(void)
+{
+    fprintf(stdout, "[TEST] should_abort_a_parse_halfway\n");
+
+    char *input = "(done 1) (define (f x) (g (h x) \"str\" 2.5)) (never reached)";
+
+    parser_t parser;
+    program_t program = {0};
+    int err = parser_init(&parser, input, strlen(input));
+    if (err)
+        return 1;
+
+    // Stop in the middle of the second form, two lists deep
+    err = parser_step(&parser, &program, 8);
+    if (err != PARSER_AGAIN || program.size != 1 || parser.open_lists.size != 2)
+    {
+        fprintf(stderr, "[FAIL] should_abort_a_parse_halfway: expected to stop inside 2 lists, got %d with %zu open\n",
+                err, parser.open_lists.size);
+        return 1;
+    }
+
+    err = parser_abort(&parser);
+    if (err || parser.open_lists.size != 0 || parser.open_lists.items != NULL)
+    {
+        fprintf(stderr, "[FAIL] should_abort_a_parse_halfway: the open lists were not freed: %d\n", err);
+        return 1;
+    }
+
+    if (parser_abort(NULL) != PARSER_ERR_PARSER_NOT_DEFINED)
+    {
+        fprintf(stderr, "[FAIL] should_abort_a_parse_halfway: accepted a NULL parser\n");
+        return 1;
+    }
+
+    parser_free_program(&program);
+    fprintf(stdout, "[PASS] should_abort_a_parse_halfway\n");
+    return 0;
+}
+
+int should_enforce_parser_limits(void)
+{
+    fprintf(stdout, "[TEST] should_enforce_parser_limits\n");
+
+    struct
+    {
+        parser_limits_t limits;
+        char *input;
+        int expected;
+    } cases[] = {
+        {{2, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE}, "(a (b))", 0},
+        {{2, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE}, "(a (b (c)))", PARSER_ERR_MAX_DEPTH_EXCEEDED},
+        {{PARSER_LIMIT_NONE, 4, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE}, "(+ 1 2)", 0},
+        {{PARSER_LIMIT_NONE, 4, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE}, "(+ 1 2) 3", PARSER_ERR_MAX_NODES_EXCEEDED},
+        {{PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, 8, PARSER_LIMIT_NONE}, "(abc \"abc\")", 0},
+        {{PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, 8, PARSER_LIMIT_NONE}, "(abcd \"abc\")", PARSER_ERR_MAX_STRING_BYTES_EXCEEDED},
+        {{PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, 7}, "(+ 1 2)", 0},
+        {{PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, PARSER_LIMIT_NONE, 6}, "(+ 1 2)", PARSER_ERR_MAX_INPUT_SIZE_EXCEEDED},
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        parser_t parser;
+        program_t program = {0};
+        int err = parser_init(&parser, cases[i].input, strlen(cases[i].input));
+        if (err)
+            return 1;
+
+        err = parser_set_limits(&parser, &cases[i].limits);
+        if (err)
+            return 1;
+
+        err = parser_parse(&parser, &program);
+        if (err != cases[i].expected)
+        {
+            fprintf(stderr, "[FAIL] should_enforce_parser_limits: \"%s\": expected %d, got %d\n", cases[i].input, cases[i].expected, err);
+            return 1;
+        }
+
+        parser_free_program(&program);
+    }
+
+    fprintf(stdout, "[PASS] should_enforce_parser_limits\n");
+    return 0;
+}
+
+int should_collect_program_stats(void)
+{
+    fprintf(stdout, "[TEST] should_collect_program_stats\n");
+
+    parser_t parser;
+    program_t program = {0};
+    char *input = "(define x \"ab\") (f (g 1 2.5 3 4)) ()";
+    int err = parser_init(&parser, input, strlen(input));
+    if (err)
+        return 1;
+    err = parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_collect_program_stats: parser_parse failed: %d\n", err);
+        return 1;
+    }
+
+    parser_stats_t stats = {0};
+    err = parser_program_stats(&program, &stats);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_collect_program_stats: parser_program_stats failed: %d\n", err);
+        return 1;
+    }
+
+    if (stats.lists != 4 || stats.integers != 3 || stats.floats != 1 ||
+        stats.symbols != 4 || stats.strings != 1 || stats.max_depth != 2)
+    {
+        fprintf(stderr, "[FAIL] should_collect_program_stats: incorrect node counts\n");
+        return 1;
+    }
+
+    // () -> [0], (f ...) -> [2-3], (define ...) -> [2-3], (g ...) -> [4-7]
+    if (stats.fanout[0] != 1 || stats.fanout[2] != 2 || stats.fanout[3] != 1)
+    {
+        fprintf(stderr, "[FAIL] should_collect_program_stats: incorrect fan-out histogram\n");
+        return 1;
+    }
+
+    // "define" + "x" + "\"ab\"" + "f" + "g"
+    if (stats.string_bytes != 6 + 1 + 4 + 1 + 1)
+    {
+        fprintf(stderr, "[FAIL] should_collect_program_stats: expected 13 string bytes, got %zu\n", stats.string_bytes);
+        return 1;
+    }
+
+    if (stats.wasted_capacity_bytes > stats.form_array_bytes ||
+        stats.form_array_bytes < (program.size + 3 + 2 + 5) * sizeof(form_t))
+    {
+        fprintf(stderr, "[FAIL] should_collect_program_stats: incorrect array byte counts\n");
+        return 1;
+    }
+
+    parser_free_program(&program);
+    fprintf(stdout, "[PASS] should_collect_program_stats\n");
+    return 0;
+}
+
+int should_compute_structural_hashes(void)
+{
+    fprintf(stdout, "[TEST] should_compute_structural_hashes\n");
+
+    char *inputs[] = {
+        "(define (f x) (* x 2.0) \"s\")",
+        "(define   (f x)\n  (* x 2.0)   \"s\")",
+        "(define (f x) (* x 2.5) \"s\")",
+        "(define (f y) (* y 2.0) \"s\")",
+        "(define (f x) (* x 2.0) s)",
+    };
+    size_t count = sizeof(inputs) / sizeof(inputs[0]);
+    program_t programs[5] = {0};
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        parser_t parser;
+        int err = parser_init(&parser, inputs[i], strlen(inputs[i]));
+        if (err)
+            return 1;
+        err = parser_parse(&parser, &programs[i]);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_compute_structural_hashes: parser_parse failed: %d\n", err);
+            return 1;
+        }
+    }
+
+    uint64_t hash = parser_form_hash(&programs[0].items[0]);
+    if (hash != parser_form_hash(&programs[1].items[0]))
+    {
+        fprintf(stderr, "[FAIL] should_compute_structural_hashes: whitespace changed the hash\n");
+        return 1;
+    }
+
+    for (size_t i = 2; i < count; ++i)
+    {
+        if (hash == parser_form_hash(&programs[i].items[0]) || __program_equals(&programs[0], &programs[i]))
+        {
+            fprintf(stderr, "[FAIL] should_compute_structural_hashes: \"%s\" collided\n", inputs[i]);
+            return 1;
+        }
+    }
+
+    // Recomputing from scratch must agree with what the parser built incrementally
+    programs[0].items[0].list.hash = 0;
+    parser_hash_program(&programs[0]);
+    if (hash != parser_form_hash(&programs[0].items[0]) || !__program_equals(&programs[0], &programs[1]))
+    {
+        fprintf(stderr, "[FAIL] should_compute_structural_hashes: parser_hash_program disagrees with the parser\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        parser_free_program(&programs[i]);
+
+    fprintf(stdout, "[PASS] should_compute_structural_hashes\n");
+    return 0;
+}
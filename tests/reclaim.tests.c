@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reclaim.h"
+#include "parser.h"
+
+int should_free_programs_in_the_background(void);
+int should_split_large_programs_across_threads(void);
+
+int main(void)
+{
+    int err = 0;
+    err = err || should_free_programs_in_the_background();
+    err = err || should_split_large_programs_across_threads();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All reclaim tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some reclaim tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int should_free_programs_in_the_background(void)
+{
+    fprintf(stdout, "[TEST] should_free_programs_in_the_background\n");
+
+    reclaimer_t reclaimer;
+    int err = reclaimer_init(&reclaimer, 2);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_free_programs_in_the_background: reclaimer_init failed: %d\n", err);
+        return 1;
+    }
+
+    char *input = "(define (f x) (g (h x))) (f 1) ()";
+    for (size_t i = 0; i < 100; ++i)
+    {
+        parser_t parser;
+        program_t program = {0};
+        err = parser_init(&parser, input, strlen(input));
+        err = err || parser_parse(&parser, &program);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_free_programs_in_the_background: parsing failed: %d\n", err);
+            return 1;
+        }
+
+        err = reclaimer_free_program(&reclaimer, &program);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_free_programs_in_the_background: reclaimer_free_program failed: %d\n", err);
+            return 1;
+        }
+
+        if (program.items != NULL || program.size != 0)
+        {
+            fprintf(stderr, "[FAIL] should_free_programs_in_the_background: program was not emptied\n");
+            return 1;
+        }
+    }
+
+    err = reclaimer_drain(&reclaimer);
+    if (err || reclaimer.jobs.size != 0 || reclaimer.in_flight != 0)
+    {
+        fprintf(stderr, "[FAIL] should_free_programs_in_the_background: queue was not drained\n");
+        return 1;
+    }
+
+    reclaimer_destroy(&reclaimer);
+
+    fprintf(stdout, "[OK] should_free_programs_in_the_background\n");
+    return 0;
+}
+
+// Parse forms copies of a small list into program
+static int parse_forms(program_t *program, char **input, size_t forms)
+{
+    *input = malloc(forms * 8 + 1);
+    if (!*input)
+        return 1;
+
+    for (size_t i = 0; i < forms; ++i)
+        memcpy(&(*input)[i * 8], "(a (b)) ", 8);
+    (*input)[forms * 8] = '\0';
+
+    parser_t parser;
+    *program = (program_t){0};
+    int err = parser_init(&parser, *input, forms * 8);
+    err = err || parser_parse(&parser, program);
+    return err || program->size != forms;
+}
+
+int should_split_large_programs_across_threads(void)
+{
+    fprintf(stdout, "[TEST] should_split_large_programs_across_threads\n");
+
+    reclaimer_t reclaimer;
+    int err = reclaimer_init(&reclaimer, 4);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_split_large_programs_across_threads: reclaimer_init failed: %d\n", err);
+        return 1;
+    }
+
+    // One form short of the threshold is a single job, the threshold
+    // itself is split into one job per thread
+    size_t sizes[] = {RECLAIM_SPLIT_THRESHOLD - 1, RECLAIM_SPLIT_THRESHOLD, RECLAIM_SPLIT_THRESHOLD * 4};
+    size_t expected_jobs[] = {1, 4, 4};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        char *input;
+        program_t program;
+        if (parse_forms(&program, &input, sizes[i]))
+        {
+            fprintf(stderr, "[FAIL] should_split_large_programs_across_threads: parsing failed\n");
+            return 1;
+        }
+
+        size_t before = reclaimer.jobs_queued;
+        err = reclaimer_free_program(&reclaimer, &program);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_split_large_programs_across_threads: reclaimer_free_program failed: %d\n", err);
+            return 1;
+        }
+
+        if (reclaimer.jobs_queued - before != expected_jobs[i])
+        {
+            fprintf(stderr, "[FAIL] should_split_large_programs_across_threads: %zu forms gave %zu jobs, expected %zu\n",
+                    sizes[i], reclaimer.jobs_queued - before, expected_jobs[i]);
+            return 1;
+        }
+
+        reclaimer_drain(&reclaimer);
+        free(input);
+    }
+
+    reclaimer_destroy(&reclaimer);
+
+    fprintf(stdout, "[OK] should_split_large_programs_across_threads\n");
+    return 0;
+}
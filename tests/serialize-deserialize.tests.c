@@ -1,15 +1,990 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include "serialize.h"
 #include "parser.h"
 
+int round_trip(char *name, char *program_str, size_t program_len, serializer_options_t *options);
+
+int should_round_trip_a_small_program(void);
+int should_round_trip_a_program_larger_than_the_buffer(void);
+int should_serialize_into_a_caller_buffer(void);
+int should_round_trip_v2_programs(void);
+int should_encode_v2_more_compactly(void);
+int should_reject_malformed_input(void);
+int should_feed_messages_split_at_every_byte(void);
+int should_deserialize_from_a_nonblocking_socket(void);
+int should_share_symbols_through_the_table(void);
+int should_write_the_same_bytes_when_gathering(void);
+int should_start_from_default_options(void);
+int should_compress_messages(void);
+int should_get_single_forms_through_the_index(void);
+int should_transcode_to_the_same_bytes(void);
+int should_decode_into_an_arena(void);
+int should_patch_programs_with_deltas(void);
+int should_refuse_too_deeply_nested_messages(void);
+int should_refuse_deep_nesting_on_incremental_paths(void);
+
 int main(void)
 {
-    fprintf(stdout, "[TEST] serialize-deserialize\n");
+    int err = 0;
+    err = err || should_round_trip_a_small_program();
+    err = err || should_round_trip_a_program_larger_than_the_buffer();
+    err = err || should_serialize_into_a_caller_buffer();
+    err = err || should_round_trip_v2_programs();
+    err = err || should_encode_v2_more_compactly();
+    err = err || should_reject_malformed_input();
+    err = err || should_feed_messages_split_at_every_byte();
+    err = err || should_deserialize_from_a_nonblocking_socket();
+    err = err || should_share_symbols_through_the_table();
+    err = err || should_write_the_same_bytes_when_gathering();
+    err = err || should_start_from_default_options();
+    err = err || should_compress_messages();
+    err = err || should_get_single_forms_through_the_index();
+    err = err || should_transcode_to_the_same_bytes();
+    err = err || should_decode_into_an_arena();
+    err = err || should_patch_programs_with_deltas();
+    err = err || should_refuse_too_deeply_nested_messages();
+    err = err || should_refuse_deep_nesting_on_incremental_paths();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All serialize-deserialize tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some serialize-deserialize tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int should_round_trip_a_small_program(void)
+{
+    char *program_str = "(+ 1 2 3)";
+    int err = round_trip("should_round_trip_a_small_program", program_str, strlen(program_str), NULL);
+
+    // Empty lists are the smallest forms, also as the last item of a list
+    char *empty_str = "(f ()) (())";
+    return err || round_trip("should_round_trip_a_small_program (empty lists)", empty_str, strlen(empty_str), NULL);
+}
+
+int should_round_trip_a_program_larger_than_the_buffer(void)
+{
+    // Long strings force flushes mid-form, and one of them skips the buffer entirely
+    char *form = "(define (f x) (g \"a fairly long string literal to fill the buffer up\" 3.14 -42)) ";
+    size_t form_len = strlen(form);
+    size_t copies = 4 * SERIALIZER_BUFFER_SIZE / form_len;
+    size_t huge_len = 2 * SERIALIZER_BUFFER_SIZE;
+    size_t program_len = copies * form_len + huge_len + 2;
+
+    char *program_str = malloc(program_len);
+    if (!program_str)
+        return 1;
+
+    for (size_t i = 0; i < copies; ++i)
+        memcpy(&program_str[i * form_len], form, form_len);
+
+    char *huge = &program_str[copies * form_len];
+    huge[0] = '"';
+    memset(&huge[1], 'x', huge_len);
+    huge[huge_len + 1] = '"';
+
+    // Gathering every string takes more than SERIALIZER_IOV_MAX entries
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    serializer_options_t v1_gather = {.version = SERIALIZER_VERSION_1, .gather_threshold = 32};
+    serializer_options_t v2_gather = {.version = SERIALIZER_VERSION_2, .gather_threshold = 32};
+    int err = round_trip("should_round_trip_a_program_larger_than_the_buffer", program_str, program_len, NULL);
+    err = err || round_trip("should_round_trip_a_program_larger_than_the_buffer (v2)", program_str, program_len, &v2);
+    err = err || round_trip("should_round_trip_a_program_larger_than_the_buffer (gather)", program_str, program_len, &v1_gather);
+    err = err || round_trip("should_round_trip_a_program_larger_than_the_buffer (v2, gather)", program_str, program_len, &v2_gather);
+    free(program_str);
+    return err;
+}
+
+int should_round_trip_v2_programs(void)
+{
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    char *program_str = "(define (f x) (* x -2.5 \"str\")) (f 0 1 -1 63 -64 64 9223372036854775807 -9223372036854775807) ()";
+    return round_trip("should_round_trip_v2_programs", program_str, strlen(program_str), &v2);
+}
+
+int should_encode_v2_more_compactly(void)
+{
+    fprintf(stdout, "[TEST] should_encode_v2_more_compactly\n");
+
+    char *program_str = "7";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t v1 = {.version = SERIALIZER_VERSION_1};
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    size_t v1_size = serializer_encoded_size(&program, &v1);
+    size_t v2_size = serializer_encoded_size(&program, &v2);
+
+    // A single one-digit integer: one tag byte and one varint byte after the headers
+    if (v1_size != sizeof(size_t) * 2 + 4 * 3 + 8 || v2_size != SERIALIZER_V2_HEADER_SIZE + 1 + 2)
+    {
+        fprintf(stderr, "[FAIL] should_encode_v2_more_compactly: got %zu bytes for v1 and %zu for v2\n", v1_size, v2_size);
+        return 1;
+    }
+
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_encode_v2_more_compactly\n");
+    return 0;
+}
+
+int should_serialize_into_a_caller_buffer(void)
+{
+    fprintf(stdout, "[TEST] should_serialize_into_a_caller_buffer\n");
+
+    char *program_str = "(define (f x) (* x 2.5)) \"str\" (f -1)";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: failed to parse program: %d\n", err);
+        return 1;
+    }
+
+    serializer_options_t versions[] = {{.version = SERIALIZER_VERSION_1}, {.version = SERIALIZER_VERSION_2}};
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        int fds[2];
+        if (pipe(fds) == -1)
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: failed to create pipe: %s\n", strerror(errno));
+            return 1;
+        }
+
+        static serializer_t serializer;
+        serializer_init(&serializer, fds[1]);
+        serializer_set_options(&serializer, &versions[v]);
+        err = serializer_serialize(&serializer, &program);
+        close(fds[1]);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: failed to serialize program: %d\n", err);
+            return 1;
+        }
+
+        char expected[1024];
+        ssize_t expected_len = read(fds[0], expected, sizeof(expected));
+        close(fds[0]);
+
+        size_t size = serializer_encoded_size(&program, &versions[v]);
+        if (expected_len < 0 || size != (size_t)expected_len)
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: expected size %zd, got %zu\n", expected_len, size);
+            return 1;
+        }
+
+        char *buf = malloc(size);
+        if (!buf)
+            return 1;
+
+        size_t written = 0;
+        err = serializer_serialize_to_buffer(&program, &versions[v], buf, size - 1, &written);
+        if (err != SERIALIZER_ERR_BUFFER_TOO_SMALL)
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: expected error %d, got %d\n", SERIALIZER_ERR_BUFFER_TOO_SMALL, err);
+            return 1;
+        }
+
+        err = serializer_serialize_to_buffer(&program, &versions[v], buf, size, &written);
+        if (err || written != size || memcmp(buf, expected, size) != 0)
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: buffer does not match the fd output\n");
+            return 1;
+        }
+
+        program_t decoded = {0};
+        err = deserializer_deserialize_from_buffer(buf, written, &decoded);
+        if (err || !__program_equals(&program, &decoded))
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: failed to decode the buffer: %d\n", err);
+            return 1;
+        }
+
+        parser_free_program(&decoded);
+
+        err = deserializer_deserialize_in_place(buf, written, &decoded);
+        if (err || !__program_equals(&program, &decoded))
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: failed to decode the buffer in place: %d\n", err);
+            return 1;
+        }
+
+        // (define ...) "str" (f -1): the string must point into buf, not a copy
+        string_t *str = &decoded.items[1].atom.str;
+        if (str->chars < buf || str->chars + str->len > buf + written)
+        {
+            fprintf(stderr, "[FAIL] should_serialize_into_a_caller_buffer: string was copied out of the buffer\n");
+            return 1;
+        }
+
+        parser_free_program(&decoded);
+        free(buf);
+    }
+
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_serialize_into_a_caller_buffer\n");
+    return 0;
+}
+
+int should_reject_malformed_input(void)
+{
+    fprintf(stdout, "[TEST] should_reject_malformed_input\n");
+
+    char *program_str = "(define (f x) (* x 2.5)) \"str\" (f -1)";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t versions[] = {
+        {.version = SERIALIZER_VERSION_1},
+        {.version = SERIALIZER_VERSION_2},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_SYMBOL_TABLE},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED},
+    };
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        char buf[1024];
+        size_t written = 0;
+        err = serializer_serialize_to_buffer(&program, &versions[v], buf, sizeof(buf), &written);
+        if (err)
+            return 1;
+
+        // Claim less payload than there is, so every message is cut short
+        size_t header_size = versions[v].version == SERIALIZER_VERSION_2 ? SERIALIZER_V2_HEADER_SIZE : sizeof(size_t);
+        for (size_t cut = header_size; cut < written; ++cut)
+        {
+            char truncated[1024];
+            memcpy(truncated, buf, written);
+            uint64_t payload = __builtin_bswap64(cut - header_size);
+            memcpy(truncated + header_size - sizeof(payload), &payload, sizeof(payload));
+
+            program_t decoded = {0};
+            err = deserializer_deserialize_in_place(truncated, cut, &decoded);
+            if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+            {
+                fprintf(stderr, "[FAIL] should_reject_malformed_input: v%d cut at %zu: expected %d, got %d\n",
+                        versions[v].version, cut, SERIALIZER_ERR_MALFORMED_INPUT, err);
+                return 1;
+            }
+            parser_free_program(&decoded);
+        }
+    }
+
+    // Payload sizes that wrap header_size + payload_size to 0, or are just
+    // too large, must be refused before anything is allocated or copied
+    uint64_t huge_sizes[] = {UINT64_MAX - SERIALIZER_V2_HEADER_SIZE + 1, UINT64_MAX, SERIALIZER_MAX_PAYLOAD_SIZE + 1};
+    for (size_t h = 0; h < sizeof(huge_sizes) / sizeof(huge_sizes[0]); ++h)
+    {
+        char message[SERIALIZER_V2_HEADER_SIZE + 64] = {0};
+        memcpy(message, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE);
+        message[SERIALIZER_MAGIC_SIZE] = SERIALIZER_VERSION_2;
+        uint64_t payload = __builtin_bswap64(huge_sizes[h]);
+        memcpy(message + SERIALIZER_V2_HEADER_SIZE - sizeof(payload), &payload, sizeof(payload));
+        memset(message + SERIALIZER_V2_HEADER_SIZE, 'x', 64);
+
+        deserializer_t deserializer;
+        deserializer_init(&deserializer, 0);
+        program_t decoded = {0};
+        size_t consumed = 0;
+        err = deserializer_feed(&deserializer, message, sizeof(message), &consumed, &decoded);
+        deserializer_free(&deserializer);
+        if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+        {
+            fprintf(stderr, "[FAIL] should_reject_malformed_input: fed a payload size of %llu: expected %d, got %d\n",
+                    (unsigned long long)huge_sizes[h], SERIALIZER_ERR_MALFORMED_INPUT, err);
+            return 1;
+        }
+
+        err = deserializer_deserialize_in_place(message, sizeof(message), &decoded);
+        if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+        {
+            fprintf(stderr, "[FAIL] should_reject_malformed_input: decoded a payload size of %llu: expected %d, got %d\n",
+                    (unsigned long long)huge_sizes[h], SERIALIZER_ERR_MALFORMED_INPUT, err);
+            return 1;
+        }
+
+        // And read from a file descriptor, which sizes its buffer from the header too
+        int fds[2];
+        if (pipe(fds) == -1 || write(fds[1], message, sizeof(message)) != (ssize_t)sizeof(message))
+            return 1;
+        close(fds[1]);
+
+        deserializer_init(&deserializer, fds[0]);
+        err = deserializer_deserialize(&deserializer, &decoded);
+        deserializer_free(&deserializer);
+        close(fds[0]);
+        if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+        {
+            fprintf(stderr, "[FAIL] should_reject_malformed_input: read a payload size of %llu: expected %d, got %d\n",
+                    (unsigned long long)huge_sizes[h], SERIALIZER_ERR_MALFORMED_INPUT, err);
+            return 1;
+        }
+    }
+
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_reject_malformed_input\n");
+    return 0;
+}
+
+int should_share_symbols_through_the_table(void)
+{
+    serializer_options_t table = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_SYMBOL_TABLE};
+    char *program_str = "(define (f x) (let ((y (+ x 1))) (+ y y))) (define (g x) (f (f x))) (g \"define\") ()";
+    if (round_trip("should_share_symbols_through_the_table", program_str, strlen(program_str), &table))
+        return 1;
+
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    size_t plain_size = serializer_encoded_size(&program, &v2);
+    size_t table_size = serializer_encoded_size(&program, &table);
+    if (table_size >= plain_size)
+    {
+        fprintf(stderr, "[FAIL] should_share_symbols_through_the_table: %zu bytes with the table, %zu without\n", table_size, plain_size);
+        return 1;
+    }
+
+    char buf[1024];
+    size_t written = 0;
+    err = serializer_serialize_to_buffer(&program, &table, buf, sizeof(buf), &written);
+    if (err || written != table_size)
+    {
+        fprintf(stderr, "[FAIL] should_share_symbols_through_the_table: failed to serialize: %d\n", err);
+        return 1;
+    }
+
+    program_t decoded = {0};
+    err = deserializer_deserialize_from_buffer(buf, written, &decoded);
+    if (err || !__program_equals(&program, &decoded) || !decoded.chars)
+    {
+        fprintf(stderr, "[FAIL] should_share_symbols_through_the_table: failed to deserialize: %d\n", err);
+        return 1;
+    }
+
+    // Both defines are the same table entry, and so is the f called twice in g
+    form_t *f = &decoded.items[0];
+    form_t *g = &decoded.items[1];
+    form_t *calls = &g->list.items[2];
+    if (f->list.items[0].atom.sym.chars != g->list.items[0].atom.sym.chars ||
+        calls->list.items[0].atom.sym.chars != calls->list.items[1].list.items[0].atom.sym.chars)
+    {
+        fprintf(stderr, "[FAIL] should_share_symbols_through_the_table: repeated symbols were not shared\n");
+        return 1;
+    }
+
+    // The string "define" is not a symbol, its copy sits in the same block
+    char *define = decoded.items[2].list.items[1].atom.str.chars;
+    if (define < decoded.chars || define >= decoded.chars + written)
+    {
+        fprintf(stderr, "[FAIL] should_share_symbols_through_the_table: the string was copied out of the chars block\n");
+        return 1;
+    }
+    parser_free_program(&decoded);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_share_symbols_through_the_table (%zu bytes, %zu without the table)\n", table_size, plain_size);
+    return 0;
+}
+
+int should_write_the_same_bytes_when_gathering(void)
+{
+    fprintf(stdout, "[TEST] should_write_the_same_bytes_when_gathering\n");
+
+    char *program_str = "(define (f x) \"short\" \"a string long enough to be gathered\") (a-long-enough-symbol \"\") f";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t versions[] = {
+        {.version = SERIALIZER_VERSION_1, .gather_threshold = 16},
+        {.version = SERIALIZER_VERSION_2, .gather_threshold = 16},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_SYMBOL_TABLE, .gather_threshold = 16},
+        {.version = SERIALIZER_VERSION_2, .gather_threshold = 1},
+    };
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        int fds[2];
+        if (pipe(fds) == -1)
+            return 1;
+
+        static serializer_t serializer;
+        serializer_init(&serializer, fds[1]);
+        serializer_set_options(&serializer, &versions[v]);
+        err = serializer_serialize(&serializer, &program);
+        close(fds[1]);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] should_write_the_same_bytes_when_gathering: failed to serialize: %d\n", err);
+            return 1;
+        }
+
+        char gathered[1024];
+        ssize_t gathered_len = read(fds[0], gathered, sizeof(gathered));
+        close(fds[0]);
+
+        char expected[1024];
+        size_t expected_len = 0;
+        err = serializer_serialize_to_buffer(&program, &versions[v], expected, sizeof(expected), &expected_len);
+        if (err || gathered_len != (ssize_t)expected_len || memcmp(gathered, expected, expected_len) != 0)
+        {
+            fprintf(stderr, "[FAIL] should_write_the_same_bytes_when_gathering: options %zu wrote %zd bytes, expected %zu\n",
+                    v, gathered_len, expected_len);
+            return 1;
+        }
+    }
+
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_write_the_same_bytes_when_gathering\n");
+    return 0;
+}
+
+int should_start_from_default_options(void)
+{
+    fprintf(stdout, "[TEST] should_start_from_default_options\n");
+
+    char *program_str = "(define (f x) \"a string long enough to be gathered\") (f 1)";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    // Not static: whatever the memory held before must not leak into the options
+    serializer_t *serializer = malloc(sizeof(serializer_t));
+    if (!serializer)
+        return 1;
+    memset(serializer, 0xab, sizeof(serializer_t));
+
+    int fds[2];
+    if (pipe(fds) == -1)
+        return 1;
+
+    serializer_init(serializer, fds[1]);
+    if (serializer->options.gather_threshold != 0 || serializer->options.index_min_list_size != 0 ||
+        serializer->options.flags != 0 || serializer->options.version != SERIALIZER_VERSION_1)
+    {
+        fprintf(stderr, "[FAIL] should_start_from_default_options: serializer_init left options unset\n");
+        return 1;
+    }
+
+    err = serializer_serialize(serializer, &program);
+    close(fds[1]);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_start_from_default_options: failed to serialize: %d\n", err);
+        return 1;
+    }
+
+    char written[1024];
+    ssize_t written_len = read(fds[0], written, sizeof(written));
+    close(fds[0]);
+
+    char expected[1024];
+    size_t expected_len = 0;
+    err = serializer_serialize_to_buffer(&program, NULL, expected, sizeof(expected), &expected_len);
+    if (err || written_len != (ssize_t)expected_len || memcmp(written, expected, expected_len) != 0)
+    {
+        fprintf(stderr, "[FAIL] should_start_from_default_options: wrote %zd bytes, expected %zu\n",
+                written_len, expected_len);
+        return 1;
+    }
+
+    free(serializer);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_start_from_default_options\n");
+    return 0;
+}
+
+int should_compress_messages(void)
+{
+    char *form = "(define (f x) (g \"a fairly long string literal\" 3.14 -42 (h x x x))) ";
+    size_t form_len = strlen(form);
+    size_t copies = 1000;
+    char *program_str = malloc(form_len * copies);
+    if (!program_str)
+        return 1;
+    for (size_t i = 0; i < copies; ++i)
+        memcpy(&program_str[i * form_len], form, form_len);
+
+    serializer_options_t compressed = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED};
+    serializer_options_t both = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED | SERIALIZER_FLAG_SYMBOL_TABLE};
+    int err = round_trip("should_compress_messages", program_str, form_len * copies, &compressed);
+    err = err || round_trip("should_compress_messages (symbol table)", program_str, form_len * copies, &both);
+    if (err)
+        return 1;
+
+    parser_t parser = {0};
+    program_t program = {0};
+    err = parser_init(&parser, program_str, form_len * copies);
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    size_t plain_size = serializer_encoded_size(&program, &v2);
+    size_t cap = serializer_encoded_size(&program, &compressed);
+    char *buf = malloc(cap);
+    size_t written = 0;
+    err = serializer_serialize_to_buffer(&program, &compressed, buf, cap, &written);
+    if (err || written * 10 > plain_size)
+    {
+        fprintf(stderr, "[FAIL] should_compress_messages: %zu bytes compressed, %zu plain: %d\n", written, plain_size, err);
+        return 1;
+    }
+
+    program_t decoded = {0};
+    err = deserializer_deserialize_in_place(buf, written, &decoded);
+    if (err || !decoded.block || !__program_equals(&program, &decoded))
+    {
+        fprintf(stderr, "[FAIL] should_compress_messages: in place decoding failed: %d\n", err);
+        return 1;
+    }
+
+    parser_free_program(&decoded);
+    parser_free_program(&program);
+    free(buf);
+    free(program_str);
+
+    fprintf(stdout, "[OK] should_compress_messages (%zu bytes, %zu uncompressed)\n", written, plain_size);
+    return 0;
+}
+
+int get_form_equals(char *buf, size_t len, const size_t *path, size_t depth, form_t *expected)
+{
+    program_t decoded = {0};
+    int err = deserializer_get_form_at(buf, len, path, depth, &decoded);
+    if (err)
+        return err;
+
+    int equals = decoded.size == 1 && decoded.block && __form_equals(&decoded.items[0], expected);
+    parser_free_program(&decoded);
+
+    return equals ? 0 : 1;
+}
+
+int should_get_single_forms_through_the_index(void)
+{
+    // A list long enough to be indexed, with a nested one in the middle
+    char *program_str = "(define (f x) (* x 2.5)) \"str\" "
+                        "(list 0 1 2 3 4 5 6 7 8 9 (list 10 11 12 13 14 15 16 17 18 19) \"twenty\" f) (f -1 ())";
+    serializer_options_t indexed[] = {
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_FORM_INDEX},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_FORM_INDEX, .index_min_list_size = 8},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_FORM_INDEX | SERIALIZER_FLAG_SYMBOL_TABLE, .index_min_list_size = 8},
+    };
+
+    // Whole messages decode as usual, the trailer is not a form
+    for (size_t v = 0; v < sizeof(indexed) / sizeof(indexed[0]); ++v)
+    {
+        if (round_trip("should_get_single_forms_through_the_index", program_str, strlen(program_str), &indexed[v]))
+            return 1;
+    }
+
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    form_t *list = &program.items[2];
+    for (size_t v = 0; v < sizeof(indexed) / sizeof(indexed[0]); ++v)
+    {
+        char buf[1024];
+        size_t written = 0;
+        err = serializer_serialize_to_buffer(&program, &indexed[v], buf, sizeof(buf), &written);
+        if (err || written != serializer_encoded_size(&program, &indexed[v]))
+        {
+            fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: failed to serialize: %d\n", err);
+            return 1;
+        }
+
+        for (size_t i = 0; i < program.size; ++i)
+        {
+            if (get_form_equals(buf, written, &i, 1, &program.items[i]))
+            {
+                fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: options %zu, form %zu\n", v, i);
+                return 1;
+            }
+        }
+
+        size_t paths[][3] = {{2, 11, 0}, {2, 12, 0}, {2, 11, 9}, {0, 1, 1}, {3, 2, 0}};
+        size_t depths[] = {2, 2, 3, 3, 2};
+        form_t *expected[] = {
+            &list->list.items[11],
+            &list->list.items[12],
+            &list->list.items[11].list.items[9],
+            &program.items[0].list.items[1].list.items[1],
+            &program.items[3].list.items[2],
+        };
+        for (size_t p = 0; p < sizeof(depths) / sizeof(depths[0]); ++p)
+        {
+            if (get_form_equals(buf, written, paths[p], depths[p], expected[p]))
+            {
+                fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: options %zu, path %zu\n", v, p);
+                return 1;
+            }
+        }
+
+        // Past the last form, past the end of a list and into an atom
+        size_t out_of_bounds[][2] = {{4, 0}, {2, 14}, {1, 0}};
+        size_t out_of_bounds_depths[] = {1, 2, 2};
+        for (size_t p = 0; p < 3; ++p)
+        {
+            err = get_form_equals(buf, written, out_of_bounds[p], out_of_bounds_depths[p], NULL);
+            if (err != SERIALIZER_ERR_INDEX_OUT_OF_BOUNDS)
+            {
+                fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: path %zu: expected %d, got %d\n",
+                        p, SERIALIZER_ERR_INDEX_OUT_OF_BOUNDS, err);
+                return 1;
+            }
+        }
+
+        // Cutting the trailer anywhere must not send a lookup out of the payload
+        for (size_t cut = SERIALIZER_V2_HEADER_SIZE; cut < written; ++cut)
+        {
+            char truncated[1024];
+            memcpy(truncated, buf, written);
+            uint64_t payload = __builtin_bswap64(cut - SERIALIZER_V2_HEADER_SIZE);
+            memcpy(truncated + SERIALIZER_V2_HEADER_SIZE - sizeof(payload), &payload, sizeof(payload));
+
+            size_t path[] = {2, 12};
+            if (get_form_equals(truncated, cut, path, 2, &list->list.items[12]) == 0)
+            {
+                fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: options %zu cut at %zu: accepted\n", v, cut);
+                return 1;
+            }
+        }
+    }
+
+    serializer_options_t plain = {.version = SERIALIZER_VERSION_2};
+    serializer_options_t compressed = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_FORM_INDEX | SERIALIZER_FLAG_COMPRESSED};
+    char buf[1024];
+    size_t written = 0;
+    if (serializer_serialize_to_buffer(&program, &compressed, buf, sizeof(buf), &written) != SERIALIZER_ERR_INVALID_ARGUMENT)
+    {
+        fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: indexed a compressed message\n");
+        return 1;
+    }
+
+    program_t decoded = {0};
+    err = serializer_serialize_to_buffer(&program, &plain, buf, sizeof(buf), &written);
+    err = err ? err : deserializer_get_form(buf, written, 0, &decoded);
+    if (err != SERIALIZER_ERR_NO_INDEX)
+    {
+        fprintf(stderr, "[FAIL] should_get_single_forms_through_the_index: expected %d without an index, got %d\n",
+                SERIALIZER_ERR_NO_INDEX, err);
+        return 1;
+    }
+
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_get_single_forms_through_the_index\n");
+    return 0;
+}
+
+int should_transcode_to_the_same_bytes(void)
+{
+    fprintf(stdout, "[TEST] should_transcode_to_the_same_bytes\n");
+
+    // Lists of 128 items and more need a wider size than was reserved,
+    // at the top level too
+    size_t cap = 64 * 1024;
+    char *program_str = malloc(cap);
+    if (!program_str)
+        return 1;
+    size_t len = (size_t)snprintf(program_str, cap, "(define (f x) (* x 2.5)) \"str\" (f -1 ()) ((())) (+");
+    for (size_t i = 0; i < 300; ++i)
+        len += (size_t)snprintf(program_str + len, cap - len, " %zu", i * 1000);
+    len += (size_t)snprintf(program_str + len, cap - len, " (list");
+    for (size_t i = 0; i < 20000; ++i)
+        len += (size_t)snprintf(program_str + len, cap - len, " x");
+    len += (size_t)snprintf(program_str + len, cap - len, "))");
+    for (size_t i = 0; i < 200; ++i)
+        len += (size_t)snprintf(program_str + len, cap - len, " a");
+
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, len);
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t versions[] = {{.version = SERIALIZER_VERSION_1}, {.version = SERIALIZER_VERSION_2}};
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        size_t expected_len = serializer_encoded_size(&program, &versions[v]);
+        char *expected = malloc(expected_len);
+        err = serializer_serialize_to_buffer(&program, &versions[v], expected, expected_len, &expected_len);
+        if (err)
+            return 1;
+
+        char *transcoded = NULL;
+        size_t transcoded_len = 0;
+        err = serializer_transcode(program_str, len, &versions[v], &transcoded, &transcoded_len);
+        if (err || transcoded_len != expected_len || memcmp(transcoded, expected, expected_len) != 0)
+        {
+            fprintf(stderr, "[FAIL] should_transcode_to_the_same_bytes: v%d: %zu bytes, expected %zu: %d\n",
+                    versions[v].version, transcoded_len, expected_len, err);
+            return 1;
+        }
+
+        size_t written = 0;
+        err = serializer_transcode_to_buffer(program_str, len, &versions[v], transcoded, expected_len - 1, &written);
+        if (err != SERIALIZER_ERR_BUFFER_TOO_SMALL)
+        {
+            fprintf(stderr, "[FAIL] should_transcode_to_the_same_bytes: expected %d, got %d\n", SERIALIZER_ERR_BUFFER_TOO_SMALL, err);
+            return 1;
+        }
+        err = serializer_transcode_to_buffer(program_str, len, &versions[v], transcoded, expected_len, &written);
+        if (err || written != expected_len || memcmp(transcoded, expected, expected_len) != 0)
+        {
+            fprintf(stderr, "[FAIL] should_transcode_to_the_same_bytes: v%d into a buffer: %d\n", versions[v].version, err);
+            return 1;
+        }
+
+        free(transcoded);
+        free(expected);
+    }
+
+    char *malformed[] = {"(f", ")", "(f))", "(f (g x)"};
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i)
+    {
+        char buf[256];
+        size_t written;
+        err = serializer_transcode_to_buffer(malformed[i], strlen(malformed[i]), &versions[1], buf, sizeof(buf), &written);
+        if (err != SERIALIZER_ERR_PARSE_FAILED)
+        {
+            fprintf(stderr, "[FAIL] should_transcode_to_the_same_bytes: transcoded \"%s\": %d\n", malformed[i], err);
+            return 1;
+        }
+    }
+
+    serializer_options_t table = {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_SYMBOL_TABLE};
+    char buf[256];
+    size_t written;
+    if (serializer_transcode_to_buffer("(f x)", 5, &table, buf, sizeof(buf), &written) != SERIALIZER_ERR_INVALID_ARGUMENT)
+    {
+        fprintf(stderr, "[FAIL] should_transcode_to_the_same_bytes: accepted a symbol table\n");
+        return 1;
+    }
+
+    parser_free_program(&program);
+    free(program_str);
+
+    fprintf(stdout, "[OK] should_transcode_to_the_same_bytes\n");
+    return 0;
+}
+
+int should_feed_messages_split_at_every_byte(void)
+{
+    fprintf(stdout, "[TEST] should_feed_messages_split_at_every_byte\n");
+
+    char *program_str = "(define (f x) (* x 2.5)) \"str\" (f -1 ())";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t versions[] = {
+        {.version = SERIALIZER_VERSION_1},
+        {.version = SERIALIZER_VERSION_2},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED},
+    };
+    int flags[] = {0, DESERIALIZER_FLAG_ZERO_COPY};
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        // Two messages back to back, to check nothing leaks into the next one
+        char buf[2048];
+        size_t len = 0;
+        err = serializer_serialize_to_buffer(&program, &versions[v], buf, sizeof(buf) / 2, &len);
+        if (err)
+            return 1;
+        memcpy(buf + len, buf, len);
+
+        for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); ++f)
+        {
+            deserializer_t deserializer;
+            deserializer_init(&deserializer, 0);
+            deserializer_set_flags(&deserializer, flags[f]);
+
+            for (size_t split = 0; split <= len; ++split)
+            {
+                program_t decoded = {0};
+                size_t consumed = 0;
+                err = deserializer_feed(&deserializer, buf, split, &consumed, &decoded);
+                if (split < len && (err != DESERIALIZER_NEED_MORE || consumed != split))
+                {
+                    fprintf(stderr, "[FAIL] should_feed_messages_split_at_every_byte: split at %zu: got %d\n", split, err);
+                    return 1;
+                }
+
+                if (split < len)
+                {
+                    err = deserializer_feed(&deserializer, buf + split, 2 * len - split, &consumed, &decoded);
+                    consumed += split;
+                }
+
+                if (err || consumed != len || !__program_equals(&program, &decoded))
+                {
+                    fprintf(stderr, "[FAIL] should_feed_messages_split_at_every_byte: split at %zu: got %d after %zu bytes\n", split, err, consumed);
+                    return 1;
+                }
+                parser_free_program(&decoded);
+            }
+
+            // And one byte at a time, straight through both messages
+            size_t messages = 0;
+            for (size_t i = 0; i < 2 * len; ++i)
+            {
+                program_t decoded = {0};
+                size_t consumed = 0;
+                err = deserializer_feed(&deserializer, buf + i, 1, &consumed, &decoded);
+                if (err == DESERIALIZER_NEED_MORE)
+                    continue;
+                if (err || consumed != 1 || !__program_equals(&program, &decoded))
+                {
+                    fprintf(stderr, "[FAIL] should_feed_messages_split_at_every_byte: byte %zu: got %d\n", i, err);
+                    return 1;
+                }
+                parser_free_program(&decoded);
+                messages++;
+            }
+
+            if (messages != 2)
+            {
+                fprintf(stderr, "[FAIL] should_feed_messages_split_at_every_byte: expected 2 messages, got %zu\n", messages);
+                return 1;
+            }
+
+            deserializer_free(&deserializer);
+        }
+    }
+
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_feed_messages_split_at_every_byte\n");
+    return 0;
+}
+
+int should_deserialize_from_a_nonblocking_socket(void)
+{
+    fprintf(stdout, "[TEST] should_deserialize_from_a_nonblocking_socket\n");
+
+    char *program_str = "(define (f x) (* x 2.5)) \"str\" (f -1)";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    serializer_options_t v2 = {.version = SERIALIZER_VERSION_2};
+    char buf[1024];
+    size_t len = 0;
+    err = serializer_serialize_to_buffer(&program, &v2, buf, sizeof(buf), &len);
+    if (err)
+        return 1;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+    {
+        fprintf(stderr, "[FAIL] should_deserialize_from_a_nonblocking_socket: socketpair failed: %s\n", strerror(errno));
+        return 1;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    deserializer_t deserializer;
+    deserializer_init(&deserializer, fds[0]);
+
+    program_t decoded = {0};
+    err = deserializer_try_deserialize(&deserializer, &decoded);
+    if (err != DESERIALIZER_NEED_MORE)
+    {
+        fprintf(stderr, "[FAIL] should_deserialize_from_a_nonblocking_socket: empty socket: got %d\n", err);
+        return 1;
+    }
+
+    // Half a header, then the rest of the first message glued to a second one
+    if (write(fds[1], buf, 5) != 5)
+        return 1;
+    err = deserializer_try_deserialize(&deserializer, &decoded);
+    if (err != DESERIALIZER_NEED_MORE)
+    {
+        fprintf(stderr, "[FAIL] should_deserialize_from_a_nonblocking_socket: partial header: got %d\n", err);
+        return 1;
+    }
+
+    if (write(fds[1], buf + 5, len - 5) != (ssize_t)(len - 5) || write(fds[1], buf, len) != (ssize_t)len)
+        return 1;
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        err = deserializer_try_deserialize(&deserializer, &decoded);
+        if (err || !__program_equals(&program, &decoded))
+        {
+            fprintf(stderr, "[FAIL] should_deserialize_from_a_nonblocking_socket: message %zu: got %d\n", i, err);
+            return 1;
+        }
+        parser_free_program(&decoded);
+    }
+
+    err = deserializer_try_deserialize(&deserializer, &decoded);
+    if (err != DESERIALIZER_NEED_MORE)
+    {
+        fprintf(stderr, "[FAIL] should_deserialize_from_a_nonblocking_socket: drained socket: got %d\n", err);
+        return 1;
+    }
+
+    deserializer_free(&deserializer);
+    close(fds[0]);
+    close(fds[1]);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_deserialize_from_a_nonblocking_socket\n");
+    return 0;
+}
+
+int round_trip(char *name, char *program_str, size_t program_len, serializer_options_t *options)
+{
+    fprintf(stdout, "[TEST] %s\n", name);
 
     int fd = open("test.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (fd == -1)
@@ -18,7 +993,7 @@ int main(void)
         return 1;
     }
 
-    serializer_t serializer;
+    static serializer_t serializer;
 
     int err = serializer_init(&serializer, fd);
     if (err)
@@ -27,8 +1002,15 @@ int main(void)
         return 1;
     }
 
-    char *program_str = "(+ 1 2 3)";
-    size_t program_len = strlen(program_str);
+    if (options)
+    {
+        err = serializer_set_options(&serializer, options);
+        if (err)
+        {
+            fprintf(stderr, "[FAIL] Failed to set serializer options: %d\n", err);
+            return 1;
+        }
+    }
 
     parser_t parser = {0};
     program_t program = {0};
@@ -80,8 +1062,27 @@ int main(void)
 
     int equals = __program_equals(&program, &program2);
 
+    // Read the same message again, this time into a single zero-copy block
+    program_t program3 = {0};
+    if (lseek(fd, 0, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "[FAIL] Failed to rewind file: %s\n", strerror(errno));
+        return 1;
+    }
+
+    deserializer_set_flags(&deserializer, DESERIALIZER_FLAG_ZERO_COPY);
+    err = deserializer_deserialize(&deserializer, &program3);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] Failed to deserialize program in zero-copy mode: %d\n", err);
+        return 1;
+    }
+
+    equals = equals && program3.block != NULL && __program_equals(&program, &program3);
+
     parser_free_program(&program);
     parser_free_program(&program2);
+    parser_free_program(&program3);
 
     err = close(fd);
     if (err)
@@ -100,11 +1101,479 @@ int main(void)
 
     if (!equals)
     {
-        fprintf(stdout, "[FAIL] Programs are not equal\n");
+        fprintf(stdout, "[FAIL] %s: Programs are not equal\n", name);
         return 1;
     }
 
-    fprintf(stdout, "[OK] Programs are equal\n");
+    fprintf(stdout, "[OK] %s: Programs are equal\n", name);
+
+    return 0;
+}
+
+int should_decode_into_an_arena(void)
+{
+    fprintf(stdout, "[TEST] should_decode_into_an_arena\n");
+
+    char *program_str = "(define (f x) (* x 2.5)) \"str\" (f -1 ()) (f f f f)";
+    parser_t parser = {0};
+    program_t program = {0};
+    int err = parser_init(&parser, program_str, strlen(program_str));
+    err = err || parser_parse(&parser, &program);
+    if (err)
+        return 1;
+
+    alloc_arena_t arena;
+    alloc_arena_init(&arena, 1024);
+
+    serializer_options_t versions[] = {
+        {.version = SERIALIZER_VERSION_1},
+        {.version = SERIALIZER_VERSION_2},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_SYMBOL_TABLE},
+        {.version = SERIALIZER_VERSION_2, .flags = SERIALIZER_FLAG_COMPRESSED | SERIALIZER_FLAG_SYMBOL_TABLE},
+    };
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        char buf[1024];
+        size_t len = 0;
+        err = serializer_serialize_to_buffer(&program, &versions[v], buf, sizeof(buf), &len);
+        if (err)
+            return 1;
+
+        int fds[2];
+        if (pipe(fds) == -1)
+            return 1;
+
+        deserializer_t deserializer;
+        deserializer_init(&deserializer, fds[0]);
+        deserializer_set_arena(&deserializer, &arena);
+
+        // The same message over and over: after the first one the arena
+        // has every byte it needs, so it must hand out the same memory
+        size_t used = 0;
+        form_t *items = NULL;
+        for (size_t round = 0; round < 4; ++round)
+        {
+            if (write(fds[1], buf, len) != (ssize_t)len)
+                return 1;
+
+            program_t decoded = {0};
+            err = deserializer_deserialize(&deserializer, &decoded);
+            if (err || decoded.arena != &arena || !__program_equals(&program, &decoded))
+            {
+                fprintf(stderr, "[FAIL] should_decode_into_an_arena: version %zu round %zu: %d\n", v, round, err);
+                return 1;
+            }
+
+            if (round > 0 && (decoded.items != items || alloc_arena_used(&arena) != used))
+            {
+                fprintf(stderr, "[FAIL] should_decode_into_an_arena: version %zu round %zu did not reuse the arena\n", v, round);
+                return 1;
+            }
+            items = decoded.items;
+            used = alloc_arena_used(&arena);
+
+            // Forgetting the program is all there is to do, the reset frees it
+            parser_free_program(&decoded);
+            if (decoded.items || decoded.arena)
+                return 1;
+            alloc_arena_reset(&arena);
+        }
+
+        // Fed one byte at a time, the partial message lives in the arena too
+        for (size_t i = 0; i < len; ++i)
+        {
+            program_t decoded = {0};
+            size_t consumed = 0;
+            err = deserializer_feed(&deserializer, buf + i, 1, &consumed, &decoded);
+            if (i + 1 < len ? err != DESERIALIZER_NEED_MORE : err || !__program_equals(&program, &decoded))
+            {
+                fprintf(stderr, "[FAIL] should_decode_into_an_arena: version %zu byte %zu: %d\n", v, i, err);
+                return 1;
+            }
+            parser_free_program(&decoded);
+        }
+        alloc_arena_reset(&arena);
+
+        deserializer_free(&deserializer);
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    alloc_arena_free(&arena);
+    parser_free_program(&program);
+
+    fprintf(stdout, "[OK] should_decode_into_an_arena\n");
+    return 0;
+}
+
+int parse_source(char *source, program_t *program)
+{
+    parser_t parser;
+    int err = parser_init(&parser, source, strlen(source));
+    return err ? err : parser_parse(&parser, program);
+}
+
+int expect_patched(char *from_str, char *to_str)
+{
+    program_t from = {0}, to = {0};
+    if (parse_source(from_str, &from) || parse_source(to_str, &to))
+        return 1;
+
+    char *delta = NULL;
+    size_t len = 0;
+    int err = serializer_diff(&from, &to, &delta, &len);
+    err = err ? err : serializer_patch(&from, delta, len);
+    if (err || !__program_equals(&from, &to))
+    {
+        fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: %s -> %s: %d\n", from_str, to_str, err);
+        return 1;
+    }
+
+    // The patched program is not the one the delta was made from anymore
+    if (strcmp(from_str, to_str) != 0 && serializer_patch(&from, delta, len) != SERIALIZER_ERR_DELTA_MISMATCH)
+    {
+        fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: %s -> %s applied twice\n", from_str, to_str);
+        return 1;
+    }
+
+    // Patched lists carry the hashes a parse would have given them
+    for (size_t i = 0; i < to.size; ++i)
+    {
+        if (parser_form_hash(&from.items[i]) != parser_form_hash(&to.items[i]))
+        {
+            fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: %s -> %s: wrong hash for form %zu\n", from_str, to_str, i);
+            return 1;
+        }
+    }
+
+    parser_free_program(&from);
+    parser_free_program(&to);
+    free(delta);
+
+    return 0;
+}
+
+int should_patch_programs_with_deltas(void)
+{
+    fprintf(stdout, "[TEST] should_patch_programs_with_deltas\n");
+
+    char *pairs[][2] = {
+        {"(a 1) (b 2)", "(a 1) (b 2)"},
+        {"(a 1) (b (c 2 \"x\")) (d)", "(a 1) (b (c 3 \"x\")) (d)"},
+        {"(a) (b) (c)", "(a) (new 1 2) (b) (c)"},
+        {"(a) (b) (c) (d)", "(a) (d)"},
+        {"(a) 1 \"s\" (d)", "(a) 2.5 sym (d)"},
+        {"(a (b (c (d 1))) 2) (e) (f) (g)", "(x) (a (b (c (d 1 1))) 2) (e) (g)"},
+        {"", "(a) (b)"},
+        {"(a) (b)", ""},
+        {"(a (1 2 3 4 5 6 7 8 9))", "(a (1 2 3 0 4 5 6 8 9 10))"},
+    };
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i)
+    {
+        if (expect_patched(pairs[i][0], pairs[i][1]) || expect_patched(pairs[i][1], pairs[i][0]))
+            return 1;
+    }
+
+    // One edit deep inside a large program costs a few bytes
+    char *form = "(define (f x) (g x \"a string\" 2.5)) ";
+    size_t form_len = strlen(form), copies = 1000;
+    char *from_str = malloc(form_len * copies + 1);
+    char *to_str = malloc(form_len * copies + 1);
+    if (!from_str || !to_str)
+        return 1;
+    for (size_t i = 0; i < copies; ++i)
+        memcpy(from_str + i * form_len, form, form_len);
+    from_str[form_len * copies] = '\0';
+    memcpy(to_str, from_str, form_len * copies + 1);
+    to_str[500 * form_len + 15] = 'h';
+
+    program_t from = {0}, to = {0};
+    if (parse_source(from_str, &from) || parse_source(to_str, &to))
+        return 1;
+
+    char *delta = NULL;
+    size_t len = 0;
+    int err = serializer_diff(&from, &to, &delta, &len);
+    if (err || len > 128)
+    {
+        fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: one edit took %zu bytes: %d\n", len, err);
+        return 1;
+    }
+
+    // A delta only applies to the program it was made from
+    program_t other = {0};
+    if (parse_source("(a) (b)", &other) || serializer_patch(&other, delta, len) != SERIALIZER_ERR_DELTA_MISMATCH)
+    {
+        fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: patched the wrong program\n");
+        return 1;
+    }
+
+    err = serializer_patch(&from, delta, len);
+    if (err || !__program_equals(&from, &to) || serializer_patch(&from, delta, len) != SERIALIZER_ERR_DELTA_MISMATCH)
+    {
+        fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: large program: %d\n", err);
+        return 1;
+    }
+
+    // And never reads like a program
+    program_t decoded = {0};
+    if (deserializer_deserialize_from_buffer(delta, len, &decoded) != SERIALIZER_ERR_UNSUPPORTED_VERSION)
+    {
+        fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: decoded a delta as a program\n");
+        return 1;
+    }
+
+    // Every truncation is refused without touching the program
+    for (size_t cut = 0; cut < len; ++cut)
+    {
+        char *copy = malloc(len);
+        memcpy(copy, delta, len);
+        uint64_t be = __builtin_bswap64(cut > SERIALIZER_V2_HEADER_SIZE ? cut - SERIALIZER_V2_HEADER_SIZE : 0);
+        memcpy(copy + SERIALIZER_V2_HEADER_SIZE - sizeof(be), &be, sizeof(be));
+        err = serializer_patch(&other, copy, cut);
+        free(copy);
+        if (err >= 0 || other.size != 2)
+        {
+            fprintf(stderr, "[FAIL] should_patch_programs_with_deltas: accepted a delta cut at %zu\n", cut);
+            return 1;
+        }
+    }
+
+    parser_free_program(&other);
+    parser_free_program(&from);
+    parser_free_program(&to);
+    free(delta);
+    free(from_str);
+    free(to_str);
+
+    fprintf(stdout, "[OK] should_patch_programs_with_deltas (one edit in %zu forms: %zu bytes)\n", copies, len);
+    return 0;
+}
+
+/**
+ * A message holding one list nested depth levels deep, with an empty list
+ * at the bottom, written by hand as a hostile peer would
+ */
+char *nested_message(int version, size_t depth, size_t *len)
+{
+    size_t header_size = version == SERIALIZER_VERSION_2 ? SERIALIZER_V2_HEADER_SIZE : sizeof(uint64_t);
+    // v2 lists are a tag and a varint count, v1 lists a u32 type and a u64 count
+    size_t level_size = version == SERIALIZER_VERSION_2 ? 2 : sizeof(uint32_t) + sizeof(uint64_t);
+    size_t payload = (version == SERIALIZER_VERSION_2 ? 1 : sizeof(uint64_t)) + depth * level_size;
+
+    char *message = calloc(header_size + payload, 1);
+    if (!message)
+        return NULL;
+
+    uint64_t be = __builtin_bswap64(payload);
+    if (version == SERIALIZER_VERSION_2)
+    {
+        memcpy(message, SERIALIZER_MAGIC, SERIALIZER_MAGIC_SIZE);
+        message[SERIALIZER_MAGIC_SIZE] = SERIALIZER_VERSION_2;
+    }
+    memcpy(message + header_size - sizeof(be), &be, sizeof(be));
+
+    char *cur = message + header_size;
+    if (version == SERIALIZER_VERSION_2)
+    {
+        // One top-level form, then every level is the list tag (0) and a count
+        *cur++ = 1;
+        for (size_t i = 0; i < depth; ++i)
+        {
+            *cur++ = 0;
+            *cur++ = i + 1 < depth ? 1 : 0;
+        }
+    }
+    else
+    {
+        be = __builtin_bswap64(1);
+        memcpy(cur, &be, sizeof(be));
+        cur += sizeof(be);
+        for (size_t i = 0; i < depth; ++i)
+        {
+            uint32_t type = __builtin_bswap32(FORM_LIST);
+            be = __builtin_bswap64(i + 1 < depth ? 1 : 0);
+            memcpy(cur, &type, sizeof(type));
+            memcpy(cur + sizeof(type), &be, sizeof(be));
+            cur += sizeof(type) + sizeof(be);
+        }
+    }
+
+    *len = header_size + payload;
+    return message;
+}
+
+int should_refuse_too_deeply_nested_messages(void)
+{
+    fprintf(stdout, "[TEST] should_refuse_too_deeply_nested_messages\n");
+
+    // Up to the limit decodes, one more level is refused, in both versions
+    int versions[] = {SERIALIZER_VERSION_1, SERIALIZER_VERSION_2};
+    for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        for (size_t depth = SERIALIZER_MAX_DEPTH; depth <= SERIALIZER_MAX_DEPTH + 1; ++depth)
+        {
+            size_t len;
+            char *message = nested_message(versions[v], depth, &len);
+            if (!message)
+                return 1;
+
+            program_t decoded = {0};
+            int err = deserializer_deserialize_from_buffer(message, len, &decoded);
+            int expected = depth > SERIALIZER_MAX_DEPTH ? SERIALIZER_ERR_MALFORMED_INPUT : 0;
+            if (err != expected || (!err && decoded.size != 1))
+            {
+                fprintf(stderr, "[FAIL] should_refuse_too_deeply_nested_messages: v%d at depth %zu: expected %d, got %d\n",
+                        versions[v], depth, expected, err);
+                return 1;
+            }
+            parser_free_program(&decoded);
+            free(message);
+        }
+    }
+
+    // A million levels take 2 MB in v2, which would overflow the stack of
+    // a recursive decoder; every way of decoding a buffer must refuse it
+    size_t len;
+    char *message = nested_message(SERIALIZER_VERSION_2, 1 << 20, &len);
+    if (!message)
+        return 1;
+
+    program_t decoded = {0};
+    int err = deserializer_deserialize_from_buffer(message, len, &decoded);
+    if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_refuse_too_deeply_nested_messages: from a buffer: expected %d, got %d\n",
+                SERIALIZER_ERR_MALFORMED_INPUT, err);
+        return 1;
+    }
+    parser_free_program(&decoded);
+
+    err = deserializer_deserialize_in_place(message, len, &decoded);
+    if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_refuse_too_deeply_nested_messages: in place: expected %d, got %d\n",
+                SERIALIZER_ERR_MALFORMED_INPUT, err);
+        return 1;
+    }
+    parser_free_program(&decoded);
+
+    // And read from a file descriptor
+    FILE *file = tmpfile();
+    if (!file || fwrite(message, 1, len, file) != len || fflush(file) != 0)
+        return 1;
+    rewind(file);
+
+    deserializer_t deserializer;
+    deserializer_init(&deserializer, fileno(file));
+    err = deserializer_deserialize(&deserializer, &decoded);
+    deserializer_free(&deserializer);
+    fclose(file);
+    if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+    {
+        fprintf(stderr, "[FAIL] should_refuse_too_deeply_nested_messages: from a file: expected %d, got %d\n",
+                SERIALIZER_ERR_MALFORMED_INPUT, err);
+        return 1;
+    }
+    parser_free_program(&decoded);
+
+    free(message);
+
+    fprintf(stdout, "[OK] should_refuse_too_deeply_nested_messages\n");
+    return 0;
+}
+
+int should_refuse_deep_nesting_on_incremental_paths(void)
+{
+    fprintf(stdout, "[TEST] should_refuse_deep_nesting_on_incremental_paths\n");
+
+    // A hostile message followed by a good one, as a peer could send them
+    size_t deep_len, good_len;
+    char *deep = nested_message(SERIALIZER_VERSION_2, 1 << 20, &deep_len);
+    char *good = nested_message(SERIALIZER_VERSION_2, 3, &good_len);
+    if (!deep || !good)
+        return 1;
+
+    FILE *file = tmpfile();
+    if (!file || fwrite(deep, 1, deep_len, file) != deep_len || fwrite(good, 1, good_len, file) != good_len ||
+        fflush(file) != 0)
+        return 1;
+
+    alloc_arena_t arena;
+    alloc_arena_init(&arena, 4096);
+
+    // Copying, zero-copy and arena decoding each have their own path once
+    // a message is complete, all of them must stop at the depth limit
+    char *modes[] = {"copy", "zero-copy", "arena"};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+    {
+        deserializer_t deserializer;
+        deserializer_init(&deserializer, fileno(file));
+        if (m == 1)
+            deserializer_set_flags(&deserializer, DESERIALIZER_FLAG_ZERO_COPY);
+        if (m == 2)
+            deserializer_set_arena(&deserializer, &arena);
+
+        program_t decoded = {0};
+        size_t consumed = 0;
+        int err = deserializer_feed(&deserializer, deep, deep_len, &consumed, &decoded);
+        parser_free_program(&decoded);
+        if (err != SERIALIZER_ERR_MALFORMED_INPUT || consumed != deep_len)
+        {
+            fprintf(stderr, "[FAIL] should_refuse_deep_nesting_on_incremental_paths: fed, %s: expected %d, got %d\n",
+                    modes[m], SERIALIZER_ERR_MALFORMED_INPUT, err);
+            return 1;
+        }
+
+        // The deserializer is ready for the next message afterwards
+        err = deserializer_feed(&deserializer, good, good_len, &consumed, &decoded);
+        if (err || decoded.size != 1)
+        {
+            fprintf(stderr, "[FAIL] should_refuse_deep_nesting_on_incremental_paths: fed after, %s: got %d\n", modes[m], err);
+            return 1;
+        }
+        parser_free_program(&decoded);
+
+        // Same through the descriptor
+        rewind(file);
+        err = deserializer_try_deserialize(&deserializer, &decoded);
+        parser_free_program(&decoded);
+        if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+        {
+            fprintf(stderr, "[FAIL] should_refuse_deep_nesting_on_incremental_paths: read, %s: expected %d, got %d\n",
+                    modes[m], SERIALIZER_ERR_MALFORMED_INPUT, err);
+            return 1;
+        }
+
+        err = deserializer_try_deserialize(&deserializer, &decoded);
+        if (err || decoded.size != 1)
+        {
+            fprintf(stderr, "[FAIL] should_refuse_deep_nesting_on_incremental_paths: read after, %s: got %d\n", modes[m], err);
+            return 1;
+        }
+        parser_free_program(&decoded);
+
+        // And through the blocking read of a whole message
+        rewind(file);
+        err = deserializer_deserialize(&deserializer, &decoded);
+        parser_free_program(&decoded);
+        if (err != SERIALIZER_ERR_MALFORMED_INPUT)
+        {
+            fprintf(stderr, "[FAIL] should_refuse_deep_nesting_on_incremental_paths: deserialized, %s: expected %d, got %d\n",
+                    modes[m], SERIALIZER_ERR_MALFORMED_INPUT, err);
+            return 1;
+        }
+
+        deserializer_free(&deserializer);
+        rewind(file);
+        alloc_arena_reset(&arena);
+    }
+
+    alloc_arena_free(&arena);
+    fclose(file);
+    free(deep);
+    free(good);
 
+    fprintf(stdout, "[OK] should_refuse_deep_nesting_on_incremental_paths\n");
     return 0;
 }
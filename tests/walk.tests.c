@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "walk.h"
+
+int should_walk_directories_largest_first(void);
+int should_read_manifests(void);
+int should_fail_on_missing_paths(void);
+
+static char root[] = "/tmp/walk.tests.XXXXXX";
+
+static int write_file(char *name, size_t size)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return 1;
+    for (size_t i = 0; i < size; ++i)
+        fputc('x', file);
+    fclose(file);
+
+    return 0;
+}
+
+static int make_dir(char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    return mkdir(path, 0700);
+}
+
+static int make_link(char *target, char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    return symlink(target, path);
+}
+
+static int write_fixtures(void)
+{
+    if (!mkdtemp(root))
+        return 1;
+
+    int err = make_dir("sub") || make_dir("sub/deep");
+    err = err || write_file("a.lisp", 10);
+    err = err || write_file("sub/b.lisp", 300);
+    err = err || write_file("sub/deep/c.lisp", 50);
+    err = err || write_file("sub/notes.txt", 1000);
+    // A link to a file is followed, a link to a directory is not
+    err = err || make_link("sub/b.lisp", "link.lisp");
+    err = err || make_link(".", "loop");
+
+    return err;
+}
+
+static void remove_fixtures(void)
+{
+    char command[256];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    if (system(command) != 0)
+        fprintf(stderr, "Could not remove %s\n", root);
+}
+
+static int expect_paths(char *name, walk_list_t *list, char **expected, size_t count)
+{
+    if (list->count != count)
+    {
+        fprintf(stderr, "[FAIL] %s: expected %zu files, got %zu\n", name, count, list->count);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", root, expected[i]);
+        if (strcmp(list->paths[i], path) != 0)
+        {
+            fprintf(stderr, "[FAIL] %s: expected %s at %zu, got %s\n", name, path, i, list->paths[i]);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    if (write_fixtures())
+    {
+        fprintf(stdout, "[FAIL] Could not write the walk fixtures\n");
+        return 1;
+    }
+
+    int err = 0;
+    err = err || should_walk_directories_largest_first();
+    err = err || should_read_manifests();
+    err = err || should_fail_on_missing_paths();
+
+    remove_fixtures();
+
+    if (err == 0)
+    {
+        fprintf(stdout, "[OK] All walk tests passed\n");
+    }
+    else
+    {
+        fprintf(stdout, "[FAIL] Some walk tests failed\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int should_walk_directories_largest_first(void)
+{
+    fprintf(stdout, "[TEST] should_walk_directories_largest_first\n");
+
+    walk_list_t list;
+    walk_init(&list);
+    int err = walk_add_path(&list, root, ".lisp");
+    err = err || walk_sort(&list);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_walk_directories_largest_first: walk failed: %d\n", err);
+        return 1;
+    }
+
+    // Files of the same size come in path order
+    char *expected[] = {"link.lisp", "sub/b.lisp", "sub/deep/c.lisp", "a.lisp"};
+    if (expect_paths("should_walk_directories_largest_first", &list, expected, 4))
+        return 1;
+
+    if (list.entries.items[0].size != 300 || list.entries.items[3].size != 10)
+    {
+        fprintf(stderr, "[FAIL] should_walk_directories_largest_first: wrong sizes\n");
+        return 1;
+    }
+
+    walk_free(&list);
+
+    fprintf(stdout, "[OK] should_walk_directories_largest_first\n");
+    return 0;
+}
+
+int should_read_manifests(void)
+{
+    fprintf(stdout, "[TEST] should_read_manifests\n");
+
+    char manifest[256];
+    snprintf(manifest, sizeof(manifest), "%s/manifest", root);
+    FILE *file = fopen(manifest, "w");
+    if (!file)
+    {
+        fprintf(stderr, "[FAIL] should_read_manifests: could not write the manifest\n");
+        return 1;
+    }
+    fprintf(file, "# sources\n%s/sub/deep/c.lisp\r\n\n%s/sub/notes.txt\n%s/sub/deep", root, root, root);
+    fclose(file);
+
+    char arg[260];
+    snprintf(arg, sizeof(arg), "@%s", manifest);
+
+    walk_list_t list;
+    walk_init(&list);
+    int err = walk_add_argument(&list, arg, ".lisp");
+    err = err || walk_sort(&list);
+    if (err)
+    {
+        fprintf(stderr, "[FAIL] should_read_manifests: walk failed: %d\n", err);
+        return 1;
+    }
+
+    // Files named explicitly are kept whatever their suffix
+    char *expected[] = {"sub/notes.txt", "sub/deep/c.lisp", "sub/deep/c.lisp"};
+    if (expect_paths("should_read_manifests", &list, expected, 3))
+        return 1;
+
+    walk_free(&list);
+    unlink(manifest);
+
+    fprintf(stdout, "[OK] should_read_manifests\n");
+    return 0;
+}
+
+int should_fail_on_missing_paths(void)
+{
+    fprintf(stdout, "[TEST] should_fail_on_missing_paths\n");
+
+    walk_list_t list;
+    walk_init(&list);
+    int err = walk_add_argument(&list, "/tmp/walk.tests.does-not-exist", NULL);
+    int manifest_err = walk_add_argument(&list, "@/tmp/walk.tests.does-not-exist", NULL);
+    walk_free(&list);
+
+    if (err != WALK_ERR_FAILED_TO_STAT || manifest_err != WALK_ERR_FAILED_TO_READ_MANIFEST)
+    {
+        fprintf(stderr, "[FAIL] should_fail_on_missing_paths: got %d and %d\n", err, manifest_err);
+        return 1;
+    }
+
+    fprintf(stdout, "[OK] should_fail_on_missing_paths\n");
+    return 0;
+}